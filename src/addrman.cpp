@@ -8,6 +8,9 @@
 #include "serialize.h"
 #include "streams.h"
 
+#include <algorithm>
+#include <unordered_map>
+
 int CAddrInfo::GetTriedBucket(const uint256& nKey) const
 {
     uint64_t hash1 = (CHashWriter(SER_GETHASH, 0) << nKey << GetKey()).GetHash().GetCheapHash();
@@ -595,3 +598,181 @@ CAddrInfo CAddrMan::SelectTriedCollision_()
 
     return mapInfo[id_old];
 }
+
+void CAddrMan::AddBatched(const std::vector<CAddress>& vAddr, const CNetAddr& source, int64_t nTimePenalty)
+{
+    {
+        TRY_LOCK(cs, lockTables);
+        if (lockTables) {
+            FlushPending_();
+            Add(vAddr, source, nTimePenalty);
+            return;
+        }
+    }
+
+    {
+        LOCK(cs_pending);
+        vPending.push_back(PendingAdd{vAddr, source, nTimePenalty});
+        nPending += vAddr.size();
+    }
+
+    // The thread holding the tables may have finished before the addresses
+    // were queued, so try once more. Wait for the tables if the queue has
+    // grown too long.
+    if (nPending > ADDRMAN_MAX_PENDING) {
+        LOCK(cs);
+        FlushPending_();
+        return;
+    }
+    TRY_LOCK(cs, lockTables);
+    if (lockTables)
+        FlushPending_();
+}
+
+void CAddrMan::FlushPending_()
+{
+    AssertLockHeld(cs);
+    std::vector<PendingAdd> vAdd;
+    {
+        LOCK(cs_pending);
+        vAdd.swap(vPending);
+        nPending = 0;
+    }
+    for (const PendingAdd& add : vAdd)
+        Add(add.vAddr, add.source, add.nTimePenalty);
+}
+
+std::shared_ptr<const CAddrManSnapshot> CAddrMan::GetSnapshot()
+{
+    {
+        LOCK(cs_snapshot);
+        const bool fCurrent = nSnapshotChanges == nChanges && nPending == 0;
+        if (snapshot && nSnapshotChanges >= nChangesUrgent
+            && (fCurrent || GetTime() - nSnapshotTime < ADDRMAN_SNAPSHOT_MAX_AGE))
+        {
+            return snapshot;
+        }
+    }
+
+    LOCK(cs);
+    FlushPending_();
+    std::shared_ptr<const CAddrManSnapshot> s = MakeSnapshot_();
+    {
+        LOCK(cs_snapshot);
+        snapshot = s;
+        nSnapshotTime = GetTime();
+        nSnapshotChanges = nChanges;
+    }
+    return s;
+}
+
+std::shared_ptr<const CAddrManSnapshot> CAddrMan::MakeSnapshot_() const
+{
+    AssertLockHeld(cs);
+    auto s = std::make_shared<CAddrManSnapshot>();
+
+    std::unordered_map<int, uint32_t> mapIndex;
+    mapIndex.reserve(mapInfo.size());
+    s->vInfo.reserve(mapInfo.size());
+    for (const auto& i : mapInfo) {
+        mapIndex.emplace(i.first, uint32_t(s->vInfo.size()));
+        s->vInfo.push_back(i.second);
+    }
+
+    s->vNew.reserve(nNew);
+    for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++)
+        for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++)
+            if (vvNew[bucket][entry] != -1)
+                s->vNew.push_back(mapIndex.at(vvNew[bucket][entry]));
+
+    s->vTried.reserve(nTried);
+    for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++)
+        for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++)
+            if (vvTried[bucket][entry] != -1)
+                s->vTried.push_back(mapIndex.at(vvTried[bucket][entry]));
+
+    return s;
+}
+
+CAddrInfo CAddrManSnapshot::Select(bool newOnly) const
+{
+    if (vNew.empty() && (newOnly || vTried.empty()))
+        return CAddrInfo();
+
+    FastRandomContext rng;
+    const int64_t nNow = GetAdjustedTime();
+
+    // Use a 50% chance for choosing between tried and new table entries.
+    const bool fTried = !newOnly && !vTried.empty() && (vNew.empty() || rng.rand32() % 2 == 0);
+    const std::vector<uint32_t>& vPos = fTried ? vTried : vNew;
+
+    double fChanceFactor = 1.0;
+    while (1) {
+        const CAddrInfo& info = vInfo[vPos[rng.randrange(vPos.size())]];
+        if (rng.rand32() % (1 << 30) < fChanceFactor * info.GetChance(nNow) * (1 << 30))
+            return info;
+        fChanceFactor *= 1.2;
+    }
+}
+
+std::vector<CAddress> CAddrManSnapshot::GetAddr() const
+{
+    unsigned int nNodes = ADDRMAN_GETADDR_MAX_PCT * vInfo.size() / 100;
+    if (nNodes > ADDRMAN_GETADDR_MAX)
+        nNodes = ADDRMAN_GETADDR_MAX;
+
+    FastRandomContext rng;
+    const int64_t nNow = GetAdjustedTime();
+
+    std::vector<uint32_t> vOrder(vInfo.size());
+    for (size_t n = 0; n < vOrder.size(); n++)
+        vOrder[n] = n;
+
+    // gather a list of random nodes, skipping those of low quality
+    std::vector<CAddress> vAddr;
+    for (size_t n = 0; n < vOrder.size() && vAddr.size() < nNodes; n++) {
+        std::swap(vOrder[n], vOrder[n + rng.randrange(vOrder.size() - n)]);
+        const CAddrInfo& ai = vInfo[vOrder[n]];
+        if (!ai.IsTerrible(nNow))
+            vAddr.push_back(ai);
+    }
+    return vAddr;
+}
+
+CAddrMan::SerializeState CAddrMan::MakeSerializeState_() const
+{
+    AssertLockHeld(cs);
+    SerializeState state;
+    state.nKey = nKey;
+
+    // Ids of the "new" entries, in the (sorted) order they are written.
+    std::vector<int> vNewIds;
+    vNewIds.reserve(nNew);
+    state.vNew.reserve(nNew);
+    state.vTried.reserve(nTried);
+    for (const auto& i : mapInfo) {
+        const CAddrInfo& info = i.second;
+        if (info.nRefCount) {
+            assert(state.vNew.size() != (size_t)nNew); // this means nNew was wrong, oh ow
+            vNewIds.push_back(i.first);
+            state.vNew.push_back(info);
+        }
+        if (info.fInTried) {
+            assert(state.vTried.size() != (size_t)nTried); // this means nTried was wrong, oh ow
+            state.vTried.push_back(info);
+        }
+    }
+
+    state.vBucketSizes.assign(ADDRMAN_NEW_BUCKET_COUNT, 0);
+    state.vBucketEntries.reserve(nNew);
+    for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
+        for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+            if (vvNew[bucket][i] != -1) {
+                state.vBucketSizes[bucket]++;
+                auto it = std::lower_bound(vNewIds.begin(), vNewIds.end(), vvNew[bucket][i]);
+                state.vBucketEntries.push_back(it - vNewIds.begin());
+            }
+        }
+    }
+    return state;
+}
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_ADDRMAN_H
 #define BITCOIN_ADDRMAN_H
 
+#include "memusage.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -12,7 +13,9 @@
 #include "timedata.h"
 #include "util.h"
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <vector>
@@ -176,15 +179,45 @@ public:
 //! the maximum number of tried addr collisions to store
 #define ADDRMAN_SET_TRIED_COLLISION_SIZE 10
 
+//! how many seconds a snapshot is reused for after addresses have been added
+#define ADDRMAN_SNAPSHOT_MAX_AGE 10
+
+//! how many queued addresses make the next batched add wait for the tables
+#define ADDRMAN_MAX_PENDING 10000
+
+/**
+ * An immutable copy of the address tables, for selecting addresses without
+ * holding the address manager's lock.
+ */
+class CAddrManSnapshot
+{
+public:
+    //! Choose an address to connect to, if newOnly is set to true, only the new table is selected from.
+    CAddrInfo Select(bool newOnly = false) const;
+
+    //! Return a bunch of addresses, selected at random.
+    std::vector<CAddress> GetAddr() const;
+
+    size_t size() const { return vInfo.size(); }
+
+private:
+    friend class CAddrMan;
+
+    //! all entries
+    std::vector<CAddrInfo> vInfo;
+
+    //! an index into vInfo for each occupied position in the "new" and
+    //! "tried" tables, so that selecting never probes empty positions
+    std::vector<uint32_t> vNew;
+    std::vector<uint32_t> vTried;
+};
+
 /**
  * Stochastical (IP) address manager
  */
 class CAddrMan
 {
 private:
-    //! critical section to protect the inner data structures
-    mutable CCriticalSection cs;
-
     //! last used nId
     int nIdCount;
 
@@ -215,7 +248,61 @@ private:
     //! Holds addrs inserted into tried table that collide with existing entries. Test-before-evict discpline used to resolve these collisions.
     std::set<int> m_tried_collisions;
 
+    //! Addresses queued by AddBatched while the tables were busy.
+    struct PendingAdd {
+        std::vector<CAddress> vAddr;
+        CNetAddr source;
+        int64_t nTimePenalty;
+    };
+    CCriticalSection cs_pending;
+    std::vector<PendingAdd> vPending;
+    std::atomic<size_t> nPending;
+
+    //! The last published snapshot, and when it was made.
+    CCriticalSection cs_snapshot;
+    std::shared_ptr<const CAddrManSnapshot> snapshot;
+    int64_t nSnapshotTime;
+    uint64_t nSnapshotChanges;
+
+    //! Number of changes to the tables, and the number at the last change
+    //! that should be seen by the next snapshot (as opposed to added addresses,
+    //! updated timestamps and connection attempts, which may wait for
+    //! ADDRMAN_SNAPSHOT_MAX_AGE).
+    std::atomic<uint64_t> nChanges;
+    std::atomic<uint64_t> nChangesUrgent;
+
+    void MarkChanged(bool fUrgent)
+    {
+        uint64_t n = ++nChanges;
+        if (fUrgent)
+            nChangesUrgent = n;
+    }
+
+    //! The tables as written by Serialize.
+    struct SerializeState {
+        uint256 nKey;
+        //! entries in the "new" and "tried" tables, by id
+        std::vector<CAddrInfo> vNew;
+        std::vector<CAddrInfo> vTried;
+        //! number of entries in each "new" bucket
+        std::vector<int> vBucketSizes;
+        //! for each bucket in turn, the positions in vNew of its entries
+        std::vector<int> vBucketEntries;
+    };
+
+    //! Copy the tables for serializing. Called with cs held.
+    SerializeState MakeSerializeState_() const;
+
+    //! Apply the addresses queued by AddBatched. Called with cs held.
+    void FlushPending_();
+
+    //! Copy the tables into a new snapshot. Called with cs held.
+    std::shared_ptr<const CAddrManSnapshot> MakeSnapshot_() const;
+
 protected:
+    //! critical section to protect the inner data structures
+    mutable CCriticalSection cs;
+
     //! secret key to randomize bucket select with
     uint256 nKey;
 
@@ -306,49 +393,34 @@ public:
     template<typename Stream>
     void Serialize(Stream &s) const
     {
-        LOCK(cs);
+        // Copy the tables and write out the copy, so that the lock is
+        // only held for the copy.
+        SerializeState state;
+        {
+            LOCK(cs);
+            state = MakeSerializeState_();
+        }
 
         unsigned char nVersion = 1;
         s << nVersion;
         s << ((unsigned char)32);
-        s << nKey;
-        s << nNew;
-        s << nTried;
+        s << state.nKey;
+        s << (int)state.vNew.size();
+        s << (int)state.vTried.size();
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
-        int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            mapUnkIds[(*it).first] = nIds;
-            const CAddrInfo &info = (*it).second;
-            if (info.nRefCount) {
-                assert(nIds != nNew); // this means nNew was wrong, oh ow
-                s << info;
-                nIds++;
-            }
-        }
-        nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            const CAddrInfo &info = (*it).second;
-            if (info.fInTried) {
-                assert(nIds != nTried); // this means nTried was wrong, oh ow
-                s << info;
-                nIds++;
-            }
-        }
+        for (const CAddrInfo& info : state.vNew)
+            s << info;
+        for (const CAddrInfo& info : state.vTried)
+            s << info;
+        std::vector<int>::const_iterator itIndex = state.vBucketEntries.begin();
         for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
-            int nSize = 0;
-            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
-                if (vvNew[bucket][i] != -1)
-                    nSize++;
-            }
+            int nSize = state.vBucketSizes[bucket];
             s << nSize;
-            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
-                if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
-                    s << nIndex;
-                }
+            for (int i = 0; i < nSize; i++) {
+                int nIndex = *itIndex++;
+                s << nIndex;
             }
         }
     }
@@ -382,9 +454,12 @@ public:
             throw std::ios_base::failure("Corrupt CAddrMan serialization, nTried exceeds limit.");
         }
 
-        // Deserialize entries from the new table.
+        vRandom.reserve(nNew + nTried);
+
+        // Deserialize entries from the new table. Ids are handed out in
+        // increasing order, so each is inserted at the end of mapInfo.
         for (int n = 0; n < nNew; n++) {
-            CAddrInfo &info = mapInfo[n];
+            CAddrInfo &info = mapInfo.emplace_hint(mapInfo.end(), n, CAddrInfo())->second;
             s >> info;
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
@@ -413,7 +488,7 @@ public:
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
                 vRandom.push_back(nIdCount);
-                mapInfo[nIdCount] = info;
+                mapInfo.emplace_hint(mapInfo.end(), nIdCount, info);
                 mapAddr[info] = nIdCount;
                 vvTried[nKBucket][nKBucketPos] = nIdCount;
                 nIdCount++;
@@ -478,10 +553,19 @@ public:
         nTried = 0;
         nNew = 0;
         nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
+
+        {
+            LOCK(cs_pending);
+            vPending.clear();
+            nPending = 0;
+        }
+        MarkChanged(true);
     }
 
-    CAddrMan()
+    CAddrMan() : nPending(0), nChanges(0), nChangesUrgent(0)
     {
+        nSnapshotTime = 0;
+        nSnapshotChanges = 0;
         Clear();
     }
 
@@ -497,6 +581,14 @@ public:
         return vRandom.size();
     }
 
+    //! Return the approximate heap usage of the address tables.
+    size_t DynamicMemoryUsage() const
+    {
+        LOCK(cs);
+        return memusage::DynamicUsage(mapInfo) + memusage::DynamicUsage(mapAddr) +
+            memusage::DynamicUsage(vRandom);
+    }
+
     //! Consistency check
     void Check()
     {
@@ -518,6 +610,7 @@ public:
         Check();
         fRet |= Add_(addr, source, nTimePenalty);
         Check();
+        MarkChanged(false);
         if (fRet)
             LogPrint(Log::ADDRMAN, "Added %s from %s: %i tried, %i new\n", addr.ToStringIPPort(), source.ToString(), nTried, nNew);
         return fRet;
@@ -532,11 +625,39 @@ public:
         for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
             nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
         Check();
+        MarkChanged(false);
         if (nAdd)
             LogPrint(Log::ADDRMAN, "Added %i addresses from %s: %i tried, %i new\n", nAdd, source.ToString(), nTried, nNew);
         return nAdd > 0;
     }
 
+    /**
+     * Add addresses without waiting for the tables. If another thread holds
+     * them, the addresses are queued and applied by the next thread to take
+     * the lock, so peers flooding addr messages don't serialize on it.
+     */
+    void AddBatched(const std::vector<CAddress> &vAddr, const CNetAddr& source, int64_t nTimePenalty = 0);
+
+    //! A number that changes whenever the tables do.
+    uint64_t GetChangeCount() const
+    {
+        return nChanges;
+    }
+
+    //! Apply addresses queued by AddBatched.
+    void FlushPending()
+    {
+        LOCK(cs);
+        FlushPending_();
+    }
+
+    /**
+     * Return a snapshot of the tables to select addresses from without
+     * locking. Added addresses and connection attempts show up in it within
+     * ADDRMAN_SNAPSHOT_MAX_AGE seconds, other changes right away.
+     */
+    std::shared_ptr<const CAddrManSnapshot> GetSnapshot();
+
     //! Mark an entry as accessible.
     void Good(const CService &addr, bool test_before_evict = true, int64_t nTime = GetAdjustedTime())
     {
@@ -544,6 +665,7 @@ public:
         Check();
         Good_(addr, test_before_evict, nTime);
         Check();
+        MarkChanged(true);
     }
 
     //! Mark an entry as connection attempted to.
@@ -553,6 +675,9 @@ public:
         Check();
         Attempt_(addr, fCountFailure, nTime);
         Check();
+        // Only changes the odds of selecting the entry, so it can wait for
+        // the next snapshot like an added address.
+        MarkChanged(false);
     }
 
     //! See if any to-be-evicted tried table entries have been tested and if so resolve the collisions.
@@ -560,8 +685,11 @@ public:
     {
         LOCK(cs);
         Check();
+        const bool fCollisions = !m_tried_collisions.empty();
         ResolveCollisions_();
         Check();
+        if (fCollisions)
+            MarkChanged(true);
     }
 
     //! Randomly select an address in tried that another address is attempting to evict.
@@ -612,6 +740,7 @@ public:
         Check();
         Connected_(addr, nTime);
         Check();
+        MarkChanged(false);
     }
 
 };
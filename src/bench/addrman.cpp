@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addrman.h"
+#include "bench.h"
+#include "random.h"
+#include "timedata.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const size_t NUM_MESSAGES = 100;
+static const size_t ADDRS_PER_MESSAGE = 1000;
+
+// Addr messages as a flooding peer would send them.
+static std::vector<std::vector<CAddress> > MakeAddrMessages()
+{
+    FastRandomContext rand(true);
+    std::vector<std::vector<CAddress> > vMessages(NUM_MESSAGES);
+    for (std::vector<CAddress>& vAddr : vMessages) {
+        for (size_t i = 0; i < ADDRS_PER_MESSAGE; ++i) {
+            struct in_addr ip;
+            ip.s_addr = rand.rand32();
+            CAddress addr(CService(CNetAddr(ip), 8333));
+            addr.nTime = GetAdjustedTime();
+            vAddr.push_back(addr);
+        }
+    }
+    return vMessages;
+}
+
+static void AddrFlood(benchmark::State& state, bool fSelecting)
+{
+    const std::vector<std::vector<CAddress> > vMessages = MakeAddrMessages();
+    const CNetAddr source("250.1.1.1");
+    CAddrMan addrman;
+    addrman.Add(vMessages[0], source);
+
+    // Stand in for the connection thread selecting addresses meanwhile.
+    std::atomic<bool> fStop(false);
+    std::thread selector([&]() {
+        while (fSelecting && !fStop) {
+            std::shared_ptr<const CAddrManSnapshot> snapshot = addrman.GetSnapshot();
+            for (int i = 0; i < 100; ++i)
+                snapshot->Select();
+        }
+    });
+
+    size_t n = 0;
+    while (state.KeepRunning())
+        addrman.AddBatched(vMessages[n++ % vMessages.size()], source);
+
+    fStop = true;
+    selector.join();
+}
+
+static void AddrManAddFlood(benchmark::State& state)
+{
+    AddrFlood(state, false);
+}
+
+static void AddrManAddFloodWhileSelecting(benchmark::State& state)
+{
+    AddrFlood(state, true);
+}
+
+static void AddrManSelectSnapshot(benchmark::State& state)
+{
+    const std::vector<std::vector<CAddress> > vMessages = MakeAddrMessages();
+    const CNetAddr source("250.1.1.1");
+    CAddrMan addrman;
+    for (const std::vector<CAddress>& vAddr : vMessages)
+        addrman.Add(vAddr, source);
+
+    std::shared_ptr<const CAddrManSnapshot> snapshot = addrman.GetSnapshot();
+    while (state.KeepRunning())
+        snapshot->Select();
+}
+
+static void AddrManSelectLocked(benchmark::State& state)
+{
+    const std::vector<std::vector<CAddress> > vMessages = MakeAddrMessages();
+    const CNetAddr source("250.1.1.1");
+    CAddrMan addrman;
+    for (const std::vector<CAddress>& vAddr : vMessages)
+        addrman.Add(vAddr, source);
+
+    while (state.KeepRunning())
+        addrman.Select();
+}
+
+BENCHMARK(AddrManAddFlood);
+BENCHMARK(AddrManAddFloodWhileSelecting);
+BENCHMARK(AddrManSelectSnapshot);
+BENCHMARK(AddrManSelectLocked);
@@ -0,0 +1,154 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "consensus/merkle.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "serialize.h"
+#include "streams.h"
+#include "version.h"
+
+#include <vector>
+
+// A mix of transaction shapes roughly matching what is seen on mainnet:
+// mostly 1-2 input P2PKH payments, some fan-outs and a few consolidations.
+static CMutableTransaction MixedTx(FastRandomContext& rand)
+{
+    size_t nIn, nOut;
+    const uint64_t r = rand.randrange(100);
+    if (r < 70) {
+        nIn = 1 + rand.randrange(2);
+        nOut = 2;
+    } else if (r < 90) {
+        nIn = 1;
+        nOut = 3 + rand.randrange(20);
+    } else {
+        nIn = 5 + rand.randrange(45);
+        nOut = 1;
+    }
+
+    CMutableTransaction tx;
+    tx.vin.resize(nIn);
+    for (CTxIn& in : tx.vin) {
+        in.prevout = COutPoint(GetRandHash(), rand.randrange(4));
+        in.scriptSig = CScript() << std::vector<unsigned char>(71 + rand.randrange(2), 0x30)
+                                 << std::vector<unsigned char>(33, 0x02);
+    }
+    tx.vout.resize(nOut);
+    for (CTxOut& out : tx.vout) {
+        out.nValue = rand.randrange(50 * COIN);
+        std::vector<unsigned char> h(20);
+        for (unsigned char& c : h)
+            c = rand.rand32();
+        out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << h
+                                     << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return tx;
+}
+
+static CBlock MakeBlock(size_t nTargetSize)
+{
+    FastRandomContext rand(true);
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1500000000;
+    block.nBits = 0x1d00ffff;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 500000 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    block.vtx.push_back(CTransaction(coinbase));
+
+    size_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    while (nSize < nTargetSize) {
+        block.vtx.push_back(CTransaction(MixedTx(rand)));
+        nSize += ::GetSerializeSize(block.vtx.back(), SER_NETWORK, PROTOCOL_VERSION);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+static CDataStream SerializedBlock(size_t nTargetSize)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << MakeBlock(nTargetSize);
+    return stream;
+}
+
+static void DeserializeBlock(benchmark::State& state, size_t nTargetSize)
+{
+    const CDataStream stream = SerializedBlock(nTargetSize);
+    while (state.KeepRunning()) {
+        CDataStream s(stream.begin(), stream.end(), SER_NETWORK, PROTOCOL_VERSION);
+        CBlock block;
+        s >> block;
+        assert(s.empty());
+    }
+}
+
+static void SerializeBlock(benchmark::State& state, size_t nTargetSize)
+{
+    const CBlock block = MakeBlock(nTargetSize);
+    const size_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    while (state.KeepRunning()) {
+        CDataStream s(SER_NETWORK, PROTOCOL_VERSION);
+        s.reserve(nSize);
+        s << block;
+        assert(s.size() == nSize);
+    }
+}
+
+// Hash every transaction in a block from its serialized form; this is the
+// work done for each CTransaction constructed during deserialization.
+static void BlockTxHashes(benchmark::State& state, size_t nTargetSize)
+{
+    const CBlock block = MakeBlock(nTargetSize);
+    std::vector<CMutableTransaction> vtx(block.vtx.begin(), block.vtx.end());
+    while (state.KeepRunning()) {
+        for (const CMutableTransaction& tx : vtx)
+            tx.GetHash();
+    }
+}
+
+static void DeserializeBlock1MB(benchmark::State& state) { DeserializeBlock(state, 1000000); }
+static void DeserializeBlock8MB(benchmark::State& state) { DeserializeBlock(state, 8000000); }
+static void DeserializeBlock32MB(benchmark::State& state) { DeserializeBlock(state, 32000000); }
+static void SerializeBlock1MB(benchmark::State& state) { SerializeBlock(state, 1000000); }
+static void SerializeBlock8MB(benchmark::State& state) { SerializeBlock(state, 8000000); }
+static void SerializeBlock32MB(benchmark::State& state) { SerializeBlock(state, 32000000); }
+static void BlockTxHashes1MB(benchmark::State& state) { BlockTxHashes(state, 1000000); }
+static void BlockTxHashes32MB(benchmark::State& state) { BlockTxHashes(state, 32000000); }
+
+static void DeserializeTransactions(benchmark::State& state)
+{
+    FastRandomContext rand(true);
+    std::vector<CTransaction> vtx;
+    for (int i = 0; i < 1000; ++i)
+        vtx.push_back(CTransaction(MixedTx(rand)));
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << vtx;
+
+    while (state.KeepRunning()) {
+        CDataStream s(stream.begin(), stream.end(), SER_NETWORK, PROTOCOL_VERSION);
+        std::vector<CTransaction> out;
+        s >> out;
+        assert(out.size() == vtx.size());
+    }
+}
+
+BENCHMARK(DeserializeBlock1MB);
+BENCHMARK(DeserializeBlock8MB);
+BENCHMARK(DeserializeBlock32MB);
+BENCHMARK(SerializeBlock1MB);
+BENCHMARK(SerializeBlock8MB);
+BENCHMARK(SerializeBlock32MB);
+BENCHMARK(BlockTxHashes1MB);
+BENCHMARK(BlockTxHashes32MB);
+BENCHMARK(DeserializeTransactions);
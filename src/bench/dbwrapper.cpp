@@ -0,0 +1,120 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "coins.h"
+#include "dbwrapper.h"
+#include "hash.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/standard.h"
+
+#include <boost/filesystem.hpp>
+
+// A chainstate-like workload: coins keyed by outpoint, written in large
+// batches as when the coins cache is flushed, and read at random as when
+// validating blocks.
+
+static const uint32_t NUM_COINS = 200000;
+static const uint32_t FLUSH_SIZE = 10000;
+
+static std::pair<char, COutPoint> CoinKey(uint32_t n)
+{
+    return std::make_pair('C', COutPoint((CHashWriter(SER_GETHASH, 0) << n).GetHash(), n % 3));
+}
+
+static Coin MakeCoin(uint32_t n)
+{
+    CScript script = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, n & 0xff))));
+    return Coin(CTxOut(n * 1000, script), 400000 + n / 2000, false);
+}
+
+static void WriteCoins(CDBWrapper& db, uint32_t nBegin, uint32_t nEnd)
+{
+    CDBBatch batch;
+    for (uint32_t n = nBegin; n < nEnd; ++n)
+        batch.Write(CoinKey(n), MakeCoin(n));
+    db.WriteBatch(batch);
+}
+
+static void CoinDBRead(benchmark::State& state, const DBOptions& options)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    {
+        bool isObfuscated;
+        CDBWrapper db(path, options, isObfuscated, false, true);
+        for (uint32_t n = 0; n < NUM_COINS; n += FLUSH_SIZE)
+            WriteCoins(db, n, n + FLUSH_SIZE);
+
+        // Half the lookups are for coins that don't exist.
+        FastRandomContext rand(true);
+        Coin coin;
+        while (state.KeepRunning())
+            db.Read(CoinKey(rand.randrange(2 * NUM_COINS)), coin);
+    }
+    boost::filesystem::remove_all(path);
+}
+
+static void CoinDBFlush(benchmark::State& state, const DBOptions& options)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    {
+        bool isObfuscated;
+        CDBWrapper db(path, options, isObfuscated, false, true);
+
+        // Each flush adds new coins and spends as many old ones.
+        uint32_t nNext = 0;
+        while (state.KeepRunning()) {
+            CDBBatch batch;
+            for (uint32_t n = nNext; n < nNext + FLUSH_SIZE; ++n) {
+                batch.Write(CoinKey(n), MakeCoin(n));
+                if (n >= NUM_COINS)
+                    batch.Erase(CoinKey(n - NUM_COINS));
+            }
+            db.WriteBatch(batch);
+            nNext += FLUSH_SIZE;
+        }
+    }
+    boost::filesystem::remove_all(path);
+}
+
+// The chainstate database's share of the default -dbcache.
+static const size_t COINS_DB_CACHE = 8 << 20;
+
+static void CoinDBReadDefault(benchmark::State& state)
+{
+    CoinDBRead(state, DBOptions(COINS_DB_CACHE));
+}
+
+static void CoinDBReadLargeBlockCache(benchmark::State& state)
+{
+    DBOptions options(COINS_DB_CACHE);
+    options.nBlockCache = 64 << 20;
+    CoinDBRead(state, options);
+}
+
+static void CoinDBReadNoBloom(benchmark::State& state)
+{
+    DBOptions options(COINS_DB_CACHE);
+    options.nBloomBits = 0;
+    CoinDBRead(state, options);
+}
+
+static void CoinDBFlushDefault(benchmark::State& state)
+{
+    CoinDBFlush(state, DBOptions(COINS_DB_CACHE));
+}
+
+static void CoinDBFlushLargeWriteBuffer(benchmark::State& state)
+{
+    DBOptions options(COINS_DB_CACHE);
+    options.nWriteBuffer = 32 << 20;
+    CoinDBFlush(state, options);
+}
+
+BENCHMARK(CoinDBReadDefault);
+BENCHMARK(CoinDBReadLargeBlockCache);
+BENCHMARK(CoinDBReadNoBloom);
+BENCHMARK(CoinDBFlushDefault);
+BENCHMARK(CoinDBFlushLargeWriteBuffer);
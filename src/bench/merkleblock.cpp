@@ -0,0 +1,105 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "bloom.h"
+#include "consensus/merkle.h"
+#include "merkleblock.h"
+#include "primitives/block.h"
+#include "random.h"
+
+#include <vector>
+
+// A block of about 1MB of P2PKH payments.
+static CBlock MakeBlock(FastRandomContext& rand)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 500000 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    block.vtx.push_back(CTransaction(coinbase));
+
+    for (int i = 0; i < 4000; ++i) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), rand.randrange(4));
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30)
+                                        << std::vector<unsigned char>(33, 0x02);
+        tx.vout.resize(2);
+        for (CTxOut& out : tx.vout) {
+            out.nValue = rand.randrange(50 * COIN);
+            std::vector<unsigned char> h(20);
+            for (unsigned char& c : h)
+                c = rand.rand32();
+            out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << h
+                                         << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx.push_back(CTransaction(tx));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+// Wallet-sized filters, each matching a couple of transactions in the block.
+static std::vector<CBloomFilter> MakeFilters(FastRandomContext& rand, const CBlock& block, int nPeers)
+{
+    std::vector<CBloomFilter> filters;
+    for (int i = 0; i < nPeers; ++i) {
+        CBloomFilter filter(100, 0.0001, rand.rand32(), BLOOM_UPDATE_ALL);
+        for (int j = 0; j < 98; ++j)
+            filter.insert(GetRandHash());
+        filter.insert(block.vtx[1 + rand.randrange(block.vtx.size() - 1)].GetHash());
+        filter.insert(block.vtx[1 + rand.randrange(block.vtx.size() - 1)].vin[0].prevout);
+        filters.push_back(filter);
+    }
+    return filters;
+}
+
+// Serve one block as a filtered block to each of nPeers SPV peers, as
+// before: every peer re-parses the scripts and rebuilds the merkle tree.
+static void FilteredBlockPerPeer(benchmark::State& state, int nPeers)
+{
+    FastRandomContext rand(true);
+    const CBlock block = MakeBlock(rand);
+    const std::vector<CBloomFilter> filters = MakeFilters(rand, block, nPeers);
+    while (state.KeepRunning()) {
+        for (CBloomFilter filter : filters) {
+            CMerkleBlock merkleBlock(block, filter);
+            assert(merkleBlock.vMatchedTxn.size() >= 2);
+        }
+    }
+}
+
+// Same, sharing the block's precomputed match elements and merkle levels.
+static void FilteredBlockShared(benchmark::State& state, int nPeers)
+{
+    FastRandomContext rand(true);
+    const CBlock block = MakeBlock(rand);
+    const std::vector<CBloomFilter> filters = MakeFilters(rand, block, nPeers);
+    while (state.KeepRunning()) {
+        const CFilteredBlockData data(block);
+        for (CBloomFilter filter : filters) {
+            CMerkleBlock merkleBlock(data, filter);
+            assert(merkleBlock.vMatchedTxn.size() >= 2);
+        }
+    }
+}
+
+static void FilteredBlockPerPeer1(benchmark::State& state) { FilteredBlockPerPeer(state, 1); }
+static void FilteredBlockPerPeer8(benchmark::State& state) { FilteredBlockPerPeer(state, 8); }
+static void FilteredBlockPerPeer32(benchmark::State& state) { FilteredBlockPerPeer(state, 32); }
+static void FilteredBlockShared1(benchmark::State& state) { FilteredBlockShared(state, 1); }
+static void FilteredBlockShared8(benchmark::State& state) { FilteredBlockShared(state, 8); }
+static void FilteredBlockShared32(benchmark::State& state) { FilteredBlockShared(state, 32); }
+
+BENCHMARK(FilteredBlockPerPeer1);
+BENCHMARK(FilteredBlockPerPeer8);
+BENCHMARK(FilteredBlockPerPeer32);
+BENCHMARK(FilteredBlockShared1);
+BENCHMARK(FilteredBlockShared8);
+BENCHMARK(FilteredBlockShared32);
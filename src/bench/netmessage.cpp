@@ -0,0 +1,147 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "hash.h"
+#include "net.h"
+#include "netmessagemaker.h"
+#include "primitives/transaction.h"
+#include "protocol.h"
+#include "random.h"
+#include "version.h"
+
+#include <vector>
+
+static const CMessageHeader::MessageStartChars BENCH_MAGIC = { 0xf9, 0xbe, 0xb4, 0xd9 };
+
+// Frame a message the same way CConnman::PushMessage does, appending
+// header and payload to a contiguous wire buffer.
+static void AppendWireMessage(std::vector<unsigned char>& wire, CSerializedNetMsg&& msg)
+{
+    uint256 hash = Hash(msg.data.data(), msg.data.data() + msg.data.size());
+    CMessageHeader hdr(BENCH_MAGIC, msg.command.c_str(), msg.data.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, wire, wire.size(), hdr};
+    wire.insert(wire.end(), msg.data.begin(), msg.data.end());
+}
+
+static CMutableTransaction SmallTx(FastRandomContext& rand)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), rand.randrange(3));
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30)
+                                    << std::vector<unsigned char>(33, 0x02);
+    tx.vout.resize(2);
+    for (CTxOut& out : tx.vout) {
+        out.nValue = rand.randrange(100 * COIN);
+        out.scriptPubKey = CScript() << OP_DUP << OP_HASH160
+            << std::vector<unsigned char>(20, rand.rand32() & 0xff)
+            << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return tx;
+}
+
+// Build a wire stream of many small messages typical of steady-state relay:
+// single-entry invs, pings and transactions.
+static std::vector<unsigned char> SmallMessageStream(size_t nMessages)
+{
+    FastRandomContext rand(true);
+    CNetMsgMaker maker(PROTOCOL_VERSION);
+    std::vector<unsigned char> wire;
+    for (size_t i = 0; i < nMessages; ++i) {
+        switch (i % 4) {
+        case 0:
+        case 1:
+            AppendWireMessage(wire, maker.Make(NetMsgType::INV,
+                        std::vector<CInv>(1, CInv(MSG_TX, GetRandHash()))));
+            break;
+        case 2:
+            AppendWireMessage(wire, maker.Make(NetMsgType::PING, rand.rand64()));
+            break;
+        default:
+            AppendWireMessage(wire, maker.Make(NetMsgType::TX, CTransaction(SmallTx(rand))));
+        }
+    }
+    return wire;
+}
+
+// Feed a wire stream through CNetMessage in socket sized chunks, mimicking
+// CNode::ReceiveMsgBytes without the node and signal plumbing.
+static size_t ParseStream(const std::vector<unsigned char>& wire, unsigned int nChunk)
+{
+    std::vector<CNetMessage> msgs;
+    const char* pch = reinterpret_cast<const char*>(wire.data());
+    unsigned int nBytes = wire.size();
+    while (nBytes > 0) {
+        unsigned int nRead = std::min(nBytes, nChunk);
+        const char* p = pch;
+        unsigned int n = nRead;
+        while (n > 0) {
+            if (msgs.empty() || msgs.back().complete())
+                msgs.push_back(CNetMessage(BENCH_MAGIC, SER_NETWORK, INIT_PROTO_VERSION));
+            CNetMessage& msg = msgs.back();
+            int handled = msg.in_data ? msg.readData(p, n) : msg.readHeader(p, n);
+            assert(handled > 0);
+            if (msg.complete())
+                msg.GetMessageHash();
+            p += handled;
+            n -= handled;
+        }
+        pch += nRead;
+        nBytes -= nRead;
+    }
+    return msgs.size();
+}
+
+static void NetMessageReadSmall(benchmark::State& state)
+{
+    const size_t nMessages = 1000;
+    std::vector<unsigned char> wire = SmallMessageStream(nMessages);
+    while (state.KeepRunning()) {
+        size_t n = ParseStream(wire, MAX_RECV_CHUNK);
+        assert(n == nMessages);
+    }
+}
+
+// Small reads, as seen with slow peers or fragmented TCP segments.
+static void NetMessageReadSmallFragmented(benchmark::State& state)
+{
+    const size_t nMessages = 1000;
+    std::vector<unsigned char> wire = SmallMessageStream(nMessages);
+    while (state.KeepRunning()) {
+        size_t n = ParseStream(wire, 536);
+        assert(n == nMessages);
+    }
+}
+
+static void NetMsgMakerInv(benchmark::State& state)
+{
+    CNetMsgMaker maker(PROTOCOL_VERSION);
+    std::vector<CInv> vInv;
+    for (int i = 0; i < 1000; ++i)
+        vInv.push_back(CInv(MSG_TX, GetRandHash()));
+
+    while (state.KeepRunning()) {
+        CSerializedNetMsg msg = maker.Make(NetMsgType::INV, vInv);
+        assert(!msg.data.empty());
+    }
+}
+
+static void NetMsgMakerTx(benchmark::State& state)
+{
+    FastRandomContext rand(true);
+    CNetMsgMaker maker(PROTOCOL_VERSION);
+    const CTransaction tx(SmallTx(rand));
+
+    while (state.KeepRunning()) {
+        std::vector<unsigned char> wire;
+        AppendWireMessage(wire, maker.Make(NetMsgType::TX, tx));
+    }
+}
+
+BENCHMARK(NetMessageReadSmall);
+BENCHMARK(NetMessageReadSmallFragmented);
+BENCHMARK(NetMsgMakerInv);
+BENCHMARK(NetMsgMakerTx);
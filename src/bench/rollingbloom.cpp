@@ -2,12 +2,26 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include "bench.h"
 #include "bloom.h"
+#include "random.h"
+#include "uint256.h"
 #include "utiltime.h"
 
+// Table size of the filter before windowed generations: 2 bits per
+// position, sized for 1.5 * nElements at the textbook false positive rate.
+static size_t PreviousRollingBloomSize(unsigned int nElements, double fpRate)
+{
+    const int nHashFuncs = std::max(1, std::min((int)round(log(fpRate) / log(0.5)), 50));
+    const uint32_t nMaxElements = (nElements + 1) / 2 * 3;
+    const uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(log(fpRate) / nHashFuncs)));
+    return ((nFilterBits + 63) / 64) * 2 * sizeof(uint64_t);
+}
+
 static void RollingBloom(benchmark::State& state)
 {
     CRollingBloomFilter filter(120000, 0.000001);
@@ -38,6 +52,38 @@ static void RollingBloom(benchmark::State& state)
         data[3] = count;
         match += filter.contains(data);
     }
+    std::cout << "RollingBloom-bytes," << filter.GetAllocatedSize() << ",previous layout,"
+              << PreviousRollingBloomSize(120000, 0.000001) << "\n";
+}
+
+// Inventory tracking as done for every peer: insert a txid, check another.
+static void RollingBloomInventory(benchmark::State& state)
+{
+    CRollingBloomFilter filter(50000, 0.000001);
+    std::vector<uint256> hashes(1024);
+    for (uint256& hash : hashes)
+        hash = GetRandHash();
+    uint32_t count = 0;
+    uint64_t match = 0;
+    while (state.KeepRunning()) {
+        filter.insert(hashes[count++ & 1023]);
+        match += filter.contains(hashes[(count * 7) & 1023]);
+    }
+}
+
+// Connecting a peer: create its inventory filter and use it a little.
+static void RollingBloomNewPeer(benchmark::State& state)
+{
+    uint256 hash;
+    while (state.KeepRunning()) {
+        CRollingBloomFilter filter(50000, 0.000001);
+        for (int i = 0; i < 10; i++) {
+            *hash.begin() = i;
+            filter.insert(hash);
+        }
+    }
 }
 
 BENCHMARK(RollingBloom);
+BENCHMARK(RollingBloomInventory);
+BENCHMARK(RollingBloomNewPeer);
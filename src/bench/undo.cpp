@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "hash.h"
+#include "pubkey.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "undo.h"
+
+// Disconnecting blocks in a reorg: the undo data of each block is decoded
+// and the coins it spent are put back in the coins cache.
+
+static const size_t NUM_BLOCKS = 10;
+static const size_t TXS_PER_BLOCK = 2000;
+static const size_t INPUTS_PER_TX = 2;
+
+static CBlockUndo MakeBlockUndo(size_t nBlock)
+{
+    CBlockUndo undo;
+    undo.vtxundo.resize(TXS_PER_BLOCK);
+    for (size_t i = 0; i < TXS_PER_BLOCK; ++i) {
+        for (size_t c = 0; c < INPUTS_PER_TX; ++c) {
+            CScript script = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, (i + c) & 0xff))));
+            undo.vtxundo[i].vprevout.emplace_back(CTxOut(i * 1000 + c, script), 400000 + nBlock, false);
+        }
+    }
+    return undo;
+}
+
+static COutPoint SpentOutPoint(size_t nBlock, size_t i, size_t c)
+{
+    return COutPoint((CHashWriter(SER_GETHASH, 0) << nBlock << i).GetHash(), c);
+}
+
+template <typename BlockUndo>
+static std::vector<CDataStream> WriteBlocks()
+{
+    std::vector<CDataStream> blocks;
+    for (size_t n = 0; n < NUM_BLOCKS; ++n) {
+        blocks.emplace_back(SER_DISK, CLIENT_VERSION);
+        blocks.back() << BlockUndo(MakeBlockUndo(n));
+    }
+    return blocks;
+}
+
+static void Restore(CCoinsViewCache& cache, size_t nBlock, size_t i, CTxUndo& txundo)
+{
+    for (size_t c = txundo.vprevout.size(); c-- > 0; )
+        cache.AddCoin(SpentOutPoint(nBlock, i, c), std::move(txundo.vprevout[c]), true);
+}
+
+template <typename BlockUndo>
+static void DisconnectBlocks(benchmark::State& state)
+{
+    const std::vector<CDataStream> blocks = WriteBlocks<BlockUndo>();
+    CCoinsView base;
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&base);
+        for (size_t n = NUM_BLOCKS; n-- > 0; ) {
+            CDataStream stream(blocks[n]);
+            CBlockUndo undo;
+            stream >> undo;
+            for (size_t i = undo.vtxundo.size(); i-- > 0; )
+                Restore(cache, n, i, undo.vtxundo[i]);
+        }
+    }
+}
+
+static void UndoDisconnectLegacy(benchmark::State& state)
+{
+    DisconnectBlocks<CBlockUndo>(state);
+}
+
+static void UndoDisconnectColumnar(benchmark::State& state)
+{
+    DisconnectBlocks<CColumnarBlockUndo>(state);
+}
+
+// Looking up the coins spent by one transaction of a block, as to compute
+// statistics, needs only the offset table with the columnar format.
+static void UndoSingleTxLegacy(benchmark::State& state)
+{
+    const std::vector<CDataStream> blocks = WriteBlocks<CBlockUndo>();
+    size_t n = 0;
+    while (state.KeepRunning()) {
+        CDataStream stream(blocks[n % NUM_BLOCKS]);
+        CBlockUndo undo;
+        stream >> undo;
+        CTxUndo txundo = undo.vtxundo[n++ % TXS_PER_BLOCK];
+    }
+}
+
+static void UndoSingleTxColumnar(benchmark::State& state)
+{
+    const std::vector<CDataStream> blocks = WriteBlocks<CColumnarBlockUndo>();
+    size_t n = 0;
+    while (state.KeepRunning()) {
+        CDataStream stream(blocks[n % NUM_BLOCKS]);
+        CColumnarBlockUndo undo;
+        stream >> undo;
+        CTxUndo txundo;
+        undo.GetTxUndo(n++ % TXS_PER_BLOCK, txundo);
+    }
+}
+
+BENCHMARK(UndoDisconnectLegacy);
+BENCHMARK(UndoDisconnectColumnar);
+BENCHMARK(UndoSingleTxLegacy);
+BENCHMARK(UndoSingleTxColumnar);
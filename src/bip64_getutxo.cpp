@@ -1,6 +1,12 @@
 #include "bip64_getutxo.h"
+#include "chain.h"
+#include "main.h"
 #include "txmempool.h"
 #include "coins.h"
+#include "util.h"
+
+#include <algorithm>
+#include <thread>
 
 namespace bip64 {
 
@@ -8,7 +14,7 @@ UTXORetriever::UTXORetriever(
         const std::vector<COutPoint>& o,
         CCoinsView& viewChain,
         CTxMemPool* mempool,
-        size_t maxBytes) : outpoints(o)
+        size_t maxBytes) : outpoints(o), tipHeight(-1)
 {
     if (mempool != nullptr) {
         // also check mempool if provided
@@ -43,6 +49,112 @@ void UTXORetriever::Process(CCoinsView* view, CTxMemPool* mempool, size_t maxByt
     }
 }
 
+UTXORetriever::UTXORetriever(
+        const std::vector<COutPoint>& o,
+        CTxMemPool* mempool,
+        size_t maxBytes) : outpoints(o), tipHeight(-1)
+{
+    std::vector<Coin> coins(outpoints.size());
+    std::vector<char> found(outpoints.size(), false);
+    std::vector<size_t> vMissing;
+
+    // Without a snapshot of the tip, look the coins up in pcoinsTip rather
+    // than copy its modified coins for one request.
+    std::shared_ptr<CCoinsViewSnapshot> snapshot = GetCoinsSnapshotIfCheap();
+    if (snapshot) {
+        tipHeight = snapshot->GetHeight();
+        tipHash = snapshot->GetBestBlock();
+        LookupInMempool(mempool, coins, found, vMissing);
+
+        const int nThreads = vMissing.size() < MIN_PARALLEL_FETCH ? 1
+            : std::min<int>({MAX_FETCH_THREADS, GetNumCores(), (int)(vMissing.size() / (MIN_PARALLEL_FETCH / 2))});
+        FetchMissing(*snapshot, nThreads, coins, found, vMissing);
+    } else {
+        LOCK(cs_main);
+        tipHeight = chainActive.Height();
+        tipHash = chainActive.Tip()->GetBlockHash();
+        LookupInMempool(mempool, coins, found, vMissing);
+        FetchMissing(*pcoinsTip, 1, coins, found, vMissing);
+    }
+
+    SetResults(coins, found, maxBytes);
+}
+
+void UTXORetriever::LookupInMempool(CTxMemPool* mempool,
+                                    std::vector<Coin>& coins, std::vector<char>& found,
+                                    std::vector<size_t>& vMissing) const
+{
+    if (mempool == nullptr) {
+        for (size_t i = 0; i < outpoints.size(); ++i)
+            vMissing.push_back(i);
+        return;
+    }
+
+    LOCK(mempool->cs);
+    for (size_t i = 0; i < outpoints.size(); ++i) {
+        const COutPoint& outpoint = outpoints[i];
+        if (mempool->isSpent(outpoint))
+            continue;
+        // Same as CCoinsViewMemPool: a mempool transaction is
+        // authoritative for its outputs.
+        auto it = mempool->mapTx.find(outpoint.hash);
+        if (it != mempool->mapTx.end()) {
+            const CTransaction& tx = it->GetTx();
+            if (outpoint.n < tx.vout.size()) {
+                coins[i] = Coin(tx.vout[outpoint.n], MEMPOOL_HEIGHT, false);
+                found[i] = true;
+            }
+            continue;
+        }
+        vMissing.push_back(i);
+    }
+}
+
+void UTXORetriever::FetchMissing(const CCoinsView& view, int nThreads,
+                                 std::vector<Coin>& coins, std::vector<char>& found,
+                                 const std::vector<size_t>& vMissing) const
+{
+    // Each thread reads a contiguous share of vMissing and writes only the
+    // entries of coins and found for it.
+    auto fetch = [&](size_t nBegin, size_t nEnd) {
+        for (size_t j = nBegin; j < nEnd; ++j) {
+            const size_t i = vMissing[j];
+            found[i] = view.GetCoin(outpoints[i], coins[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    const size_t nShare = (vMissing.size() + nThreads - 1) / nThreads;
+    for (int t = 1; t < nThreads; ++t) {
+        const size_t nBegin = std::min(vMissing.size(), t * nShare);
+        const size_t nEnd = std::min(vMissing.size(), nBegin + nShare);
+        threads.emplace_back(fetch, nBegin, nEnd);
+    }
+    fetch(0, std::min(vMissing.size(), nShare));
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+void UTXORetriever::SetResults(std::vector<Coin>& coins, const std::vector<char>& found, size_t maxBytes)
+{
+    size_t bytesUsed = outpoints.size() / 8;
+
+    hits.assign(found.begin(), found.end());
+    for (size_t i = 0; i < outpoints.size(); ++i) {
+        if (!found[i])
+            continue;
+
+        CCoin bip64coin(std::move(coins[i]));
+        bytesUsed += bip64coin.GetSizeOf();
+        if (maxBytes != 0 && bytesUsed > maxBytes) {
+            hits.clear();
+            outs.clear();
+            throw std::runtime_error("utxos result exceed max bytes limit");
+        }
+        outs.emplace_back(std::move(bip64coin));
+    }
+}
+
 std::vector<uint8_t> UTXORetriever::GetBitmap() const {
     std::vector<uint8_t> bitmap;
     bitmap.resize((outpoints.size() + 7) / 8);
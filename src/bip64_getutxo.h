@@ -4,6 +4,7 @@
 #include "primitives/transaction.h"
 #include "serialize.h"
 #include "coins.h"
+#include "uint256.h"
 
 #include <cstdint>
 #include <vector>
@@ -36,6 +37,11 @@ struct CCoin {
     }
 };
 
+//! Don't fetch coins from disk in parallel for fewer misses than this.
+static const size_t MIN_PARALLEL_FETCH = 64;
+//! Maximum number of threads reading coins from disk for one request.
+static const int MAX_FETCH_THREADS = 4;
+
 class UTXORetriever {
 public:
     UTXORetriever(const std::vector<COutPoint>& o,
@@ -44,6 +50,17 @@ public:
                   //! throws if result objects exceed maxBytes (0 == no limit)
                   size_t maxBytes = 0);
 
+    //! Look the outpoints up in a snapshot of the coins of the active chain,
+    //! and in the mempool if given. mempool.cs is taken once; the coins are
+    //! then read from the snapshot in parallel without holding cs_main.
+    UTXORetriever(const std::vector<COutPoint>& o,
+                  CTxMemPool* mempool,
+                  size_t maxBytes = 0);
+
+    //! Chain tip the results are for (only set by the active chain lookup).
+    int GetTipHeight() const { return tipHeight; }
+    const uint256& GetTipHash() const { return tipHash; }
+
     //! An array of bytes encoding one bit for each outpoint queried. Each bit
     //! indicates whether the queried outpoint was found in the UTXO set or not.
     std::vector<uint8_t> GetBitmap() const;
@@ -59,8 +76,21 @@ private:
     // output
     std::vector<bool> hits;
     std::vector<CCoin> outs;
+    int tipHeight;
+    uint256 tipHash;
 
     void Process(CCoinsView*, CTxMemPool*, size_t maxBytes);
+
+    //! Resolve outpoints from the mempool, if given; the indexes of the ones
+    //! to read from the chain's coins go to vMissing.
+    void LookupInMempool(CTxMemPool* mempool,
+                         std::vector<Coin>& coins, std::vector<char>& found,
+                         std::vector<size_t>& vMissing) const;
+    //! Read the vMissing coins from view, using up to nThreads threads.
+    void FetchMissing(const CCoinsView& view, int nThreads,
+                      std::vector<Coin>& coins, std::vector<char>& found,
+                      const std::vector<size_t>& vMissing) const;
+    void SetResults(std::vector<Coin>& coins, const std::vector<char>& found, size_t maxBytes);
 };
 
 } // ns bip64
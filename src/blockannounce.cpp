@@ -7,6 +7,7 @@
 #include "net.h" // CConnman
 #include "netmessagemaker.h"
 #include "options.h"
+#include "recentblockcache.h"
 #include "timedata.h"
 #include "inflightindex.h"
 #include "nodestate.h"
@@ -343,7 +344,7 @@ void BlockAnnounceSender::announce() {
         bool announced = false;
 
         if (node->prefersBlocks && canAnnounceWithBlock()) {
-            BlockSender sender;
+            BlockSender sender(&g_recentblocks);
             announceWithBlock(sender);
             announced = true;
         }
@@ -33,15 +33,20 @@ uint64_t GetShortID(
 }
 
 CompactBlock::CompactBlock(const CBlock& block, const CompactPrefiller& prefiller) :
-        nonce(GetRand(std::numeric_limits<uint64_t>::max())), header(block)
+        CompactBlock(block, block.vtx.empty()
+                ? std::vector<PrefilledTransaction>() : prefiller.fillFrom(block))
+{
+}
+
+CompactBlock::CompactBlock(const CBlock& block, std::vector<PrefilledTransaction> prefilled) :
+        nonce(GetRand(std::numeric_limits<uint64_t>::max())),
+        prefilledtxn(std::move(prefilled)), header(block)
 {
     FillShortTxIDSelector();
 
     if (block.vtx.empty())
         throw std::invalid_argument(__func__ + std::string(" expects coinbase tx"));
 
-    prefilledtxn = prefiller.fillFrom(block);
-
     auto isPrefilled = [this](const uint256& tx) {
         for (auto& p : this->prefilledtxn)
             if (p.tx.GetHash() == tx)
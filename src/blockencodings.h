@@ -125,6 +125,8 @@ public:
     CompactBlock() {}
 
     CompactBlock(const CBlock& block, const CompactPrefiller& prefiller);
+    // With the transactions prefiller.fillFrom(block) would choose.
+    CompactBlock(const CBlock& block, std::vector<PrefilledTransaction> prefilled);
 
     uint64_t GetShortID(const uint256& txhash) const;
 
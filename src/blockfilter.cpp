@@ -0,0 +1,253 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "coins.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+static const std::string BASIC_FILTER_NAME = "basic";
+
+// Map a 64-bit hash uniformly onto [0, n) without a division.
+static uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (static_cast<unsigned __int128>(x) * static_cast<unsigned __int128>(n)) >> 64;
+#else
+    // (x * n) >> 64 using 32-bit halves.
+    uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+template <typename OStream>
+static void GolombRiceEncode(BitStreamWriter<OStream>& bitwriter, uint8_t P, uint64_t x)
+{
+    // Quotient in unary, terminated by a 0 bit.
+    uint64_t q = x >> P;
+    while (q > 0) {
+        int nbits = q <= 64 ? static_cast<int>(q) : 64;
+        bitwriter.Write(~0ULL, nbits);
+        q -= nbits;
+    }
+    bitwriter.Write(0, 1);
+
+    // Remainder in binary.
+    bitwriter.Write(x, P);
+}
+
+template <typename IStream>
+static uint64_t GolombRiceDecode(BitStreamReader<IStream>& bitreader, uint8_t P)
+{
+    uint64_t q = 0;
+    while (bitreader.Read(1) == 1)
+        ++q;
+    uint64_t r = bitreader.Read(P);
+    return (q << P) + r;
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn)
+    : params(paramsIn), nN(0), nF(0), vEncoded(1, 0)
+{
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, std::vector<unsigned char> encoded)
+    : params(paramsIn), vEncoded(std::move(encoded))
+{
+    CDataStream stream(vEncoded, SER_NETWORK, 0);
+
+    uint64_t N = ReadCompactSize(stream);
+    nN = static_cast<uint32_t>(N);
+    if (nN != N)
+        throw std::ios_base::failure("N must be <2^32");
+    nF = static_cast<uint64_t>(nN) * params.nM;
+
+    // Decode all elements to make sure the filter is well formed; trailing
+    // padding within the last byte is all that may be left over.
+    BitStreamReader<CDataStream> bitreader(stream);
+    for (uint64_t i = 0; i < nN; ++i)
+        GolombRiceDecode(bitreader, params.nP);
+    if (!stream.empty())
+        throw std::ios_base::failure("encoded filter contains excess data");
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, const ElementSet& elements)
+    : params(paramsIn)
+{
+    size_t N = elements.size();
+    nN = static_cast<uint32_t>(N);
+    if (nN != N)
+        throw std::invalid_argument("N must be <2^32");
+    nF = static_cast<uint64_t>(nN) * params.nM;
+
+    CVectorWriter stream(SER_NETWORK, 0, vEncoded, 0);
+    WriteCompactSize(stream, nN);
+    if (elements.empty())
+        return;
+
+    BitStreamWriter<CVectorWriter> bitwriter(stream);
+    uint64_t nLast = 0;
+    for (uint64_t value : BuildHashedSet(elements)) {
+        GolombRiceEncode(bitwriter, params.nP, value - nLast);
+        nLast = value;
+    }
+    bitwriter.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t hash = CSipHasher(params.nSipHashK0, params.nSipHashK1)
+        .Write(element.data(), element.size())
+        .Finalize();
+    return MapIntoRange(hash, nF);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> hashed;
+    hashed.reserve(elements.size());
+    for (const Element& element : elements)
+        hashed.push_back(HashToRange(element));
+    std::sort(hashed.begin(), hashed.end());
+    return hashed;
+}
+
+// Merge-join the sorted query hashes against the filter as it is decoded.
+bool GCSFilter::MatchInternal(const uint64_t* hashes, size_t size) const
+{
+    CDataStream stream(vEncoded, SER_NETWORK, 0);
+
+    // Seek past the element count.
+    uint64_t N = ReadCompactSize(stream);
+    assert(N == nN);
+
+    BitStreamReader<CDataStream> bitreader(stream);
+    uint64_t value = 0;
+    size_t iHash = 0;
+    for (uint32_t i = 0; i < nN; ++i) {
+        value += GolombRiceDecode(bitreader, params.nP);
+
+        for (;;) {
+            if (iHash == size)
+                return false;
+            if (hashes[iHash] == value)
+                return true;
+            if (hashes[iHash] > value)
+                break;
+            iHash++;
+        }
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    uint64_t query = HashToRange(element);
+    return MatchInternal(&query, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    const std::vector<uint64_t> queries = BuildHashedSet(elements);
+    return MatchInternal(queries.data(), queries.size());
+}
+
+const std::string& BlockFilterTypeName(BlockFilterType type)
+{
+    static const std::string unknown;
+    return type == BLOCK_FILTER_BASIC ? BASIC_FILTER_NAME : unknown;
+}
+
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& type)
+{
+    if (name == BASIC_FILTER_NAME) {
+        type = BLOCK_FILTER_BASIC;
+        return true;
+    }
+    return false;
+}
+
+// The basic filter holds every output script created in the block and
+// every output script spent by it, except data carrier outputs.
+static GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& blockUndo)
+{
+    GCSFilter::ElementSet elements;
+
+    for (const CTransaction& tx : block.vtx) {
+        for (const CTxOut& txout : tx.vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    for (const CTxUndo& txUndo : blockUndo.vtxundo) {
+        for (const Coin& prevout : txUndo.vprevout) {
+            const CScript& script = prevout.out.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    return elements;
+}
+
+BlockFilter::BlockFilter(BlockFilterType typeIn, const uint256& blockHashIn, std::vector<unsigned char> vFilter)
+    : type(typeIn), blockHash(blockHashIn)
+{
+    if (!BuildParams(params))
+        throw std::invalid_argument("unknown filter type");
+    filter = GCSFilter(params, std::move(vFilter));
+}
+
+BlockFilter::BlockFilter(BlockFilterType typeIn, const CBlock& block, const CBlockUndo& blockUndo)
+    : type(typeIn), blockHash(block.GetHash())
+{
+    if (!BuildParams(params))
+        throw std::invalid_argument("unknown filter type");
+    filter = GCSFilter(params, BasicFilterElements(block, blockUndo));
+}
+
+bool BlockFilter::BuildParams(GCSFilter::Params& paramsOut) const
+{
+    switch (type) {
+    case BLOCK_FILTER_BASIC:
+        paramsOut.nSipHashK0 = ReadLE64(blockHash.begin());
+        paramsOut.nSipHashK1 = ReadLE64(blockHash.begin() + 8);
+        paramsOut.nP = BASIC_FILTER_P;
+        paramsOut.nM = BASIC_FILTER_M;
+        return true;
+    case BLOCK_FILTER_INVALID:
+        return false;
+    }
+    return false;
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& data = GetEncodedFilter();
+    return Hash(data.begin(), data.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& prevHeader) const
+{
+    const uint256 filterHash = GetHash();
+    return Hash(filterHash.begin(), filterHash.end(), prevHeader.begin(), prevHeader.end());
+}
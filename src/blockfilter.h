@@ -0,0 +1,140 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * Golomb-coded set filter, as specified in BIP 158. Elements are hashed to
+ * integers in [0, N * M), sorted and the differences Golomb-Rice coded with
+ * parameter P. Matching has a false positive rate of about 1/M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    struct Params {
+        uint64_t nSipHashK0;
+        uint64_t nSipHashK1;
+        uint8_t nP; //!< Golomb-Rice coding parameter
+        uint32_t nM; //!< Inverse false positive rate
+
+        Params(uint64_t k0 = 0, uint64_t k1 = 0, uint8_t p = 0, uint32_t m = 1)
+            : nSipHashK0(k0), nSipHashK1(k1), nP(p), nM(m) {}
+    };
+
+    /** Constructs an empty filter. */
+    explicit GCSFilter(const Params& params = Params());
+
+    /** Reconstructs an already-encoded filter. Throws if the encoding is malformed. */
+    GCSFilter(const Params& params, std::vector<unsigned char> encoded);
+
+    /** Builds a new filter from the elements. */
+    GCSFilter(const Params& params, const ElementSet& elements);
+
+    uint32_t GetN() const { return nN; }
+    const Params& GetParams() const { return params; }
+    const std::vector<unsigned char>& GetEncoded() const { return vEncoded; }
+
+    /** Checks if the element may be in the set. False positives occur at about 1/M. */
+    bool Match(const Element& element) const;
+
+    /** Checks if any of the elements may be in the set. Cheaper than calling Match repeatedly. */
+    bool MatchAny(const ElementSet& elements) const;
+
+private:
+    Params params;
+    uint32_t nN; //!< Number of elements in the filter
+    uint64_t nF; //!< Range of element hashes, N * M
+    std::vector<unsigned char> vEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+    bool MatchInternal(const uint64_t* hashes, size_t size) const;
+};
+
+static const uint8_t BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+enum BlockFilterType : uint8_t
+{
+    BLOCK_FILTER_BASIC = 0,
+    BLOCK_FILTER_INVALID = 255,
+};
+
+/** Name used for the filter type in REST paths and on disk. */
+const std::string& BlockFilterTypeName(BlockFilterType type);
+
+/** Find a filter type by name, returning false if unknown. */
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& type);
+
+/**
+ * Complete block filter as served to light clients: the filter type, the
+ * hash of the block it was built from and the encoded GCS filter.
+ */
+class BlockFilter
+{
+public:
+    BlockFilter() : type(BLOCK_FILTER_INVALID) {}
+
+    /** Reconstruct a filter from its parts. Throws if the encoding is malformed. */
+    BlockFilter(BlockFilterType type, const uint256& blockHash, std::vector<unsigned char> filter);
+
+    /** Build the filter of the given type from a block and its undo data. */
+    BlockFilter(BlockFilterType type, const CBlock& block, const CBlockUndo& blockUndo);
+
+    BlockFilterType GetType() const { return type; }
+    const uint256& GetBlockHash() const { return blockHash; }
+    const GCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    /** Hash of the encoded filter. */
+    uint256 GetHash() const;
+
+    /** Filter header committing to this filter and the previous block's header. */
+    uint256 ComputeHeader(const uint256& prevHeader) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        uint8_t nType = type;
+        std::vector<unsigned char> vEncoded;
+        if (!ser_action.ForRead())
+            vEncoded = filter.GetEncoded();
+        READWRITE(nType);
+        READWRITE(blockHash);
+        READWRITE(vEncoded);
+        if (ser_action.ForRead()) {
+            type = static_cast<BlockFilterType>(nType);
+            if (!BuildParams(params))
+                throw std::ios_base::failure("unknown filter type");
+            filter = GCSFilter(params, std::move(vEncoded));
+        }
+    }
+
+private:
+    BlockFilterType type;
+    uint256 blockHash;
+    GCSFilter::Params params;
+    GCSFilter filter;
+
+    bool BuildParams(GCSFilter::Params& params) const;
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
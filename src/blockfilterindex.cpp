@@ -0,0 +1,244 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "init.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+static const char DB_FILTER = 'f';
+static const char DB_BEST_BLOCK = 'B';
+
+/** Seconds between checks for new blocks to index once caught up. */
+static const int64_t SYNC_INTERVAL = 1;
+/** Milliseconds a sync task indexes for before letting other tasks run. */
+static const int64_t SYNC_BATCH_MILLIS = 500;
+/** Longest wait before retrying a failed sync, in seconds. */
+static const int64_t SYNC_MAX_RETRY_INTERVAL = 60 * 60;
+
+std::unique_ptr<BlockFilterIndex> g_blockfilterindex;
+
+struct BlockFilterIndex::Entry {
+    uint256 filterHash;
+    uint256 header;
+    std::vector<unsigned char> filter;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(filterHash);
+        READWRITE(header);
+        READWRITE(filter);
+    }
+};
+
+BlockFilterIndex::BlockFilterIndex(BlockFilterType typeIn, size_t nCacheSize, bool fMemory, bool fWipe)
+    : db(GetDataDir() / "indexes" / "blockfilter" / BlockFilterTypeName(typeIn), nCacheSize, isObfuscated, fMemory, fWipe,
+         "indexes/blockfilter/" + BlockFilterTypeName(typeIn)),
+      type(typeIn), fSynced(false), scheduler(nullptr), strand(CScheduler::NO_STRAND),
+      taskId(CScheduler::NO_TASK), nFailures(0)
+{
+    db.Read(DB_BEST_BLOCK, hashBest);
+}
+
+bool BlockFilterIndex::ReadEntry(const uint256& hash, Entry& entry) const
+{
+    return db.Read(std::make_pair(DB_FILTER, hash), entry);
+}
+
+bool BlockFilterIndex::LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const
+{
+    Entry entry;
+    if (!ReadEntry(pindex->GetBlockHash(), entry))
+        return false;
+    filter = BlockFilter(type, pindex->GetBlockHash(), std::move(entry.filter));
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const
+{
+    Entry entry;
+    if (!ReadEntry(pindex->GetBlockHash(), entry))
+        return false;
+    header = entry.header;
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop,
+                                         std::vector<BlockFilter>& filters) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+
+    filters.resize(pindexStop->nHeight - nStartHeight + 1);
+    const CBlockIndex* pindex = pindexStop;
+    for (size_t i = filters.size(); i-- > 0; pindex = pindex->pprev) {
+        if (!LookupFilter(pindex, filters[i]))
+            return false;
+    }
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop,
+                                             std::vector<uint256>& hashes) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+
+    hashes.resize(pindexStop->nHeight - nStartHeight + 1);
+    const CBlockIndex* pindex = pindexStop;
+    for (size_t i = hashes.size(); i-- > 0; pindex = pindex->pprev) {
+        Entry entry;
+        if (!ReadEntry(pindex->GetBlockHash(), entry))
+            return false;
+        hashes[i] = entry.filterHash;
+    }
+    return true;
+}
+
+bool BlockFilterIndex::IsSynced() const
+{
+    LOCK(cs);
+    return fSynced;
+}
+
+uint256 BlockFilterIndex::GetBestBlockHash() const
+{
+    LOCK(cs);
+    return hashBest;
+}
+
+bool BlockFilterIndex::Sync(int64_t nMaxMillis)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    int64_t nLastLog = GetTime();
+    const int64_t nStart = GetTimeMillis();
+
+    for (;;) {
+        if (ShutdownRequested())
+            return false;
+        if (GetTimeMillis() - nStart >= nMaxMillis) {
+            LOCK(cs);
+            fSynced = false;
+            return true;
+        }
+
+        // Pick the next block to index: the block after the point where our
+        // best block forks off the active chain.
+        const CBlockIndex* pindex;
+        CDiskBlockPos undoPos;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexBest = nullptr;
+            const uint256 hash = GetBestBlockHash();
+            if (!hash.IsNull()) {
+                BlockMap::const_iterator it = mapBlockIndex.find(hash);
+                if (it != mapBlockIndex.end())
+                    pindexBest = chainActive.FindFork(it->second);
+            }
+            pindex = pindexBest ? chainActive.Next(pindexBest) : chainActive.Genesis();
+            if (pindex == nullptr) {
+                LOCK(cs);
+                if (!fSynced)
+                    LogPrintf("%s: block filter index is synced at height %d\n", __func__, chainActive.Height());
+                fSynced = true;
+                return true;
+            }
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (pindex->pprev && !(pindex->nStatus & BLOCK_HAVE_UNDO)))
+                return error("%s: block data missing for %s", __func__, pindex->GetBlockHash().ToString());
+            undoPos = pindex->GetUndoPos();
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensusParams))
+            return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+
+        CBlockUndo blockUndo;
+        uint256 prevHeader;
+        if (pindex->pprev) {
+            if (!UndoReadFromDisk(blockUndo, undoPos, pindex->pprev->GetBlockHash()))
+                return error("%s: failed to read undo data for %s", __func__, pindex->GetBlockHash().ToString());
+            if (!LookupFilterHeader(pindex->pprev, prevHeader))
+                return error("%s: no filter header for %s", __func__, pindex->pprev->GetBlockHash().ToString());
+        }
+
+        const BlockFilter filter(type, block, blockUndo);
+        Entry entry;
+        entry.filterHash = filter.GetHash();
+        entry.header = filter.ComputeHeader(prevHeader);
+        entry.filter = filter.GetEncodedFilter();
+
+        CDBBatch batch;
+        batch.Write(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry);
+        batch.Write(DB_BEST_BLOCK, pindex->GetBlockHash());
+        if (!db.WriteBatch(batch))
+            return error("%s: failed to write filter for %s", __func__, pindex->GetBlockHash().ToString());
+
+        {
+            LOCK(cs);
+            hashBest = pindex->GetBlockHash();
+        }
+
+        if (GetTime() - nLastLog >= 30) {
+            LogPrintf("Syncing block filter index with block chain from height %d\n", pindex->nHeight);
+            nLastLog = GetTime();
+        }
+    }
+}
+
+void BlockFilterIndex::SyncTask()
+{
+    int64_t nDelay = SYNC_INTERVAL;
+    if (Sync(SYNC_BATCH_MILLIS)) {
+        nFailures = 0;
+        // Catching up continues right away, after other tasks had a turn.
+        if (!IsSynced())
+            nDelay = 0;
+    }
+    else {
+        if (ShutdownRequested())
+            return;
+        // Missing block data, such as pruned blocks, does not come back by
+        // itself, so back off rather than fill the log.
+        nFailures = std::min(nFailures + 1, 16);
+        nDelay = std::min(SYNC_MAX_RETRY_INTERVAL, SYNC_INTERVAL << nFailures);
+        LogPrintf("%s: block filter index sync failed, retrying in %d seconds\n", __func__, nDelay);
+    }
+
+    LOCK(cs);
+    if (scheduler)
+        taskId = scheduler->scheduleFromNow(boost::bind(&BlockFilterIndex::SyncTask, this), nDelay,
+                                            "blockfilterindex", strand);
+}
+
+void BlockFilterIndex::Start(CScheduler& s)
+{
+    LOCK(cs);
+    scheduler = &s;
+    // Catch up right away, then follow the tip. Each run schedules the next
+    // on the strand, so runs never overlap.
+    strand = s.newStrand();
+    taskId = s.scheduleFromNow(boost::bind(&BlockFilterIndex::SyncTask, this), 0, "blockfilterindex", strand);
+}
+
+void BlockFilterIndex::Stop()
+{
+    LOCK(cs);
+    if (scheduler && taskId != CScheduler::NO_TASK)
+        scheduler->cancel(taskId);
+    scheduler = nullptr;
+    taskId = CScheduler::NO_TASK;
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTERINDEX_H
+#define BITCOIN_BLOCKFILTERINDEX_H
+
+#include "blockfilter.h"
+#include "dbwrapper.h"
+#include "scheduler.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <limits>
+#include <memory>
+#include <vector>
+
+class CBlockIndex;
+
+/** -blockfilterindex default */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+/** -peerblockfilters default */
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+
+/** Maximum number of filters served in response to one getcfilters request. */
+static const int MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of filter hashes served in response to one getcfheaders request. */
+static const int MAX_GETCFHEADERS_SIZE = 2000;
+/** Interval between the filter headers served in cfcheckpt. */
+static const int CFCHECKPT_INTERVAL = 1000;
+
+/**
+ * Persistent index of the block filters of one filter type, with their
+ * filter headers. Entries are keyed by block hash, so filters of blocks
+ * that were reorganized away stay valid for their own branch.
+ *
+ * The index is built and kept up to date with the active chain by a
+ * periodic task on the scheduler; lookups never take cs_main and cost a
+ * single database read per block.
+ */
+class BlockFilterIndex
+{
+public:
+    BlockFilterIndex(BlockFilterType type, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    BlockFilterType GetFilterType() const { return type; }
+
+    bool LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const;
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const;
+
+    /** Filters of the blocks from nStartHeight up to and including pindexStop. */
+    bool LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop,
+                           std::vector<BlockFilter>& filters) const;
+
+    /** Filter hashes of the blocks from nStartHeight up to and including pindexStop. */
+    bool LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop,
+                               std::vector<uint256>& hashes) const;
+
+    /**
+     * Index the blocks of the active chain that are not indexed yet, for
+     * up to about nMaxMillis. Returns false if interrupted by shutdown or if
+     * block data is missing.
+     */
+    bool Sync(int64_t nMaxMillis = std::numeric_limits<int64_t>::max());
+
+    /** True if the last Sync reached the tip of the active chain. */
+    bool IsSynced() const;
+
+    /** Last block indexed while following the active chain. */
+    uint256 GetBestBlockHash() const;
+
+    /** Keep the index in sync with the active chain from a scheduler task. */
+    void Start(CScheduler& scheduler);
+    void Stop();
+
+private:
+    struct Entry;
+
+    bool isObfuscated;
+    CDBWrapper db;
+    const BlockFilterType type;
+
+    mutable CCriticalSection cs;
+    uint256 hashBest;
+    bool fSynced;
+
+    //! The next sync task, protected by cs
+    CScheduler* scheduler;
+    CScheduler::Strand strand;
+    CScheduler::TaskId taskId;
+    //! Failed syncs in a row, to back off retrying
+    int nFailures;
+
+    bool ReadEntry(const uint256& hash, Entry& entry) const;
+    void SyncTask();
+};
+
+/** The basic block filter index, if enabled with -blockfilterindex. */
+extern std::unique_ptr<BlockFilterIndex> g_blockfilterindex;
+
+#endif // BITCOIN_BLOCKFILTERINDEX_H
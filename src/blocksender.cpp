@@ -13,6 +13,7 @@
 #include "netmessagemaker.h"
 #include "xthin.h"
 #include "merkleblock.h"
+#include "recentblockcache.h"
 #include "main.h" // ReadBlockFromDisk
 #include "nodestate.h"
 #include <vector>
@@ -24,7 +25,7 @@ static const int MAX_CMPCTBLOCK_DEPTH = 5;
 static const int MAX_BLOCKTXN_DEPTH = 10;
 
 
-BlockSender::BlockSender() {
+BlockSender::BlockSender(RecentBlockCache* r) : recentBlocks(r) {
 }
 
 bool BlockSender::isBlockType(int t) const {
@@ -64,6 +65,12 @@ void BlockSender::send(const CChain& activeChain, CConnman& connman, CNode& node
         CBlockIndex& blockIndex, const CInv& inv)
 {
     sendBlock(connman, node, blockIndex, inv.type, activeChain.Height());
+    finishSend(activeChain, connman, node, blockIndex, inv);
+}
+
+void BlockSender::finishSend(const CChain& activeChain, CConnman& connman, CNode& node,
+        CBlockIndex& blockIndex, const CInv& inv)
+{
     UpdateBestHeaderSent(node, &blockIndex);
     triggerNextRequest(activeChain, inv, connman, node);
 }
@@ -93,14 +100,41 @@ static bool withinDepthLimits(int depth, int blockHeight, int activeChainHeight)
     return blockHeight >= activeChainHeight - depth;
 }
 
-void BlockSender::sendBlock(CConnman& connman, CNode& node,
-        const CBlockIndex& blockIndex, int invType, int activeChainHeight)
+std::shared_ptr<const CachedBlock> BlockSender::loadBlock(CNode& node, CBlock& block,
+        const CBlockIndex& blockIndex, int activeChainHeight)
 {
+    const bool fRecent = recentBlocks != nullptr
+        && withinDepthLimits(MAX_RECENT_BLOCKS - 1, blockIndex.nHeight, activeChainHeight);
+    if (fRecent) {
+        std::shared_ptr<const CachedBlock> cached = recentBlocks->Get(blockIndex.GetBlockHash());
+        if (cached)
+            return cached;
+    }
 
-    // Send block from disk
-    CBlock block;
     if (!readBlockFromDisk(block, &blockIndex) || block.IsNull())
         throw std::runtime_error("cannot read block from disk");
+    node.requestCost.AddDiskRead(GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+
+    if (!fRecent)
+        return nullptr;
+    return recentBlocks->Insert(std::make_shared<const CBlock>(std::move(block)));
+}
+
+static void pushBlock(CConnman& connman, CNode& node, const CBlock& block,
+        const CachedBlock* cached)
+{
+    if (cached)
+        connman.PushMessage(&node, NetMsg(&node, NetMsgType::BLOCK, cached->GetSerialized()));
+    else
+        connman.PushMessage(&node, NetMsg(&node, NetMsgType::BLOCK, block));
+}
+
+void BlockSender::sendBlock(CConnman& connman, CNode& node,
+        const CBlockIndex& blockIndex, int invType, int activeChainHeight)
+{
+    CBlock diskBlock;
+    std::shared_ptr<const CachedBlock> cached = loadBlock(node, diskBlock, blockIndex, activeChainHeight);
+    const CBlock& block = cached ? cached->GetBlock() : diskBlock;
 
     // We only support MSG_XTHINBLOCK, if peer wants MSG_THINBLOCK,
     // fallback to full one.
@@ -115,7 +149,7 @@ void BlockSender::sendBlock(CConnman& connman, CNode& node,
         // "Nodes MUST NOT send a request for a MSG_CMPCT_BLOCK object to a
         // peer before having received a sendcmpct message from that peer."
 
-        connman.PushMessage(&node, NetMsg(&node, NetMsgType::BLOCK, block));
+        pushBlock(connman, node, block, cached.get());
         return;
     }
 
@@ -136,27 +170,34 @@ void BlockSender::sendBlock(CConnman& connman, CNode& node,
                 }
             }
             if (!sent)
-                connman.PushMessage(&node, NetMsg(&node, NetMsgType::BLOCK, block));
+                pushBlock(connman, node, block, cached.get());
         }
         catch (const xthin_collision_error& e) {
             LogPrintf("tx collision in thin block %s\n",
                     block.GetHash().ToString());
 
             // fall back to full block
-            connman.PushMessage(&node, NetMsg(&node, NetMsgType::BLOCK, block));
+            pushBlock(connman, node, block, cached.get());
         }
         return;
     }
 
     if (invType == MSG_CMPCT_BLOCK && NodeStatePtr(node.id)->supportsCompactBlocks) {
         if (withinDepthLimits(MAX_CMPCTBLOCK_DEPTH, blockIndex.nHeight, activeChainHeight)) {
-            CompactBlock cmpct(block, *choosePrefiller(node));
-            connman.PushMessage(&node, NetMsg(&node, NetMsgType::CMPCTBLOCK, cmpct));
+            std::vector<PrefilledTransaction> prefilled = choosePrefiller(node)->fillFrom(block);
+            // Peers that need only the coinbase prefilled share an encoding.
+            if (cached && prefilled.size() == 1) {
+                connman.PushMessage(&node, NetMsg(&node, NetMsgType::CMPCTBLOCK, cached->GetCompact()));
+            }
+            else {
+                CompactBlock cmpct(block, std::move(prefilled));
+                connman.PushMessage(&node, NetMsg(&node, NetMsgType::CMPCTBLOCK, cmpct));
+            }
         }
         else {
             LogPrint(Log::NET, "cmpctblock outside depth %d, %d peer=%d\n",
                     blockIndex.nHeight, activeChainHeight, node.id);
-            connman.PushMessage(&node, NetMsg(&node, NetMsgType::BLOCK, block));
+            pushBlock(connman, node, block, cached.get());
         }
         return;
     }
@@ -167,7 +208,8 @@ void BlockSender::sendBlock(CConnman& connman, CNode& node,
         LOCK(node.cs_filter);
         filter = *node.pfilter;
     }
-    CMerkleBlock merkleBlock(block, filter);
+    // The per-block work is shared with other peers served the same block.
+    CMerkleBlock merkleBlock(*GetFilteredBlockData(block), filter);
     connman.PushMessage(&node, NetMsg(&node, NetMsgType::MERKLEBLOCK, merkleBlock));
     // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
     // This avoids hurting performance by pointlessly requiring a round-trip
@@ -186,32 +228,44 @@ void BlockSender::sendBlock(CConnman& connman, CNode& node,
 void BlockSender::sendReReqReponse(CConnman& connman, CNode& node, const CBlockIndex& blockIndex,
         const XThinReRequest& req, int activeChainHeight)
 {
-    CBlock block;
-    if (!readBlockFromDisk(block, &blockIndex))
-        throw std::runtime_error("cannot load block from disk");
+    CBlock diskBlock;
+    std::shared_ptr<const CachedBlock> cached = loadBlock(node, diskBlock, blockIndex, activeChainHeight);
+    const CBlock& block = cached ? cached->GetBlock() : diskBlock;
 
-    if (withinDepthLimits(MAX_BLOCKTXN_DEPTH, blockIndex.nHeight, activeChainHeight)) {
+    if (!withinDepthLimits(MAX_BLOCKTXN_DEPTH, blockIndex.nHeight, activeChainHeight)) {
+        pushBlock(connman, node, block, cached.get());
+        return;
+    }
+
+    if (!cached) {
         XThinReReqResponse resp(block, req.txRequesting);
         connman.PushMessage(&node, NetMsg(&node, NetMsgType::XBLOCKTX, resp));
+        return;
     }
-    else {
-        connman.PushMessage(&node, NetMsg(&node, NetMsgType::BLOCK, block));
-    }
+
+    // Look the transactions up instead of hashing the whole block.
+    if (req.txRequesting.empty())
+        throw std::runtime_error("re-requested response with 0 transactions");
+    XThinReReqResponse resp;
+    resp.block = cached->GetHash();
+    for (uint32_t i : cached->FindByCheapHash(req.txRequesting))
+        resp.txRequested.push_back(block.vtx[i]);
+    connman.PushMessage(&node, NetMsg(&node, NetMsgType::XBLOCKTX, resp));
 }
 
 void BlockSender::sendReReqReponse(CConnman& connman, CNode& node, const CBlockIndex& blockIndex,
         const CompactReRequest& req, int activeChainHeight)
 {
-    CBlock block;
-    if (!readBlockFromDisk(block, &blockIndex))
-        throw std::runtime_error("cannot load block from disk");
+    CBlock diskBlock;
+    std::shared_ptr<const CachedBlock> cached = loadBlock(node, diskBlock, blockIndex, activeChainHeight);
+    const CBlock& block = cached ? cached->GetBlock() : diskBlock;
 
     if (withinDepthLimits(MAX_BLOCKTXN_DEPTH, blockIndex.nHeight, activeChainHeight)) {
         CompactReReqResponse resp(block, req.indexes);
         connman.PushMessage(&node, NetMsg(&node, NetMsgType::BLOCKTXN, resp));
     }
     else {
-        connman.PushMessage(&node, NetMsg(&node, NetMsgType::BLOCK, block));
+        pushBlock(connman, node, block, cached.get());
     }
 }
 
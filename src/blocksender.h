@@ -4,6 +4,8 @@
 #ifndef BITCOIN_BLOCKSENDER_H
 #define BITCOIN_BLOCKSENDER_H
 
+#include <memory>
+
 class CChain;
 class CConnman;
 class CBlockIndex;
@@ -12,11 +14,15 @@ class CNode;
 class CBlock;
 class XThinReRequest;
 class CompactReRequest;
+class CachedBlock;
+class RecentBlockCache;
 
 // Handles network 'getdata' requests for blocks.
 class BlockSender {
     public:
-        BlockSender();
+        // Blocks near the tip are kept in and served from recentBlocks,
+        // if given.
+        explicit BlockSender(RecentBlockCache* recentBlocks = nullptr);
 
         // Is this inv a block inv?
         bool isBlockType(int invType) const;
@@ -28,6 +34,10 @@ class BlockSender {
         void send(const CChain& activeChain, CConnman&, CNode& node,
             CBlockIndex& blockIndex, const CInv& inv);
 
+        // Bookkeeping after a block has been sent with sendBlock.
+        void finishSend(const CChain& activeChain, CConnman&, CNode& node,
+            CBlockIndex& blockIndex, const CInv& inv);
+
         virtual void sendBlock(CConnman&, CNode& node,
             const CBlockIndex& blockIndex, int invType, int activeChainHeight);
 
@@ -44,6 +54,15 @@ class BlockSender {
     protected: // used in unit tests
         virtual void triggerNextRequest(const CChain& activeChain, const CInv& inv, CConnman&, CNode& node);
         virtual bool readBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+
+    private:
+        RecentBlockCache* recentBlocks;
+
+        // Get the block from the recent block cache, or else read it from
+        // disk into block, charged to the node's request cost. Returns the
+        // cached block if there is one.
+        std::shared_ptr<const CachedBlock> loadBlock(CNode& node, CBlock& block,
+            const CBlockIndex& blockIndex, int activeChainHeight);
 };
 
 #endif
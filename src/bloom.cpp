@@ -5,12 +5,17 @@
 #include "bloom.h"
 
 #include "primitives/transaction.h"
+#include "crypto/common.h"
 #include "hash.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
 #include "streams.h"
+#include "sync.h"
 
+#include <algorithm>
+#include <limits>
+#include <map>
 #include <math.h>
 #include <stdlib.h>
 
@@ -77,6 +82,50 @@ static std::vector<unsigned char> ToVector(const COutPoint& outpoint) {
     return std::vector<unsigned char>(stream.begin(), stream.end());
 }
 
+// Non-empty data pushes of a script, up to the first opcode that fails to parse.
+static std::vector<CMurmurHash3Input> ScriptPushes(const CScript& script)
+{
+    std::vector<CMurmurHash3Input> pushes;
+    CScript::const_iterator pc = script.begin();
+    vector<unsigned char> data;
+    while (pc < script.end())
+    {
+        opcodetype opcode;
+        if (!script.GetOp(pc, opcode, data))
+            break;
+        if (data.size() != 0)
+            pushes.emplace_back(data);
+    }
+    return pushes;
+}
+
+CBloomTxElements::CBloomTxElements(const CTransaction& tx) :
+    hash(tx.GetHash()), hashInput(hash.begin(), hash.size())
+{
+    vout.resize(tx.vout.size());
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        const CScript& scriptPubKey = tx.vout[i].scriptPubKey;
+        vout[i].vPushes = ScriptPushes(scriptPubKey);
+        txnouttype type;
+        vector<vector<unsigned char> > vSolutions;
+        vout[i].fPubKeyOrMultisig = !vout[i].vPushes.empty() &&
+            Solver(scriptPubKey, type, vSolutions) && (type == TX_PUBKEY || type == TX_MULTISIG);
+    }
+
+    vPrevouts.reserve(tx.vin.size());
+    vInputPushes.reserve(tx.vin.size());
+    unsigned char prevout[36];
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        // Same bytes as the serialized outpoint.
+        memcpy(prevout, txin.prevout.hash.begin(), 32);
+        WriteLE32(prevout + 32, txin.prevout.n);
+        vPrevouts.emplace_back(prevout, sizeof(prevout));
+        vInputPushes.push_back(ScriptPushes(txin.scriptSig));
+    }
+}
+
 
 void CBloomFilter::insert(const COutPoint& outpoint)
 {
@@ -89,6 +138,44 @@ void CBloomFilter::insert(const uint256& hash)
     insert(data);
 }
 
+void CBloomFilter::insert(const CMurmurHash3Input& key)
+{
+    if (isFull)
+        return;
+    for (unsigned int i = 0; i < nHashFuncs; i++)
+    {
+        unsigned int nIndex = key.Hash(i * 0xFBA4C795 + nTweak) % (vData.size() * 8);
+        vData[nIndex >> 3] |= (1 << (7 & nIndex));
+    }
+    isEmpty = false;
+}
+
+bool CBloomFilter::contains(const CMurmurHash3Input& key) const
+{
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    // Hash a few seeds at a time; most elements miss within the first probes,
+    // so hashing all nHashFuncs seeds up front would mostly be wasted.
+    static const unsigned int BATCH = 8;
+    unsigned int seeds[BATCH], hashes[BATCH];
+    for (unsigned int i = 0; i < nHashFuncs; i += BATCH)
+    {
+        const unsigned int nCount = min(BATCH, nHashFuncs - i);
+        for (unsigned int j = 0; j < nCount; j++)
+            seeds[j] = (i + j) * 0xFBA4C795 + nTweak;
+        key.HashMany(seeds, hashes, nCount);
+        for (unsigned int j = 0; j < nCount; j++)
+        {
+            unsigned int nIndex = hashes[j] % (vData.size() * 8);
+            if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
+                return false;
+        }
+    }
+    return true;
+}
+
 bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
 {
     if (isFull)
@@ -135,6 +222,15 @@ bool CBloomFilter::IsWithinSizeConstraints() const
 }
 
 bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
+{
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    return IsRelevantAndUpdate(CBloomTxElements(tx));
+}
+
+bool CBloomFilter::IsRelevantAndUpdate(const CBloomTxElements& tx)
 {
     bool fFound = false;
     // Match if the filter contains the hash of tx
@@ -143,37 +239,25 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
         return true;
     if (isEmpty)
         return false;
-    const uint256& hash = tx.GetHash();
-    if (contains(hash))
+    if (contains(tx.hashInput))
         fFound = true;
 
     for (unsigned int i = 0; i < tx.vout.size(); i++)
     {
-        const CTxOut& txout = tx.vout[i];
+        const CBloomTxElements::Output& txout = tx.vout[i];
         // Match if the filter contains any arbitrary script data element in any scriptPubKey in tx
         // If this matches, also add the specific output that was matched.
         // This means clients don't have to update the filter themselves when a new relevant tx
         // is discovered in order to find spending transactions, which avoids round-tripping and race conditions.
-        CScript::const_iterator pc = txout.scriptPubKey.begin();
-        vector<unsigned char> data;
-        while (pc < txout.scriptPubKey.end())
+        for (const CMurmurHash3Input& data : txout.vPushes)
         {
-            opcodetype opcode;
-            if (!txout.scriptPubKey.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+            if (contains(data))
             {
                 fFound = true;
                 if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
-                    insert(COutPoint(hash, i));
-                else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY)
-                {
-                    txnouttype type;
-                    vector<vector<unsigned char> > vSolutions;
-                    if (Solver(txout.scriptPubKey, type, vSolutions) &&
-                            (type == TX_PUBKEY || type == TX_MULTISIG))
-                        insert(COutPoint(hash, i));
-                }
+                    insert(COutPoint(tx.hash, i));
+                else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY && txout.fPubKeyOrMultisig)
+                    insert(COutPoint(tx.hash, i));
                 break;
             }
         }
@@ -182,23 +266,16 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
     if (fFound)
         return true;
 
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    for (unsigned int i = 0; i < tx.vPrevouts.size(); i++)
     {
         // Match if the filter contains an outpoint tx spends
-        if (contains(txin.prevout))
+        if (contains(tx.vPrevouts[i]))
             return true;
 
         // Match if the filter contains any arbitrary script data element in any scriptSig in tx
-        CScript::const_iterator pc = txin.scriptSig.begin();
-        vector<unsigned char> data;
-        while (pc < txin.scriptSig.end())
-        {
-            opcodetype opcode;
-            if (!txin.scriptSig.GetOp(pc, opcode, data))
-                break;
-            if (data.size() != 0 && contains(data))
+        for (const CMurmurHash3Input& data : tx.vInputPushes[i])
+            if (contains(data))
                 return true;
-        }
     }
 
     return false;
@@ -217,110 +294,199 @@ void CBloomFilter::UpdateEmptyFull()
     isEmpty = empty;
 }
 
+/** Items set all their bits within one window of this many words (a cache line). */
+static const uint32_t WINDOW_WORDS = 8;
+static const uint32_t WINDOW_BITS = WINDOW_WORDS * 64;
+/** Generations of a rolling bloom filter; a full one replaces the oldest. */
+static const int ROLLING_GENERATIONS = 3;
+
+/**
+ * False positive rate of a bloom filter that confines each item to one
+ * window, with nBitsPerElement bits per item and nHashFuncs probes. Window
+ * loads vary (Poisson distributed), which costs more than the textbook rate
+ * for a filter of the same size; this is what the sizing has to make up for.
+ */
+static double WindowedFPRate(double nBitsPerElement, int nHashFuncs)
+{
+    const double lambda = WINDOW_BITS / nBitsPerElement;
+    const double logLambda = log(lambda);
+    const double logUnsetPerItem = nHashFuncs * log(1.0 - 1.0 / WINDOW_BITS);
+    const int nSpread = (int)(12 * sqrt(lambda)) + 20;
+    double rate = 0;
+    for (int j = std::max(0, (int)lambda - nSpread); j <= (int)lambda + nSpread; j++) {
+        const double logP = -lambda + j * logLambda - lgamma(j + 1.0);
+        rate += exp(logP) * pow(1.0 - exp(j * logUnsetPerItem), nHashFuncs);
+    }
+    return rate;
+}
+
+/**
+ * Choose the number of probes and bits per item reaching fpRate with the
+ * least memory. Filters are mostly created with the same few parameters,
+ * so results are remembered.
+ */
+static void ChooseWindowedParams(double fpRate, int& nHashFuncsOut, double& nBitsPerElementOut)
+{
+    static CCriticalSection cs;
+    static std::map<double, std::pair<int, double> > cache;
+    LOCK(cs);
+    auto it = cache.find(fpRate);
+    if (it != cache.end()) {
+        nHashFuncsOut = it->second.first;
+        nBitsPerElementOut = it->second.second;
+        return;
+    }
+
+    // Uneven window loads make somewhat fewer probes than the textbook
+    // log(fpRate) / log(0.5) optimal; restrict to the range 1-50.
+    const int nStd = std::max(1, std::min((int)ceil(log(fpRate) / log(0.5)), 50));
+    nHashFuncsOut = nStd;
+    nBitsPerElementOut = std::numeric_limits<double>::max();
+    for (int k = std::max(1, nStd - 6); k <= nStd; k++) {
+        double lo = 1, hi = 64;
+        while (WindowedFPRate(hi, k) > fpRate && hi < WINDOW_BITS)
+            hi *= 2;
+        if (WindowedFPRate(hi, k) > fpRate)
+            continue;
+        for (int i = 0; i < 25; i++) {
+            const double mid = (lo + hi) / 2;
+            if (WindowedFPRate(mid, k) > fpRate)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        if (hi < nBitsPerElementOut) {
+            nHashFuncsOut = k;
+            nBitsPerElementOut = hi;
+        }
+    }
+    cache[fpRate] = std::make_pair(nHashFuncsOut, nBitsPerElementOut);
+}
+
 CRollingBloomFilter::CRollingBloomFilter(const unsigned int nElements, const double fpRate)
 {
-    double logFpRate = log(fpRate);
-    /* The optimal number of hash functions is log(fpRate) / log(0.5), but
-     * restrict it to the range 1-50. */
-    nHashFuncs = std::max(1, std::min((int)round(logFpRate / log(0.5)), 50));
-    /* In this rolling bloom filter, we'll store between 2 and 3 generations of nElements / 2 entries. */
-    nEntriesPerGeneration = (nElements + 1) / 2;
-    uint32_t nMaxElements = nEntriesPerGeneration * 3;
-    /* The maximum fpRate = pow(1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits), nHashFuncs)
-     * =>          pow(fpRate, 1.0 / nHashFuncs) = 1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits)
-     * =>          1.0 - pow(fpRate, 1.0 / nHashFuncs) = exp(-nHashFuncs * nMaxElements / nFilterBits)
-     * =>          log(1.0 - pow(fpRate, 1.0 / nHashFuncs)) = -nHashFuncs * nMaxElements / nFilterBits
-     * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - pow(fpRate, 1.0 / nHashFuncs))
-     * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs))
-     */
-    uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs)));
-    data.clear();
-    /* For each data element we need to store 2 bits. If both bits are 0, the
-     * bit is treated as unset. If the bits are (01), (10), or (11), the bit is
-     * treated as set in generation 1, 2, or 3 respectively.
-     * These bits are stored in separate integers: position P corresponds to bit
-     * (P & 63) of the integers data[(P >> 6) * 2] and data[(P >> 6) * 2 + 1]. */
-    data.resize(((nFilterBits + 63) / 64) << 1);
+    /* Three generations of nElements / 2 entries are kept and a lookup
+     * checks all of them, so each gets a third of the false positive
+     * budget. */
+    nEntriesPerGeneration = (std::max(1u, nElements) + 1) / 2;
+    double nBitsPerElement;
+    ChooseWindowedParams(fpRate / ROLLING_GENERATIONS, nHashFuncs, nBitsPerElement);
+    nWords = std::max<uint32_t>(WINDOW_WORDS, (uint32_t)ceil(nBitsPerElement * nEntriesPerGeneration / 64));
     reset();
 }
 
-/* Similar to CBloomFilter::Hash */
-static inline uint32_t RollingBloomHash(unsigned int nHashNum, uint32_t nTweak, const std::vector<unsigned char>& vDataToHash) {
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash);
+/**
+ * The bits an item sets in its window. Successive probes are the top bits
+ * of a 64-bit LCG seeded with the item's hash, so every probe depends on
+ * all of the hash.
+ */
+static inline void WindowMask(uint64_t nHash, int nHashFuncs, uint64_t mask[WINDOW_WORDS])
+{
+    for (uint32_t i = 0; i < WINDOW_WORDS; i++)
+        mask[i] = 0;
+    uint64_t state = nHash;
+    for (int n = 0; n < nHashFuncs; n++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        const uint32_t bit = state >> 55;
+        mask[bit >> 6] |= ((uint64_t)1) << (bit & 63);
+    }
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+/**
+ * Word offset of the window an item hashes to. Windows wrap around the end
+ * of the generation, so that every word is covered by equally many windows
+ * and small filters load evenly.
+ */
+static inline uint32_t WindowOffset(uint64_t nHash, uint32_t nWords)
+{
+    return ((nHash >> 32) * nWords) >> 32;
+}
+
+static inline uint32_t WindowWord(uint32_t nOffset, uint32_t i, uint32_t nWords)
+{
+    const uint32_t nWord = nOffset + i;
+    return nWord < nWords ? nWord : nWord - nWords;
+}
+
+void CRollingBloomFilter::Insert(uint64_t nHash)
 {
+    if (data.empty())
+        data.resize(ROLLING_GENERATIONS * nWords);
     if (nEntriesThisGeneration == nEntriesPerGeneration) {
+        /* Wipe the oldest generation and make it the current one. */
         nEntriesThisGeneration = 0;
-        nGeneration++;
-        if (nGeneration == 4) {
-            nGeneration = 1;
-        }
-        uint64_t nGenerationMask1 = 0 - (uint64_t)(nGeneration & 1);
-        uint64_t nGenerationMask2 = 0 - (uint64_t)(nGeneration >> 1);
-        /* Wipe old entries that used this generation number. */
-        for (uint32_t p = 0; p < data.size(); p += 2) {
-            uint64_t p1 = data[p], p2 = data[p + 1];
-            uint64_t mask = (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
-            data[p] = p1 & mask;
-            data[p + 1] = p2 & mask;
-        }
+        nCurrent = (nCurrent + 1) % ROLLING_GENERATIONS;
+        std::fill(data.begin() + nCurrent * nWords, data.begin() + (nCurrent + 1) * nWords, 0);
     }
     nEntriesThisGeneration++;
 
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* The lowest bit of pos is ignored, and set to zero for the first bit, and to one for the second. */
-        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
-        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+    uint64_t mask[WINDOW_WORDS];
+    WindowMask(nHash, nHashFuncs, mask);
+    const uint32_t nOffset = WindowOffset(nHash, nWords);
+    uint64_t* generation = &data[nCurrent * nWords];
+    for (uint32_t i = 0; i < WINDOW_WORDS; i++)
+        generation[WindowWord(nOffset, i, nWords)] |= mask[i];
+}
+
+bool CRollingBloomFilter::Contains(uint64_t nHash) const
+{
+    if (data.empty())
+        return false;
+    uint64_t mask[WINDOW_WORDS];
+    WindowMask(nHash, nHashFuncs, mask);
+    const uint32_t nOffset = WindowOffset(nHash, nWords);
+    for (int nAge = 0; nAge < ROLLING_GENERATIONS; nAge++) {
+        /* Newest first; compare whole words rather than branching on each probe. */
+        const int nGeneration = (nCurrent + ROLLING_GENERATIONS - nAge) % ROLLING_GENERATIONS;
+        const uint64_t* generation = &data[nGeneration * nWords];
+        uint64_t missing = 0;
+        for (uint32_t i = 0; i < WINDOW_WORDS; i++)
+            missing |= mask[i] & ~generation[WindowWord(nOffset, i, nWords)];
+        if (!missing)
+            return true;
     }
+    return false;
 }
 
-void CRollingBloomFilter::insert(const uint256& hash)
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
 {
-    vector<unsigned char> vData(hash.begin(), hash.end());
-    insert(vData);
+    Insert(CSipHasher(nSalt0, nSalt1).Write(vKey.data(), vKey.size()).Finalize());
 }
 
-bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+/* The hash of an uint256 or outpoint equals that of its serialization, so
+ * mixing the typed and byte vector calls gives the same results. */
+void CRollingBloomFilter::insert(const uint256& hash)
 {
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain vKey */
-        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
-            return false;
-        }
-    }
-    return true;
+    Insert(SipHashUint256(nSalt0, nSalt1, hash));
 }
 
 void CRollingBloomFilter::insert(const COutPoint& outpoint)
 {
-    insert(ToVector(outpoint));
+    Insert(SipHashUint256Extra(nSalt0, nSalt1, outpoint.hash, outpoint.n));
+}
+
+bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+{
+    return Contains(CSipHasher(nSalt0, nSalt1).Write(vKey.data(), vKey.size()).Finalize());
 }
 
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> vData(hash.begin(), hash.end());
-    return contains(vData);
+    return Contains(SipHashUint256(nSalt0, nSalt1, hash));
 }
 
 bool CRollingBloomFilter::contains(const COutPoint& outpoint) const
 {
-    return contains(ToVector(outpoint));
+    return Contains(SipHashUint256Extra(nSalt0, nSalt1, outpoint.hash, outpoint.n));
 }
 
 void CRollingBloomFilter::reset()
 {
-    nTweak = GetRand(std::numeric_limits<unsigned int>::max());
+    const uint256 salt = GetRandHash();
+    nSalt0 = salt.GetUint64(0);
+    nSalt1 = salt.GetUint64(1);
     nEntriesThisGeneration = 0;
-    nGeneration = 1;
-    for (std::vector<uint64_t>::iterator it = data.begin(); it != data.end(); it++) {
-        *it = 0;
-    }
+    nCurrent = 0;
+    /* Release the memory; it is allocated again on the next insert. */
+    std::vector<uint64_t>().swap(data);
 }
@@ -5,13 +5,14 @@
 #ifndef BITCOIN_BLOOM_H
 #define BITCOIN_BLOOM_H
 
+#include "hash.h"
 #include "serialize.h"
+#include "uint256.h"
 
 #include <vector>
 
 class COutPoint;
 class CTransaction;
-class uint256;
 
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
@@ -35,6 +36,30 @@ enum bloomflags
  */
 static const unsigned char BLOOM_ANCESTOR_UPDATE_BIT = 4;
 
+/**
+ * Everything CBloomFilter::IsRelevantAndUpdate looks at in a transaction:
+ * the txid, the data pushes of each output and input script and the spent
+ * outpoints, each prepared for hashing. Building this once lets a block be
+ * matched against the filters of many peers without re-parsing scripts and
+ * re-serializing outpoints for each of them.
+ */
+class CBloomTxElements
+{
+public:
+    struct Output {
+        std::vector<CMurmurHash3Input> vPushes; //!< Non-empty data pushes of the scriptPubKey
+        bool fPubKeyOrMultisig; //!< For BLOOM_UPDATE_P2PUBKEY_ONLY
+    };
+
+    uint256 hash;
+    CMurmurHash3Input hashInput;
+    std::vector<Output> vout;
+    std::vector<CMurmurHash3Input> vPrevouts;
+    std::vector<std::vector<CMurmurHash3Input> > vInputPushes; //!< Non-empty data pushes of each scriptSig
+
+    explicit CBloomTxElements(const CTransaction& tx);
+};
+
 /**
  * BloomFilter is a probabilistic filter which SPV clients provide
  * so that we can filter the transactions we send them.
@@ -58,6 +83,9 @@ private:
 
     unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
 
+    void insert(const CMurmurHash3Input& key);
+    bool contains(const CMurmurHash3Input& key) const;
+
     // Private constructor for CRollingBloomFilter, no restrictions on size
     CBloomFilter(const unsigned int nElements, const double nFPRate, const unsigned int nTweak);
     friend class CRollingBloomFilter;
@@ -104,6 +132,7 @@ public:
 
     //! Also adds any outputs which match the filter to the filter (to match their spending txes)
     bool IsRelevantAndUpdate(const CTransaction& tx);
+    bool IsRelevantAndUpdate(const CBloomTxElements& tx);
 
     //! Wants ancestors of matching transactions to be inserted
     bool WantsAncestors() {return nFlags & BLOOM_ANCESTOR_UPDATE_BIT;}
@@ -115,16 +144,25 @@ public:
 /**
  * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
  * Construct it with the number of items to keep track of, and a false-positive
- * rate. Unlike CBloomFilter, by default nTweak is set to a cryptographically
+ * rate. Unlike CBloomFilter, by default the hash salt is set to a cryptographically
  * secure random value for you. Similarly rather than clear() the method
- * reset() is provided, which also changes nTweak to decrease the impact of
+ * reset() is provided, which also changes the salt to decrease the impact of
  * false-positives.
  *
  * contains(item) will always return true if item was one of the last N to 1.5*N
  * insert()'ed ... but may also return true for items that were not inserted.
  *
- * It needs around 1.8 bytes per element per factor 0.1 of false positive rate.
- * (More accurately: 3/(log(256)*log(2)) * log(1/fpRate) * nElements bytes)
+ * Items go into three generations of N/2, each a blocked bloom filter: an
+ * item is hashed once with salted SipHash, which picks a 512-bit (cache
+ * line sized) window of the generation and seeds all the bit probes within
+ * it. When the current generation is full the oldest one is cleared and
+ * takes its place. Memory is only allocated on the first insert, as many
+ * peers never use their filters.
+ *
+ * A lookup checks the same window in each generation, so each generation
+ * gets a third of the false positive budget. The size and number of probes
+ * are chosen from a model of the window loads. At a 0.000001 false positive
+ * rate it needs about 8.1 bytes per element, at 0.001 about 3.5 bytes.
  */
 class CRollingBloomFilter
 {
@@ -143,13 +181,21 @@ public:
 
     void reset();
 
+    /** Bytes used by the filter once anything was inserted. */
+    size_t GetAllocatedSize() const { return 3 * nWords * sizeof(uint64_t); }
+
 private:
     int nEntriesPerGeneration;
     int nEntriesThisGeneration;
-    int nGeneration;
-    std::vector<uint64_t> data;
-    unsigned int nTweak;
     int nHashFuncs;
+    uint32_t nWords; //!< Size of each generation in 64-bit words
+    uint64_t nSalt0;
+    uint64_t nSalt1;
+    int nCurrent; //!< Generation currently inserted into, 0 to 2
+    std::vector<uint64_t> data; //!< All generations, empty until the first insert
+
+    void Insert(uint64_t nHash);
+    bool Contains(uint64_t nHash) const;
 };
 
 #endif // BITCOIN_BLOOM_H
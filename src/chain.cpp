@@ -6,6 +6,8 @@
 #include "chain.h"
 #include "consensus/consensus.h" // for MAX_BLOCK_SIZE
 
+#include <limits>
+
 using namespace std;
 
 CChain::CChain() : tipMaxBlockSize(MAX_BLOCK_SIZE)
@@ -126,6 +128,47 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+static int WalkVersionsAtLeast(const CBlockIndex* pindex, int minVersion, int nWindow)
+{
+    int nFound = 0;
+    for (int i = 0; i < nWindow && pindex != NULL; i++) {
+        if (pindex->nVersion >= minVersion)
+            ++nFound;
+        pindex = pindex->pprev;
+    }
+    return nFound;
+}
+
+void CBlockIndex::BuildVersionCounts(int nWindow)
+{
+    assert(nWindow > 0 && nWindow <= std::numeric_limits<uint16_t>::max());
+
+    if (pprev == NULL || pprev->nVersionCountWindow != nWindow) {
+        for (int i = 0; i < 3; i++)
+            nVersionCount[i] = WalkVersionsAtLeast(this, VERSION_COUNT_MIN + i, nWindow);
+        nVersionCountWindow = nWindow;
+        return;
+    }
+
+    // Slide pprev's window forward: add this block, drop the one that fell out.
+    const CBlockIndex* pexpired = nHeight >= nWindow
+        ? pprev->GetAncestor(nHeight - nWindow) : NULL;
+    for (int i = 0; i < 3; i++) {
+        const int v = VERSION_COUNT_MIN + i;
+        nVersionCount[i] = pprev->nVersionCount[i] + (nVersion >= v)
+            - (pexpired != NULL && pexpired->nVersion >= v);
+    }
+    nVersionCountWindow = nWindow;
+}
+
+int CBlockIndex::CountVersionsAtLeast(int minVersion, int nWindow) const
+{
+    const int i = minVersion - VERSION_COUNT_MIN;
+    if (nVersionCountWindow == nWindow && i >= 0 && i < 3)
+        return nVersionCount[i];
+    return WalkVersionsAtLeast(this, minVersion, nWindow);
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex* pb) {
@@ -12,6 +12,7 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <algorithm>
 #include <vector>
 #include <functional>
 #include <atomic>
@@ -214,6 +215,16 @@ public:
     //! This block's vote for future maximum serialized block size
     uint64_t nMaxBlockSizeVote;
 
+    //! (memory only) Window size nVersionCount was built for, 0 if not built
+    int nVersionCountWindow;
+
+    //! (memory only) Number of blocks with nVersion >= VERSION_COUNT_MIN + i
+    //! among the last nVersionCountWindow blocks, up to and including this one
+    uint16_t nVersionCount[3];
+
+    //! Lowest block version tracked in nVersionCount
+    static const int VERSION_COUNT_MIN = 2;
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -231,6 +242,8 @@ public:
         nSerialVersion = 0;
         nMaxBlockSize = 0;
         nMaxBlockSizeVote = 0;
+        nVersionCountWindow = 0;
+        std::fill(nVersionCount, nVersionCount + 3, 0);
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
@@ -348,6 +361,14 @@ public:
     //! Build the skiplist pointer for this entry.
     void BuildSkip();
 
+    //! Build the rolling version counts for this entry over the last
+    //! nWindow blocks. Cheap when pprev was built for the same window.
+    void BuildVersionCounts(int nWindow);
+
+    //! Count blocks with nVersion >= minVersion among the last nWindow
+    //! blocks, up to and including this one.
+    int CountVersionsAtLeast(int minVersion, int nWindow) const;
+
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
@@ -8,6 +8,7 @@
 #include "memusage.h"
 #include "random.h"
 
+#include <algorithm>
 #include <assert.h>
 
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
@@ -37,7 +38,8 @@ SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<ui
 CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage
+        + (trackedCoins ? trackedCoins->DynamicMemoryUsage() : 0);
 }
 
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
@@ -135,6 +137,14 @@ bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
     return (it != cacheCoins.end() && !it->second.coin.IsSpent());
 }
 
+bool CCoinsViewCache::GetCoinFromCache(const COutPoint &outpoint, Coin &coin) const {
+    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+    if (it == cacheCoins.end())
+        return false;
+    coin = it->second.coin;
+    return true;
+}
+
 uint256 CCoinsViewCache::GetBestBlock() const {
     if (hashBlock.IsNull())
         hashBlock = base->GetBestBlock();
@@ -146,6 +156,17 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
 }
 
 bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+    if (trackedCoins) {
+        CCoinsOverlay::Layer layer;
+        for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY)
+                layer.emplace_back(it->first, it->second.coin);
+        }
+        std::sort(layer.begin(), layer.end(), [](const std::pair<COutPoint, Coin>& a, const std::pair<COutPoint, Coin>& b) {
+            return a.first < b.first;
+        });
+        trackedCoins->Push(std::move(layer));
+    }
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
@@ -205,6 +226,8 @@ bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    if (trackedCoins)
+        trackedCoins->Clear();
     return fOk;
 }
 
@@ -217,6 +240,48 @@ void CCoinsViewCache::Uncache(const COutPoint& hash)
     }
 }
 
+void CCoinsViewCache::AddCachedCoin(const COutPoint &outpoint, Coin&& coin)
+{
+    assert(!coin.IsSpent());
+    std::pair<CCoinsMap::iterator, bool> inserted = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (inserted.second)
+        cachedCoinsUsage += inserted.first->second.coin.DynamicMemoryUsage();
+}
+
+std::vector<COutPoint> CCoinsViewCache::GetCachedOutPoints(size_t nMax) const
+{
+    std::vector<COutPoint> vOutPoints;
+    vOutPoints.reserve(std::min(nMax, cacheCoins.size()));
+    for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end() && vOutPoints.size() < nMax; ++it) {
+        if (!it->second.coin.IsSpent())
+            vOutPoints.push_back(it->first);
+    }
+    return vOutPoints;
+}
+
+std::vector<std::pair<COutPoint, Coin>> CCoinsViewCache::GetModifiedCoins() const
+{
+    std::vector<std::pair<COutPoint, Coin>> coins;
+    for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); ++it) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            coins.emplace_back(it->first, it->second.coin);
+    }
+    std::sort(coins.begin(), coins.end(), [](const std::pair<COutPoint, Coin>& a, const std::pair<COutPoint, Coin>& b) {
+        return a.first < b.first;
+    });
+    return coins;
+}
+
+void CCoinsViewCache::TrackModifiedCoins(bool fTrack)
+{
+    if (!fTrack) {
+        trackedCoins.reset();
+    } else if (!trackedCoins) {
+        trackedCoins.reset(new CCoinsOverlay());
+        trackedCoins->Push(GetModifiedCoins());
+    }
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -245,6 +310,192 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
     return true;
 }
 
+namespace {
+
+/** Merges a cursor of the base view with the overlay of a CCoinsViewSnapshot. */
+class CCoinsViewSnapshotCursor : public CCoinsViewCursor
+{
+public:
+    CCoinsViewSnapshotCursor(CCoinsViewCursor* baseIn, std::shared_ptr<const CCoinsOverlay::Layer> overlayIn,
+                             const uint256& hashBlockIn) :
+        CCoinsViewCursor(hashBlockIn), base(baseIn), overlay(overlayIn), nOverlay(0), fValid(false), fValueOk(false)
+    {
+        Next();
+    }
+
+    bool GetKey(COutPoint &key) const override {
+        if (!fValid)
+            return false;
+        key = keyCurrent;
+        return true;
+    }
+    bool GetValue(Coin &coin) const override {
+        if (!fValid || !fValueOk)
+            return false;
+        coin = coinCurrent;
+        return true;
+    }
+    unsigned int GetValueSize() const override {
+        return ::GetSerializeSize(coinCurrent, SER_DISK, PROTOCOL_VERSION);
+    }
+    bool Valid() const override { return fValid; }
+
+    void Next() override {
+        while (true) {
+            COutPoint keyBase;
+            const bool fBase = base->Valid() && base->GetKey(keyBase);
+            const bool fOverlay = nOverlay < overlay->size();
+            if (!fBase && !fOverlay) {
+                fValid = false;
+                return;
+            }
+            if (fOverlay && (!fBase || !(keyBase < (*overlay)[nOverlay].first))) {
+                // The overlay entry replaces the coin of base, if any.
+                const std::pair<COutPoint, Coin>& entry = (*overlay)[nOverlay++];
+                if (fBase && keyBase == entry.first)
+                    base->Next();
+                if (entry.second.IsSpent())
+                    continue;
+                keyCurrent = entry.first;
+                coinCurrent = entry.second;
+                fValueOk = true;
+            } else {
+                keyCurrent = keyBase;
+                fValueOk = base->GetValue(coinCurrent);
+                base->Next();
+            }
+            fValid = true;
+            return;
+        }
+    }
+
+private:
+    std::unique_ptr<CCoinsViewCursor> base;
+    const std::shared_ptr<const CCoinsOverlay::Layer> overlay;
+    size_t nOverlay;
+    bool fValid;
+    bool fValueOk;
+    COutPoint keyCurrent;
+    Coin coinCurrent;
+};
+
+} // ns anon
+
+static bool LayerEntryLess(const std::pair<COutPoint, Coin>& entry, const COutPoint& outpoint)
+{
+    return entry.first < outpoint;
+}
+
+static size_t LayerMemoryUsage(const CCoinsOverlay::Layer& layer)
+{
+    size_t nUsage = memusage::DynamicUsage(layer);
+    for (const std::pair<COutPoint, Coin>& entry : layer)
+        nUsage += entry.second.DynamicMemoryUsage();
+    return nUsage;
+}
+
+// Merge two sorted layers; entries of newer replace those of older.
+static CCoinsOverlay::Layer MergeLayers(const CCoinsOverlay::Layer& older, const CCoinsOverlay::Layer& newer)
+{
+    CCoinsOverlay::Layer merged;
+    merged.reserve(older.size() + newer.size());
+    CCoinsOverlay::Layer::const_iterator itOld = older.begin(), itNew = newer.begin();
+    while (itOld != older.end() || itNew != newer.end()) {
+        if (itNew == newer.end() || (itOld != older.end() && itOld->first < itNew->first)) {
+            merged.push_back(*itOld++);
+        } else {
+            if (itOld != older.end() && itOld->first == itNew->first)
+                ++itOld;
+            merged.push_back(*itNew++);
+        }
+    }
+    return merged;
+}
+
+void CCoinsOverlay::Push(Layer layer)
+{
+    if (layer.empty())
+        return;
+    nUsage += LayerMemoryUsage(layer);
+    nSize += layer.size();
+    layers.push_back(std::make_shared<const Layer>(std::move(layer)));
+    while (layers.size() >= 2 && layers[layers.size() - 2]->size() <= 2 * layers.back()->size()) {
+        const std::shared_ptr<const Layer> newer = layers.back();
+        layers.pop_back();
+        const std::shared_ptr<const Layer> older = layers.back();
+        nUsage -= LayerMemoryUsage(*older) + LayerMemoryUsage(*newer);
+        nSize -= older->size() + newer->size();
+        layers.back() = std::make_shared<const Layer>(MergeLayers(*older, *newer));
+        nUsage += LayerMemoryUsage(*layers.back());
+        nSize += layers.back()->size();
+    }
+}
+
+const Coin* CCoinsOverlay::Find(const COutPoint &outpoint) const
+{
+    for (size_t i = layers.size(); i-- > 0; ) {
+        const Layer& layer = *layers[i];
+        Layer::const_iterator it = std::lower_bound(layer.begin(), layer.end(), outpoint, LayerEntryLess);
+        if (it != layer.end() && it->first == outpoint)
+            return &it->second;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<const CCoinsOverlay::Layer> CCoinsOverlay::Flatten() const
+{
+    if (layers.empty())
+        return std::make_shared<const Layer>();
+    std::shared_ptr<const Layer> merged = layers.front();
+    for (size_t i = 1; i < layers.size(); i++)
+        merged = std::make_shared<const Layer>(MergeLayers(*merged, *layers[i]));
+    return merged;
+}
+
+void CCoinsOverlay::Clear()
+{
+    layers.clear();
+    nUsage = 0;
+    nSize = 0;
+}
+
+CCoinsViewSnapshot::CCoinsViewSnapshot(std::unique_ptr<CCoinsView> baseIn, const CCoinsOverlay& overlayIn,
+                                       const uint256& hashBlockIn, int nHeightIn) :
+    base(std::move(baseIn)), overlay(overlayIn), hashBlock(hashBlockIn), nHeight(nHeightIn)
+{
+}
+
+bool CCoinsViewSnapshot::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    const Coin* pcoin = overlay.Find(outpoint);
+    if (pcoin == nullptr)
+        return base->GetCoin(outpoint, coin);
+    if (pcoin->IsSpent())
+        return false;
+    coin = *pcoin;
+    return true;
+}
+
+bool CCoinsViewSnapshot::HaveCoin(const COutPoint &outpoint) const
+{
+    const Coin* pcoin = overlay.Find(outpoint);
+    if (pcoin == nullptr)
+        return base->HaveCoin(outpoint);
+    return !pcoin->IsSpent();
+}
+
+uint256 CCoinsViewSnapshot::GetBestBlock() const { return hashBlock; }
+
+CCoinsViewCursor *CCoinsViewSnapshot::Cursor() const
+{
+    CCoinsViewCursor* pcursor = base->Cursor();
+    if (pcursor == nullptr)
+        return nullptr;
+    return new CCoinsViewSnapshotCursor(pcursor, overlay.Flatten(), hashBlock);
+}
+
+size_t CCoinsViewSnapshot::EstimateSize() const { return base->EstimateSize(); }
+
 // TODO: merge with similar definition in undo.h.
 static const size_t MAX_OUTPUTS_PER_TX =
     MAX_TRANSACTION_SIZE / ::GetSerializeSize(CTxOut(), SER_NETWORK, PROTOCOL_VERSION);
@@ -17,7 +17,10 @@
 #include <stdint.h>
 
 #include <boost/foreach.hpp>
+#include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 /**
  * A UTXO entry.
@@ -201,6 +204,7 @@ public:
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
+    CCoinsView* GetBackend() const { return base; }
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
@@ -208,6 +212,38 @@ public:
 
 
 /** CCoinsView that adds a memory cache for transactions to another CCoinsView */
+/**
+ * Coins modified on top of a view, as a stack of layers sorted by outpoint
+ * in which newer layers hide older ones. Layers are never modified once
+ * added, so copies of the overlay share them. A new layer is merged into
+ * the one below while that one is not much larger, which keeps the number
+ * of layers logarithmic in the number of coins.
+ */
+class CCoinsOverlay
+{
+public:
+    typedef std::vector<std::pair<COutPoint, Coin>> Layer;
+
+    CCoinsOverlay() : nUsage(0), nSize(0) {}
+
+    //! Add coins sorted by outpoint, spent ones included.
+    void Push(Layer layer);
+    //! The newest entry for outpoint, or nullptr.
+    const Coin* Find(const COutPoint &outpoint) const;
+    //! All layers merged into one.
+    std::shared_ptr<const Layer> Flatten() const;
+    void Clear();
+
+    //! Number of entries over all layers.
+    size_t GetSize() const { return nSize; }
+    size_t DynamicMemoryUsage() const { return nUsage; }
+
+private:
+    std::vector<std::shared_ptr<const Layer>> layers; //!< Oldest first
+    size_t nUsage;
+    size_t nSize;
+};
+
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
@@ -221,6 +257,9 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* The coins modified since the last Flush, if tracked. */
+    std::unique_ptr<CCoinsOverlay> trackedCoins;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -238,6 +277,12 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Look the coin up in this cache only. Returns false if the cache has no
+     * entry for it; otherwise coin is set, and may be spent.
+     */
+    bool GetCoinFromCache(const COutPoint &outpoint, Coin &coin) const;
+
     /**
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin. Modifications to other cache entries are
@@ -271,10 +316,34 @@ public:
      */
     void Uncache(const COutPoint &outpoint);
 
+    /**
+     * Add a coin read from the base view, unless the cache already has an
+     * entry for it. The coin must be unspent in the base view, as it is
+     * not marked as modified.
+     */
+    void AddCachedCoin(const COutPoint &outpoint, Coin&& coin);
+
+    //! The outpoints of up to nMax unspent coins in the cache.
+    std::vector<COutPoint> GetCachedOutPoints(size_t nMax) const;
+
+    //! The entries that differ from the base view, spent ones included,
+    //! sorted by outpoint.
+    std::vector<std::pair<COutPoint, Coin>> GetModifiedCoins() const;
+
+    /**
+     * Start or stop keeping the coins modified since the last Flush in an
+     * overlay that snapshots can share. Starting copies the modified coins
+     * once; after that each BatchWrite from a child cache adds its coins as
+     * a layer. Coins changed directly in this cache are not tracked.
+     */
+    void TrackModifiedCoins(bool fTrack);
+    //! The coins modified since the last Flush, or nullptr if not tracked.
+    const CCoinsOverlay* GetTrackedCoins() const { return trackedCoins.get(); }
+
     //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
-    //! Calculate the size of the cache (in bytes)
+    //! Calculate the size of the cache, tracked coins included (in bytes)
     size_t DynamicMemoryUsage() const;
 
     /**
@@ -299,6 +368,36 @@ private:
     CCoinsViewCache(const CCoinsViewCache &);
 };
 
+/**
+ * Read-only view of the coins at one block: a base view that is not
+ * changed by later writes, such as a database snapshot, and a frozen copy
+ * of the cache entries that were not yet written to it. It can be read
+ * from any thread without locking.
+ */
+class CCoinsViewSnapshot : public CCoinsView
+{
+public:
+    //! The spent coins of overlay hide those of base.
+    CCoinsViewSnapshot(std::unique_ptr<CCoinsView> base, const CCoinsOverlay& overlay,
+                       const uint256& hashBlock, int nHeight);
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    //! Iterates the coins of base and overlay merged, in outpoint order.
+    CCoinsViewCursor *Cursor() const override;
+    size_t EstimateSize() const override;
+
+    int GetHeight() const { return nHeight; }
+    size_t GetOverlaySize() const { return overlay.GetSize(); }
+
+private:
+    const std::unique_ptr<CCoinsView> base;
+    const CCoinsOverlay overlay;
+    const uint256 hashBlock;
+    const int nHeight;
+};
+
 //! Utility function to add all of a transaction's outputs to a cache.
 // When check is false, this assumes that overwrites are only possible for coinbase transactions.
 // When check is true, the underlying view may be queried to determine whether an addition is
@@ -0,0 +1,164 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinswarmup.h"
+
+#include "clientversion.h"
+#include "coins.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <functional>
+#include <unordered_set>
+
+std::unique_ptr<CoinsWarmup> g_coinswarmup;
+
+//! Version of the coins warm-up file
+static const uint32_t COINS_WARMUP_VERSION = 1;
+
+CoinsWarmup::CoinsWarmup(CCoinsViewCache& c, CCoinsView& b, CCriticalSection& cs_, size_t nMaxUsageIn) :
+    cache(c), base(b), cs(cs_), nMaxUsage(nMaxUsageIn),
+    nNext(0), nRead(0), nLoaded(0), fStop(false), nStartTime(0), nMicros(0), nRunning(0)
+{
+}
+
+CoinsWarmup::~CoinsWarmup()
+{
+    Stop();
+}
+
+void CoinsWarmup::Start(std::vector<COutPoint> vOutPointsIn, int nThreads)
+{
+    assert(threads.empty());
+    vOutPoints = std::move(vOutPointsIn);
+    nStartTime = GetTimeMicros();
+    nRunning = nThreads;
+    for (int i = 0; i < nThreads; ++i)
+        threads.emplace_back(&TraceThread<std::function<void()> >, "coinswarmup",
+                             std::function<void()>(std::bind(&CoinsWarmup::ThreadWarm, this)));
+}
+
+bool CoinsWarmup::WaitFor(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(csDone);
+    return condDone.wait_for(lock, timeout, [this]() { return nRunning == 0; });
+}
+
+void CoinsWarmup::Stop()
+{
+    fStop = true;
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+}
+
+CoinsWarmupStats CoinsWarmup::GetStats() const
+{
+    const size_t nTotal = vOutPoints.size();
+    const bool fDone = nMicros != 0 || nTotal == 0;
+    return CoinsWarmupStats{nTotal, std::min(nRead.load(), nTotal), nLoaded, fDone,
+                            fDone ? nMicros.load() : GetTimeMicros() - nStartTime};
+}
+
+void CoinsWarmup::ThreadWarm()
+{
+    std::vector<std::pair<COutPoint, Coin>> vCoins;
+    while (!fStop) {
+        const size_t nBegin = nNext.fetch_add(COINS_WARMUP_BATCH);
+        if (nBegin >= vOutPoints.size())
+            break;
+        const size_t nEnd = std::min(nBegin + COINS_WARMUP_BATCH, vOutPoints.size());
+
+        // Reading the coins does not need the lock, but the database may
+        // be written meanwhile.
+        const uint256 hashBest = base.GetBestBlock();
+        vCoins.clear();
+        for (size_t i = nBegin; i < nEnd; ++i) {
+            Coin coin;
+            if (base.GetCoin(vOutPoints[i], coin))
+                vCoins.emplace_back(vOutPoints[i], std::move(coin));
+        }
+        nRead += nEnd - nBegin;
+
+        LOCK(cs);
+        if (base.GetBestBlock() != hashBest)
+            continue;
+        if (cache.DynamicMemoryUsage() >= nMaxUsage)
+            break;
+        const size_t nCacheSize = cache.GetCacheSize();
+        for (auto& c : vCoins)
+            cache.AddCachedCoin(c.first, std::move(c.second));
+        nLoaded += cache.GetCacheSize() - nCacheSize;
+    }
+
+    std::lock_guard<std::mutex> lock(csDone);
+    if (--nRunning == 0) {
+        nMicros = std::max<int64_t>(GetTimeMicros() - nStartTime, 1);
+        LogPrint(Log::COINDB, "Warmed coins cache with %u of %u coins in %.2fms\n",
+                 nLoaded, vOutPoints.size(), nMicros * 0.001);
+        condDone.notify_all();
+    }
+}
+
+std::vector<COutPoint> GetCoinsToWarm(const CCoinsViewCache& cache, const CTxMemPool& pool, size_t nMax)
+{
+    std::vector<COutPoint> vOutPoints;
+    std::unordered_set<COutPoint, SaltedOutpointHasher> setAdded;
+    {
+        LOCK(pool.cs);
+        for (const auto& spent : pool.mapNextTx) {
+            if (vOutPoints.size() >= nMax)
+                return vOutPoints;
+            // Outputs of mempool transactions aren't in the database.
+            if (!pool.exists(spent.first.hash) && setAdded.insert(spent.first).second)
+                vOutPoints.push_back(spent.first);
+        }
+    }
+    for (const COutPoint& outpoint : cache.GetCachedOutPoints(nMax)) {
+        if (vOutPoints.size() >= nMax)
+            break;
+        if (!setAdded.count(outpoint))
+            vOutPoints.push_back(outpoint);
+    }
+    return vOutPoints;
+}
+
+bool WriteCoinsWarmupFile(const boost::filesystem::path& path, const std::vector<COutPoint>& vOutPoints)
+{
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+    try {
+        CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s: Failed to open %s", __func__, pathTmp.string());
+        fileout << COINS_WARMUP_VERSION << vOutPoints;
+        FileCommit(fileout.Get());
+    }
+    catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    if (!RenameOver(pathTmp, path))
+        return error("%s: Rename to %s failed", __func__, path.string());
+    return true;
+}
+
+bool ReadCoinsWarmupFile(const boost::filesystem::path& path, std::vector<COutPoint>& vOutPoints)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+    try {
+        uint32_t nVersion;
+        filein >> nVersion;
+        if (nVersion != COINS_WARMUP_VERSION)
+            return error("%s: Unknown version %u of %s", __func__, nVersion, path.string());
+        filein >> vOutPoints;
+    }
+    catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    return true;
+}
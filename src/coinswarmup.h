@@ -0,0 +1,100 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_COINSWARMUP_H
+#define BITCOIN_COINSWARMUP_H
+
+#include "primitives/transaction.h"
+#include "sync.h"
+
+#include <boost/filesystem/path.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CCoinsView;
+class CCoinsViewCache;
+class CTxMemPool;
+
+//! Default for -coinswarmup, the number of coins recorded at shutdown to
+//! be loaded into the coins cache at startup (0 = disable).
+static const int64_t DEFAULT_COINS_WARMUP = 500000;
+//! Threads reading the coins from the database
+static const int COINS_WARMUP_THREADS = 4;
+//! Coins read by a thread before adding them to the cache at once
+static const size_t COINS_WARMUP_BATCH = 1000;
+static const char* const COINS_WARMUP_FILENAME = "coinswarmup.dat";
+
+struct CoinsWarmupStats {
+    size_t nTotal;
+    //! Coins looked up so far
+    size_t nRead;
+    //! Coins added to the cache. Those spent, or already cached, are not.
+    size_t nLoaded;
+    bool fDone;
+    int64_t nMicros;
+};
+
+/**
+ * Fills the coins cache after a restart with the coins it held at
+ * shutdown, so that the first blocks after startup are not validated from
+ * disk. The coins are read from the database by several threads, and
+ * added to the cache a batch at a time.
+ *
+ * A batch is dropped if the database was written meanwhile, as the coins
+ * read may have been spent since.
+ */
+class CoinsWarmup {
+public:
+    //! The cache is guarded by cs, and base is the database under it.
+    //! Coins are added until the cache uses nMaxUsage bytes.
+    CoinsWarmup(CCoinsViewCache& cache, CCoinsView& base, CCriticalSection& cs, size_t nMaxUsage);
+    ~CoinsWarmup();
+
+    void Start(std::vector<COutPoint> vOutPoints, int nThreads);
+    //! Returns true if done, false if it timed out.
+    bool WaitFor(std::chrono::milliseconds timeout);
+    //! Stop early, and wait for the threads to exit.
+    void Stop();
+
+    CoinsWarmupStats GetStats() const;
+
+private:
+    CCoinsViewCache& cache;
+    CCoinsView& base;
+    CCriticalSection& cs;
+    const size_t nMaxUsage;
+
+    std::vector<COutPoint> vOutPoints;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nNext;
+    std::atomic<size_t> nRead;
+    std::atomic<size_t> nLoaded;
+    std::atomic<bool> fStop;
+    int64_t nStartTime;
+    std::atomic<int64_t> nMicros;
+
+    std::mutex csDone;
+    std::condition_variable condDone;
+    int nRunning;
+
+    void ThreadWarm();
+};
+
+extern std::unique_ptr<CoinsWarmup> g_coinswarmup;
+
+//! The coins worth loading at the next startup: the inputs of mempool
+//! transactions, which are likely in the next blocks, and then the coins
+//! in the cache. At most nMax.
+std::vector<COutPoint> GetCoinsToWarm(const CCoinsViewCache& cache, const CTxMemPool& pool, size_t nMax);
+
+bool WriteCoinsWarmupFile(const boost::filesystem::path& path, const std::vector<COutPoint>& vOutPoints);
+bool ReadCoinsWarmupFile(const boost::filesystem::path& path, std::vector<COutPoint>& vOutPoints);
+
+#endif // BITCOIN_COINSWARMUP_H
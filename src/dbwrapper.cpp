@@ -5,6 +5,7 @@
 #include "dbwrapper.h"
 
 #include "util.h"
+#include "utilstrencodings.h"
 
 #include <boost/filesystem.hpp>
 
@@ -13,6 +14,73 @@
 #include <leveldb/filter_policy.h>
 #include <memenv.h>
 #include <algorithm>
+#include <limits>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+
+namespace {
+
+//! All open databases, for the statistics.
+std::mutex csDBWrappers;
+std::list<CDBWrapper*> vDBWrappers;
+//! Signalled when a database is no longer used by WithDBWrapper.
+std::condition_variable cvDBWrapperUsers;
+
+// Counts lookups in LevelDB's block cache, for its hit rate.
+class CountingCache : public leveldb::Cache {
+public:
+    CountingCache(leveldb::Cache* cacheIn, CDBStats& statsIn) : cache(cacheIn), stats(statsIn) { }
+    ~CountingCache() { delete cache; }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge,
+                   void (*deleter)(const leveldb::Slice& key, void* value)) override
+    {
+        return cache->Insert(key, value, charge, deleter);
+    }
+
+    Handle* Lookup(const leveldb::Slice& key) override
+    {
+        Handle* handle = cache->Lookup(key);
+        ++stats.nCacheLookups;
+        if (handle)
+            ++stats.nCacheHits;
+        return handle;
+    }
+
+    void Release(Handle* handle) override { cache->Release(handle); }
+    void* Value(Handle* handle) override { return cache->Value(handle); }
+    void Erase(const leveldb::Slice& key) override { cache->Erase(key); }
+    uint64_t NewId() override { return cache->NewId(); }
+
+private:
+    leveldb::Cache* cache;
+    CDBStats& stats;
+};
+
+} // ns anon
+
+CDBLatency::CDBLatency() : nCount(0), nTotalMicros(0), nMaxMicros(0)
+{
+    for (auto& b : vBuckets)
+        b = 0;
+}
+
+void CDBLatency::Add(int64_t nMicros)
+{
+    if (nMicros < 0)
+        nMicros = 0;
+    ++nCount;
+    nTotalMicros += nMicros;
+
+    uint64_t nMax = nMaxMicros;
+    while (uint64_t(nMicros) > nMax && !nMaxMicros.compare_exchange_weak(nMax, nMicros)) { }
+
+    int n = 0;
+    while (n < NUM_BUCKETS - 1 && nMicros >= (int64_t(1) << n))
+        ++n;
+    ++vBuckets[n];
+}
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
@@ -72,14 +140,71 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+DBOptions::DBOptions(size_t nCacheSize) :
+    nBlockCache(nCacheSize / 2),
+    nWriteBuffer(nCacheSize / 4), // up to two write buffers may be held in memory simultaneously
+    nBloomBits(DBWRAPPER_BLOOM_BITS),
+    nMaxOpenFiles(DBWRAPPER_MAX_OPEN_FILES)
+{
+}
+
+DBOptions DBOptions::FromArgs(const std::string& name, size_t nCacheSize)
+{
+    DBOptions options(nCacheSize);
+    for (const std::string& setting : mapMultiArgs["-dbopt"]) {
+        if (!ApplyDBOption(setting, name, options))
+            LogPrintf("Ignoring malformed -dbopt=%s\n", setting);
+    }
+    return options;
+}
+
+bool ApplyDBOption(const std::string& setting, const std::string& name, DBOptions& options)
+{
+    size_t nEquals = setting.find('=');
+    size_t nDot = setting.rfind('.', nEquals);
+    if (nEquals == std::string::npos || nDot == std::string::npos)
+        return false;
+    const std::string option = setting.substr(nDot + 1, nEquals - nDot - 1);
+    int64_t nValue;
+    if (!ParseInt64(setting.substr(nEquals + 1), &nValue) || nValue < 0)
+        return false;
+
+    // Sizes are given in MiB.
+    if (option == "blockcache" || option == "writebuffer") {
+        if (nValue > (int64_t(1) << 20))
+            return false;
+    }
+    else if (option == "bloombits" || option == "maxopenfiles") {
+        if (nValue > std::numeric_limits<int>::max())
+            return false;
+    }
+    else {
+        return false;
+    }
+
+    if (setting.substr(0, nDot) != name)
+        return true;
+
+    if (option == "blockcache")
+        options.nBlockCache = nValue << 20;
+    else if (option == "writebuffer")
+        options.nWriteBuffer = nValue << 20;
+    else if (option == "bloombits")
+        options.nBloomBits = nValue;
+    else
+        options.nMaxOpenFiles = nValue;
+    return true;
+}
+
+static leveldb::Options GetOptions(const DBOptions& dbOptions)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.block_cache = leveldb::NewLRUCache(dbOptions.nBlockCache);
+    options.write_buffer_size = dbOptions.nWriteBuffer;
+    if (dbOptions.nBloomBits > 0)
+        options.filter_policy = leveldb::NewBloomFilterPolicy(dbOptions.nBloomBits);
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.max_open_files = dbOptions.nMaxOpenFiles;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -89,14 +214,25 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool &isObfuscated, bool fMemory, bool fWipe)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool &isObfuscated, bool fMemory, bool fWipe,
+                       const std::string& nameIn)
+    : CDBWrapper(path, DBOptions::FromArgs(nameIn.empty() ? path.filename().string() : nameIn, nCacheSize),
+                 isObfuscated, fMemory, fWipe, nameIn)
+{
+}
+
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, const DBOptions& dbOptions, bool &isObfuscated, bool fMemory, bool fWipe,
+                       const std::string& nameIn)
+    : name(nameIn.empty() ? path.filename().string() : nameIn), nUsers(0)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(dbOptions);
+    options.block_cache = new CountingCache(options.block_cache, stats);
+    nBlockCacheSize = dbOptions.nBlockCache;
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -113,13 +249,24 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
     LogPrintf("Opened LevelDB successfully\n");
+    LogPrint(Log::LEVELDB, "%s: block cache %d, write buffer %d, bloom bits %d, max open files %d\n",
+             name, dbOptions.nBlockCache, dbOptions.nWriteBuffer,
+             dbOptions.nBloomBits, dbOptions.nMaxOpenFiles);
 
     std::vector<unsigned char> obfuscate_key;
     isObfuscated = Read(OBFUSCATE_KEY_KEY, obfuscate_key);
+
+    std::lock_guard<std::mutex> lock(csDBWrappers);
+    vDBWrappers.push_back(this);
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    {
+        std::unique_lock<std::mutex> lock(csDBWrappers);
+        vDBWrappers.remove(this);
+        cvDBWrapperUsers.wait(lock, [this] { return nUsers == 0; });
+    }
     delete pdb;
     pdb = NULL;
     delete options.filter_policy;
@@ -134,11 +281,96 @@ CDBWrapper::~CDBWrapper()
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
-    leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    leveldb::Status status;
+    {
+        CDBTimer timer(&stats.writeBatch);
+        status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    }
     dbwrapper_private::HandleError(status);
+    stats.nBytesWritten += batch.SizeEstimate();
+    return true;
+}
+
+std::string CDBWrapper::GetProperty(const std::string& property) const
+{
+    std::string value;
+    if (!pdb->GetProperty(property, &value))
+        return "";
+    return value;
+}
+
+std::shared_ptr<const leveldb::Snapshot> CDBWrapper::GetSnapshot() const
+{
+    leveldb::DB* db = pdb;
+    return std::shared_ptr<const leveldb::Snapshot>(pdb->GetSnapshot(),
+            [db](const leveldb::Snapshot* snapshot) { db->ReleaseSnapshot(snapshot); });
+}
+
+void CDBWrapper::CompactRange(const std::string& begin, const std::string& end)
+{
+    leveldb::Slice slBegin(begin), slEnd(end);
+    LogPrint(Log::LEVELDB, "Compacting %s\n", name);
+    pdb->CompactRange(begin.empty() ? nullptr : &slBegin, end.empty() ? nullptr : &slEnd);
+}
+
+void ForEachDBWrapper(std::function<void(CDBWrapper&)> f)
+{
+    std::lock_guard<std::mutex> lock(csDBWrappers);
+    for (CDBWrapper* db : vDBWrappers)
+        f(*db);
+}
+
+bool WithDBWrapper(const std::string& name, std::function<void(CDBWrapper&)> f)
+{
+    CDBWrapper* pdb = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(csDBWrappers);
+        for (CDBWrapper* db : vDBWrappers) {
+            if (db->GetName() == name) {
+                pdb = db;
+                break;
+            }
+        }
+        if (!pdb)
+            return false;
+        ++pdb->nUsers;
+    }
+    // Released on exceptions too, as the database waits for it to close.
+    std::shared_ptr<CDBWrapper> user(pdb, [](CDBWrapper* db) {
+        std::lock_guard<std::mutex> lock(csDBWrappers);
+        --db->nUsers;
+        cvDBWrapperUsers.notify_all();
+    });
+    f(*pdb);
     return true;
 }
 
+static std::string LatencyToString(const CDBLatency& latency)
+{
+    return strprintf("%d ops, avg %dus, max %dus", latency.Count(),
+                     latency.Count() ? latency.TotalMicros() / latency.Count() : 0,
+                     latency.MaxMicros());
+}
+
+void LogDBStats()
+{
+    if (!LogAcceptCategory(Log::LEVELDB))
+        return;
+
+    ForEachDBWrapper([](CDBWrapper& db) {
+        const CDBStats& stats = db.GetStats();
+        LogPrintf("leveldb: %s: read %s; exists %s; write %s; seek %s; next %s; "
+                  "%d bytes read, %d written; block cache %d/%d hits\n",
+                  db.GetName(),
+                  LatencyToString(stats.read), LatencyToString(stats.exists),
+                  LatencyToString(stats.writeBatch), LatencyToString(stats.iterSeek),
+                  LatencyToString(stats.iterNext),
+                  uint64_t(stats.nBytesRead), uint64_t(stats.nBytesWritten),
+                  uint64_t(stats.nCacheHits), uint64_t(stats.nCacheLookups));
+        LogPrintf("leveldb: %s:\n%s", db.GetName(), db.GetProperty("leveldb.stats"));
+    });
+}
+
 bool CDBWrapper::IsEmpty()
 {
     std::unique_ptr<CDBIterator> it(NewIterator());
@@ -151,8 +383,16 @@ const std::string CDBWrapper::OBFUSCATE_KEY_KEY("\000obfuscate_key", 14);
 
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
-void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
-void CDBIterator::Next() { piter->Next(); }
+void CDBIterator::SeekToFirst()
+{
+    CDBTimer timer(stats ? &stats->iterSeek : nullptr);
+    piter->SeekToFirst();
+}
+void CDBIterator::Next()
+{
+    CDBTimer timer(stats ? &stats->iterNext : nullptr);
+    piter->Next();
+}
 
 namespace dbwrapper_private {
 
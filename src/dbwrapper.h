@@ -11,6 +11,12 @@
 #include "util.h"
 #include "version.h"
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
 #include <boost/filesystem/path.hpp>
 
 #include <leveldb/db.h>
@@ -18,6 +24,12 @@
 
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
+//! Seconds between writing database statistics to debug.log
+static const int DBWRAPPER_STATS_LOG_INTERVAL = 10 * 60;
+//! Default bits per key of LevelDB's bloom filters
+static const int DBWRAPPER_BLOOM_BITS = 10;
+//! Default number of table files LevelDB keeps open
+static const int DBWRAPPER_MAX_OPEN_FILES = 64;
 
 class dbwrapper_error : public std::runtime_error
 {
@@ -35,6 +47,99 @@ void HandleError(const leveldb::Status& status);
 
 };
 
+/** LevelDB settings of a database */
+struct DBOptions
+{
+    //! size of the cache of uncompressed table blocks
+    size_t nBlockCache;
+    //! size of the in-memory table that writes go to before they are written
+    //! out as a level 0 file; up to two may be held in memory
+    size_t nWriteBuffer;
+    //! bits per key of the bloom filters (0 for none)
+    int nBloomBits;
+    int nMaxOpenFiles;
+
+    //! Settings for a database given nCacheSize bytes of memory: half for
+    //! the block cache, and a quarter for each of the write buffers.
+    explicit DBOptions(size_t nCacheSize);
+
+    //! Settings for the named database, with its -dbopt settings applied.
+    static DBOptions FromArgs(const std::string& name, size_t nCacheSize);
+};
+
+/**
+ * Apply a setting given as "<database>.<option>=<value>" (as with -dbopt) if
+ * it is for the named database. Returns false if the setting is malformed.
+ */
+bool ApplyDBOption(const std::string& setting, const std::string& name, DBOptions& options);
+
+/** Latency of one kind of database operation */
+class CDBLatency
+{
+public:
+    //! Bucket n of the histogram counts operations that took less than 2^n
+    //! microseconds, and at least 2^(n-1). The last bucket also counts
+    //! everything slower.
+    static const int NUM_BUCKETS = 24;
+
+    CDBLatency();
+
+    void Add(int64_t nMicros);
+
+    uint64_t Count() const { return nCount; }
+    uint64_t TotalMicros() const { return nTotalMicros; }
+    uint64_t MaxMicros() const { return nMaxMicros; }
+    uint64_t Bucket(int n) const { return vBuckets[n]; }
+
+private:
+    std::atomic<uint64_t> nCount;
+    std::atomic<uint64_t> nTotalMicros;
+    std::atomic<uint64_t> nMaxMicros;
+    std::atomic<uint64_t> vBuckets[NUM_BUCKETS];
+};
+
+/** Adds the time from its construction to its destruction to a CDBLatency */
+class CDBTimer
+{
+public:
+    explicit CDBTimer(CDBLatency* latencyIn) : latency(latencyIn)
+    {
+        if (latency)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~CDBTimer()
+    {
+        if (latency)
+            latency->Add(std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    CDBLatency* latency;
+    std::chrono::steady_clock::time_point start;
+};
+
+/** Operation counters of a CDBWrapper */
+struct CDBStats
+{
+    CDBLatency read;
+    CDBLatency exists;
+    CDBLatency writeBatch;
+    //! Seeks of iterators, including to the first entry.
+    CDBLatency iterSeek;
+    CDBLatency iterNext;
+
+    std::atomic<uint64_t> nBytesRead;
+    std::atomic<uint64_t> nBytesWritten;
+
+    //! Lookups in LevelDB's block cache, and how many found the block.
+    std::atomic<uint64_t> nCacheLookups;
+    std::atomic<uint64_t> nCacheHits;
+
+    CDBStats() : nBytesRead(0), nBytesWritten(0), nCacheLookups(0), nCacheHits(0) { }
+};
+
 /** Batch of changes queued to be written to a CDBWrapper */
 class CDBBatch
 {
@@ -105,9 +210,10 @@ class CDBIterator
 {
 private:
     leveldb::Iterator *piter;
+    CDBStats *stats;
 
 public:
-    CDBIterator(leveldb::Iterator *piterIn) : piter(piterIn) {}
+    CDBIterator(leveldb::Iterator *piterIn, CDBStats *statsIn = nullptr) : piter(piterIn), stats(statsIn) {}
     ~CDBIterator();
 
     bool Valid();
@@ -119,6 +225,7 @@ public:
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
         ssKey << key;
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
+        CDBTimer timer(stats ? &stats->iterSeek : nullptr);
         piter->Seek(slKey);
     }
 
@@ -173,6 +280,13 @@ private:
     //! options used when iterating over values of the database
     leveldb::ReadOptions iteroptions;
 
+    leveldb::ReadOptions ReadOptionsAt(const leveldb::Snapshot* snapshot) const
+    {
+        leveldb::ReadOptions options = readoptions;
+        options.snapshot = snapshot;
+        return options;
+    }
+
     //! options used when writing to the database
     leveldb::WriteOptions writeoptions;
 
@@ -182,15 +296,38 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! the database's path relative to the data directory
+    std::string name;
+
+    //! counters of the operations on the database
+    mutable CDBStats stats;
+
+    //! size of LevelDB's block cache
+    size_t nBlockCacheSize;
+
+    //! callers of WithDBWrapper using the database, protected by the list
+    //! of open databases; it is not closed until they are done
+    int nUsers;
+    friend bool WithDBWrapper(const std::string& name, std::function<void(CDBWrapper&)> f);
+
     //! the key under which a obfuscation key may be stored by a future version of DBWrapper
     static const std::string OBFUSCATE_KEY_KEY;
 
 public:
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool &isObfuscated, bool fMemory = false, bool fWipe = false);
+    /**
+     * @param[in] nameIn  Name the database's statistics are shown under.
+     *                    Defaults to the last component of the path.
+     */
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool &isObfuscated, bool fMemory = false, bool fWipe = false,
+               const std::string& nameIn = "");
+    //! Open the database with the given settings, ignoring -dbopt.
+    CDBWrapper(const boost::filesystem::path& path, const DBOptions& dbOptions, bool &isObfuscated, bool fMemory = false, bool fWipe = false,
+               const std::string& nameIn = "");
     ~CDBWrapper();
 
+    //! Reads see the database as it was when snapshot was taken, if given.
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const
+    bool Read(const K& key, V& value, const leveldb::Snapshot* snapshot = nullptr) const
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
@@ -198,13 +335,18 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status;
+        {
+            CDBTimer timer(&stats.read);
+            status = pdb->Get(ReadOptionsAt(snapshot), slKey, &strValue);
+        }
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
             dbwrapper_private::HandleError(status);
         }
+        stats.nBytesRead += strValue.size();
         try {
             CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
@@ -223,7 +365,7 @@ public:
     }
 
     template <typename K>
-    bool Exists(const K& key) const
+    bool Exists(const K& key, const leveldb::Snapshot* snapshot = nullptr) const
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
@@ -231,7 +373,11 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status;
+        {
+            CDBTimer timer(&stats.exists);
+            status = pdb->Get(ReadOptionsAt(snapshot), slKey, &strValue);
+        }
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -263,11 +409,37 @@ public:
         return WriteBatch(batch, true);
     }
 
-    CDBIterator *NewIterator()
+    CDBIterator *NewIterator(const leveldb::Snapshot* snapshot = nullptr)
     {
-        return new CDBIterator(pdb->NewIterator(iteroptions));
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot;
+        return new CDBIterator(pdb->NewIterator(options), &stats);
     }
 
+    /**
+     * Take a snapshot of the database. Reads and iterators given it see the
+     * database as it was when taken, whatever is written since, and can be
+     * used from any thread. It is released when the last reference goes, and
+     * must not outlive the database.
+     */
+    std::shared_ptr<const leveldb::Snapshot> GetSnapshot() const;
+
+    const std::string& GetName() const { return name; }
+
+    const CDBStats& GetStats() const { return stats; }
+
+    size_t GetBlockCacheSize() const { return nBlockCacheSize; }
+
+    //! Return one of LevelDB's properties, such as "leveldb.stats". Returns
+    //! an empty string if the property is unknown.
+    std::string GetProperty(const std::string& property) const;
+
+    /**
+     * Compact the serialized keys from begin to end. An empty key leaves
+     * that end of the range open. Blocks until done.
+     */
+    void CompactRange(const std::string& begin, const std::string& end);
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
@@ -290,4 +462,21 @@ public:
     }
 };
 
+/**
+ * Call f for each open database. Databases are not opened or closed
+ * meanwhile.
+ */
+void ForEachDBWrapper(std::function<void(CDBWrapper&)> f);
+
+/**
+ * Call f for the open database of the name, without keeping other databases
+ * from being opened, closed or listed meanwhile, for long operations. The
+ * database is not closed until f returns. Returns false if no database of
+ * the name is open.
+ */
+bool WithDBWrapper(const std::string& name, std::function<void(CDBWrapper&)> f);
+
+//! Write the statistics of all databases to debug.log (with -debug=leveldb).
+void LogDBStats();
+
 #endif // BITCOIN_DBWRAPPER_H
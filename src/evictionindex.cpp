@@ -0,0 +1,61 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "evictionindex.h"
+#include "net.h"
+
+void EvictionIndex::insert(CNode* pnode, const std::string& group, int priority) {
+    erase(pnode);
+
+    auto g = groups.find(group);
+    if (g == groups.end()) {
+        g = groups.insert(std::make_pair(group, Group())).first;
+        g->second.priority = priority;
+        byPriority.insert(std::make_pair(priority, group));
+    }
+    else if (g->second.priority != priority) {
+        setPriority(group, priority);
+    }
+    g->second.nodes[pnode->GetId()] = pnode;
+    nodeGroup[pnode->GetId()] = group;
+}
+
+void EvictionIndex::erase(CNode* pnode) {
+    auto n = nodeGroup.find(pnode->GetId());
+    if (n == nodeGroup.end())
+        return;
+
+    auto g = groups.find(n->second);
+    g->second.nodes.erase(n->first);
+    if (g->second.nodes.empty()) {
+        byPriority.erase(std::make_pair(g->second.priority, g->first));
+        groups.erase(g);
+    }
+    nodeGroup.erase(n);
+}
+
+void EvictionIndex::setPriority(const std::string& group, int priority) {
+    auto g = groups.find(group);
+    if (g == groups.end() || g->second.priority == priority)
+        return;
+
+    byPriority.erase(std::make_pair(g->second.priority, group));
+    g->second.priority = priority;
+    byPriority.insert(std::make_pair(priority, group));
+}
+
+bool EvictionIndex::findLowerThan(int priority, CNode*& pnode, std::string& group) const {
+    if (byPriority.empty() || byPriority.begin()->first >= priority)
+        return false;
+
+    group = byPriority.begin()->second;
+    pnode = groups.find(group)->second.nodes.rbegin()->second;
+    return true;
+}
+
+void EvictionIndex::clear() {
+    groups.clear();
+    byPriority.clear();
+    nodeGroup.clear();
+}
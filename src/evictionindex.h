@@ -0,0 +1,49 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_EVICTIONINDEX_H
+#define BITCOIN_EVICTIONINDEX_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+class CNode;
+typedef int NodeId;
+
+/**
+ * Inbound nodes ordered by the priority of their IP group, to find the node
+ * to evict for a higher priority connection without looking up the group of
+ * every connected node. The priority of a group is kept up to date with
+ * setPriority as connections join and leave it.
+ *
+ * Not thread safe, protected by cs_vNodes.
+ */
+class EvictionIndex {
+    public:
+    void insert(CNode* pnode, const std::string& group, int priority);
+    void erase(CNode* pnode);
+
+    //! Moves all nodes of group to the new priority. Ignored for a group
+    //! with no indexed nodes.
+    void setPriority(const std::string& group, int priority);
+
+    //! Finds the newest node of the lowest priority group, if that group
+    //! has a priority lower than the one given.
+    bool findLowerThan(int priority, CNode*& pnode, std::string& group) const;
+
+    size_t size() const { return nodeGroup.size(); }
+    void clear();
+
+    private:
+    struct Group {
+        int priority;
+        std::map<NodeId, CNode*> nodes;
+    };
+    std::map<std::string, Group> groups;
+    std::set<std::pair<int, std::string> > byPriority;
+    std::map<NodeId, std::string> nodeGroup;
+};
+
+#endif
@@ -0,0 +1,186 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "getdataworkers.h"
+
+#include "blocksender.h"
+#include "chain.h"
+#include "main.h"
+#include "recentblockcache.h"
+#include "util.h"
+
+#include <chrono>
+
+std::unique_ptr<GetDataWorkers> g_getdataworkers;
+
+GetDataWorkers::GetDataWorkers(CConnman& c) : connman(c), fStop(false)
+{
+}
+
+GetDataWorkers::~GetDataWorkers()
+{
+    Stop();
+}
+
+void GetDataWorkers::Start(int nThreads)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    fStop = false;
+    for (int i = 0; i < nThreads; ++i)
+        threads.emplace_back(&TraceThread<std::function<void()> >, "getdata",
+                             std::function<void()>(std::bind(&GetDataWorkers::ThreadServe, this)));
+}
+
+void GetDataWorkers::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+
+    std::lock_guard<std::mutex> lock(cs);
+    for (auto& p : peers)
+        p.second.node->Release();
+    peers.clear();
+    vRotation.clear();
+}
+
+bool GetDataWorkers::Queue(CNode& node, const CInv& inv, CBlockIndex* pindex)
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (fStop)
+            return false;
+
+        auto it = peers.find(node.id);
+        if (it == peers.end())
+            it = peers.insert(std::make_pair(node.id, PeerQueue{node.AddRef(), {}, false})).first;
+
+        PeerQueue& peer = it->second;
+        if (peer.requests.size() >= MAX_GETDATA_QUEUE_PER_PEER)
+            return false;
+
+        // A peer that is being served is put back in turn when done.
+        if (peer.requests.empty() && !peer.fBusy)
+            vRotation.push_back(node.id);
+        peer.requests.push_back(Request{inv, pindex});
+    }
+    cond.notify_one();
+    return true;
+}
+
+bool GetDataWorkers::HasPending(NodeId id) const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return peers.count(id);
+}
+
+size_t GetDataWorkers::NumPending(NodeId id) const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    auto it = peers.find(id);
+    if (it == peers.end())
+        return 0;
+    return it->second.requests.size() + it->second.fBusy;
+}
+
+void GetDataWorkers::ErasePeer(std::map<NodeId, PeerQueue>::iterator it)
+{
+    it->second.node->Release();
+    peers.erase(it);
+    connman.WakeMessageHandler();
+}
+
+bool GetDataWorkers::NextRequest(NodeId& id, CNode*& node, Request& req)
+{
+    auto r = vRotation.begin();
+    while (r != vRotation.end()) {
+        auto it = peers.find(*r);
+        assert(it != peers.end());
+        PeerQueue& peer = it->second;
+
+        if (peer.node->fDisconnect) {
+            ErasePeer(it);
+            r = vRotation.erase(r);
+            continue;
+        }
+        // Come back to it when there is room in its send buffer.
+        if (peer.node->fPauseSend) {
+            ++r;
+            continue;
+        }
+
+        id = *r;
+        node = peer.node;
+        req = peer.requests.front();
+        peer.requests.pop_front();
+        peer.fBusy = true;
+        vRotation.erase(r);
+        return true;
+    }
+    return false;
+}
+
+void GetDataWorkers::ThreadServe()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    while (!fStop) {
+        NodeId id;
+        CNode* node;
+        Request req;
+        if (!NextRequest(id, node, req)) {
+            // Send buffers draining is not signalled, so poll for that.
+            cond.wait_for(lock, std::chrono::milliseconds(100));
+            continue;
+        }
+
+        lock.unlock();
+        try {
+            Serve(*node, req);
+        }
+        catch (const std::exception& e) {
+            LogPrint(Log::NET, "failed to send block %s to peer=%d: %s\n",
+                     req.inv.hash.ToString(), id, e.what());
+        }
+        lock.lock();
+
+        auto it = peers.find(id);
+        assert(it != peers.end());
+        it->second.fBusy = false;
+        if (it->second.requests.empty() || node->fDisconnect) {
+            ErasePeer(it);
+        }
+        else {
+            vRotation.push_back(id);
+            // Let the message handler top up the queue.
+            connman.WakeMessageHandler();
+        }
+    }
+}
+
+void GetDataWorkers::Serve(CNode& node, const Request& req)
+{
+    int nActiveHeight;
+    {
+        LOCK(cs_main);
+        // The block may have been pruned since it was queued.
+        if (!(req.pindex->nStatus & BLOCK_HAVE_DATA))
+            return;
+        nActiveHeight = chainActive.Height();
+    }
+
+    // Reading the block does not need cs_main. If it is pruned meanwhile
+    // the read fails, as the block at its old position won't match.
+    BlockSender sender(&g_recentblocks);
+    const int64_t nCPUStart = GetThreadCPUTimeMicros();
+    sender.sendBlock(connman, node, *req.pindex, req.inv.type, nActiveHeight);
+    node.requestCost.AddCPUTime(GetThreadCPUTimeMicros() - nCPUStart);
+
+    LOCK(cs_main);
+    sender.finishSend(chainActive, connman, node, *req.pindex, req.inv);
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_GETDATAWORKERS_H
+#define BITCOIN_GETDATAWORKERS_H
+
+#include "net.h"
+#include "protocol.h"
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CBlockIndex;
+
+//! Default number of threads serving historical blocks (0 = serve them on
+//! the message handler thread).
+static const int DEFAULT_GETDATA_THREADS = 2;
+static const int MAX_GETDATA_THREADS = 16;
+//! Blocks at least this deep are served by the workers. Shallower ones are
+//! likely in memory and cheap enough to send from the message handler.
+static const int MIN_ASYNC_GETDATA_DEPTH = 10;
+//! Maximum number of blocks queued for one peer at a time.
+static const size_t MAX_GETDATA_QUEUE_PER_PEER = 16;
+
+// Serves getdata requests for historical blocks on a pool of threads, so
+// that reading them from disk doesn't hold up message processing for all
+// other peers.
+//
+// Blocks queued for a peer are sent in the order they were requested, by
+// one thread at a time. Threads take turns between peers, one block each,
+// and skip peers whose send buffer is full until it has drained.
+class GetDataWorkers {
+public:
+    struct Request {
+        CInv inv;
+        CBlockIndex* pindex;
+    };
+
+    GetDataWorkers(CConnman& connman);
+    virtual ~GetDataWorkers();
+
+    void Start(int nThreads);
+    // Stops the threads and drops everything still queued.
+    void Stop();
+
+    // Queue a block to be sent to the peer. Returns false if the peer's
+    // queue is full or the workers are stopped; the caller should then
+    // retry later.
+    bool Queue(CNode& node, const CInv& inv, CBlockIndex* pindex);
+
+    // Whether blocks are queued or being sent to the peer. Its other
+    // messages should not be processed until this is false, so that
+    // responses keep their order. The message handler is woken when the
+    // peer's queue empties.
+    bool HasPending(NodeId id) const;
+
+    size_t NumPending(NodeId id) const;
+
+protected: // used in unit tests
+    virtual void Serve(CNode& node, const Request& req);
+
+private:
+    struct PeerQueue {
+        CNode* node;
+        std::deque<Request> requests;
+        bool fBusy;
+    };
+
+    CConnman& connman;
+    mutable std::mutex cs;
+    std::condition_variable cond;
+    bool fStop;
+    std::map<NodeId, PeerQueue> peers;
+    // Peers with requests that no thread is serving, in turn order.
+    std::list<NodeId> vRotation;
+    std::vector<std::thread> threads;
+
+    void ThreadServe();
+    // Pick the next peer to serve. Called with cs held.
+    bool NextRequest(NodeId& id, CNode*& node, Request& req);
+    // Forget a peer, waking the message handler. Called with cs held.
+    void ErasePeer(std::map<NodeId, PeerQueue>::iterator it);
+};
+
+extern std::unique_ptr<GetDataWorkers> g_getdataworkers;
+
+#endif // BITCOIN_GETDATAWORKERS_H
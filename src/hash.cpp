@@ -7,6 +7,8 @@
 #include "crypto/hmac_sha512.h"
 #include "pubkey.h"
 
+#include <algorithm>
+
 
 inline uint32_t ROTL32(uint32_t x, int8_t r)
 {
@@ -74,6 +76,86 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
     return h1;
 }
 
+static const uint32_t MURMUR_C1 = 0xcc9e2d51;
+static const uint32_t MURMUR_C2 = 0x1b873593;
+
+static inline uint32_t MurmurMixBlock(uint32_t k1)
+{
+    k1 *= MURMUR_C1;
+    k1 = ROTL32(k1, 15);
+    k1 *= MURMUR_C2;
+    return k1;
+}
+
+static inline uint32_t MurmurFinalize(uint32_t h1, uint32_t nSize)
+{
+    h1 ^= nSize;
+    h1 ^= h1 >> 16;
+    h1 *= 0x85ebca6b;
+    h1 ^= h1 >> 13;
+    h1 *= 0xc2b2ae35;
+    h1 ^= h1 >> 16;
+    return h1;
+}
+
+void CMurmurHash3Input::Set(const unsigned char* pData, size_t nLen)
+{
+    nSize = nLen;
+    const size_t nBlocks = nLen / 4;
+    vBlocks.resize(nBlocks);
+    for (size_t i = 0; i < nBlocks; ++i)
+        vBlocks[i] = MurmurMixBlock(ReadLE32(pData + i * 4));
+
+    const unsigned char* tail = pData + nBlocks * 4;
+    uint32_t k1 = 0;
+    switch (nLen & 3) {
+    case 3:
+        k1 ^= tail[2] << 16;
+        // Falls through
+    case 2:
+        k1 ^= tail[1] << 8;
+        // Falls through
+    case 1:
+        k1 ^= tail[0];
+    };
+    // Mixing zero gives zero, so an absent tail is a no-op when applied.
+    nTail = MurmurMixBlock(k1);
+}
+
+unsigned int CMurmurHash3Input::Hash(unsigned int nHashSeed) const
+{
+    uint32_t h1 = nHashSeed;
+    for (uint32_t k1 : vBlocks) {
+        h1 ^= k1;
+        h1 = ROTL32(h1, 13);
+        h1 = h1 * 5 + 0xe6546b64;
+    }
+    h1 ^= nTail;
+    return MurmurFinalize(h1, nSize);
+}
+
+void CMurmurHash3Input::HashMany(const unsigned int* seeds, unsigned int* results, size_t nCount) const
+{
+    // Run the seeds in fixed-width lanes over the shared blocks; the inner
+    // loops have no dependencies between lanes and vectorize.
+    static const size_t LANES = 8;
+    for (size_t nDone = 0; nDone < nCount; nDone += LANES) {
+        const size_t nLanes = std::min(LANES, nCount - nDone);
+        uint32_t h[LANES];
+        for (size_t j = 0; j < LANES; ++j)
+            h[j] = j < nLanes ? seeds[nDone + j] : 0;
+        for (uint32_t k1 : vBlocks) {
+            for (size_t j = 0; j < LANES; ++j) {
+                h[j] ^= k1;
+                h[j] = ROTL32(h[j], 13);
+                h[j] = h[j] * 5 + 0xe6546b64;
+            }
+        }
+        for (size_t j = 0; j < nLanes; ++j)
+            results[nDone + j] = MurmurFinalize(h[j] ^ nTail, nSize);
+    }
+}
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64])
 {
     unsigned char num[4];
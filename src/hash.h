@@ -198,6 +198,33 @@ uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+/**
+ * An element prepared for MurmurHash3 under many seeds. The per-block mixing
+ * of the input does not depend on the seed, so it is done once here and
+ * each hash only runs the seed-dependent rounds. Bloom filters hash every
+ * element under up to 50 seeds, for each filter the element is tested in.
+ */
+class CMurmurHash3Input
+{
+public:
+    CMurmurHash3Input() : nTail(0), nSize(0) {}
+    explicit CMurmurHash3Input(const std::vector<unsigned char>& vData) { Set(vData.data(), vData.size()); }
+    CMurmurHash3Input(const unsigned char* pData, size_t nLen) { Set(pData, nLen); }
+
+    /** Same result as MurmurHash3(nHashSeed, data). */
+    unsigned int Hash(unsigned int nHashSeed) const;
+
+    /** Hash under nCount seeds at once, results[i] = Hash(seeds[i]). */
+    void HashMany(const unsigned int* seeds, unsigned int* results, size_t nCount) const;
+
+private:
+    std::vector<uint32_t> vBlocks; //!< Mixed 4-byte body blocks
+    uint32_t nTail; //!< Mixed tail bytes, zero if there are none
+    uint32_t nSize;
+
+    void Set(const unsigned char* pData, size_t nLen);
+};
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
 
 /** SipHash-2-4 */
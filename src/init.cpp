@@ -11,9 +11,12 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockfilterindex.h"
 #include "checkpoints.h"
+#include "coinswarmup.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "getdataworkers.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
@@ -22,6 +25,7 @@
 #include "miner.h"
 #include "net.h"
 #include "options.h"
+#include "respend/respenddetector.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "script/standard.h"
@@ -189,15 +193,36 @@ void Shutdown()
 #endif
     GenerateBitcoins(false, 0, Params(), nullptr);
     MapPort(false);
+    // Queued respend actions may relay through connman.
+    respend::StopAsyncActions();
+    // Release the peers held by the workers before they are deleted. The
+    // message handler may still look at the workers until connman stops.
+    if (g_getdataworkers)
+        g_getdataworkers->Stop();
     g_connman.reset();
+    g_getdataworkers.reset();
 
     // After everything has been shut down, but before things get flushed, stop the
     // CScheduler/checkqueue threadGroup
     threadGroup.interrupt_all();
     threadGroup.join_all();
+    StopBlockPruning();
+    if (g_blockfilterindex) {
+        g_blockfilterindex->Stop();
+        g_blockfilterindex.reset();
+    }
+
+    for (const CScheduler::TaskStats& s : scheduler.getTaskStats())
+        LogPrint(Log::BENCH, "scheduler task %s: %u runs, %.2fms avg, %.2fms max, last started %.2fms late\n",
+                 s.name, s.nRuns, s.nTotalMicros * 0.001 / s.nRuns, s.nMaxMicros * 0.001, s.nLastDelayMicros * 0.001);
 
     UnregisterNodeSignals(GetNodeSignals());
 
+    if (g_coinswarmup) {
+        g_coinswarmup->Stop();
+        g_coinswarmup.reset();
+    }
+
     if (fFeeEstimatesInitialized)
     {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -212,8 +237,12 @@ void Shutdown()
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
+            int64_t nWarmup = GetArg("-coinswarmup", DEFAULT_COINS_WARMUP);
+            if (nWarmup > 0)
+                WriteCoinsWarmupFile(GetDataDir() / COINS_WARMUP_FILENAME, GetCoinsToWarm(*pcoinsTip, mempool, nWarmup));
             FlushStateToDisk();
         }
+        SetCoinsSnapshotDB(nullptr);
         delete pcoinsTip;
         pcoinsTip = NULL;
         delete pcoinscatcher;
@@ -309,6 +338,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
+    strUsage += HelpMessageOpt("-coinswarmup=<n>", strprintf(_("Record up to <n> coins in the cache at shutdown, and load them at startup before connecting to peers (0 = disable, default: %u)"), DEFAULT_COINS_WARMUP));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), "bitcoin.conf"));
     if (mode == HMM_BITCOIND)
     {
@@ -321,27 +351,37 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
     }
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-dbopt=<db>.<option>=<n>", strprintf("Override a LevelDB setting of a database (chainstate, blocks/index or indexes/blockfilter/basic). "
+            "Options are blockcache and writebuffer in megabytes, bloombits and maxopenfiles (default: derived from -dbcache; bloombits: %d, maxopenfiles: %d)",
+            DBWRAPPER_BLOOM_BITS, DBWRAPPER_MAX_OPEN_FILES));
+    }
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-parallelmempoolinputs=<n>", strprintf(_("Verify the scripts of transactions with at least <n> inputs on the script verification threads when accepting them to the memory pool (0 = never, default: %u)"),
+        DEFAULT_PARALLEL_MEMPOOL_INPUTS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "bitcoind.pid"));
 #endif
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+    strUsage += HelpMessageOpt("-prunekeepblocks=<n>", strprintf(_("When pruning, keep at least the last <n> blocks and their undo data (default and minimum: %u)"), MIN_BLOCKS_TO_KEEP));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
 #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of BIP158 basic block filters, served over REST and with -peerblockfilters (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve compact block filters to peers per BIP157, requires -blockfilterindex (default: %u)"), DEFAULT_PEERBLOCKFILTERS));
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), 100));
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), 86400));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
@@ -352,6 +392,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect)"));
     strUsage += HelpMessageOpt("-externalip=<ip>", _("Specify your own public address"));
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-getdatathreads=<n>", strprintf(_("Set the number of threads sending historical blocks to peers (0 to %d, 0 = send them from the message handler thread, default: %d)"), MAX_GETDATA_THREADS, DEFAULT_GETDATA_THREADS));
     strUsage += HelpMessageOpt("-hide-platform", _("Don't show platform information in the client string"));
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect)"));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), 125));
@@ -360,6 +401,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
+    strUsage += HelpMessageOpt("-peerrequestbudget=<n>", strprintf(_("Milliseconds of processing per second that serving a peer's requests may take on average before the peer has to wait, scaled by the priority of its IP group (0 = unlimited, default: %u)"), DEFAULT_PEER_REQUEST_BUDGET));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), 8333, 18333));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
@@ -410,7 +452,9 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Skip validating scripts for old blocks with valid PoW (default: %u)", 1));
+        strUsage += HelpMessageOpt("-columnarundo", strprintf("Write block undo data in a columnar format that is faster to read, but not readable by older versions (default: %u)", DEFAULT_COLUMNAR_UNDO));
         strUsage += HelpMessageOpt("-checkpoint-days", strprintf("Minimum age of blocks (in days) to skip validation for (default: %u)", DEFAULT_CHECKPOINT_DAYS));
+        strUsage += HelpMessageOpt("-fastprune", "Use smaller block files and allocation chunks to test pruning (default: 0)");
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush database activity from memory pool to disk log every <n> megabytes (default: %u)", 100));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", 0));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", 0));
@@ -419,6 +463,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", 1));
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", 0));
         strUsage += HelpMessageOpt("-stopatheight", strprintf("Stop running after reaching the given height in the main chain (default: %u)", DEFAULT_STOPATHEIGHT));
+        strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf("Set the number of threads servicing periodic background tasks (1 to %d, default: %d)", MAX_SCHEDULER_THREADS, DEFAULT_SCHEDULER_THREADS));
         strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
         strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
@@ -854,6 +899,8 @@ bool AppInit2()
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", false))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
 #ifdef ENABLE_WALLET
         if (!GetBoolArg("-disablewallet", false)) {
             if (SoftSetBoolArg("-disablewallet", true))
@@ -913,6 +960,8 @@ bool AppInit2()
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
+    fColumnarUndo = GetBoolArg("-columnarundo", DEFAULT_COLUMNAR_UNDO);
+    nParallelMempoolInputs = std::max<int64_t>(0, GetArg("-parallelmempoolinputs", DEFAULT_PARALLEL_MEMPOOL_INPUTS));
     if (fCheckpointsEnabled && !Opt().UAHFTime()) {
         InitWarning(_("Warning: checkpoints are not supported on the BTC chain."));
         fCheckpointsEnabled = false;
@@ -938,6 +987,7 @@ bool AppInit2()
         }
         LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
         fPruneMode = true;
+        nPruneKeepBlocks = std::max((int)GetArg("-prunekeepblocks", MIN_BLOCKS_TO_KEEP), MIN_BLOCKS_TO_KEEP);
     }
 
     RegisterAllCoreRPCCommands(tableRPC);
@@ -1030,6 +1080,12 @@ bool AppInit2()
     if (Opt().UAHFTime())
         nLocalServices |= NODE_BITCOIN_CASH;
 
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (!GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Cannot set -peerblockfilters without -blockfilterindex."));
+        nLocalServices |= NODE_COMPACT_FILTERS;
+    }
+
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
     // Initialize elliptic curve code
@@ -1089,9 +1145,12 @@ bool AppInit2()
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads
+    int nSchedulerThreads = std::max(1, std::min(MAX_SCHEDULER_THREADS,
+                (int)GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS)));
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < nSchedulerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1280,6 +1339,12 @@ bool AppInit2()
         }
     }
 
+    for (const std::string& setting : mapMultiArgs["-dbopt"]) {
+        DBOptions dummy(0);
+        if (!ApplyDBOption(setting, "", dummy))
+            return InitError(strprintf(_("Invalid -dbopt setting: '%s'"), setting));
+    }
+
     // cache size calculations
     int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
@@ -1287,12 +1352,19 @@ bool AppInit2()
     int64_t nBlockTreeDBCache = nTotalCache / 8;
     nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", 0) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nFilterIndexCache = 0;
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        nFilterIndexCache = std::min(nTotalCache / 8, nMaxFilterIndexCache << 20);
+        nTotalCache -= nFilterIndexCache;
+    }
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (nFilterIndexCache > 0)
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nFilterIndexCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
@@ -1307,6 +1379,7 @@ bool AppInit2()
         do {
             try {
                 UnloadBlockIndex();
+                SetCoinsSnapshotDB(nullptr);
                 delete pcoinsTip;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
@@ -1375,12 +1448,13 @@ bool AppInit2()
                     break;
                 }
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                SetCoinsSnapshotDB(pcoinsdbview);
                 LoadChainTip(chainparams);
 
                 uiInterface.InitMessage(_("Verifying blocks..."));
-                if (fHavePruned && GetArg("-checkblocks", DEFAULT_CHECKBLOCKS) > MIN_BLOCKS_TO_KEEP) {
+                if (fHavePruned && GetArg("-checkblocks", DEFAULT_CHECKBLOCKS) > nPruneKeepBlocks) {
                     LogPrintf("Prune: pruned datadir may not have more than %d blocks; -checkblocks=%d may fail\n",
-                        MIN_BLOCKS_TO_KEEP, GetArg("-checkblocks", DEFAULT_CHECKBLOCKS));
+                        nPruneKeepBlocks, GetArg("-checkblocks", DEFAULT_CHECKBLOCKS));
                 }
                 if (!CVerifyDB().VerifyDB(pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
                               GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
@@ -1432,15 +1506,32 @@ bool AppInit2()
         mempool.ReadFeeEstimates(est_filein);
     fFeeEstimatesInitialized = true;
 
+    // Load the coins that were in the cache at shutdown, while the wallet
+    // loads. They are waited for before connecting to peers.
+    std::vector<COutPoint> vWarmCoins;
+    if (GetArg("-coinswarmup", DEFAULT_COINS_WARMUP) > 0 && !fReindex && !fReindexChainState
+        && ReadCoinsWarmupFile(GetDataDir() / COINS_WARMUP_FILENAME, vWarmCoins) && !vWarmCoins.empty())
+    {
+        // Leave room in the cache for the blocks validated meanwhile.
+        g_coinswarmup.reset(new CoinsWarmup(*pcoinsTip, *pcoinsdbview, cs_main, nCoinCacheUsage / 4 * 3));
+        g_coinswarmup->Start(std::move(vWarmCoins), COINS_WARMUP_THREADS);
+    }
+
     // if prune mode, unset NODE_NETWORK and prune block files
     if (fPruneMode) {
         LogPrintf("Unsetting NODE_NETWORK on prune mode\n");
         nLocalServices &= ~NODE_NETWORK;
+        StartBlockPruning(scheduler);
         if (!fReindex) {
             PruneAndFlush();
         }
     }
 
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        g_blockfilterindex.reset(new BlockFilterIndex(BLOCK_FILTER_BASIC, nFilterIndexCache, false, fReindex));
+        g_blockfilterindex->Start(scheduler);
+    }
+
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
     if (fDisableWallet) {
@@ -1656,6 +1747,22 @@ bool AppInit2()
     connOptions.uiInterface = &uiInterface;
     connOptions.nSendBufferMaxSize = 1000*GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
+    nPeerRequestBudget = std::max<int64_t>(0, GetArg("-peerrequestbudget", DEFAULT_PEER_REQUEST_BUDGET));
+
+    if (g_coinswarmup) {
+        while (!g_coinswarmup->WaitFor(std::chrono::seconds(1)) && !fRequestShutdown) {
+            CoinsWarmupStats stats = g_coinswarmup->GetStats();
+            uiInterface.InitMessage(strprintf(_("Warming coins cache (%d%%)..."), stats.nRead * 100 / stats.nTotal));
+        }
+    }
+
+    int nGetDataThreads = std::max(0, std::min(MAX_GETDATA_THREADS,
+                (int)GetArg("-getdatathreads", DEFAULT_GETDATA_THREADS)));
+    if (nGetDataThreads > 0) {
+        g_getdataworkers.reset(new GetDataWorkers(connman));
+        g_getdataworkers->Start(nGetDataThreads);
+    }
+    respend::StartAsyncActions(scheduler);
 
     if (!connman.Start(scheduler, strNodeError, connOptions))
         return InitError(strNodeError);
@@ -1665,7 +1772,11 @@ bool AppInit2()
     CScheduler::Function f = boost::bind(&PartitionCheck, &IsInitialBlockDownload,
                                          boost::ref(cs_main), boost::cref(pindexBestHeader), nPowTargetSpacing);
     CBlockIndex *pdummy = NULL;
-    scheduler.scheduleEvery(f, PartitionCheck(&IsInitialBlockDownload, boost::ref(cs_main), boost::cref(pdummy), nPowTargetSpacing));
+    scheduler.scheduleEvery(f, PartitionCheck(&IsInitialBlockDownload, boost::ref(cs_main), boost::cref(pdummy), nPowTargetSpacing),
+                            "partitioncheck");
+
+    // Write database statistics to debug.log, with -debug=leveldb
+    scheduler.scheduleEvery(&LogDBStats, DBWRAPPER_STATS_LOG_INTERVAL, "dbstats");
 
     // Generate coins in the background
     GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1), Params(), g_connman.get());
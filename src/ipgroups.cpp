@@ -2,6 +2,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <algorithm>
+
 #include <boost/foreach.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/algorithm/string.hpp>
@@ -41,6 +43,15 @@ static const int DEFAULT_IP_PRIO_SRC_POLL_INTERVAL = 60;            // Once per
 
 extern bool fListen;
 
+boost::signals2::signal<void (const std::string&, int)>& IPGroupsChanged() {
+    static boost::signals2::signal<void (const std::string&, int)> signal;
+    return signal;
+}
+
+static void NotifyGroupsReloaded() {
+    IPGroupsChanged()("", DEFAULT_IPGROUP_PRI);
+}
+
 // Returns the empty/default group if the IP does not belong to any group.
 CIPGroupData FindGroupForIP(CNetAddr ip) {
     LOCK(*cs_groups);
@@ -187,32 +198,60 @@ static void LoadTorIPsFromStaticData() {
         ip = ip + "/32";
         ipGroup.subnets.push_back(CSubNet(ip));
     }
-    LOCK(*cs_groups);
-    groups.push_back(ipGroup);
+    {
+        LOCK(*cs_groups);
+        groups.push_back(ipGroup);
+    }
+    NotifyGroupsReloaded();
+}
+
+static bool SameGroup(const CIPGroup& a, const CIPGroup& b) {
+    return a.header.priority == b.header.priority
+        && a.header.decrPriority == b.header.decrPriority
+        && a.header.selfErases == b.header.selfErases
+        && a.subnets == b.subnets;
 }
 
 void AddOrReplace(CIPGroup &group) {
-    LOCK(*cs_groups);
-    // Try to replace existing group with same name.
-    for (size_t i = 0; i < groups.size(); i++) {
-        if (groups[i].header.name == group.header.name) {
-            int connCount = groups[i].header.connCount;
-            groups[i] = group;
-            groups[i].header.connCount = connCount;
-            return;
+    {
+        LOCK(*cs_groups);
+        // Try to replace existing group with same name.
+        auto it = std::find_if(groups.begin(), groups.end(),
+                [&group](const CIPGroup& g) { return g.header.name == group.header.name; });
+        if (it == groups.end()) {
+            groups.insert(groups.begin(), group);
+        }
+        else {
+            // Sources are polled, and mostly unchanged.
+            if (SameGroup(*it, group))
+                return;
+            int connCount = it->header.connCount;
+            *it = group;
+            it->header.connCount = connCount;
         }
     }
-    groups.insert(groups.begin(), group);
+    NotifyGroupsReloaded();
 }
 
-static void MaybeRemoveGroup(const string &group_name) {
-    LOCK(*cs_groups);
+static bool RemoveGroup(const string &group_name) {
+    AssertLockHeld(*cs_groups);
     for (size_t i = 0; i < groups.size(); i++) {
         if (groups[i].header.name == group_name) {
             groups.erase(groups.begin() + i);
-            return;
+            return true;
         }
     }
+    return false;
+}
+
+static void MaybeRemoveGroup(const string &group_name) {
+    bool fRemoved;
+    {
+        LOCK(*cs_groups);
+        fRemoved = RemoveGroup(group_name);
+    }
+    if (fRemoved)
+        NotifyGroupsReloaded();
 }
 
 static bool LoadIPGroupsFromFile(const boost::filesystem::path &path, const string &group_name, int priority) {
@@ -279,8 +318,10 @@ static void InitTorIPGroups(CScheduler *scheduler) {
     // to DoS the Tor website, and to give us a fighting chance of correctly labelling connections that come in
     // a few seconds after startup (this can happen). Kick off a poll now and then do it (by default) once per day.
     if (scheduler) {
-        scheduler->scheduleFromNow(&PollTorWebsite, 0);
-        scheduler->scheduleEvery(&PollTorWebsite, GetArg("-poll-tor-seconds", DEFAULT_IP_PRIO_URL_POLL_INTERVAL));
+        // Share a strand so the initial poll and the periodic one never overlap.
+        CScheduler::Strand strand = scheduler->newStrand();
+        scheduler->scheduleFromNow(&PollTorWebsite, 0, "polltor", strand);
+        scheduler->scheduleEvery(&PollTorWebsite, GetArg("-poll-tor-seconds", DEFAULT_IP_PRIO_URL_POLL_INTERVAL), "polltor", strand);
     }
     LoadTorIPsFromStaticData();
 }
@@ -290,6 +331,7 @@ void InitIPGroups(CScheduler *scheduler) {
         LOCK(*cs_groups);
         groups.clear();
     }
+    NotifyGroupsReloaded();
 
     // If scheduler is NULL then we're in unit tests.
     if (scheduler) {
@@ -305,7 +347,7 @@ void InitIPGroups(CScheduler *scheduler) {
     InitTorIPGroups(scheduler);
     InitIPGroupsFromCommandLine();
     if (scheduler)
-        scheduler->scheduleEvery(&InitIPGroupsFromCommandLine, GetArg("-poll-ip-sources-seconds", DEFAULT_IP_PRIO_SRC_POLL_INTERVAL));
+        scheduler->scheduleEvery(&InitIPGroupsFromCommandLine, GetArg("-poll-ip-sources-seconds", DEFAULT_IP_PRIO_SRC_POLL_INTERVAL), "ipgroups");
 
     // Future ideas:
     // - Load IP ranges from URLs to let node admin deprioritise ranges that seem to be jamming.
@@ -317,24 +359,10 @@ void InitIPGroups(CScheduler *scheduler) {
     //   idling connections.
 }
 
+// The group has already been joined, see AssignIPGroupSlot.
 IPGroupSlot::IPGroupSlot(const std::string& groupName) :
     groupName(groupName), groupCS(cs_groups)
 {
-    LOCK(*cs_groups);
-
-    typedef std::vector<CIPGroup>::iterator auto_;
-    for (auto_ g = groups.begin(); g != groups.end(); ++g) {
-        if (g->header.name != groupName)
-            continue;
-
-        g->header.connCount += 1;
-
-        if (g->header.decrPriority)
-            g->header.priority -= IPGROUP_CONN_MODIFIER;
-
-        return; // names are unique, so we're done.
-    }
-    assert(!"tried to create a groupslot for a group that does not exist");
 }
 
 IPGroupSlot::~IPGroupSlot() {
@@ -344,26 +372,38 @@ IPGroupSlot::~IPGroupSlot() {
     if (cs.get() == NULL)
         return;
 
-    LOCK(*cs);
+    int priority = 0;
+    bool changed = false;
+    {
+        LOCK(*cs);
 
-    typedef std::vector<CIPGroup>::iterator auto_;
-    for (auto_ g = groups.begin(); g != groups.end(); ++g) {
-        CIPGroupData& group = g->header;
+        typedef std::vector<CIPGroup>::iterator auto_;
+        for (auto_ g = groups.begin(); g != groups.end(); ++g) {
+            CIPGroupData& group = g->header;
 
-        if (group.name != groupName)
-            continue;
+            if (group.name != groupName)
+                continue;
 
-        group.connCount -= 1;
-        assert(group.connCount >= 0);
+            group.connCount -= 1;
+            assert(group.connCount >= 0);
 
-        if (group.decrPriority)
-            group.priority += IPGROUP_CONN_MODIFIER;
+            if (group.decrPriority) {
+                group.priority += IPGROUP_CONN_MODIFIER;
+                priority = group.priority;
+                changed = true;
+            }
 
-        if (group.selfErases && !group.connCount)
-            MaybeRemoveGroup(g->header.name);
+            // No connections are left to tell.
+            if (group.selfErases && !group.connCount) {
+                RemoveGroup(groupName);
+                changed = false;
+            }
 
-        return;
+            break;
+        }
     }
+    if (changed)
+        IPGroupsChanged()(groupName, priority);
 }
 
 CIPGroupData IPGroupSlot::Group() {
@@ -377,27 +417,45 @@ CIPGroupData IPGroupSlot::Group() {
 }
 
 std::unique_ptr<IPGroupSlot> AssignIPGroupSlot(const CNetAddr& ip) {
-    LOCK(*cs_groups);
+    CIPGroupData group;
+    {
+        LOCK(*cs_groups);
 
-    CIPGroupData group = FindGroupForIP(ip);
+        group = FindGroupForIP(ip);
+
+        // If IP does not belong to a group, create a new group
+        // for only this IP. This group is used to de-prioritize multiple
+        // connections from same IP.
+        //
+        // The goal is to force an attacker to spread out in order to get lots of priority.
+        if (group.name.empty()) {
+            // IPGROUP_CONN_MODIFIER will be decremented again when the group is joined below.
+            int pri = DEFAULT_IPGROUP_PRI + IPGROUP_CONN_MODIFIER;
+
+            CIPGroup newGroup;
+            newGroup.header = CIPGroupData(ip.ToStringIP(), pri, true, true);
+            newGroup.subnets.push_back(CSubNet(ip.ToStringIP() + "/32"));
+            groups.push_back(newGroup);
+            group = newGroup.header;
+        }
 
-    // IP belongs to a group already.
-    if (!group.name.empty())
-        return std::unique_ptr<IPGroupSlot>(new IPGroupSlot(group.name));
+        // Join the group. Names are unique.
+        typedef std::vector<CIPGroup>::iterator auto_;
+        auto_ g = groups.begin();
+        for (; g != groups.end(); ++g)
+            if (g->header.name == group.name)
+                break;
+        assert(g != groups.end());
 
-    // If IP does not belong to a group, create a new group
-    // for only this IP. This group is used to de-prioritize multiple
-    // connections from same IP.
-    //
-    // The goal is to force an attacker to spread out in order to get lots of priority.
+        g->header.connCount += 1;
 
-    // IPGROUP_CONN_MODIFIER will be decremented again when slot is constructed.
-    int pri = DEFAULT_IPGROUP_PRI + IPGROUP_CONN_MODIFIER;
+        if (g->header.decrPriority)
+            g->header.priority -= IPGROUP_CONN_MODIFIER;
 
-    CIPGroup newGroup;
-    newGroup.header = CIPGroupData(ip.ToStringIP(), pri, true, true);
-    newGroup.subnets.push_back(CSubNet(ip.ToStringIP() + "/32"));
-    groups.push_back(newGroup);
+        group = g->header;
+    }
+    if (group.decrPriority)
+        IPGroupsChanged()(group.name, group.priority);
 
-    return std::unique_ptr<IPGroupSlot>(new IPGroupSlot(newGroup.header.name));
+    return std::unique_ptr<IPGroupSlot>(new IPGroupSlot(group.name));
 }
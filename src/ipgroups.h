@@ -8,6 +8,7 @@
 #include "netbase.h"
 #include "sync.h"
 #include <boost/noncopyable.hpp>
+#include <boost/signals2/signal.hpp>
 #include <boost/weak_ptr.hpp>
 
 #define IP_PRIO_SRC_FLAG_NAME "-ip-priority-source"
@@ -70,6 +71,12 @@ class IPGroupSlot : boost::noncopyable {
 
 CIPGroupData FindGroupForIP(CNetAddr ip);
 
+// Signalled with the name and new priority of a group whose priority changed
+// as a connection joined or left it, or with an empty name when groups were
+// loaded or reloaded, so IPs may belong to other groups now. Never signalled
+// with the groups lock held.
+boost::signals2::signal<void (const std::string&, int)>& IPGroupsChanged();
+
 void InitIPGroupsFromCommandLine();
 void InitIPGroups(CScheduler *scheduler);
 
@@ -4,6 +4,9 @@
 
 #include "leakybucket.h"
 
+#include <algorithm>
+#include <stdint.h>
+
 CLeakyBucket::CLeakyBucket(int maxp, int fillp, int startLevel)
     : max(maxp),
     fill(fillp)
@@ -29,9 +32,8 @@ void CLeakyBucket::fillIt()
     if (msElapsed > 100)
     {
         lastFill = now;
-        level += (fill * msElapsed) / 1000;
-        if (level > max)
-            level = max;
+        // in 64 bits, as buckets can stay untouched for long
+        level = (int)std::min<int64_t>(max, level + ((int64_t)fill * msElapsed) / 1000);
     }
 }
 
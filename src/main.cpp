@@ -10,6 +10,7 @@
 #include "bip64_getutxo.h"
 #include "blockannounce.h"
 #include "blockencodings.h"
+#include "blockfilterindex.h"
 #include "blockheaderprocessor.h"
 #include "blocksender.h"
 #include "chainparams.h"
@@ -21,6 +22,8 @@
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
 #include "consensus/validation.h"
+#include "core_memusage.h"
+#include "getdataworkers.h"
 #include "inflightindex.h"
 #include "init.h"
 #include "maxblocksize.h"
@@ -34,12 +37,15 @@
 #include "policy/txpriority.h"
 #include "pow.h"
 #include "process_xthinblock.h"
+#include "recentblockcache.h"
 #include "respend/respenddetector.h"
+#include "scheduler.h"
 #include "thinblockbuilder.h"
 #include "thinblockconcluder.h"
 #include "thinblockmanager.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "txrequest.h"
 #include "ui_interface.h"
 #include "undo.h"
 #include "util.h"
@@ -86,9 +92,12 @@ bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
+bool fColumnarUndo = DEFAULT_COLUMNAR_UNDO;
+unsigned int nParallelMempoolInputs = DEFAULT_PARALLEL_MEMPOOL_INPUTS;
 bool fCheckpointsEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
+int nPruneKeepBlocks = MIN_BLOCKS_TO_KEEP;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
 CFeeRate minRelayTxFee = CFeeRate(1000);
@@ -111,6 +120,8 @@ static bool SanityCheckMessage(CNode* peer, const CNetMessage& msg);
  */
 static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned nRequired, const Consensus::Params& consensusParams);
 static void CheckBlockIndex();
+static bool CheckMempoolInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view,
+                               unsigned int flags, PrecomputedTransactionData& txdata);
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -167,6 +178,14 @@ namespace {
      */
     bool fCheckForPruning = false;
 
+    /** Scheduler running the pruning service, if started (see StartBlockPruning). */
+    CScheduler* pPruneScheduler = nullptr;
+    CScheduler::Strand pruneStrand = CScheduler::NO_STRAND;
+    /** A pruning pass is queued on pPruneScheduler. Protected by cs_main. */
+    bool fPruneScheduled = false;
+    /** Held for a whole pruning pass, so passes never overlap. Taken before cs_main. */
+    CCriticalSection cs_prunePass;
+
     /**
      * Every received block is assigned a unique and increasing identifier, so we
      * know which one to give priority in case of a fork.
@@ -247,6 +266,12 @@ ThinBlockManager thinblockmg(
         std::unique_ptr<ThinBlockFinishedCallb>(new OnBlockFinished(false)),
         std::unique_ptr<InFlightEraser>(new InFlightEraserImpl()));
 
+size_t ThinBlocksDynamicMemoryUsage()
+{
+    AssertLockHeld(cs_main);
+    return thinblockmg.DynamicMemoryUsage();
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Registration of network node signals.
@@ -323,6 +348,7 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
     BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight)
         blocksInFlight.erase(nodeid, entry.hash);
     EraseOrphansFor(nodeid);
+    g_txrequest.DisconnectedPeer(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
 
     state.erase();
@@ -629,6 +655,64 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
+static CCoinsViewDB* pcoinsSnapshotDB = nullptr;
+//! The last snapshot taken, dropped when the tip changes (protected by cs_main)
+static std::shared_ptr<CCoinsViewSnapshot> pcoinsSnapshot;
+//! A snapshot was taken since the last flush of pcoinsTip (protected by cs_main)
+static bool fCoinsSnapshotSinceFlush = false;
+
+void SetCoinsSnapshotDB(CCoinsViewDB* db)
+{
+    LOCK(cs_main);
+    pcoinsSnapshotDB = db;
+    pcoinsSnapshot.reset();
+}
+
+/**
+ * The snapshot of the tip, from the coins modified in pcoinsTip since the
+ * last flush. Once pcoinsTip tracks them, every block adds its changes and
+ * taking a snapshot is cheap. Otherwise, if fStartTracking, they are copied
+ * once and tracking starts; if not, returns nullptr.
+ */
+static std::shared_ptr<CCoinsViewSnapshot> TakeCoinsSnapshot(bool fStartTracking)
+{
+    AssertLockHeld(cs_main);
+    assert(pcoinsSnapshotDB != nullptr);
+    const uint256 hashBlock = pcoinsTip->GetBestBlock();
+    if (pcoinsSnapshot && pcoinsSnapshot->GetBestBlock() == hashBlock)
+        return pcoinsSnapshot;
+    if (pcoinsTip->GetTrackedCoins() == nullptr) {
+        if (!fStartTracking)
+            return nullptr;
+        pcoinsTip->TrackModifiedCoins(true);
+    }
+
+    const int64_t nStart = GetTimeMicros();
+    BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+    const int nHeight = it == mapBlockIndex.end() ? -1 : it->second->nHeight;
+    // The database holds the coins up to the last flush, and pcoinsTip the
+    // changes since; both are only written under cs_main.
+    pcoinsSnapshot = std::make_shared<CCoinsViewSnapshot>(
+            std::unique_ptr<CCoinsView>(pcoinsSnapshotDB->Snapshot()),
+            *pcoinsTip->GetTrackedCoins(), hashBlock, nHeight);
+    fCoinsSnapshotSinceFlush = true;
+    LogPrint(Log::COINDB, "Took coins snapshot at height %d with %u modified coins in %.2fms\n",
+             nHeight, pcoinsSnapshot->GetOverlaySize(), (GetTimeMicros() - nStart) * 0.001);
+    return pcoinsSnapshot;
+}
+
+std::shared_ptr<CCoinsViewSnapshot> GetCoinsSnapshot()
+{
+    LOCK(cs_main);
+    return TakeCoinsSnapshot(true);
+}
+
+std::shared_ptr<CCoinsViewSnapshot> GetCoinsSnapshotIfCheap()
+{
+    LOCK(cs_main);
+    return TakeCoinsSnapshot(false);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // mapOrphanTransactions
@@ -714,6 +798,18 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
     return nEvicted;
 }
 
+size_t OrphanTxDynamicMemoryUsage()
+{
+    AssertLockHeld(cs_main);
+    size_t usage = memusage::DynamicUsage(mapOrphanTransactions)
+        + memusage::DynamicUsage(mapOrphanTransactionsByPrev);
+    for (auto& o : mapOrphanTransactions)
+        usage += RecursiveDynamicUsage(o.second.tx);
+    for (auto& p : mapOrphanTransactionsByPrev)
+        usage += memusage::DynamicUsage(p.second);
+    return usage;
+}
+
 bool CheckFinalTx(const CTransaction &tx, int flags)
 {
     AssertLockHeld(cs_main);
@@ -1069,8 +1165,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS | forkVerifyFlags,
-	                    true, txdata))
+        if (!CheckMempoolInputs(tx, state, view, STANDARD_SCRIPT_VERIFY_FLAGS | forkVerifyFlags, txdata))
         {
             return error("AcceptToMemoryPool: ConnectInputs failed %s", hash.ToString());
         }
@@ -1084,8 +1179,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS | forkVerifyFlags,
-	                    true, txdata))
+        if (!CheckMempoolInputs(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS | forkVerifyFlags, txdata))
         {
             return error("AcceptToMemoryPool: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
@@ -1557,7 +1651,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+template <typename BlockUndo>
+bool UndoWriteToDisk(const BlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
@@ -1584,7 +1679,10 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+// Either format is read with a CHashVerifier, as the checksum is over the
+// bytes on disk.
+template <typename BlockUndo>
+bool UndoReadFromDiskImpl(BlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
     CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
@@ -1610,6 +1708,20 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+} // anon namespace
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+{
+    return UndoReadFromDiskImpl(blockundo, pos, hashBlock);
+}
+
+bool UndoReadFromDisk(CColumnarBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+{
+    return UndoReadFromDiskImpl(blockundo, pos, hashBlock);
+}
+
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1767,6 +1879,36 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/**
+ * CheckInputs for a transaction entering the mempool. The scripts of large
+ * transactions are verified on the script check threads, so a transaction
+ * spending thousands of inputs does not stall message processing for long.
+ * The queue is free for it, as blocks are also only connected under cs_main.
+ */
+static bool CheckMempoolInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view,
+                               unsigned int flags, PrecomputedTransactionData& txdata)
+{
+    AssertLockHeld(cs_main);
+    if (!Opt().ScriptCheckThreads() || nParallelMempoolInputs == 0 || tx.vin.size() < nParallelMempoolInputs)
+        return CheckInputs(tx, state, view, true, flags, true, txdata);
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, view, true, flags, true, txdata, &vChecks))
+        return false;
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    if (control.Wait())
+        return true;
+
+    // Verify again serially to find the failing input and reject the
+    // transaction for the same reason as otherwise. The scripts that passed
+    // are in the signature cache by now.
+    LogPrint(Log::MEMPOOL, "%s: script check failed for %s, verifying serially\n", __func__, tx.GetHash().ToString());
+    if (CheckInputs(tx, state, view, true, flags, true, txdata))
+        return state.DoS(100, false, REJECT_INVALID, "script-verify-failed");
+    return false;
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -1891,6 +2033,21 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+template <typename BlockUndo>
+static bool WriteBlockUndo(const BlockUndo& blockundo, CValidationState& state, CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    CDiskBlockPos pos;
+    if (!FindUndoPos(state, pindex->nFile, pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+        return error("ConnectBlock(): FindUndoPos failed");
+    if (!UndoWriteToDisk(blockundo, pos, pindex->pprev->GetBlockHash(), chainparams.DBMagic()))
+        return AbortNode(state, "Failed to write undo data");
+
+    // update nUndoPos in block index
+    pindex->nUndoPos = pos.nPos;
+    pindex->nStatus |= BLOCK_HAVE_UNDO;
+    return true;
+}
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
     const CChainParams& chainparams = Params();
@@ -2116,15 +2273,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
     {
         if (pindex->GetUndoPos().IsNull()) {
-            CDiskBlockPos pos;
-            if (!FindUndoPos(state, pindex->nFile, pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
-                return error("ConnectBlock(): FindUndoPos failed");
-            if (!UndoWriteToDisk(blockundo, pos, pindex->pprev->GetBlockHash(), chainparams.DBMagic()))
-                return AbortNode(state, "Failed to write undo data");
-
-            // update nUndoPos in block index
-            pindex->nUndoPos = pos.nPos;
-            pindex->nStatus |= BLOCK_HAVE_UNDO;
+            bool fWritten = fColumnarUndo
+                ? WriteBlockUndo(CColumnarBlockUndo(blockundo), state, pindex, chainparams)
+                : WriteBlockUndo(blockundo, state, pindex, chainparams);
+            if (!fWritten)
+                return false;
         }
 
         pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
@@ -2159,30 +2312,25 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+static void SchedulePruning();
+static void SelectFilesToPrune(const std::vector<CBlockFileInfo>& vinfo, int nLastFile,
+                               int nLastBlockWeCanPrune, uint64_t nTarget, std::set<int>& setFilesToPrune);
+static void PruneBlockFiles(const std::set<int>& setFilesToPrune, std::vector<const CBlockIndex*>& vBlocks);
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
- * if they're too large, if it's been a while since the last write,
- * or always and in all cases if we're in prune mode and are deleting files.
+ * if they're too large, or if it's been a while since the last write.
+ * Pruning is handed over to the pruning service (see RunPrunePass).
  */
 bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK2(cs_main, cs_LastBlockFile);
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
     static int64_t nLastSetChain = 0;
-    std::set<int> setFilesToPrune;
-    bool fFlushForPrune = false;
     try {
-    if (fPruneMode && fCheckForPruning) {
-        FindFilesToPrune(setFilesToPrune);
-        fCheckForPruning = false;
-        if (!setFilesToPrune.empty()) {
-            fFlushForPrune = true;
-            if (!fHavePruned) {
-                pblocktree->WriteFlag("prunedblockfiles", true);
-                fHavePruned = true;
-            }
-        }
+    if (fPruneMode && fCheckForPruning && pPruneScheduler) {
+        SchedulePruning();
     }
     int64_t nNow = GetTimeMicros();
     // Avoid writing/flushing immediately after startup.
@@ -2205,7 +2353,7 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
     // Combine all conditions that result in a full cache flush.
-    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush;
     // Write blocks and block index to disk.
     if (fDoFullFlush || fPeriodicWrite) {
         // Depend on nMinDiskSpace to ensure we can write block index
@@ -2231,9 +2379,6 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 return AbortNode(state, "Files to write to block index database");
             }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
-            UnlinkPrunedFiles(setFilesToPrune);
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2248,6 +2393,11 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        // Stop tracking the modified coins for snapshots if none were
+        // taken since the previous flush.
+        if (!fCoinsSnapshotSinceFlush)
+            pcoinsTip->TrackModifiedCoins(false);
+        fCoinsSnapshotSinceFlush = false;
         nLastFlush = nNow;
     }
     if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
@@ -2266,16 +2416,186 @@ void FlushStateToDisk() {
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+// Highest block a pruning pass may remove, or -1 if none. Requires cs_main.
+static int LastBlockWeCanPrune(int nPruneToHeight)
+{
+    AssertLockHeld(cs_main);
+    if (chainActive.Tip() == NULL || chainActive.Tip()->nHeight <= Params().PruneAfterHeight())
+        return -1;
+    int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - nPruneKeepBlocks;
+    if (nPruneToHeight > 0)
+        nLastBlockWeCanPrune = std::min(nLastBlockWeCanPrune, nPruneToHeight);
+    return std::max(nLastBlockWeCanPrune, -1);
+}
+
+/**
+ * Prune block files up to nPruneToHeight and/or down to nTarget bytes.
+ *
+ * Files are selected from a copy of the block file info without holding
+ * any locks. cs_main is only held to mark the selected files pruned in the
+ * block index and to write those entries, which is proportional to the
+ * files pruned rather than to the size of the caches. The chainstate is not
+ * flushed: files holding blocks the chainstate on disk may still need to
+ * replay after a crash are left alone, unless they are all that keeps the
+ * pass from reaching its goal.
+ */
+static bool RunPrunePass(CValidationState& state, int nPruneToHeight, uint64_t nTarget)
+{
+    LOCK(cs_prunePass);
+    if (nTarget == 0 && nPruneToHeight <= 0)
+        return true;
+
+    std::vector<CBlockFileInfo> vinfo;
+    int nLastFile;
+    int nLastBlockWeCanPrune;
+    int nFlushedHeight = -1;
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        fCheckForPruning = false;
+        nLastBlockWeCanPrune = LastBlockWeCanPrune(nPruneToHeight);
+        if (nLastBlockWeCanPrune < 0)
+            return true;
+        const uint256 hashFlushed = pcoinsSnapshotDB ? pcoinsSnapshotDB->GetBestBlock() : uint256();
+        BlockMap::const_iterator it = mapBlockIndex.find(hashFlushed);
+        if (it != mapBlockIndex.end()) {
+            const CBlockIndex* pindexFork = chainActive.FindFork(it->second);
+            if (pindexFork)
+                nFlushedHeight = pindexFork->nHeight;
+        }
+        vinfo = vinfoBlockFile;
+        nLastFile = nLastBlockFile;
+    }
+
+    std::set<int> setFilesToPrune;
+    SelectFilesToPrune(vinfo, nLastFile, std::min(nLastBlockWeCanPrune, nFlushedHeight), nTarget, setFilesToPrune);
+    if (nFlushedHeight < nLastBlockWeCanPrune) {
+        std::set<int> setUnflushed;
+        SelectFilesToPrune(vinfo, nLastFile, nLastBlockWeCanPrune, nTarget, setUnflushed);
+        if (setUnflushed != setFilesToPrune) {
+            LogPrint(Log::PRUNE, "Prune: flushing chainstate at height %d to prune up to height %d\n",
+                     nFlushedHeight, nLastBlockWeCanPrune);
+            if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+                return false;
+            setFilesToPrune.swap(setUnflushed);
+        }
+    }
+    if (setFilesToPrune.empty())
+        return true;
+
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        // Undo data may have been added to a selected file since the copy
+        // was taken, if the chain reorganized deep enough to need it.
+        const int nLastBlockNow = LastBlockWeCanPrune(nPruneToHeight);
+        for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ) {
+            if (vinfoBlockFile[*it].nSize == 0 || vinfoBlockFile[*it].nHeightLast > (unsigned int)nLastBlockNow)
+                setFilesToPrune.erase(it++);
+            else
+                ++it;
+        }
+        if (setFilesToPrune.empty())
+            return true;
+
+        std::vector<const CBlockIndex*> vBlocks;
+        PruneBlockFiles(setFilesToPrune, vBlocks);
+        std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+        for (int nFile : setFilesToPrune) {
+            vFiles.push_back(std::make_pair(nFile, &vinfoBlockFile[nFile]));
+            setDirtyFileInfo.erase(nFile);
+        }
+        try {
+            if (!fHavePruned) {
+                pblocktree->WriteFlag("prunedblockfiles", true);
+                fHavePruned = true;
+            }
+            // The block index on disk must stop referring to the files
+            // before they are deleted.
+            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks))
+                return AbortNode(state, "Failed to write pruned files to block index database");
+        } catch (const std::runtime_error& e) {
+            return AbortNode(state, std::string("System error while pruning: ") + e.what());
+        }
+    }
+
+    UnlinkPrunedFiles(setFilesToPrune);
+    return true;
+}
+
 void PruneAndFlush() {
+    {
+        LOCK(cs_main);
+        fCheckForPruning = true;
+        if (pPruneScheduler) {
+            SchedulePruning();
+            return;
+        }
+    }
+    CValidationState state;
+    RunPrunePass(state, 0, nPruneTarget);
+}
+
+bool PruneBlockFilesTo(int nHeight, uint64_t nTarget, std::string& strError)
+{
+    if (!fPruneMode) {
+        strError = "Cannot prune blocks because node is not in prune mode.";
+        return false;
+    }
+    if (nHeight <= 0 && nTarget == 0) {
+        strError = "Either a height or a target size is required.";
+        return false;
+    }
     CValidationState state;
-    fCheckForPruning = true;
-    FlushStateToDisk(state, FLUSH_STATE_NONE);
+    if (!RunPrunePass(state, nHeight, nTarget)) {
+        strError = state.GetRejectReason();
+        return false;
+    }
+    return true;
+}
+
+static void PruneInBackground()
+{
+    {
+        LOCK(cs_main);
+        fPruneScheduled = false;
+        if (!fCheckForPruning)
+            return;
+    }
+    CValidationState state;
+    RunPrunePass(state, 0, nPruneTarget);
+}
+
+// Queue a pruning pass on the service. Requires cs_main.
+static void SchedulePruning()
+{
+    AssertLockHeld(cs_main);
+    if (fPruneScheduled)
+        return;
+    fPruneScheduled = true;
+    pPruneScheduler->scheduleFromNow(&PruneInBackground, 0, "prune", pruneStrand);
+}
+
+void StartBlockPruning(CScheduler& scheduler)
+{
+    LOCK(cs_main);
+    pPruneScheduler = &scheduler;
+    pruneStrand = scheduler.newStrand();
+    if (fCheckForPruning)
+        SchedulePruning();
+}
+
+void StopBlockPruning()
+{
+    LOCK(cs_main);
+    pPruneScheduler = nullptr;
+    fPruneScheduled = false;
 }
 
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
     chainActive.SetTip(pindexNew);
+    // Queries still using the snapshot of the old tip keep it.
+    pcoinsSnapshot.reset();
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -2330,8 +2650,13 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     }
 }
 
-/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
-bool static DisconnectTip(CValidationState &state) {
+/**
+ * Disconnect chainActive's tip into view, which the caller writes to
+ * pcoinsTip. The block's transactions are held in disconnectpool, to be
+ * added back to the mempool with UpdateMempoolForReorg once the new chain
+ * is connected.
+ */
+bool static DisconnectTip(CValidationState &state, CCoinsViewCache& view, DisconnectedBlockTransactions& disconnectpool) {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
     // Read block from disk.
@@ -2341,23 +2666,74 @@ bool static DisconnectTip(CValidationState &state) {
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
-        CCoinsViewCache view(pcoinsTip);
-        assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        CCoinsViewCache blockView(&view);
+        assert(blockView.GetBestBlock() == pindexDelete->GetBlockHash());
+        if (DisconnectBlock(block, pindexDelete, blockView) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
-        assert(view.Flush());
+        assert(blockView.Flush());
     }
     LogPrint(Log::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+
+    // Update chainActive and related variables.
+    UpdateTip(pindexDelete->pprev);
+    // Let wallets know transactions went from 1-confirmed to
+    // 0-confirmed or conflicted:
+    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+        SyncWithWallets(tx, NULL, false);
+    }
+
+    disconnectpool.AddBlock(block.vtx);
+    while (disconnectpool.DynamicMemoryUsage() > MAX_DISCONNECTED_TX_POOL_SIZE * 1000) {
+        // Give up on the transactions of the newest block, and on their
+        // children in the mempool.
+        for (const CTransaction& tx : disconnectpool.RemoveNewestBlock()) {
+            list<CTransaction> removed;
+            mempool.removeRecursive(tx, removed);
+        }
+    }
+    return true;
+}
+
+/**
+ * Disconnect chainActive's tip until pindexFork is the tip. The blocks are
+ * disconnected into one coins cache layer, which is written to pcoinsTip
+ * once, or when it would take pcoinsTip over its limit.
+ */
+static bool DisconnectTo(CValidationState& state, const CBlockIndex* pindexFork, DisconnectedBlockTransactions& disconnectpool)
+{
+    CCoinsViewCache view(pcoinsTip);
+    while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
+        bool fDisconnected = DisconnectTip(state, view, disconnectpool);
+        if (fDisconnected && view.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage() <= nCoinCacheUsage)
+            continue;
+        // The layer holds the blocks disconnected so far, even if the last
+        // one failed, matching chainActive.
+        assert(view.Flush());
+        if (!fDisconnected || !FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
+            return false;
+    }
+    assert(view.Flush());
     // Write the chain state to disk, if necessary.
-    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
-        return false;
-    // Resurrect mempool transactions from the disconnected block.
+    return FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED);
+}
+
+/**
+ * Add the transactions of disconnected blocks back to the mempool, parents
+ * first, and update the mempool once for the whole reorg. If
+ * fAddToMempool is false, their descendants in the mempool are removed
+ * instead.
+ */
+static void UpdateMempoolForReorg(DisconnectedBlockTransactions& disconnectpool, bool fAddToMempool)
+{
+    AssertLockHeld(cs_main);
+    int64_t nStart = GetTimeMicros();
     std::vector<uint256> vHashUpdate;
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+    const std::vector<CTransaction> vtx = disconnectpool.TakeTransactions();
+    for (const CTransaction& tx : vtx) {
         // ignore validation errors in resurrected transactions
         list<CTransaction> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, nullptr, true)) {
+        if (!fAddToMempool || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, nullptr, true)) {
             mempool.removeRecursive(tx, removed);
         } else if (mempool.exists(tx.GetHash())) {
             vHashUpdate.push_back(tx.GetHash());
@@ -2366,18 +2742,16 @@ bool static DisconnectTip(CValidationState &state) {
     // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
     // no in-mempool children, which is generally not true when adding
     // previously-confirmed transactions back to the mempool.
-    // UpdateTransactionsFromBlock finds descendants of any transactions in this
-    // block that were added back and cleans up the mempool state.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in
+    // the disconnected blocks that were added back and cleans up the
+    // mempool state.
     mempool.UpdateTransactionsFromBlock(vHashUpdate);
 
-    // Update chainActive and related variables.
-    UpdateTip(pindexDelete->pprev);
-    // Let wallets know transactions went from 1-confirmed to
-    // 0-confirmed or conflicted:
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        SyncWithWallets(tx, NULL, false);
-    }
-    return true;
+    // Remove transactions that are no longer final or that spend immature
+    // coinbases, and re-limit the mempool size.
+    mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
+    mempool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+    LogPrint(Log::BENCH, "- Mempool update for reorg: %u txs, %.2fms\n", vtx.size(), (GetTimeMicros() - nStart) * 0.001);
 }
 
 static int64_t nTimeReadFromDisk = 0;
@@ -2391,7 +2765,7 @@ static int64_t nTimePostConnect = 0;
  * corresponding to pindexNew, to bypass loading it again from disk.
  */
 bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew,
-        CBlock *pblock, const BlockSource& blockSource) {
+        CBlock *pblock, const BlockSource& blockSource, DisconnectedBlockTransactions& disconnectpool) {
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
@@ -2429,6 +2803,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew,
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
+    disconnectpool.RemoveForBlock(pblock->vtx);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
     // Tell wallet about transactions that went from mempool
@@ -2526,12 +2901,14 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     const CBlockIndex *pindexOldTip = chainActive.Tip();
     const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
 
-    // Disconnect active blocks which are no longer in the best chain.
-    bool fBlocksDisconnected = false;
-    while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state))
-            return false;
-        fBlocksDisconnected = true;
+    // Disconnect active blocks which are no longer in the best chain. Their
+    // transactions are added back to the mempool once the new blocks are
+    // connected, as most are in those too.
+    DisconnectedBlockTransactions disconnectpool;
+    bool fBlocksDisconnected = chainActive.Tip() && chainActive.Tip() != pindexFork;
+    if (fBlocksDisconnected && !DisconnectTo(state, pindexFork, disconnectpool)) {
+        UpdateMempoolForReorg(disconnectpool, false);
+        return false;
     }
 
     // Build list of new blocks to connect.
@@ -2554,7 +2931,7 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
         // Connect new blocks.
         BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
             CBlock* mostWork = pindexConnect == pindexMostWork ? pblock : nullptr;
-            if (!ConnectTip(state, pindexConnect, mostWork, blockSource)) {
+            if (!ConnectTip(state, pindexConnect, mostWork, blockSource, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2565,6 +2942,7 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
                     break;
                 } else {
                     // A system error occurred (disk space, database error, ...).
+                    UpdateMempoolForReorg(disconnectpool, false);
                     return false;
                 }
             } else {
@@ -2578,10 +2956,8 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
         }
     }
 
-    if (fBlocksDisconnected) {
-        mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
-        mempool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
-    }
+    if (fBlocksDisconnected)
+        UpdateMempoolForReorg(disconnectpool, true);
     mempool.check(pcoinsTip);
 
     // Callbacks/notifications for a new best chain.
@@ -2687,21 +3063,21 @@ bool InvalidateBlock(CValidationState& state, CBlockIndex *pindex) {
     setDirtyBlockIndex.insert(pindex);
     setBlockIndexCandidates.erase(pindex);
 
-    while (chainActive.Contains(pindex)) {
-        CBlockIndex *pindexWalk = chainActive.Tip();
-        pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
-        setDirtyBlockIndex.insert(pindexWalk);
-        setBlockIndexCandidates.erase(pindexWalk);
+    DisconnectedBlockTransactions disconnectpool;
+    if (chainActive.Contains(pindex)) {
+        for (CBlockIndex *pindexWalk = chainActive.Tip(); pindexWalk != pindex->pprev; pindexWalk = pindexWalk->pprev) {
+            pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
+            setDirtyBlockIndex.insert(pindexWalk);
+            setBlockIndexCandidates.erase(pindexWalk);
+        }
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
-        if (!DisconnectTip(state)) {
-            mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
+        if (!DisconnectTo(state, pindex->pprev, disconnectpool)) {
+            UpdateMempoolForReorg(disconnectpool, false);
             return false;
         }
     }
 
-    mempool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
-
     // The resulting new best tip may not be in setBlockIndexCandidates anymore, so
     // add it again.
     BlockMap::iterator it = mapBlockIndex.begin();
@@ -2713,7 +3089,7 @@ bool InvalidateBlock(CValidationState& state, CBlockIndex *pindex) {
     }
 
     InvalidChainFound(pindex);
-    mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
+    UpdateMempoolForReorg(disconnectpool, true);
     return true;
 }
 
@@ -2774,6 +3150,7 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
     }
+    pindexNew->BuildVersionCounts(Params().GetConsensus().nMajorityWindow);
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
@@ -2832,6 +3209,24 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     return true;
 }
 
+// With -fastprune, block files are kept tiny so tests can exercise pruning.
+static unsigned int BlockFileChunkSize()
+{
+    return GetBoolArg("-fastprune", false) ? 0x4000 : BLOCKFILE_CHUNK_SIZE;
+}
+
+static unsigned int UndoFileChunkSize()
+{
+    return GetBoolArg("-fastprune", false) ? 0x4000 : UNDOFILE_CHUNK_SIZE;
+}
+
+static uint64_t MaxBlockFileSize()
+{
+    if (GetBoolArg("-fastprune", false))
+        return 0x10000;
+    return GetNextMaxBlockSize(chainActive.Tip(), Params().GetConsensus()) * Params().MinBlockFileBlocks();
+}
+
 bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false)
 {
     LOCK(cs_LastBlockFile);
@@ -2842,8 +3237,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
     }
 
     if (!fKnown) {
-        while (vinfoBlockFile[nFile].nSize + nAddSize >=
-               GetNextMaxBlockSize(chainActive.Tip(), Params().GetConsensus()) * Params().MinBlockFileBlocks()) {
+        const uint64_t nMaxFileSize = MaxBlockFileSize();
+        while (vinfoBlockFile[nFile].nSize + nAddSize >= nMaxFileSize) {
             LogPrintf("Leaving block file %i: %s\n", nFile, vinfoBlockFile[nFile].ToString());
             FlushBlockFile(true);
             nFile++;
@@ -2863,16 +3258,17 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         vinfoBlockFile[nFile].nSize += nAddSize;
 
     if (!fKnown) {
-        unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
-        unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
+        const unsigned int nChunkSize = BlockFileChunkSize();
+        unsigned int nOldChunks = (pos.nPos + nChunkSize - 1) / nChunkSize;
+        unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + nChunkSize - 1) / nChunkSize;
         if (nNewChunks > nOldChunks) {
             if (fPruneMode)
                 fCheckForPruning = true;
-            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
+            if (CheckDiskSpace(nNewChunks * nChunkSize - pos.nPos)) {
                 FILE *file = OpenBlockFile(pos);
                 if (file) {
-                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
-                    AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
+                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * nChunkSize, pos.nFile);
+                    AllocateFileRange(file, pos.nPos, nNewChunks * nChunkSize - pos.nPos);
                     fclose(file);
                 }
             }
@@ -2896,16 +3292,17 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     nNewSize = vinfoBlockFile[nFile].nUndoSize += nAddSize;
     setDirtyFileInfo.insert(nFile);
 
-    unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
-    unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
+    const unsigned int nChunkSize = UndoFileChunkSize();
+    unsigned int nOldChunks = (pos.nPos + nChunkSize - 1) / nChunkSize;
+    unsigned int nNewChunks = (nNewSize + nChunkSize - 1) / nChunkSize;
     if (nNewChunks > nOldChunks) {
         if (fPruneMode)
             fCheckForPruning = true;
-        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
+        if (CheckDiskSpace(nNewChunks * nChunkSize - pos.nPos)) {
             FILE *file = OpenUndoFile(pos);
             if (file) {
-                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
-                AllocateFileRange(file, pos.nPos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
+                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * nChunkSize, pos.nFile);
+                AllocateFileRange(file, pos.nPos, nNewChunks * nChunkSize - pos.nPos);
                 fclose(file);
             }
         }
@@ -3237,14 +3634,11 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
 
 static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned nRequired, const Consensus::Params& consensusParams)
 {
-    unsigned int nFound = 0;
-    for (int i = 0; i < consensusParams.nMajorityWindow && nFound < nRequired && pstart != NULL; i++)
-    {
-        if (pstart->nVersion >= minVersion)
-            ++nFound;
-        pstart = pstart->pprev;
-    }
-    return (nFound >= nRequired);
+    if (pstart == NULL)
+        return nRequired == 0;
+    // O(1) when the index entry has its version counts built (see AddToBlockIndex)
+    const int nFound = pstart->CountVersionsAtLeast(minVersion, consensusParams.nMajorityWindow);
+    return (unsigned int)nFound >= nRequired;
 }
 
 
@@ -3315,18 +3709,21 @@ uint64_t CalculateCurrentUsage()
     return retval;
 }
 
-/* Prune a block file (modify associated database entries)*/
-void PruneOneBlockFile(const int fileNumber)
+/* Mark block files pruned in a single pass over the block index, returning the entries to write */
+static void PruneBlockFiles(const std::set<int>& setFilesToPrune, std::vector<const CBlockIndex*>& vBlocks)
 {
+    if (setFilesToPrune.empty())
+        return;
     for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
         CBlockIndex* pindex = it->second;
-        if (pindex->nFile == fileNumber) {
+        if ((pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)) && setFilesToPrune.count(pindex->nFile)) {
             pindex->nStatus &= ~BLOCK_HAVE_DATA;
             pindex->nStatus &= ~BLOCK_HAVE_UNDO;
             pindex->nFile = 0;
             pindex->nDataPos = 0;
             pindex->nUndoPos = 0;
-            setDirtyBlockIndex.insert(pindex);
+            setDirtyBlockIndex.erase(pindex);
+            vBlocks.push_back(pindex);
 
             // Prune from mapBlocksUnlinked -- any block we prune would have
             // to be downloaded again in order to consider its chain, at which
@@ -3343,8 +3740,9 @@ void PruneOneBlockFile(const int fileNumber)
         }
     }
 
-    vinfoBlockFile[fileNumber].SetNull();
-    setDirtyFileInfo.insert(fileNumber);
+    for (int fileNumber : setFilesToPrune) {
+        vinfoBlockFile[fileNumber].SetNull();
+    }
 }
 
 
@@ -3359,40 +3757,35 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 }
 
 /* Calculate the block/rev files that should be deleted to remain under target*/
-void FindFilesToPrune(std::set<int>& setFilesToPrune)
+static void SelectFilesToPrune(const std::vector<CBlockFileInfo>& vinfo, int nLastFile,
+                               int nLastBlockWeCanPrune, uint64_t nTarget, std::set<int>& setFilesToPrune)
 {
-    LOCK2(cs_main, cs_LastBlockFile);
-    if (chainActive.Tip() == NULL || nPruneTarget == 0) {
-        return;
-    }
-    if (chainActive.Tip()->nHeight <= Params().PruneAfterHeight()) {
+    if (nLastBlockWeCanPrune < 0)
         return;
-    }
-
-    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
-    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    uint64_t nCurrentUsage = 0;
+    for (const CBlockFileInfo& file : vinfo)
+        nCurrentUsage += file.nSize + file.nUndoSize;
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
     // before the next pruning.
-    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    uint64_t nBuffer = BlockFileChunkSize() + UndoFileChunkSize();
     uint64_t nBytesToPrune;
     int count=0;
 
-    if (nCurrentUsage + nBuffer >= nPruneTarget) {
-        for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
-            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+    if (nCurrentUsage + nBuffer >= nTarget) {
+        for (int fileNumber = 0; fileNumber < nLastFile; fileNumber++) {
+            nBytesToPrune = vinfo[fileNumber].nSize + vinfo[fileNumber].nUndoSize;
 
-            if (vinfoBlockFile[fileNumber].nSize == 0)
+            if (vinfo[fileNumber].nSize == 0)
                 continue;
 
-            if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
+            if (nCurrentUsage + nBuffer < nTarget)  // are we below our target?
                 break;
 
-            // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip but keep scanning
-            if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+            // don't prune files that could have a block within nPruneKeepBlocks of the main chain's tip but keep scanning
+            if (vinfo[fileNumber].nHeightLast > (unsigned int)nLastBlockWeCanPrune)
                 continue;
 
-            PruneOneBlockFile(fileNumber);
             // Queue up the files for removal
             setFilesToPrune.insert(fileNumber);
             nCurrentUsage -= nBytesToPrune;
@@ -3401,8 +3794,8 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune)
     }
 
     LogPrint(Log::PRUNE, "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
-           nPruneTarget/1024/1024, nCurrentUsage/1024/1024,
-           ((int64_t)nPruneTarget - (int64_t)nCurrentUsage)/1024/1024,
+           nTarget/1024/1024, nCurrentUsage/1024/1024,
+           ((int64_t)nTarget - (int64_t)nCurrentUsage)/1024/1024,
            nLastBlockWeCanPrune, count);
 }
 
@@ -3473,6 +3866,14 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+size_t BlockIndexDynamicMemoryUsage()
+{
+    AssertLockHeld(cs_main);
+    return memusage::DynamicUsage(mapBlockIndex)
+        + mapBlockIndex.size() * memusage::MallocUsage(sizeof(CBlockIndex))
+        + memusage::DynamicUsage(setBlockIndexCandidates);
+}
+
 bool static LoadBlockIndexDB(bool* fRebuildRequired)
 {
     const CChainParams& chainparams = Params();
@@ -3516,6 +3917,7 @@ bool static LoadBlockIndexDB(bool* fRebuildRequired)
             pindexBestInvalid = pindex;
         if (pindex->pprev)
             pindex->BuildSkip();
+        pindex->BuildVersionCounts(chainparams.GetConsensus().nMajorityWindow);
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
         if (!pindex->pprev ||
@@ -4341,18 +4743,40 @@ void static ProcessGetData(CNode* pfrom, CConnman* connman, std::atomic<bool>& i
         {
             if (interruptMsgProc)
                 return;
-            it++;
 
-            BlockSender blockSender;
+            BlockSender blockSender(&g_recentblocks);
+            CBlockIndex* pindexSend = nullptr;
             if (blockSender.isBlockType(inv.type))
             {
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 bool haveBlock = mi != mapBlockIndex.end();
                 bool canSend = haveBlock && blockSender.canSend(
                         chainActive, *(mi->second), pindexBestHeader);
-
                 if (canSend)
-                    blockSender.send(chainActive, *connman, *pfrom, *(mi->second), inv);
+                    pindexSend = mi->second;
+
+                // Historical blocks are read from disk and sent by the
+                // getdata workers.
+                if (canSend && g_getdataworkers
+                    && chainActive.Height() - pindexSend->nHeight >= MIN_ASYNC_GETDATA_DEPTH)
+                {
+                    if (!g_getdataworkers->Queue(*pfrom, inv, pindexSend))
+                        break;
+                    it++;
+                    GetMainSignals().Inventory(inv.hash);
+                    continue;
+                }
+            }
+
+            // Anything else is answered after the blocks queued before it.
+            if (g_getdataworkers && g_getdataworkers->HasPending(pfrom->id))
+                break;
+            it++;
+
+            if (blockSender.isBlockType(inv.type))
+            {
+                if (pindexSend)
+                    blockSender.send(chainActive, *connman, *pfrom, *pindexSend, inv);
             }
             else if (inv.IsKnownType())
             {
@@ -4403,10 +4827,48 @@ void static ProcessGetData(CNode* pfrom, CConnman* connman, std::atomic<bool>& i
     }
 }
 
-static std::tuple<std::vector<uint8_t>, std::vector<bip64::CCoin> > ProcessGetUTXOs(
+/**
+ * Validate a BIP157 request and look up its stop block. Returns nullptr,
+ * disconnecting the peer if the request is invalid, if it cannot be served.
+ */
+static const CBlockIndex* PrepareBlockFilterRequest(CNode* pfrom, uint8_t nFilterType,
+                                                    uint32_t nStartHeight, const uint256& stopHash,
+                                                    uint32_t nMaxCount)
+{
+    if (!g_blockfilterindex || !(pfrom->GetLocalServices() & NODE_COMPACT_FILTERS)
+        || nFilterType != g_blockfilterindex->GetFilterType())
+    {
+        LogPrint(Log::NET, "peer %d requested unsupported block filter type %d\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return nullptr;
+    }
+
+    const CBlockIndex* pindexStop;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(stopHash);
+        if (it == mapBlockIndex.end() || !chainActive.Contains(it->second)) {
+            LogPrint(Log::NET, "peer %d requested block filters for unknown or stale block %s\n",
+                     pfrom->id, stopHash.ToString());
+            pfrom->fDisconnect = true;
+            return nullptr;
+        }
+        pindexStop = it->second;
+    }
+
+    const uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight || nStopHeight - nStartHeight >= nMaxCount) {
+        LogPrint(Log::NET, "peer %d sent invalid block filter range start=%d stop=%d\n",
+                 pfrom->id, nStartHeight, nStopHeight);
+        pfrom->fDisconnect = true;
+        return nullptr;
+    }
+    return pindexStop;
+}
+
+static std::unique_ptr<bip64::UTXORetriever> ProcessGetUTXOs(
         const vector<COutPoint> &vOutPoints, bool fCheckMemPool, size_t maxBytes)
 {
-    AssertLockHeld(cs_main);
     // Defined by BIP 64.
     //
     // Allows a peer to retrieve the CTxOut structures corresponding to the given COutPoints.
@@ -4430,15 +4892,9 @@ static std::tuple<std::vector<uint8_t>, std::vector<bip64::CCoin> > ProcessGetUT
 
     LogPrint(Log::NET, "getutxos for %d queries %s mempool\n", vOutPoints.size(), fCheckMemPool ? "with" : "without");
 
-    std::unique_ptr<bip64::UTXORetriever> utxos;
-    if (fCheckMemPool) {
-        LOCK(mempool.cs);
-        utxos.reset(new bip64::UTXORetriever(vOutPoints, *pcoinsTip, &mempool, maxBytes));
-    }
-    else {
-        utxos.reset(new bip64::UTXORetriever(vOutPoints, *pcoinsTip, nullptr, maxBytes));
-    }
-    return std::make_tuple(utxos->GetBitmap(), utxos->GetResults());
+    // Takes cs_main only briefly, coins are read from disk without it.
+    return std::unique_ptr<bip64::UTXORetriever>(new bip64::UTXORetriever(
+                vOutPoints, fCheckMemPool ? &mempool : nullptr, maxBytes));
 }
 
 
@@ -4833,8 +5289,10 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             bool fAlreadyHave = AlreadyHave(inv);
             LogPrint(Log::NET, "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom->id);
 
-            if (!fAlreadyHave && !fImporting && !fReindex && inv.type != MSG_BLOCK && !IsInitialBlockDownload())
-                pfrom->AskFor(inv);
+            if (!fAlreadyHave && !fImporting && !fReindex && inv.type == MSG_TX && !IsInitialBlockDownload()) {
+                const bool fPreferred = !pfrom->fInbound || pfrom->fWhitelisted;
+                g_txrequest.ReceivedInv(pfrom->GetId(), inv.hash, fPreferred, GetTimeMicros());
+            }
 
             if (inv.type == MSG_BLOCK) {
                 BlockAnnounceReceiver ann(inv.hash, *connman, *pfrom, thinblockmg, blocksInFlight);
@@ -4867,7 +5325,7 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         LOCK(cs_main);
         auto mi = mapBlockIndex.find(req.blockhash);
         bool haveBlock = mi != mapBlockIndex.end();
-        BlockSender bs;
+        BlockSender bs(&g_recentblocks);
         bool canSend = haveBlock && bs.canSend(
                 chainActive, *(mi->second), pindexBestHeader);
 
@@ -4934,7 +5392,7 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
             // If pruning, don't inv blocks unless we have on disk and are likely to still have
             // for some reasonable time window (1 hour) that block relay might require.
-            const int nPrunedBlocksLikelyToHave = MIN_BLOCKS_TO_KEEP - 3600 / Params().GetConsensus().nPowTargetSpacing;
+            const int nPrunedBlocksLikelyToHave = nPruneKeepBlocks - 3600 / Params().GetConsensus().nPowTargetSpacing;
             if (fPruneMode && (!(pindex->nStatus & BLOCK_HAVE_DATA) || pindex->nHeight <= chainActive.Tip()->nHeight - nPrunedBlocksLikelyToHave))
             {
                 LogPrint(Log::NET, " getblocks stopping, pruned or too old block at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -5007,15 +5465,10 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         try {
             size_t maxBytes = connman->GetSendBufferSize();
-            std::vector<unsigned char> bitmap;
-            std::vector<bip64::CCoin> outs;
-            {
-                LOCK(cs_main);
-                tie(bitmap, outs) = ProcessGetUTXOs(vOutPoints, fCheckMemPool, maxBytes);
-            }
+            std::unique_ptr<bip64::UTXORetriever> utxos = ProcessGetUTXOs(vOutPoints, fCheckMemPool, maxBytes);
             connman->PushMessage(pfrom, NetMsg(pfrom, NetMsgType::UTXOS,
-                                               static_cast<uint32_t>(chainActive.Height()),
-                                               chainActive.Tip()->GetBlockHash(), bitmap, outs));
+                                               static_cast<uint32_t>(utxos->GetTipHeight()),
+                                               utxos->GetTipHash(), utxos->GetBitmap(), utxos->GetResults()));
         }
         catch (const std::exception& e) {
             connman->PushMessage(pfrom, NetMsg(pfrom, NetMsgType::REJECT, strCommand, REJECT_INVALID,
@@ -5025,6 +5478,78 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CValidationState state;
         FlushStateToDisk(state, FLUSH_STATE_PERIODIC);
     }
+    else if (strCommand == NetMsgType::GETCFILTERS)
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 stopHash;
+        vRecv >> nFilterType >> nStartHeight >> stopHash;
+
+        const CBlockIndex* pindexStop = PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight,
+                                                                  stopHash, MAX_GETCFILTERS_SIZE);
+        if (!pindexStop)
+            return true;
+
+        std::vector<BlockFilter> filters;
+        if (!g_blockfilterindex->LookupFilterRange(nStartHeight, pindexStop, filters)) {
+            LogPrint(Log::NET, "block filters up to %s not indexed yet, peer=%d\n", stopHash.ToString(), pfrom->id);
+            return true;
+        }
+        for (const BlockFilter& filter : filters)
+            connman->PushMessage(pfrom, NetMsg(pfrom, NetMsgType::CFILTER, filter));
+    }
+    else if (strCommand == NetMsgType::GETCFHEADERS)
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 stopHash;
+        vRecv >> nFilterType >> nStartHeight >> stopHash;
+
+        const CBlockIndex* pindexStop = PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight,
+                                                                  stopHash, MAX_GETCFHEADERS_SIZE);
+        if (!pindexStop)
+            return true;
+
+        uint256 prevHeader;
+        if (nStartHeight > 0) {
+            const CBlockIndex* pindexPrev = pindexStop->GetAncestor(nStartHeight - 1);
+            if (!g_blockfilterindex->LookupFilterHeader(pindexPrev, prevHeader)) {
+                LogPrint(Log::NET, "block filter header for %s not indexed yet, peer=%d\n",
+                         pindexPrev->GetBlockHash().ToString(), pfrom->id);
+                return true;
+            }
+        }
+        std::vector<uint256> filterHashes;
+        if (!g_blockfilterindex->LookupFilterHashRange(nStartHeight, pindexStop, filterHashes)) {
+            LogPrint(Log::NET, "block filters up to %s not indexed yet, peer=%d\n", stopHash.ToString(), pfrom->id);
+            return true;
+        }
+        connman->PushMessage(pfrom, NetMsg(pfrom, NetMsgType::CFHEADERS, nFilterType,
+                                           pindexStop->GetBlockHash(), prevHeader, filterHashes));
+    }
+    else if (strCommand == NetMsgType::GETCFCHECKPT)
+    {
+        uint8_t nFilterType;
+        uint256 stopHash;
+        vRecv >> nFilterType >> stopHash;
+
+        const CBlockIndex* pindexStop = PrepareBlockFilterRequest(pfrom, nFilterType, 0, stopHash,
+                                                                  std::numeric_limits<uint32_t>::max());
+        if (!pindexStop)
+            return true;
+
+        std::vector<uint256> headers(pindexStop->nHeight / CFCHECKPT_INTERVAL);
+        for (size_t i = 0; i < headers.size(); ++i) {
+            const CBlockIndex* pindex = pindexStop->GetAncestor((i + 1) * CFCHECKPT_INTERVAL);
+            if (!g_blockfilterindex->LookupFilterHeader(pindex, headers[i])) {
+                LogPrint(Log::NET, "block filter header for %s not indexed yet, peer=%d\n",
+                         pindex->GetBlockHash().ToString(), pfrom->id);
+                return true;
+            }
+        }
+        connman->PushMessage(pfrom, NetMsg(pfrom, NetMsgType::CFCHECKPT, nFilterType,
+                                           pindexStop->GetBlockHash(), headers));
+    }
     else if (strCommand == NetMsgType::TX)
     {
         vector<uint256> vWorkQueue;
@@ -5042,7 +5567,8 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         bool fMissingInputs = false;
         CValidationState state;
 
-        mapAlreadyAskedFor.erase(inv);
+        // Whatever comes of it, there is no need to fetch it again.
+        g_txrequest.ForgetTxHash(inv.hash);
 
         if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, connman))
         {
@@ -5297,7 +5823,7 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         BlockMap::iterator mi = mapBlockIndex.find(req.block);
         bool haveBlock = mi != mapBlockIndex.end();
         LOCK(cs_main);
-        BlockSender bs;
+        BlockSender bs(&g_recentblocks);
         bool canSend = haveBlock && bs.canSend(
                 chainActive, *(mi->second), pindexBestHeader);
 
@@ -5530,6 +6056,20 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == NetMsgType::NOTFOUND)
+    {
+        vector<CInv> vInv;
+        vRecv >> vInv;
+        if (vInv.size() <= MAX_INV_SZ) {
+            // Ask another peer for the transactions this one doesn't have.
+            LOCK(cs_main);
+            for (const CInv& inv : vInv)
+                if (inv.type == MSG_TX)
+                    g_txrequest.ReceivedResponse(pfrom->GetId(), inv.hash);
+        }
+    }
+
+
     else if (strCommand == "reject")
     {
         if (LogAcceptCategory(Log::NET)) {
@@ -5578,14 +6118,23 @@ bool ProcessMessages(CNode* pfrom, CConnman* connman, std::atomic<bool>& interru
     //
     bool fMoreWork = true;
 
-    if (!pfrom->vRecvGetData.empty())
+    // The requests of a peer that used up its budget wait for it to refill,
+    // with everything behind them but what we asked it for, such as blocks.
+    const bool fOverBudget = !pfrom->fWhitelisted && pfrom->requestCost.IsOverBudget();
+
+    if (!fOverBudget && !pfrom->vRecvGetData.empty()) {
+        const int64_t nCPUStart = GetThreadCPUTimeMicros();
         ProcessGetData(pfrom, connman, interruptMsgProc);
+        pfrom->requestCost.AddCPUTime(GetThreadCPUTimeMicros() - nCPUStart);
+    }
 
     if (pfrom->fDisconnect)
         return false;
 
     // this maintains the order of responses
-    if (!pfrom->vRecvGetData.empty()) return true;
+    if (g_getdataworkers && g_getdataworkers->HasPending(pfrom->id))
+        return false; // woken up by the workers
+    if (!fOverBudget && !pfrom->vRecvGetData.empty()) return true;
 
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->fPauseSend)
@@ -5596,8 +6145,14 @@ bool ProcessMessages(CNode* pfrom, CConnman* connman, std::atomic<bool>& interru
             LOCK(pfrom->cs_vProcessMsg);
             if (pfrom->vProcessMsg.empty())
                 return false;
+            std::list<CNetMessage>::iterator next = pfrom->vProcessMsg.begin();
+            if (fOverBudget) {
+                next = NextUnmeteredMessage(pfrom->vProcessMsg, !pfrom->vRecvGetData.empty());
+                if (next == pfrom->vProcessMsg.end())
+                    return false;
+            }
             // Just take one message
-            msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
+            msgs.splice(msgs.begin(), pfrom->vProcessMsg, next);
             pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
             pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman->GetReceiveFloodSize();
         }
@@ -5638,6 +6193,8 @@ bool ProcessMessages(CNode* pfrom, CConnman* connman, std::atomic<bool>& interru
 
         // Process message
         bool fRet = false;
+        const bool fRequest = IsRequestCommand(strCommand);
+        const int64_t nCPUStart = fRequest ? GetThreadCPUTimeMicros() : 0;
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, connman, interruptMsgProc);
@@ -5674,6 +6231,8 @@ bool ProcessMessages(CNode* pfrom, CConnman* connman, std::atomic<bool>& interru
         } catch (...) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
+        if (fRequest)
+            pfrom->requestCost.AddCPUTime(GetThreadCPUTimeMicros() - nCPUStart);
 
         if (!fRet)
             LogPrint(Log::NET, "%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
@@ -5856,7 +6415,7 @@ bool SendMessages(CNode* pto, CConnman* connman, std::atomic<bool>& interruptMsg
         // Message: inventory
         //
         vector<CInv> vInv;
-        vector<CInv> vInvWait;
+        vector<uint256> vTxTrickle;
         {
             bool fSendTrickle = pto->fWhitelisted;
             if (pto->nNextInvSend < nNow) {
@@ -5865,30 +6424,11 @@ bool SendMessages(CNode* pto, CConnman* connman, std::atomic<bool>& interruptMsg
             }
             LOCK(pto->cs_inventory);
             vInv.reserve(std::min<size_t>(1000, pto->vInventoryToSend.size()));
-            vInvWait.reserve(pto->vInventoryToSend.size());
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
                 if (inv.type == MSG_TX && pto->filterInventoryKnown.contains(inv.hash))
                     continue;
 
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
-                {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
-
-                    if (fTrickleWait)
-                    {
-                        vInvWait.push_back(inv);
-                        continue;
-                    }
-                }
-
                 pto->filterInventoryKnown.insert(inv.hash);
 
                 vInv.push_back(inv);
@@ -5898,7 +6438,36 @@ bool SendMessages(CNode* pto, CConnman* connman, std::atomic<bool>& interruptMsg
                     vInv.clear();
                 }
             }
-            pto->vInventoryToSend = vInvWait;
+            pto->vInventoryToSend.clear();
+
+            // trickle out tx inv to protect privacy
+            if (fSendTrickle) {
+                vTxTrickle.reserve(pto->setInventoryTxToSend.size());
+                for (const uint256& hash : pto->setInventoryTxToSend)
+                    if (!pto->filterInventoryKnown.contains(hash))
+                        vTxTrickle.push_back(hash);
+                pto->setInventoryTxToSend.clear();
+            }
+        }
+        if (!vTxTrickle.empty()) {
+            // Best feerates first, so that they propagate first. The ones
+            // over the limit wait for the next trickle.
+            const size_t nMax = std::min<size_t>(vTxTrickle.size(), INVENTORY_BROADCAST_MAX);
+            mempool.SortForRelay(vTxTrickle, nMax);
+            LOCK(pto->cs_inventory);
+            for (size_t i = 0; i < vTxTrickle.size(); ++i) {
+                if (i >= nMax) {
+                    pto->setInventoryTxToSend.insert(vTxTrickle[i]);
+                    continue;
+                }
+                pto->filterInventoryKnown.insert(vTxTrickle[i]);
+                vInv.push_back(CInv(MSG_TX, vTxTrickle[i]));
+                if (vInv.size() >= 1000)
+                {
+                    connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+                    vInv.clear();
+                }
+            }
         }
         if (!vInv.empty())
             connman->PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
@@ -5978,21 +6547,21 @@ bool SendMessages(CNode* pto, CConnman* connman, std::atomic<bool>& interruptMsg
         //
         // Message: getdata (non-blocks)
         //
-        while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
+        for (const uint256& hash : g_txrequest.GetRequestable(pto->GetId(), nNow))
         {
-            const CInv& inv = (*pto->mapAskFor.begin()).second;
-            if (!AlreadyHave(inv))
+            CInv inv(MSG_TX, hash);
+            if (AlreadyHave(inv)) {
+                g_txrequest.ForgetTxHash(hash);
+                continue;
+            }
+            if (LogAcceptCategory(Log::NET))
+                LogPrint(Log::NET, "Requesting %s peer=%d\n", inv.ToString(), pto->id);
+            vGetData.push_back(inv);
+            if (vGetData.size() >= 1000)
             {
-                if (LogAcceptCategory(Log::NET))
-                    LogPrint(Log::NET, "Requesting %s peer=%d\n", inv.ToString(), pto->id);
-                vGetData.push_back(inv);
-                if (vGetData.size() >= 1000)
-                {
-                    connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETDATA, vGetData));
-                    vGetData.clear();
-                }
+                connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETDATA, vGetData));
+                vGetData.clear();
             }
-            pto->mapAskFor.erase(pto->mapAskFor.begin());
         }
         if (!vGetData.empty())
             connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETDATA, vGetData));
@@ -29,6 +29,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -39,9 +40,13 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
+class CColumnarBlockUndo;
+class CCoinsViewDB;
 class CBloomFilter;
 class CInv;
 class CConnman;
+class CScheduler;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -93,9 +98,17 @@ static const unsigned int AVG_ADDRESS_BROADCAST_INTERVAL = 30;
 /** Average delay between trickled inventory broadcasts in seconds.
  *  Blocks, whitelisted receivers, and a random 25% of transactions bypass this. */
 static const unsigned int AVG_INVENTORY_BROADCAST_INTERVAL = 5;
+/** Maximum number of trickled transactions announced to a peer at once.
+ *  The rest wait for the next trickle, the lowest feerates last. */
+static const unsigned int INVENTORY_BROADCAST_MAX = 1000 * AVG_INVENTORY_BROADCAST_INTERVAL;
 
 /** Default for -stopatheight */
 static const int DEFAULT_STOPATHEIGHT = 0;
+/** Default for -columnarundo, write block undo data in the columnar format */
+static const bool DEFAULT_COLUMNAR_UNDO = false;
+/** Default for -parallelmempoolinputs, from how many inputs the scripts of a
+ *  transaction entering the mempool are verified on the script check threads */
+static const unsigned int DEFAULT_PARALLEL_MEMPOOL_INPUTS = 100;
 
 struct BlockHasher
 {
@@ -117,6 +130,8 @@ extern bool fReindex;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
+extern bool fColumnarUndo;
+extern unsigned int nParallelMempoolInputs;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
@@ -141,6 +156,8 @@ extern bool fPruneMode;
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const signed int MIN_BLOCKS_TO_KEEP = 288;
+/** Number of recent blocks (and their undo data) that pruning keeps; at least MIN_BLOCKS_TO_KEEP. */
+extern int nPruneKeepBlocks;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
@@ -248,21 +265,19 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock = nullptr,
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
 
 /**
- * Prune block and undo files (blk???.dat and undo???.dat) so that the disk space used is less than a user-defined target.
+ * Pruning deletes block and undo files (blk???.dat and undo???.dat) so that the disk space used is less than a user-defined target.
  * The user sets the target (in MB) on the command line or in config file.  This will be run on startup and whenever new
  * space is allocated in a block or undo file, staying below the target. Changing back to unpruned requires a reindex
  * (which in this case means the blockchain must be re-downloaded.)
  *
- * Pruning functions are called from FlushStateToDisk when the global fCheckForPruning flag has been set.
+ * Pruning passes run on the pruning service (see StartBlockPruning) once new file space has been allocated,
+ * or on request with PruneBlockFilesTo. Files are selected without holding cs_main.
  * Block and undo files are deleted in lock-step (when blk00003.dat is deleted, so is rev00003.dat.)
- * Pruning cannot take place until the longest chain is at least a certain length (100000 on mainnet, 1000 on testnet, 10 on regtest).
- * Pruning will never delete a block within a defined distance (currently 288) from the active chain's tip.
+ * Pruning cannot take place until the longest chain is at least a certain length (100000 on mainnet, 1000 on testnet, 1000 on regtest).
+ * Pruning will never delete a block within nPruneKeepBlocks (at least 288) of the active chain's tip.
  * The block index is updated by unsetting HAVE_DATA and HAVE_UNDO for any blocks that were stored in the deleted files.
  * A db flag records the fact that at least some block files have been pruned.
- *
- * @param[out]   setFilesToPrune   The set of file indices that can be unlinked will be returned
  */
-void FindFilesToPrune(std::set<int>& setFilesToPrune);
 
 /**
  *  Actually unlink the specified files
@@ -279,8 +294,26 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch, const std::string& what);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
-/** Prune block files and flush state to disk. */
+/** Prune block files down to nPruneTarget, on the pruning service if it is running. */
 void PruneAndFlush();
+/**
+ * Prune block files up to a height and/or down to a target size in bytes,
+ * keeping nPruneKeepBlocks. Runs in the calling thread, which must not hold
+ * cs_main, and removes the files before returning.
+ */
+bool PruneBlockFilesTo(int nHeight, uint64_t nTarget, std::string& strError);
+/** Calculate the amount of disk space the block & undo files currently use */
+uint64_t CalculateCurrentUsage();
+/** Run pruning and the removal of pruned files on the scheduler instead of the validation path. */
+void StartBlockPruning(CScheduler& scheduler);
+/** Stop the pruning service and remove any files it had not got to yet. */
+void StopBlockPruning();
+/** Approximate heap usage of the block index. Requires cs_main. */
+size_t BlockIndexDynamicMemoryUsage();
+/** Approximate heap usage of the orphan transaction pool. Requires cs_main. */
+size_t OrphanTxDynamicMemoryUsage();
+/** Approximate heap usage of thin blocks under construction. Requires cs_main. */
+size_t ThinBlocksDynamicMemoryUsage();
 
 /** Check is Cash HF has activated. */
 bool IsCashHFEnabled(const CBlockIndex *pindexPrev);
@@ -392,6 +425,9 @@ public:
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params&);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params&);
+/** Read the undo data of a block, checking it against the hash of the block's parent */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
+bool UndoReadFromDisk(CColumnarBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -450,6 +486,25 @@ extern CCoinsViewCache *pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Set the coin database under pcoinsTip, that snapshots are taken of. Null at shutdown. */
+void SetCoinsSnapshotDB(CCoinsViewDB* db);
+
+/**
+ * A read-only view of the UTXO set at the active chain's tip, for queries
+ * that should not hold cs_main while they read it. The first snapshot
+ * copies the coins modified in pcoinsTip since the last flush under
+ * cs_main; from then on pcoinsTip tracks the changes of each block,
+ * counted against its memory limit, until a flush passes without a
+ * snapshot being taken. The same snapshot is returned until the tip
+ * changes.
+ */
+std::shared_ptr<CCoinsViewSnapshot> GetCoinsSnapshot();
+/**
+ * The snapshot of the tip if one can be had without copying pcoinsTip,
+ * otherwise nullptr. For point lookups, which are then cheaper in pcoinsTip.
+ */
+std::shared_ptr<CCoinsViewSnapshot> GetCoinsSnapshotIfCheap();
+
 /**
  * Determine what nVersion a new block should use.
  */
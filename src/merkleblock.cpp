@@ -7,8 +7,66 @@
 
 #include "hash.h"
 #include "consensus/consensus.h"
+#include "sync.h"
 #include "utilstrencodings.h"
 
+#include <deque>
+
+/** Number of recently served blocks to keep filtered block data for. */
+static const size_t FILTERED_BLOCK_CACHE_SIZE = 4;
+
+CFilteredBlockData::CFilteredBlockData(const CBlock& block) : header(block.GetBlockHeader())
+{
+    std::vector<uint256> vHashes;
+    vtx.reserve(block.vtx.size());
+    vHashes.reserve(block.vtx.size());
+    for (const CTransaction& tx : block.vtx) {
+        vtx.emplace_back(tx);
+        vHashes.push_back(vtx.back().hash);
+    }
+    vMerkleLevels = CPartialMerkleTree::ComputeLevels(vHashes);
+}
+
+std::shared_ptr<const CFilteredBlockData> GetFilteredBlockData(const CBlock& block)
+{
+    static CCriticalSection cs;
+    static std::deque<std::shared_ptr<const CFilteredBlockData> > cache;
+
+    const uint256 hash = block.GetHash();
+    {
+        LOCK(cs);
+        for (const auto& data : cache)
+            if (data->header.GetHash() == hash)
+                return data;
+    }
+
+    // Build outside the lock; peers racing on the same block at worst
+    // build it twice.
+    auto data = std::make_shared<const CFilteredBlockData>(block);
+    LOCK(cs);
+    cache.push_front(data);
+    if (cache.size() > FILTERED_BLOCK_CACHE_SIZE)
+        cache.pop_back();
+    return data;
+}
+
+CMerkleBlock::CMerkleBlock(const CFilteredBlockData& block, CBloomFilter& filter)
+{
+    header = block.header;
+
+    std::vector<bool> vMatch;
+    vMatch.reserve(block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const bool fMatch = filter.IsRelevantAndUpdate(block.vtx[i]);
+        if (fMatch)
+            vMatchedTxn.emplace_back(i, block.vtx[i].hash);
+        vMatch.push_back(fMatch);
+    }
+
+    txn = CPartialMerkleTree(block.vMerkleLevels, vMatch);
+}
+
 CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter* filter, const std::set<uint256>* txids)
 {
     header = block.GetBlockHeader();
@@ -74,6 +132,20 @@ void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const st
     }
 }
 
+void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch) {
+    bool fParentOfMatch = false;
+    for (unsigned int p = pos << height; p < (pos+1) << height && p < nTransactions; p++)
+        fParentOfMatch |= vMatch[p];
+    vBits.push_back(fParentOfMatch);
+    if (height==0 || !fParentOfMatch) {
+        vHash.push_back(vLevels[height][pos]);
+    } else {
+        TraverseAndBuild(height-1, pos*2, vLevels, vMatch);
+        if (pos*2+1 < CalcTreeWidth(height-1))
+            TraverseAndBuild(height-1, pos*2+1, vLevels, vMatch);
+    }
+}
+
 uint256 CPartialMerkleTree::TraverseAndExtract(int height, unsigned int pos, unsigned int &nBitsUsed, unsigned int &nHashUsed, std::vector<uint256> &vMatch, std::vector<unsigned int> &vnIndex) {
     if (nBitsUsed >= vBits.size()) {
         // overflowed the bits array - failure
@@ -126,8 +198,29 @@ CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid, const
     TraverseAndBuild(nHeight, 0, vTxid, vMatch);
 }
 
+CPartialMerkleTree::CPartialMerkleTree(const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch) : nTransactions(vLevels.at(0).size()), fBad(false) {
+    assert(nTransactions != 0);
+    TraverseAndBuild(vLevels.size() - 1, 0, vLevels, vMatch);
+}
+
 CPartialMerkleTree::CPartialMerkleTree() : nTransactions(0), fBad(true) {}
 
+std::vector<std::vector<uint256> > CPartialMerkleTree::ComputeLevels(const std::vector<uint256> &vTxid) {
+    std::vector<std::vector<uint256> > vLevels(1, vTxid);
+    while (vLevels.back().size() > 1) {
+        const std::vector<uint256>& below = vLevels.back();
+        std::vector<uint256> level((below.size() + 1) / 2);
+        for (size_t i = 0; i < level.size(); i++) {
+            // an odd node out is paired with itself
+            const uint256& left = below[i*2];
+            const uint256& right = i*2+1 < below.size() ? below[i*2+1] : left;
+            level[i] = Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+        }
+        vLevels.push_back(std::move(level));
+    }
+    return vLevels;
+}
+
 uint256 CPartialMerkleTree::ExtractMatches(std::vector<uint256> &vMatch, std::vector<unsigned int> &vnIndex) {
     vMatch.clear();
     // An empty set will not work
@@ -11,6 +11,7 @@
 #include "primitives/block.h"
 #include "bloom.h"
 
+#include <memory>
 #include <vector>
 
 /** Data structure that represents a partial merkle tree.
@@ -73,6 +74,9 @@ protected:
     /** recursive function that traverses tree nodes, storing the data as bits and hashes */
     void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    /** same as TraverseAndBuild, taking node hashes from the precomputed tree levels */
+    void TraverseAndBuild(int height, unsigned int pos, const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch);
+
     /**
      * recursive function that traverses tree nodes, consuming the bits and hashes produced by TraverseAndBuild.
      * it returns the hash of the respective node and its respective index.
@@ -107,8 +111,19 @@ public:
     /** Construct a partial merkle tree from a list of transaction ids, and a mask that selects a subset of them */
     CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    /**
+     * Construct from all levels of the merkle tree, vLevels[0] being the txids
+     * and each following level the hashes of the one below, up to the root.
+     * Cheaper than the constructor above when many trees are built for the
+     * same block.
+     */
+    CPartialMerkleTree(const std::vector<std::vector<uint256> > &vLevels, const std::vector<bool> &vMatch);
+
     CPartialMerkleTree();
 
+    /** Compute all levels of the merkle tree over vTxid, as used by the constructor above. */
+    static std::vector<std::vector<uint256> > ComputeLevels(const std::vector<uint256> &vTxid);
+
     /**
      * extract the matching txid's represented by this partial merkle tree
      * and their respective indices within the partial tree.
@@ -118,6 +133,27 @@ public:
 };
 
 
+/**
+ * The parts of a block needed to serve it as a filtered block, computed once
+ * and shared by every peer the block is served to: the bloom filter match
+ * elements of each transaction and the levels of the merkle tree.
+ */
+class CFilteredBlockData
+{
+public:
+    CBlockHeader header;
+    std::vector<CBloomTxElements> vtx;
+    std::vector<std::vector<uint256> > vMerkleLevels;
+
+    explicit CFilteredBlockData(const CBlock& block);
+};
+
+/**
+ * Returns the filtered block data of the block, reusing the data of recently
+ * served blocks. SPV peers tend to ask for the same few new blocks.
+ */
+std::shared_ptr<const CFilteredBlockData> GetFilteredBlockData(const CBlock& block);
+
 /**
  * Used to relay blocks as header + vector<merkle branch>
  * to filtered nodes.
@@ -146,6 +182,9 @@ public:
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter) : CMerkleBlock(block, &filter, nullptr) { }
 
+    // Same as above, from data precomputed for the block.
+    CMerkleBlock(const CFilteredBlockData& block, CBloomFilter& filter);
+
     // Create from a CBlock, matching the txids in the set
     CMerkleBlock(const CBlock& block, const std::set<uint256>& txids) : CMerkleBlock(block, nullptr, &txids) { }
 
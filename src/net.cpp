@@ -19,6 +19,7 @@
 #include "ui_interface.h"
 #include "crypto/common.h"
 #include "ipgroups.h"
+#include "memusage.h"
 #include "options.h"
 
 #ifdef WIN32
@@ -61,6 +62,7 @@
 using namespace std;
 
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
+static const uint64_t RANDOMIZER_ID_TXTRICKLE = 0x32e8bf7e8bf81701ULL; // SHA256("txtrickle")[0:8]
 //
 // Global state variables
 //
@@ -74,7 +76,6 @@ static bool vfLimited[NET_MAX] = {};
 map<CInv, CDataStream> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
-limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -491,9 +492,27 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+    stats.requestCost = requestCost.GetStats();
 }
 #undef X
 
+size_t CNode::GetSendBufferUsage()
+{
+    LOCK(cs_vSend);
+    size_t usage = memusage::MallocUsage(vSendMsg.size() * sizeof(vSendMsg.front()));
+    for (const std::vector<unsigned char>& msg : vSendMsg)
+        usage += memusage::DynamicUsage(msg);
+    return usage;
+}
+
+size_t CNode::GetRecvBufferUsage()
+{
+    // vRecvMsg belongs to the socket handler thread and is not counted;
+    // it holds at most one partially received message.
+    LOCK(cs_vProcessMsg);
+    return nProcessQueueSize;
+}
+
 bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete)
 {
     complete = false;
@@ -688,6 +707,11 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     return nSentSize;
 }
 
+// IPs in no group are in a group of their own while connected.
+static std::string AdmissionGroupName(const CIPGroupData& group) {
+    return group.name.empty() || group.selfErases ? string("default") : group.name;
+}
+
 void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     struct sockaddr_storage sockaddr;
     socklen_t len = sizeof(sockaddr);
@@ -738,19 +762,35 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         bool disconnected = false;
         {
             LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode *n, vNodes)
-            {
-                CIPGroupData ngroup = FindGroupForIP(n->addr);
-                int nodePriority = ngroup.priority;
-                if (nodePriority < ipgroup.priority) {
-                    LogPrintf("Connection slots exhausted, evicting peer %d with priority %d (group %s) to free up resources\n",
-                              n->id, nodePriority, ngroup.name == "" ? string("default") : ngroup.name);
-                    n->fDisconnect = true;
-                    disconnected = true;
-                    // Leave shouldConnect = true to allow this socket through.
-                    break;
+            if (fRebuildEvictionIndex) {
+                // IPs may have moved to other groups.
+                evictionIndex.clear();
+                BOOST_FOREACH(CNode *n, vNodes) {
+                    if (!n->fInbound || n->fDisconnect)
+                        continue;
+                    CIPGroupData ngroup = FindGroupForIP(n->addr);
+                    evictionIndex.insert(n, ngroup.name, ngroup.priority);
                 }
+                fRebuildEvictionIndex = false;
+            }
+
+            CNode *n;
+            std::string ngroup;
+            while (evictionIndex.findLowerThan(ipgroup.priority, n, ngroup)) {
+                evictionIndex.erase(n);
+                if (n->fDisconnect)
+                    continue;
+                CIPGroupData nodeGroup = FindGroupForIP(n->addr);
+                LogPrintf("Connection slots exhausted, evicting peer %d with priority %d (group %s) to free up resources\n",
+                          n->id, nodeGroup.priority, AdmissionGroupName(nodeGroup));
+                mapAdmissionStats[AdmissionGroupName(nodeGroup)].nEvicted++;
+                n->fDisconnect = true;
+                disconnected = true;
+                // Leave shouldConnect = true to allow this socket through.
+                break;
             }
+            if (!disconnected)
+                mapAdmissionStats[AdmissionGroupName(ipgroup)].nRefused++;
         }
 
         if (!disconnected) {
@@ -771,9 +811,21 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        // Later changes to the group's priority wait for cs_vNodes in
+        // IPGroupChanged, so none are missed.
+        CIPGroupData ipgroup = pnode->ipgroupSlot->Group();
+        evictionIndex.insert(pnode, ipgroup.name, ipgroup.priority);
     }
 }
 
+void CConnman::IPGroupChanged(const std::string& group, int priority) {
+    LOCK(cs_vNodes);
+    if (group.empty())
+        fRebuildEvictionIndex = true;
+    else
+        evictionIndex.setPriority(group, priority);
+}
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -801,6 +853,7 @@ void CConnman::ThreadSocketHandler()
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                    evictionIndex.erase(pnode);
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -1283,8 +1336,18 @@ void CConnman::DumpAddresses()
 {
     int64_t nStart = GetTimeMillis();
 
+    addrman.FlushPending();
+
+    // peers.dat is rewritten whole, so skip it if nothing has changed.
+    const uint64_t nChanges = addrman.GetChangeCount();
+    if (nChanges == nDumpedAddrChanges) {
+        LogPrint(Log::NET, "No address changes to flush to peers.dat\n");
+        return;
+    }
+
     CAddrDB adb;
-    adb.Write(addrman);
+    if (adb.Write(addrman))
+        nDumpedAddrChanges = nChanges;
 
     LogPrint(Log::NET, "Flushed %d addresses to peers.dat  %dms\n",
            addrman.size(), GetTimeMillis() - nStart);
@@ -1336,6 +1399,11 @@ void CConnman::ThreadOpenConnections()
 
     // Minimum time before next feeler connection (in microseconds).
     int64_t nNextFeeler = PoissonNextSend(nStart*1000*1000, FEELER_INTERVAL);
+
+    // Addresses attempted since the snapshot we select from was made, which
+    // it still shows with their previous nLastTry.
+    std::shared_ptr<const CAddrManSnapshot> addrSnapshot;
+    std::set<CService> setAttempted;
     while (!interruptNet)
     {
         ProcessOneShot();
@@ -1401,6 +1469,13 @@ void CConnman::ThreadOpenConnections()
 
         addrman.ResolveCollisions();
 
+        // Select from a snapshot of the tables, so that peers sending us
+        // addresses don't wait on this loop.
+        std::shared_ptr<const CAddrManSnapshot> addrSnapshotNew = addrman.GetSnapshot();
+        if (addrSnapshotNew != addrSnapshot) {
+            addrSnapshot = addrSnapshotNew;
+            setAttempted.clear();
+        }
         int64_t nANow = GetAdjustedTime();
         int nTries = 0;
         while (!interruptNet)
@@ -1409,7 +1484,7 @@ void CConnman::ThreadOpenConnections()
 
             // SelectTriedCollision returns an invalid address if it is empty.
             if (!fFeeler || !addr.IsValid()) {
-                addr = addrman.Select(fFeeler);
+                addr = addrSnapshot->Select(fFeeler);
             }
 
             // if we selected an invalid address, restart
@@ -1427,7 +1502,7 @@ void CConnman::ThreadOpenConnections()
                 continue;
 
             // only consider very recently tried nodes after 30 failed attempts
-            if (nANow - addr.nLastTry < 600 && nTries < 30)
+            if ((nANow - addr.nLastTry < 600 || setAttempted.count(addr)) && nTries < 30)
                 continue;
 
             // do not allow non-default ports, unless after 50 invalid addresses selected already
@@ -1448,6 +1523,7 @@ void CConnman::ThreadOpenConnections()
                 LogPrint(Log::NET, "Making feeler connection to %s\n", addrConnect.ToString());
             }
 
+            setAttempted.insert(addrConnect);
             OpenNetworkConnection(addrConnect, (int)setConnected.size() >= std::min(nMaxConnections - 1, 2), &grant, NULL, false, fFeeler);
         }
     }
@@ -1771,10 +1847,13 @@ void InitNetworkShapers() {
 }
 
 CConnman::CConnman(uint64_t seed0, uint64_t seed1) : nSendBufferMaxSize(0), nReceiveFloodSize(0),
-                       fAddressesInitialized(false),  nLastNodeId(0), semOutbound(nullptr),
+                       fAddressesInitialized(false), nDumpedAddrChanges(0), nLastNodeId(0), fRebuildEvictionIndex(false),
+                       semOutbound(nullptr),
                        nMaxConnections(0), nMaxOutbound(0), nBestHeight(0), clientInterface(nullptr),
                        nSeed0(seed0), nSeed1(seed1), flagInterruptMsgProc(false)
 {
+    ipgroupsChangedConn = IPGroupsChanged().connect(
+            [this](const std::string& group, int priority) { IPGroupChanged(group, priority); });
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -1804,8 +1883,10 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     int64_t nStart = GetTimeMillis();
     {
         CAddrDB adb;
-        if (adb.Read(addrman))
+        if (adb.Read(addrman)) {
             LogPrintf("Loaded %i addresses from peers.dat  %dms\n", addrman.size(), GetTimeMillis() - nStart);
+            nDumpedAddrChanges = addrman.GetChangeCount();
+        }
         else {
             addrman.Clear(); // Addrman can be in an inconsistent state after failure, reset it
             LogPrintf("Invalid or missing peers.dat; recreating\n");
@@ -1854,7 +1935,7 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
 
     // Dump network addresses
-    scheduler.scheduleEvery(boost::bind(&CConnman::DumpAddresses, this), DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(boost::bind(&CConnman::DumpAddresses, this), DUMP_ADDRESSES_INTERVAL, "dumpaddresses");
 
     return true;
 }
@@ -1926,6 +2007,7 @@ void CConnman::Stop()
     }
     vNodes.clear();
     vNodesDisconnected.clear();
+    evictionIndex.clear();
     vhListenSocket.clear();
     delete semOutbound;
     semOutbound = NULL;
@@ -1952,6 +2034,11 @@ size_t CConnman::GetAddressCount() const
     return addrman.size();
 }
 
+size_t CConnman::GetAddressMemoryUsage() const
+{
+    return addrman.DynamicMemoryUsage();
+}
+
 void CConnman::MarkAddressGood(const CAddress& addr)
 {
     addrman.Good(addr);
@@ -1964,12 +2051,12 @@ void CConnman::AddNewAddress(const CAddress& addr, const CAddress& addrFrom, int
 
 void CConnman::AddNewAddresses(const std::vector<CAddress>& vAddr, const CAddress& addrFrom, int64_t nTimePenalty)
 {
-    addrman.Add(vAddr, addrFrom, nTimePenalty);
+    addrman.AddBatched(vAddr, addrFrom, nTimePenalty);
 }
 
 std::vector<CAddress> CConnman::GetAddresses()
 {
-    return addrman.GetAddr();
+    return addrman.GetSnapshot()->GetAddr();
 }
 
 bool CConnman::AddNode(const std::string& strNode)
@@ -2010,6 +2097,12 @@ size_t CConnman::GetNodeCount(NumConnections flags)
     return nNum;
 }
 
+std::map<std::string, AdmissionStats> CConnman::GetAdmissionStats() const
+{
+    LOCK(cs_vNodes);
+    return mapAdmissionStats;
+}
+
 void CConnman::GetNodeStats(std::vector<CNodeStats>& vstats)
 {
     vstats.clear();
@@ -2026,6 +2119,8 @@ void CConnman::GetNodeStats(std::vector<CNodeStats>& vstats)
 void CConnman::RelayTransaction(const CTransaction& tx, const CDataStream& ss, std::vector<uint256>& vAncestors, const bool fRespend)
 {
     CInv inv(MSG_TX, tx.GetHash());
+    // Respends are rate limited alerts, so they are never held back.
+    const bool fTrickle = !fRespend && IsTrickleWait(inv.hash);
     {
         LOCK(cs_mapRelay);
         // Expire old relay messages
@@ -2057,13 +2152,15 @@ void CConnman::RelayTransaction(const CTransaction& tx, const CDataStream& ss, s
                     BOOST_FOREACH(uint256& hashFound, vAncestors) {
                         if (hashFound != tx.GetHash() && pnode->pfilter->WantsAncestors())
                             pnode->pfilter->insert(hashFound);
-                        if (hashFound == tx.GetHash() || pnode->pfilter->WantsAncestors())
-                            pnode->PushInventory(CInv(MSG_TX, hashFound));
+                        if (hashFound == tx.GetHash())
+                            pnode->PushTxInventory(hashFound, fTrickle);
+                        else if (pnode->pfilter->WantsAncestors())
+                            pnode->PushTxInventory(hashFound, !fRespend && IsTrickleWait(hashFound));
                     }
                 }
             }
             else {
-                pnode->PushInventory(inv);
+                pnode->PushTxInventory(inv.hash, fTrickle);
             }
         }
     }
@@ -2080,6 +2177,15 @@ bool FindTransactionInRelayMap(uint256 hash, CTransaction &out) {
     return false;
 }
 
+size_t RelayMapDynamicMemoryUsage() {
+    LOCK(cs_mapRelay);
+    size_t usage = memusage::DynamicUsage(mapRelay)
+        + memusage::MallocUsage(vRelayExpiration.size() * sizeof(vRelayExpiration.front()));
+    for (auto& r : mapRelay)
+        usage += memusage::MallocUsage(r.second.size());
+    return usage;
+}
+
 void CConnman::RelayTransaction(const CTransaction& tx, std::vector<uint256>& vAncestors, const bool fRespend)
 {
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
@@ -2180,6 +2286,7 @@ CNode::CNode(NodeId idIn, uint64_t nLocalServicesIn, int nMyStartingHeightIn, SO
     ipgroupSlot = AssignIPGroupSlot(CNetAddr(addr.ToStringIP()));
     CIPGroupData ipgroup = ipgroupSlot->Group();
     std::string strIpGroup = tfm::format("(group %s)", ipgroup.name);
+    requestCost.SetBudget(nPeerRequestBudget, ipgroup.priority);
     fPauseRecv = false;
     fPauseSend = false;
     nProcessQueueSize = 0;
@@ -2195,38 +2302,6 @@ CNode::~CNode()
     CloseSocket(hSocket);
 }
 
-void CNode::AskFor(const CInv& inv)
-{
-    if (mapAskFor.size() > MAPASKFOR_MAX_SZ)
-        return;
-    // We're using mapAskFor as a priority queue,
-    // the key is the earliest time the request can be sent
-    int64_t nRequestTime;
-    limitedmap<CInv, int64_t>::const_iterator it = mapAlreadyAskedFor.find(inv);
-    if (it != mapAlreadyAskedFor.end())
-        nRequestTime = it->second;
-    else
-        nRequestTime = 0;
-    LogPrint(Log::NET, "askfor %s  %d (%s) peer=%d\n", inv.ToString(), nRequestTime, DateTimeStrFormat("%H:%M:%S", nRequestTime/1000000), id);
-
-    // Make sure not to reuse time indexes to keep things in the same order
-    int64_t nNow = GetTimeMicros() - 1000000;
-    static int64_t nLastTime;
-    ++nLastTime;
-    nNow = std::max(nNow, nLastTime);
-    nLastTime = nNow;
-
-    // Each retry is 20 seconds after the last. Calculations based on observed relay
-    // times as of July 2015 show that we will receive a transaction within 20 seconds
-    // 99% of the time.
-    nRequestTime = std::max(nRequestTime + (20 * 1000000), nNow);
-    if (it != mapAlreadyAskedFor.end())
-        mapAlreadyAskedFor.update(it, nRequestTime);
-    else
-        mapAlreadyAskedFor.insert(std::make_pair(inv, nRequestTime));
-    mapAskFor.insert(std::make_pair(nRequestTime, inv));
-}
-
 bool CConnman::NodeFullyConnected(const CNode* pnode)
 {
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
@@ -2316,3 +2391,9 @@ CSipHasher CConnman::GetDeterministicRandomizer(uint64_t id) const
 {
     return CSipHasher(nSeed0, nSeed1).Write(id);
 }
+
+bool CConnman::IsTrickleWait(const uint256& hash) const
+{
+    uint64_t nRand = GetDeterministicRandomizer(RANDOMIZER_ID_TXTRICKLE).Write(hash.begin(), hash.size()).Finalize();
+    return (nRand & 3) != 0;
+}
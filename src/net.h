@@ -10,13 +10,14 @@
 #include "addrman.h"
 #include "bloom.h"
 #include "compat.h"
+#include "evictionindex.h"
 #include "hash.h"
 #include "leakybucket.h"
 #include "ipgroups.h"
-#include "limitedmap.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
+#include "requestcost.h"
 #include "streams.h"
 #include "sync.h"
 #include "threadinterrupt.h"
@@ -72,8 +73,6 @@ static const bool DEFAULT_UPNP = USE_UPNP;
 #else
 static const bool DEFAULT_UPNP = false;
 #endif
-/** The maximum number of entries in mapAskFor */
-static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 
@@ -87,6 +86,14 @@ struct AddedNodeInfo
     bool fInbound;
 };
 
+/** Inbound connections admitted at the expense of peers of an IP group, or
+ *  refused from it, while connection slots were exhausted. */
+struct AdmissionStats
+{
+    uint64_t nEvicted = 0;
+    uint64_t nRefused = 0;
+};
+
 class CTransaction;
 class CNodeStats;
 class CClientUIInterface;
@@ -187,6 +194,7 @@ public:
 
     // Addrman functions
     size_t GetAddressCount() const;
+    size_t GetAddressMemoryUsage() const;
     void MarkAddressGood(const CAddress& addr);
     void AddNewAddress(const CAddress& addr, const CAddress& addrFrom, int64_t nTimePenalty = 0);
     void AddNewAddresses(const std::vector<CAddress>& vAddr, const CAddress& addrFrom, int64_t nTimePenalty = 0);
@@ -218,6 +226,8 @@ public:
 
     size_t GetNodeCount(NumConnections num);
     void GetNodeStats(std::vector<CNodeStats>& vstats);
+    //! Per IP group, or "default" for IPs in no group
+    std::map<std::string, AdmissionStats> GetAdmissionStats() const;
 
     unsigned int GetSendBufferSize() const;
 
@@ -238,6 +248,10 @@ public:
     /** Get a unique deterministic randomizer. */
     CSipHasher GetDeterministicRandomizer(uint64_t id) const;
 
+    /** Whether a transaction waits for the next trickle to each peer. A
+     *  random quarter of transactions is announced to all peers at once. */
+    bool IsTrickleWait(const uint256& hash) const;
+
     unsigned int GetReceiveFloodSize() const;
 
     void WakeMessageHandler();
@@ -263,6 +277,7 @@ private:
     CNode* FindNode(const CService& addr);
 
     bool AttemptToEvictConnection();
+    void IPGroupChanged(const std::string& group, int priority);
     CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fCountFailure);
     bool IsWhitelistedRange(const CNetAddr &addr);
 
@@ -301,6 +316,8 @@ private:
     CCriticalSection cs_setBanned;
     bool fAddressesInitialized;
     CAddrMan addrman;
+    //! addrman's change count when peers.dat was last written or read
+    std::atomic<uint64_t> nDumpedAddrChanges;
     std::deque<std::string> vOneShots;
     CCriticalSection cs_vOneShots;
     std::vector<std::string> vAddedNodes;
@@ -310,6 +327,12 @@ private:
     mutable CCriticalSection cs_vNodes;
     std::atomic<NodeId> nLastNodeId;
 
+    // Inbound nodes by IP group priority, rebuilt after IP groups were reloaded.
+    // Protected by cs_vNodes.
+    EvictionIndex evictionIndex;
+    bool fRebuildEvictionIndex;
+    std::map<std::string, AdmissionStats> mapAdmissionStats;
+
     /** Services this instance offers */
     uint64_t nLocalServices;
 
@@ -337,6 +360,9 @@ private:
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
     std::thread threadMessageHandler;
+
+    // Last, so that it disconnects before the members it updates are destroyed.
+    boost::signals2::scoped_connection ipgroupsChangedConn;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -412,7 +438,6 @@ extern bool fListen;
 extern std::map<CInv, CDataStream> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
-extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
 
 struct LocalServiceInfo {
     int nScore;
@@ -442,6 +467,7 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    RequestCostStats requestCost;
 };
 
 
@@ -567,8 +593,9 @@ public:
     // inventory based relay
     CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
+    // Transactions held back until the next trickle to this peer
+    std::set<uint256> setInventoryTxToSend;
     CCriticalSection cs_inventory;
-    std::multimap<int64_t, CInv> mapAskFor;
     int64_t nNextInvSend;
     // Used for headers announcements - unfiltered blocks to relay
     // Also protected by cs_inventory
@@ -586,6 +613,8 @@ public:
 
     // adds connection to ipgroup (for prioritising connection slots)
     std::unique_ptr<IPGroupSlot> ipgroupSlot;
+    // what serving the peer's requests costs us, limited by a budget
+    RequestCost requestCost;
 
     CNode(NodeId id, uint64_t nLocalServicesIn, int nMyStartingHeightIn, SOCKET hSocketIn, const CAddress &addrIn, uint64_t nLocalHostNonceIn, const std::string &addrNameIn = "", bool fInboundIn = false);
     virtual ~CNode();
@@ -687,18 +716,33 @@ public:
         }
     }
 
+    // Announce a transaction, either right away or at the next trickle.
+    void PushTxInventory(const uint256& hash, bool fTrickle)
+    {
+        LOCK(cs_inventory);
+        if (filterInventoryKnown.contains(hash))
+            return;
+        if (fTrickle)
+            setInventoryTxToSend.insert(hash);
+        else
+            vInventoryToSend.push_back(CInv(MSG_TX, hash));
+    }
+
     void PushBlockHash(const uint256 &hash)
     {
         LOCK(cs_inventory);
         blocksToAnnounce.push_back(hash);
     }
 
-    void AskFor(const CInv& inv);
-
     void CloseSocketDisconnect();
 
     void copyStats(CNodeStats &stats);
 
+    //! Approximate heap usage of queued outgoing messages.
+    size_t GetSendBufferUsage();
+    //! Approximate heap usage of received messages waiting to be processed.
+    size_t GetRecvBufferUsage();
+
     uint64_t GetLocalServices() const
     {
         return nLocalServices;
@@ -714,6 +758,8 @@ public:
 
 
 bool FindTransactionInRelayMap(uint256 hash, CTransaction &out);
+/** Approximate heap usage of mapRelay and its expiration queue. */
+size_t RelayMapDynamicMemoryUsage();
 
 /** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
 int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
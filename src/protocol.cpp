@@ -44,6 +44,12 @@ const char *CMPCTBLOCK="cmpctblock";
 const char *XBLOCKTX="xblocktx";
 const char *BLOCKTXN="blocktxn";
 const char *UTXOS="utxos";
+const char *GETCFILTERS="getcfilters";
+const char *CFILTER="cfilter";
+const char *GETCFHEADERS="getcfheaders";
+const char *CFHEADERS="cfheaders";
+const char *GETCFCHECKPT="getcfcheckpt";
+const char *CFCHECKPT="cfcheckpt";
 };
 
 static const char* ppszTypeName[] =
@@ -90,7 +96,13 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::CMPCTBLOCK,
     NetMsgType::XBLOCKTX,
     NetMsgType::BLOCKTXN,
-    NetMsgType::UTXOS
+    NetMsgType::UTXOS,
+    NetMsgType::GETCFILTERS,
+    NetMsgType::CFILTER,
+    NetMsgType::GETCFHEADERS,
+    NetMsgType::CFHEADERS,
+    NetMsgType::GETCFCHECKPT,
+    NetMsgType::CFCHECKPT
 };
 const static std::vector<std::string> allNetMessageTypesVec(allNetMessageTypes, allNetMessageTypes+ARRAYLEN(allNetMessageTypes));
 
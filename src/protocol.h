@@ -227,6 +227,30 @@ extern const char *CMPCTBLOCK;
 extern const char *XBLOCKTX;
 extern const char *BLOCKTXN;
 extern const char *UTXOS;
+/**
+ * getcfilters requests the compact filters of a range of blocks.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by
+ * BIP157 and BIP158.
+ */
+extern const char *GETCFILTERS;
+/** cfilter is a response to a getcfilters request with one block filter. */
+extern const char *CFILTER;
+/**
+ * getcfheaders requests the filter hashes of a range of blocks, together
+ * with the filter header preceding them. Only available with service bit
+ * NODE_COMPACT_FILTERS.
+ */
+extern const char *GETCFHEADERS;
+/** cfheaders is a response to a getcfheaders request. */
+extern const char *CFHEADERS;
+/**
+ * getcfcheckpt requests the filter headers at evenly spaced intervals of
+ * the chain leading to a block. Only available with service bit
+ * NODE_COMPACT_FILTERS.
+ */
+extern const char *GETCFCHECKPT;
+/** cfcheckpt is a response to a getcfcheckpt request. */
+extern const char *CFCHECKPT;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -255,7 +279,11 @@ enum {
     NODE_THIN = (1 << 4),
 
     // Node supports the Bitcoin Cash fork rules
-    NODE_BITCOIN_CASH = (1 << 5)
+    NODE_BITCOIN_CASH = (1 << 5),
+
+    // NODE_COMPACT_FILTERS means the node serves basic block filters and
+    // filter headers as described by BIP157 and BIP158.
+    NODE_COMPACT_FILTERS = (1 << 6)
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
@@ -0,0 +1,99 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "recentblockcache.h"
+
+#include "blockencodings.h"
+#include "compactprefiller.h"
+#include "version.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+RecentBlockCache g_recentblocks;
+
+CachedBlock::CachedBlock(std::shared_ptr<const CBlock> b) :
+    block(std::move(b)), hash(block->GetHash()),
+    serialized(SER_NETWORK, PROTOCOL_VERSION),
+    compact(SER_NETWORK, PROTOCOL_VERSION)
+{
+}
+
+const CDataStream& CachedBlock::GetSerialized() const
+{
+    std::call_once(onceSerialized, [this]() {
+        serialized.reserve(::GetSerializeSize(*block, SER_NETWORK, PROTOCOL_VERSION));
+        serialized << *block;
+    });
+    return serialized;
+}
+
+const CDataStream& CachedBlock::GetCompact() const
+{
+    std::call_once(onceCompact, [this]() {
+        compact << CompactBlock(*block, CoinbaseOnlyPrefiller());
+    });
+    return compact;
+}
+
+std::vector<uint32_t> CachedBlock::FindByCheapHash(const std::set<uint64_t>& cheapHashes) const
+{
+    std::call_once(onceIndex, [this]() {
+        cheapHashIndex.reserve(block->vtx.size());
+        for (size_t i = 0; i < block->vtx.size(); ++i)
+            cheapHashIndex.push_back(std::make_pair(block->vtx[i].GetHash().GetCheapHash(), i));
+        std::sort(cheapHashIndex.begin(), cheapHashIndex.end());
+    });
+
+    std::vector<uint32_t> positions;
+    for (uint64_t cheapHash : cheapHashes) {
+        auto range = std::equal_range(cheapHashIndex.begin(), cheapHashIndex.end(),
+                                      std::make_pair(cheapHash, uint32_t(0)),
+                                      [](const std::pair<uint64_t, uint32_t>& a,
+                                         const std::pair<uint64_t, uint32_t>& b) {
+                                          return a.first < b.first;
+                                      });
+        if (range.first == range.second)
+            throw std::runtime_error("request contained transactions not in block");
+        for (auto it = range.first; it != range.second; ++it)
+            positions.push_back(it->second);
+    }
+    std::sort(positions.begin(), positions.end());
+    return positions;
+}
+
+RecentBlockCache::RecentBlockCache(size_t n) : nMaxBlocks(n)
+{
+}
+
+std::shared_ptr<const CachedBlock> RecentBlockCache::Get(const uint256& hash) const
+{
+    LOCK(cs);
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it)
+        if ((*it)->GetHash() == hash)
+            return *it;
+    return nullptr;
+}
+
+std::shared_ptr<const CachedBlock> RecentBlockCache::Insert(std::shared_ptr<const CBlock> block)
+{
+    // Hash the block before taking the lock.
+    auto cached = std::make_shared<const CachedBlock>(std::move(block));
+
+    LOCK(cs);
+    for (auto& b : blocks)
+        if (b->GetHash() == cached->GetHash())
+            return b;
+
+    blocks.push_back(cached);
+    while (blocks.size() > nMaxBlocks)
+        blocks.pop_front();
+    return cached;
+}
+
+void RecentBlockCache::Clear()
+{
+    LOCK(cs);
+    blocks.clear();
+}
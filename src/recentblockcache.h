@@ -0,0 +1,78 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_RECENTBLOCKCACHE_H
+#define BITCOIN_RECENTBLOCKCACHE_H
+
+#include "primitives/block.h"
+#include "streams.h"
+#include "sync.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+//! Number of blocks at the tip kept in memory for serving to peers.
+static const int MAX_RECENT_BLOCKS = 3;
+
+// A block near the tip, with the encodings of it that are sent to peers.
+// Encodings are made the first time they are needed and then shared by
+// every peer the block is sent to.
+class CachedBlock {
+public:
+    CachedBlock(std::shared_ptr<const CBlock> block);
+
+    const CBlock& GetBlock() const { return *block; }
+    uint256 GetHash() const { return hash; }
+
+    // The block serialized for a BLOCK message.
+    const CDataStream& GetSerialized() const;
+
+    // The block serialized for a CMPCTBLOCK message, with only the
+    // coinbase prefilled.
+    const CDataStream& GetCompact() const;
+
+    // Positions in the block of the transactions with the given cheap
+    // hashes, in block order. Throws if one of them is not in the block.
+    std::vector<uint32_t> FindByCheapHash(const std::set<uint64_t>& cheapHashes) const;
+
+private:
+    const std::shared_ptr<const CBlock> block;
+    const uint256 hash;
+
+    mutable std::once_flag onceSerialized;
+    mutable CDataStream serialized;
+    mutable std::once_flag onceCompact;
+    mutable CDataStream compact;
+    mutable std::once_flag onceIndex;
+    // (cheap hash, position) sorted by cheap hash.
+    mutable std::vector<std::pair<uint64_t, uint32_t> > cheapHashIndex;
+};
+
+// The last few blocks sent to peers. Blocks are added when first read from
+// disk to serve a peer, so the ones that follow are served from memory.
+class RecentBlockCache {
+public:
+    RecentBlockCache(size_t nMaxBlocks = MAX_RECENT_BLOCKS);
+
+    std::shared_ptr<const CachedBlock> Get(const uint256& hash) const;
+
+    // Add a block, evicting the oldest if full. If the block is already
+    // cached, the cached entry is returned instead.
+    std::shared_ptr<const CachedBlock> Insert(std::shared_ptr<const CBlock> block);
+
+    void Clear();
+
+private:
+    const size_t nMaxBlocks;
+    mutable CCriticalSection cs;
+    // Newest last.
+    std::deque<std::shared_ptr<const CachedBlock> > blocks;
+};
+
+extern RecentBlockCache g_recentblocks;
+
+#endif // BITCOIN_RECENTBLOCKCACHE_H
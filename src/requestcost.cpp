@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "requestcost.h"
+#include "ipgroups.h"
+
+#include <algorithm>
+#include <limits>
+
+int64_t nPeerRequestBudget = DEFAULT_PEER_REQUEST_BUDGET;
+
+RequestCost::RequestCost() :
+    bucket(0, 0), nCPUMicros(0), nDiskBytes(0), nThrottled(0), fThrottled(false)
+{
+}
+
+int64_t RequestCost::ScaleBudget(int64_t nMillisPerSec, int nPriority)
+{
+    const int nRelative = nPriority - DEFAULT_IPGROUP_PRI;
+    if (nRelative >= 0)
+        return nMillisPerSec * (1 + nRelative);
+    return std::max<int64_t>(1, nMillisPerSec / (1 - nRelative));
+}
+
+void RequestCost::SetBudget(int64_t nMillisPerSec, int nPriority)
+{
+    LOCK(cs);
+    if (nMillisPerSec <= 0) {
+        bucket.disable();
+        return;
+    }
+    // The bucket counts in microseconds, in an int.
+    const int64_t nMaxRate = std::numeric_limits<int>::max() / (1000 * PEER_REQUEST_BURST);
+    const int64_t nRate = std::min(nMaxRate, ScaleBudget(nMillisPerSec, nPriority)) * 1000;
+    // Starts full, so a new peer can sync from us at once.
+    bucket = CLeakyBucket(nRate * PEER_REQUEST_BURST, nRate);
+}
+
+void RequestCost::Charge(int64_t nMicros)
+{
+    AssertLockHeld(cs);
+    const int nBurst = PEER_REQUEST_BURST * 1000000;
+    if (!bucket.consume(std::min<int64_t>(std::max<int64_t>(0, nMicros), nBurst)) && !fThrottled) {
+        fThrottled = true;
+        ++nThrottled;
+    }
+}
+
+void RequestCost::AddCPUTime(int64_t nMicros)
+{
+    LOCK(cs);
+    nCPUMicros += nMicros;
+    Charge(nMicros);
+}
+
+void RequestCost::AddDiskRead(uint64_t nBytes)
+{
+    LOCK(cs);
+    nDiskBytes += nBytes;
+    Charge(nBytes / DISK_BYTES_PER_COST_MICRO);
+}
+
+bool RequestCost::IsOverBudget()
+{
+    LOCK(cs);
+    // Consuming nothing refills the bucket, and fails if it is below zero.
+    if (!bucket.try_consume(0))
+        return true;
+    fThrottled = false;
+    return false;
+}
+
+RequestCostStats RequestCost::GetStats() const
+{
+    LOCK(cs);
+    RequestCostStats stats;
+    stats.nCPUMicros = nCPUMicros;
+    stats.nDiskBytes = nDiskBytes;
+    int nLevel = 0;
+    int nFill = 0;
+    bucket.get(nullptr, &nFill, &nLevel);
+    stats.nBudget = nFill == 0 ? 0 : nLevel;
+    stats.nThrottled = nThrottled;
+    return stats;
+}
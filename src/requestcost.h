@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_REQUESTCOST_H
+#define BITCOIN_REQUESTCOST_H
+
+#include "leakybucket.h"
+#include "sync.h"
+
+#include <cstdint>
+
+/** Default for -peerrequestbudget, milliseconds of processing per second a
+ *  peer's requests may use on average (0 = unlimited) */
+static const int64_t DEFAULT_PEER_REQUEST_BUDGET = 100;
+/** Seconds of its budget a peer can save up for a burst of requests */
+static const int PEER_REQUEST_BURST = 30;
+/** Bytes read from disk for a peer are charged as one microsecond of
+ *  processing per this many bytes */
+static const uint64_t DISK_BYTES_PER_COST_MICRO = 100;
+
+/** Milliseconds per second of the budget of a peer with the default IP
+ *  group priority; set from -peerrequestbudget */
+extern int64_t nPeerRequestBudget;
+
+struct RequestCostStats {
+    //! Processing time spent on the peer's messages
+    int64_t nCPUMicros;
+    uint64_t nDiskBytes;
+    //! Microseconds of budget left, negative if over budget
+    int64_t nBudget;
+    //! Times the peer ran out of budget
+    uint64_t nThrottled;
+};
+
+/**
+ * The cost of serving a peer's requests: the processing time spent on its
+ * messages and the bytes read from disk for it, counted against a token
+ * bucket. The bucket refills at a rate scaled by the priority of the peer's
+ * IP group, so lower priority peers are served less. A peer that drained
+ * it is not served until it refills.
+ *
+ * Thread safe.
+ */
+class RequestCost {
+public:
+    RequestCost();
+
+    //! Set the budget for a peer of the IP group priority, in milliseconds
+    //! per second (0 = unlimited). The peer starts with a full burst.
+    void SetBudget(int64_t nMillisPerSec, int nPriority);
+
+    void AddCPUTime(int64_t nMicros);
+    void AddDiskRead(uint64_t nBytes);
+
+    //! Whether the peer's requests should wait for its budget to refill.
+    bool IsOverBudget();
+
+    RequestCostStats GetStats() const;
+
+    //! The budget of a peer of the IP group priority. Each point of priority
+    //! above the default adds the default budget, and each point below
+    //! divides it.
+    static int64_t ScaleBudget(int64_t nMillisPerSec, int nPriority);
+
+private:
+    mutable CCriticalSection cs;
+    //! In microseconds of processing
+    mutable CLeakyBucket bucket;
+    int64_t nCPUMicros;
+    uint64_t nDiskBytes;
+    uint64_t nThrottled;
+    bool fThrottled;
+
+    void Charge(int64_t nMicros);
+};
+
+#endif
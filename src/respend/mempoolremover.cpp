@@ -12,11 +12,11 @@ MempoolRemover::MempoolRemover(CTxMemPool& pool, std::list<CTransaction>& remove
 }
 
 bool MempoolRemover::AddOutpointConflict(
-        const COutPoint&, const CTxMemPool::txiter mempoolEntry,
+        const COutPoint&, const CTransaction& originalTx,
         const CTransaction& respendTx,
         bool seenBefore, bool isEquivalent)
 {
-    tx1s.insert(mempoolEntry);
+    tx1s.emplace(originalTx.GetHash(), originalTx);
 
     // Keep gathering conflicting transactions
     return true;
@@ -28,8 +28,8 @@ bool MempoolRemover::IsInteresting() const {
 
 void MempoolRemover::Trigger() {
     if (valid) {
-        for (const auto& tx1Entry : tx1s)
-            pool.removeRecursive(tx1Entry->GetTx(), removed);
+        for (const auto& tx1 : tx1s)
+            pool.removeRecursive(tx1.second, removed);
     }
 }
 
@@ -6,6 +6,8 @@
 
 #include "respend/respendaction.h"
 
+#include <map>
+
 namespace respend {
 
 // Removes any conflicting txes from the mempool
@@ -14,7 +16,7 @@ class MempoolRemover : public RespendAction {
         MempoolRemover(CTxMemPool& pool, std::list<CTransaction>& removed);
 
         bool AddOutpointConflict(
-                const COutPoint&, const CTxMemPool::txiter,
+                const COutPoint&, const CTransaction&,
                 const CTransaction& respendTx,
                 bool seenBefore, bool isEquivalent) override;
 
@@ -27,7 +29,7 @@ class MempoolRemover : public RespendAction {
     private:
         CTxMemPool& pool;
         std::list<CTransaction>& removed;
-        CTxMemPool::setEntries tx1s;
+        std::map<uint256, CTransaction> tx1s;
         bool valid;
 };
 
@@ -20,8 +20,8 @@ class RespendAction {
         virtual bool AddOutpointConflict(
                 // conflicting outpoint
                 const COutPoint& out,
-                // Existing mempool entry
-                const CTxMemPool::txiter mempoolEntry,
+                // Transaction in the mempool spending it
+                const CTransaction& originalTx,
                 // Current TX that is respending
                 const CTransaction& respendTx,
                 // If we've seen a valid tx respending this output before
@@ -36,6 +36,9 @@ class RespendAction {
         virtual void SetValid(bool) = 0;
         // Action should do its thing now.
         virtual void Trigger() = 0;
+        // If the action may be triggered later on a background thread,
+        // rather than before the transaction is done with.
+        virtual bool IsAsync() const { return false; }
 };
 inline RespendAction::~RespendAction() { }
 
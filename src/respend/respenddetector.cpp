@@ -9,9 +9,12 @@
 #include "respend/respendlogger.h"
 #include "respend/respendrelayer.h"
 #include "respend/walletnotifier.h"
+#include "scheduler.h"
 #include "util.h"
+#include "utiltime.h"
 
 #include <algorithm>
+#include <condition_variable>
 
 namespace respend {
 
@@ -34,9 +37,70 @@ std::vector<RespendActionPtr> CreateDefaultActions(CConnman* connman) {
     return actions;
 }
 
+namespace {
+
+std::mutex csAsync;
+std::condition_variable condAsyncDone;
+CScheduler* pScheduler = nullptr;
+CScheduler::Strand strand = CScheduler::NO_STRAND;
+size_t nAsyncPending = 0;
+
+std::atomic<uint64_t> nRespendsDetected(0);
+std::atomic<uint64_t> nActionsRun(0);
+std::atomic<int64_t> nActionMicros(0);
+std::atomic<int64_t> nActionMaxMicros(0);
+
+void TriggerAction(RespendAction& a, int64_t nDetectedTime) {
+    try {
+        a.Trigger();
+    }
+    catch (const std::exception& e) {
+        LogPrintf("respend: ERROR - respend action threw: %s\n", e.what());
+    }
+    if (!nDetectedTime)
+        return;
+    int64_t nLatency = GetTimeMicros() - nDetectedTime;
+    ++nActionsRun;
+    nActionMicros += nLatency;
+    int64_t nMax = nActionMaxMicros;
+    while (nLatency > nMax && !nActionMaxMicros.compare_exchange_weak(nMax, nLatency)) { }
+}
+
+bool QueueAction(RespendActionPtr a, int64_t nDetectedTime) {
+    std::lock_guard<std::mutex> lock(csAsync);
+    if (!pScheduler)
+        return false;
+    ++nAsyncPending;
+    pScheduler->schedule([a, nDetectedTime]() {
+        TriggerAction(*a, nDetectedTime);
+        std::lock_guard<std::mutex> lock(csAsync);
+        if (--nAsyncPending == 0)
+            condAsyncDone.notify_all();
+    }, boost::chrono::system_clock::now(), "respend", strand);
+    return true;
+}
+
+} // ns anon
+
+void StartAsyncActions(CScheduler& scheduler) {
+    std::lock_guard<std::mutex> lock(csAsync);
+    pScheduler = &scheduler;
+    strand = scheduler.newStrand();
+}
+
+void StopAsyncActions() {
+    std::unique_lock<std::mutex> lock(csAsync);
+    pScheduler = nullptr;
+    condAsyncDone.wait(lock, []() { return nAsyncPending == 0; });
+}
+
+RespendStats GetRespendStats() {
+    return RespendStats{nRespendsDetected, nActionsRun, nActionMicros, nActionMaxMicros};
+}
+
 RespendDetector::RespendDetector(
         const CTxMemPool& pool, const CTransaction& tx,
-        std::vector<RespendActionPtr> actions) : actions(actions)
+        std::vector<RespendActionPtr> actions) : nDetectedTime(0), actions(actions)
 {
     {
         std::lock_guard<std::mutex> lock(respentBeforeMutex);
@@ -51,46 +115,67 @@ RespendDetector::~RespendDetector() {
     // Time for actions to perform their task using the (limited)
     // information they've gathered.
     for (auto& a : actions) {
-        try {
-            a->Trigger();
-        }
-        catch (const std::exception& e) {
-            LogPrintf("respend: ERROR - respend action threw: %s\n", e.what());
-        }
+        if (IsRespend() && a->IsAsync() && QueueAction(a, nDetectedTime))
+            continue;
+        TriggerAction(*a, nDetectedTime);
    }
 }
 
 void RespendDetector::CheckForRespend(
         const CTxMemPool& pool, const CTransaction& tx) {
 
-    LOCK(pool.cs); // protect pool.mapNextTx
-
-    for (const CTxIn& in : tx.vin)
+    // Copy what the actions need, so that they run without the mempool
+    // lock held.
+    std::vector<std::pair<COutPoint, size_t> > conflicts;
+    std::vector<CTransaction> originals;
     {
-        const COutPoint outpoint = in.prevout;
+        LOCK(pool.cs); // protect pool.mapNextTx
 
-        // Is there a conflicting spend?
-        auto spendIter = pool.mapNextTx.find(outpoint);
-        if (spendIter == pool.mapNextTx.end())
-            continue;
-
-        conflictingOutpoints.push_back(outpoint);
+        for (const CTxIn& in : tx.vin)
+        {
+            const COutPoint outpoint = in.prevout;
+
+            // Is there a conflicting spend?
+            auto spendIter = pool.mapNextTx.find(outpoint);
+            if (spendIter == pool.mapNextTx.end())
+                continue;
+
+            conflictingOutpoints.push_back(outpoint);
+
+            const uint256& originalHash = spendIter->second.ptx->GetHash();
+            auto original = std::find_if(originals.begin(), originals.end(),
+                    [&originalHash](const CTransaction& o) { return o.GetHash() == originalHash; });
+            if (original == originals.end()) {
+                CTxMemPool::txiter poolIter = pool.mapTx.find(originalHash);
+                if (poolIter == pool.mapTx.end() || poolIter->GetTx() == tx)
+                    continue;
+                original = originals.insert(originals.end(), poolIter->GetTx());
+            }
+            conflicts.push_back(std::make_pair(outpoint, original - originals.begin()));
+        }
+    }
+    if (conflictingOutpoints.empty())
+        return;
+    ++nRespendsDetected;
+    nDetectedTime = GetTimeMicros();
 
-        CTxMemPool::txiter poolIter = pool.mapTx.find(spendIter->second.ptx->GetHash());
-        if (poolIter == pool.mapTx.end() || poolIter->GetTx() == tx)
-            continue;
+    std::vector<bool> seen(conflicts.size());
+    {
+        std::lock_guard<std::mutex> lock(respentBeforeMutex);
+        for (size_t i = 0; i < conflicts.size(); ++i)
+            seen[i] = respentBefore->contains(conflicts[i].first);
+    }
 
+    for (size_t i = 0; i < conflicts.size(); ++i)
+    {
+        const CTransaction& originalTx = originals[conflicts[i].second];
+        const bool isEquivalent = tx.IsEquivalentTo(originalTx);
         bool collectMore = false;
-        bool seen;
-        {
-            std::lock_guard<std::mutex> lock(respentBeforeMutex);
-            seen = respentBefore->contains(outpoint);
-        }
         for (auto& a : actions) {
             // Actions can return true if they want to check more
             // outpoints for conflicts.
-            bool m = a->AddOutpointConflict(outpoint, poolIter, tx, seen,
-                                                   tx.IsEquivalentTo(poolIter->GetTx()));
+            bool m = a->AddOutpointConflict(conflicts[i].first, originalTx, tx,
+                                            seen[i], isEquivalent);
             collectMore = collectMore || m;
         }
         if (!collectMore)
@@ -11,6 +11,7 @@
 #include <mutex>
 
 class CConnman;
+class CScheduler;
 class CTxMemPool;
 class CTransaction;
 class CRollingBloomFilter;
@@ -19,6 +20,22 @@ namespace respend {
 
 std::vector<RespendActionPtr> CreateDefaultActions(CConnman*);
 
+// Trigger the actions that allow it (relaying, wallet notification) on the
+// scheduler, so they don't hold up transaction validation. Until started,
+// and after stopping, all actions are triggered right away.
+void StartAsyncActions(CScheduler& scheduler);
+// Waits for the actions already queued to finish.
+void StopAsyncActions();
+
+struct RespendStats {
+    uint64_t nDetected;
+    uint64_t nActions;
+    //! Time from detecting a respend until its actions finished
+    int64_t nActionMicros;
+    int64_t nActionMaxMicros;
+};
+RespendStats GetRespendStats();
+
 // Detects if a transaction is in conflict with mempool, and feeds various
 // actions with data about the respend. Finally triggers the actions.
 class RespendDetector {
@@ -37,6 +54,7 @@ class RespendDetector {
 
     private:
         std::vector<COutPoint> conflictingOutpoints;
+        int64_t nDetectedTime;
 
         // Outputs we've already seen in valid double spending transactions
         static std::unique_ptr<CRollingBloomFilter> respentBefore;
@@ -13,10 +13,10 @@ RespendLogger::RespendLogger() :
 }
 
 bool RespendLogger::AddOutpointConflict(
-        const COutPoint&, const CTxMemPool::txiter mempoolEntry,
+        const COutPoint&, const CTransaction& originalTx,
         const CTransaction& respendTx, bool seen, bool isEquivalent)
 {
-    orig = mempoolEntry->GetTx().GetHash().ToString();
+    orig = originalTx.GetHash().ToString();
     respend = respendTx.GetHash().ToString();
     equivalent = isEquivalent;
     newConflict = newConflict || !seen;
@@ -53,7 +53,7 @@ RespendRelayer::RespendRelayer(CConnman* connman) :
 }
 
 bool RespendRelayer::AddOutpointConflict(
-        const COutPoint&, const CTxMemPool::txiter,
+        const COutPoint&, const CTransaction&,
         const CTransaction& respendTx,
         bool seenBefore, bool isEquivalent)
 {
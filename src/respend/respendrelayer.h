@@ -16,7 +16,7 @@ class RespendRelayer : public RespendAction {
         RespendRelayer(CConnman*);
 
         bool AddOutpointConflict(
-                const COutPoint&, const CTxMemPool::txiter,
+                const COutPoint&, const CTransaction&,
                 const CTransaction& respendTx,
                 bool seenBefore, bool isEquivalent) override;
 
@@ -24,6 +24,7 @@ class RespendRelayer : public RespendAction {
         void SetValid(bool v) override;
 
         void Trigger() override;
+        bool IsAsync() const override { return true; }
 
     private:
         bool interesting;
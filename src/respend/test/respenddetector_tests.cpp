@@ -5,11 +5,13 @@
 #include "random.h"
 #include "respend/respendaction.h"
 #include "respend/respenddetector.h"
+#include "scheduler.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 using namespace respend;
 
@@ -19,13 +21,14 @@ class DummyRespendAction : public RespendAction {
     public:
         DummyRespendAction() : addOutpointCalls(0), respentBefore(false),
                                isEquivalent(false), triggered(false),
-                               returnInteresting(false), valid(false)
+                               returnInteresting(false), valid(false),
+                               async(false)
         {
         }
 
         bool AddOutpointConflict(
                 const COutPoint& out,
-                const CTxMemPool::txiter mempoolEntry,
+                const CTransaction& originalTx,
                 const CTransaction& respendTx,
                 bool respentBefore,
                 bool isEquivalent) override
@@ -45,6 +48,9 @@ class DummyRespendAction : public RespendAction {
         void Trigger() override {
             triggered = true;
         }
+        bool IsAsync() const override {
+            return async;
+        }
 
         int addOutpointCalls;
         bool respentBefore;
@@ -52,6 +58,7 @@ class DummyRespendAction : public RespendAction {
         bool triggered;
         bool returnInteresting;
         bool valid;
+        bool async;
 };
 
 class RespendFixture : public BasicTestingSetup {
@@ -156,6 +163,46 @@ BOOST_AUTO_TEST_CASE(triggers_actions) {
     BOOST_CHECK(dummyaction->triggered);
 }
 
+BOOST_AUTO_TEST_CASE(async_actions) {
+    CMutableTransaction tx1 = CreateRandomTx();
+    CMutableTransaction tx2 = tx1;
+    tx2.vout[0].scriptPubKey = CreateRandomTx().vout[0].scriptPubKey;
+
+    TestMemPoolEntryHelper entry;
+    mempool.addUnchecked(tx1.GetHash(), entry.FromTx(tx1));
+
+    CScheduler scheduler;
+    StartAsyncActions(scheduler);
+    auto syncaction = std::make_shared<DummyRespendAction>();
+    dummyaction->async = true;
+    RespendStats before = GetRespendStats();
+    {
+        RespendDetector detector(mempool, tx2, { dummyaction, syncaction });
+        BOOST_CHECK(detector.IsRespend());
+    }
+    // The async action waits for the scheduler.
+    BOOST_CHECK(syncaction->triggered);
+    BOOST_CHECK(!dummyaction->triggered);
+
+    boost::thread t(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    StopAsyncActions();
+    BOOST_CHECK(dummyaction->triggered);
+    scheduler.stop();
+    t.join();
+
+    RespendStats after = GetRespendStats();
+    BOOST_CHECK_EQUAL(after.nDetected - before.nDetected, 1);
+    BOOST_CHECK_EQUAL(after.nActions - before.nActions, 2);
+    BOOST_CHECK(after.nActionMaxMicros >= 0);
+
+    // Once stopped, actions are triggered right away.
+    dummyaction->triggered = false;
+    {
+        RespendDetector detector(mempool, tx2, { dummyaction });
+    }
+    BOOST_CHECK(dummyaction->triggered);
+}
+
 BOOST_AUTO_TEST_CASE(is_interesting) {
     // Respend is interesting when at least one action finds it interesting.
     auto action1 = new DummyRespendAction;
@@ -18,7 +18,7 @@ BOOST_AUTO_TEST_CASE(not_interesting) {
     CConnman connman(0, 0);
     RespendRelayer r(&connman);
     BOOST_CHECK(!r.IsInteresting());
-    CTxMemPool::txiter dummy;
+    CTransaction dummy;
     bool lookAtMore;
 
     lookAtMore = r.AddOutpointConflict(COutPoint{}, dummy, CTransaction{},
@@ -35,7 +35,7 @@ BOOST_AUTO_TEST_CASE(not_interesting) {
 BOOST_AUTO_TEST_CASE(is_interesting) {
     CConnman connman(0, 0);
     RespendRelayer r(&connman);
-    CTxMemPool::txiter dummy;
+    CTransaction dummy;
     bool lookAtMore;
 
     lookAtMore = r.AddOutpointConflict(COutPoint{}, dummy, CTransaction{}, false, false);
@@ -44,7 +44,7 @@ BOOST_AUTO_TEST_CASE(is_interesting) {
 }
 
 BOOST_AUTO_TEST_CASE(triggers_correctly) {
-    CTxMemPool::txiter dummy;
+    CTransaction dummy;
     CMutableTransaction respend;
     respend.vin.resize(1);
     respend.vin[0].prevout.n = 0;
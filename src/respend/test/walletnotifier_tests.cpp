@@ -16,7 +16,7 @@ BOOST_FIXTURE_TEST_SUITE(respend_walletnotifier_tests, BasicTestingSetup);
 BOOST_AUTO_TEST_CASE(not_interesting) {
     WalletNotifier w;
     BOOST_CHECK(!w.IsInteresting());
-    CTxMemPool::txiter dummy;
+    CTransaction dummy;
     bool lookAtMore;
 
     lookAtMore = w.AddOutpointConflict(COutPoint{}, dummy, CTransaction{},
@@ -32,7 +32,7 @@ BOOST_AUTO_TEST_CASE(not_interesting) {
 
 BOOST_AUTO_TEST_CASE(is_interesting) {
     WalletNotifier w;
-    CTxMemPool::txiter dummy;
+    CTransaction dummy;
     bool lookAtMore;
 
     lookAtMore = w.AddOutpointConflict(COutPoint{}, dummy, CTransaction{}, false, false);
@@ -51,7 +51,7 @@ BOOST_AUTO_TEST_CASE(triggers_correctly) {
     };
     GetMainSignals().SyncTransaction.connect(dummyslot);
 
-    CTxMemPool::txiter dummy;
+    CTransaction dummy;
     CMutableTransaction respend;
     respend.vin.resize(1);
     respend.vin[0].prevout.n = 0;
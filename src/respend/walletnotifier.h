@@ -14,13 +14,14 @@ class WalletNotifier : public RespendAction {
         WalletNotifier();
 
         bool AddOutpointConflict(
-                const COutPoint&, const CTxMemPool::txiter,
+                const COutPoint&, const CTransaction&,
                 const CTransaction& respendTx,
                 bool seenBefore, bool isEquivalent) override;
 
         bool IsInteresting() const override;
         void SetValid(bool v) override;
         void Trigger() override;
+        bool IsAsync() const override { return true; }
 
     private:
         CTransaction respendTx;
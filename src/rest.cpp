@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "bip64_getutxo.h"
+#include "blockfilterindex.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
@@ -174,6 +175,166 @@ static bool rest_headers(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+// Resolve the filter type of a block filter request against the running index.
+static bool GetBlockFilterIndex(HTTPRequest* req, const std::string& strType, BlockFilterIndex*& index)
+{
+    BlockFilterType type;
+    if (!BlockFilterTypeByName(strType, type))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Unknown filter type: " + strType);
+    index = g_blockfilterindex.get();
+    if (!index || index->GetFilterType() != type)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Index is not enabled for filter type " + strType);
+    return true;
+}
+
+static bool rest_blockfilter(HTTPRequest* req,
+                             const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilter/<filtertype>/<blockhash>.<ext>.");
+
+    BlockFilterIndex* index;
+    if (!GetBlockFilterIndex(req, path[0], index))
+        return false;
+
+    uint256 hash;
+    if (!ParseHashStr(path[1], hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[1]);
+
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end())
+            return RESTERR(req, HTTP_NOT_FOUND, path[1] + " not found");
+        pindex = it->second;
+    }
+
+    BlockFilter filter;
+    if (!index->LookupFilter(pindex, filter))
+        return RESTERR(req, HTTP_NOT_FOUND, "Filter not found. Block filter index may still be syncing.");
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssFilter(SER_NETWORK, PROTOCOL_VERSION);
+        ssFilter << filter;
+        string binaryFilter = ssFilter.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryFilter);
+        return true;
+    }
+    case RF_HEX: {
+        CDataStream ssFilter(SER_NETWORK, PROTOCOL_VERSION);
+        ssFilter << filter;
+        string strHex = HexStr(ssFilter.begin(), ssFilter.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+    case RF_JSON: {
+        UniValue ret(UniValue::VOBJ);
+        ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+        string strJSON = ret.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    }
+    }
+}
+
+static bool rest_blockfilterheaders(HTTPRequest* req,
+                                    const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 3)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilterheaders/<filtertype>/<count>/<blockhash>.<ext>.");
+
+    BlockFilterIndex* index;
+    if (!GetBlockFilterIndex(req, path[0], index))
+        return false;
+
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > 2000)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Header count out of range: " + path[1]);
+
+    uint256 hash;
+    if (!ParseHashStr(path[2], hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[2]);
+
+    // Filter headers of the active chain, starting at the given block.
+    std::vector<const CBlockIndex*> blocks;
+    blocks.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        while (pindex != NULL && chainActive.Contains(pindex)) {
+            blocks.push_back(pindex);
+            if (blocks.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    std::vector<uint256> headers;
+    headers.reserve(blocks.size());
+    for (const CBlockIndex* pindex : blocks) {
+        uint256 header;
+        if (!index->LookupFilterHeader(pindex, header))
+            break;
+        headers.push_back(header);
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        for (const uint256& header : headers)
+            ssHeader << header;
+        string binaryHeader = ssHeader.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryHeader);
+        return true;
+    }
+    case RF_HEX: {
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        for (const uint256& header : headers)
+            ssHeader << header;
+        string strHex = HexStr(ssHeader.begin(), ssHeader.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+    case RF_JSON: {
+        UniValue jsonHeaders(UniValue::VARR);
+        for (const uint256& header : headers)
+            jsonHeaders.push_back(header.GetHex());
+        string strJSON = jsonHeaders.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    }
+    }
+}
+
 static bool rest_block(HTTPRequest* req,
                        const std::string& strURIPart,
                        bool showTxDetails)
@@ -472,22 +633,10 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     if (vOutPoints.size() > MAX_GETUTXOS_OUTPOINTS)
         return RESTERR(req, HTTP_BAD_REQUEST, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", MAX_GETUTXOS_OUTPOINTS, vOutPoints.size()));
 
-    std::unique_ptr<bip64::UTXORetriever> utxos;
-    int tipHeight;
-    uint256 tipHash;
-    {
-        LOCK(cs_main);
-        tipHeight = chainActive.Height();
-        if (chainActive.Tip() != nullptr)
-            tipHash = chainActive.Tip()->GetBlockHash();
-        if (fCheckMemPool) {
-            LOCK(mempool.cs);
-            utxos.reset(new bip64::UTXORetriever(vOutPoints, *pcoinsTip, &mempool));
-        }
-        else {
-            utxos.reset(new bip64::UTXORetriever(vOutPoints, *pcoinsTip, nullptr));
-        }
-    }
+    std::unique_ptr<bip64::UTXORetriever> utxos(
+        new bip64::UTXORetriever(vOutPoints, fCheckMemPool ? &mempool : nullptr));
+    const int tipHeight = utxos->GetTipHeight();
+    const uint256 tipHash = utxos->GetTipHash();
 
     switch (rf) {
     case RF_BINARY: {
@@ -567,6 +716,8 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/blockfilter/", rest_blockfilter},
+      {"/rest/blockfilterheaders/", rest_blockfilterheaders},
       {"/rest/getutxos", rest_getutxos},
 };
 
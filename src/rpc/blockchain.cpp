@@ -4,9 +4,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "checkpoints.h"
+#include "coinswarmup.h"
 #include "consensus/validation.h"
+#include "dbwrapper.h"
 #include "main.h"
 #include "primitives/transaction.h"
+#include "respend/respenddetector.h"
 #include "rpc/server.h"
 #include "sync.h"
 #include "util.h"
@@ -459,16 +462,13 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
 }
 
 //! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+static bool GetUTXOStats(const CCoinsViewSnapshot& view, CCoinsStats &stats)
 {
-    boost::scoped_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view.Cursor());
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
+    stats.nHeight = view.GetHeight();
     ss << stats.hashBlock;
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
@@ -492,7 +492,7 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         ApplyStats(stats, ss, prevkey, outputs);
     }
     stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
+    stats.nDiskSize = view.EstimateSize();
     return true;
 }
 
@@ -518,13 +518,11 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
-    LOCK(cs_main);
-
     UniValue ret(UniValue::VOBJ);
 
+    // Read from a snapshot, so validation is not held up meanwhile.
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsTip, stats)) {
+    if (GetUTXOStats(*GetCoinsSnapshot(), stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
@@ -574,8 +572,6 @@ UniValue gettxout(const JSONRPCRequest& request)
             + HelpExampleRpc("gettxout", "\"txid\", 1")
         );
 
-    LOCK(cs_main);
-
     UniValue ret(UniValue::VOBJ);
 
     std::string strHash = request.params[0].get_str();
@@ -586,26 +582,39 @@ UniValue gettxout(const JSONRPCRequest& request)
     if (request.params.size() > 2)
         fMempool = request.params[2].get_bool();
 
+    auto lookup = [&](CCoinsView* viewChain, Coin& coin) {
+        if (fMempool) {
+            LOCK(mempool.cs);
+            CCoinsViewMemPool view(viewChain, mempool);
+            return view.GetCoin(out, coin) && !mempool.isSpent(out); // TODO: filtering spent coins should be done by the CCoinsViewMemPool
+        }
+        return viewChain->GetCoin(out, coin);
+    };
+
+    // Without a snapshot of the tip, one lookup is cheaper in pcoinsTip
+    // than taking one.
     Coin coin;
-    if (fMempool) {
-        LOCK(mempool.cs);
-        CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) { // TODO: filtering spent coins should be done by the CCoinsViewMemPool
+    uint256 hashBest;
+    int nHeight;
+    std::shared_ptr<CCoinsViewSnapshot> snapshot = GetCoinsSnapshotIfCheap();
+    if (snapshot) {
+        if (!lookup(snapshot.get(), coin))
             return NullUniValue;
-        }
+        hashBest = snapshot->GetBestBlock();
+        nHeight = snapshot->GetHeight();
     } else {
-        if (!pcoinsTip->GetCoin(out, coin)) {
+        LOCK(cs_main);
+        if (!lookup(pcoinsTip, coin))
             return NullUniValue;
-        }
+        hashBest = pcoinsTip->GetBestBlock();
+        nHeight = mapBlockIndex.find(hashBest)->second->nHeight;
     }
 
-    BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
-    CBlockIndex *pindex = it->second;
-    ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
+    ret.push_back(Pair("bestblock", hashBest.GetHex()));
     if (coin.nHeight == MEMPOOL_HEIGHT) {
         ret.push_back(Pair("confirmations", 0));
     } else {
-        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+        ret.push_back(Pair("confirmations", (int64_t)(nHeight - coin.nHeight + 1)));
     }
     ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
@@ -696,6 +705,16 @@ UniValue BIP9SoftForkDesc(const std::string& name,
     return rv;
 }
 
+/** Height of the first block on the active chain we have data for. Requires cs_main. */
+static int GetPruneHeight()
+{
+    AssertLockHeld(cs_main);
+    CBlockIndex *block = chainActive.Tip();
+    while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+        block = block->pprev;
+    return block->nHeight;
+}
+
 UniValue getblockchaininfo(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -714,6 +733,13 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
             "  \"sizelimit\" : n,          (numeric) The block size limit as of the last block\n"
+            "  \"coinswarmup\": {          (object) loading the coins cache with the coins it held before a restart, if any\n"
+            "     \"total\": xx,            (numeric) coins recorded at shutdown\n"
+            "     \"read\": xx,             (numeric) coins looked up so far\n"
+            "     \"loaded\": xx,           (numeric) coins added to the cache\n"
+            "     \"done\": xx,             (boolean) whether it finished\n"
+            "     \"time_ms\": xx           (numeric) time taken so far\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -755,6 +781,16 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
     obj.push_back(Pair("pruned",                fPruneMode));
     obj.push_back(Pair("sizelimit",             chainActive.Tip()->nMaxBlockSize));
+    if (g_coinswarmup) {
+        CoinsWarmupStats stats = g_coinswarmup->GetStats();
+        UniValue warmup(UniValue::VOBJ);
+        warmup.push_back(Pair("total", (uint64_t)stats.nTotal));
+        warmup.push_back(Pair("read", (uint64_t)stats.nRead));
+        warmup.push_back(Pair("loaded", (uint64_t)stats.nLoaded));
+        warmup.push_back(Pair("done", stats.fDone));
+        warmup.push_back(Pair("time_ms", stats.nMicros / 1000));
+        obj.push_back(Pair("coinswarmup", warmup));
+    }
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CBlockIndex* tip = chainActive.Tip();
@@ -768,13 +804,51 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
     obj.push_back(Pair("bip9_softforks", bip9_softforks));
 
     if (fPruneMode)
-    {
-        CBlockIndex *block = chainActive.Tip();
-        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
-            block = block->pprev;
+        obj.push_back(Pair("pruneheight",        GetPruneHeight()));
+    return obj;
+}
 
-        obj.push_back(Pair("pruneheight",        block->nHeight));
+UniValue pruneblockchain(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw runtime_error(
+            "pruneblockchain height ( target )\n"
+            "\nDeletes block and undo files, keeping at least the last " + strprintf("%d", nPruneKeepBlocks) + " blocks (see -prunekeepblocks).\n"
+            "Files are removed before this call returns.\n"
+            "\nArguments:\n"
+            "1. height   (numeric, required) Prune blocks up to this height, 0 for no height limit.\n"
+            "2. target   (numeric, optional, default=0) Prune the oldest files until block and undo files use less than this many MiB, 0 for no target.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"pruneheight\": xxxxx,   (numeric) height of the first block that is still stored\n"
+            "  \"size_on_disk\": xxxxx   (numeric) bytes used by block and undo files\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("pruneblockchain", "400000")
+            + HelpExampleCli("pruneblockchain", "0 10000")
+            + HelpExampleRpc("pruneblockchain", "400000")
+        );
+
+    int nHeight = request.params[0].get_int();
+    int64_t nTargetMiB = request.params.size() > 1 ? request.params[1].get_int64() : 0;
+    if (nHeight < 0 || nTargetMiB < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative height or target");
+
+    {
+        // The pass takes cs_main itself, and only briefly.
+        LOCK(cs_main);
+        if (nHeight > chainActive.Height())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Blockchain is shorter than the attempted prune height.");
     }
+
+    std::string strError;
+    if (!PruneBlockFilesTo(nHeight, nTargetMiB * 1024 * 1024, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    LOCK(cs_main);
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("pruneheight", GetPruneHeight()));
+    obj.push_back(Pair("size_on_disk", CalculateCurrentUsage()));
     return obj;
 }
 
@@ -903,6 +977,14 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
 
+    respend::RespendStats respendStats = respend::GetRespendStats();
+    UniValue respends(UniValue::VOBJ);
+    respends.push_back(Pair("detected", respendStats.nDetected));
+    respends.push_back(Pair("actions", respendStats.nActions));
+    respends.push_back(Pair("total_us", respendStats.nActionMicros));
+    respends.push_back(Pair("max_us", respendStats.nActionMaxMicros));
+    ret.push_back(Pair("respends", respends));
+
     return ret;
 }
 
@@ -917,6 +999,12 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"respends\": {               (object) Transactions double spending mempool transactions\n"
+            "    \"detected\": xxxxx         (numeric) Number detected since startup\n"
+            "    \"actions\": xxxxx          (numeric) Number of actions run on them, such as relaying\n"
+            "    \"total_us\": xxxxx         (numeric) Total time from detection until the actions finished, in microseconds\n"
+            "    \"max_us\": xxxxx           (numeric) Longest time from detection until an action finished\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -926,6 +1014,121 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+static UniValue LatencyToJSON(const CDBLatency& latency)
+{
+    UniValue histogram(UniValue::VARR);
+    for (int n = 0; n < CDBLatency::NUM_BUCKETS; n++)
+        histogram.push_back((int64_t)latency.Bucket(n));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("count", (int64_t)latency.Count()));
+    ret.push_back(Pair("total_us", (int64_t)latency.TotalMicros()));
+    ret.push_back(Pair("max_us", (int64_t)latency.MaxMicros()));
+    ret.push_back(Pair("histogram", histogram));
+    return ret;
+}
+
+UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "\nReturns operation statistics of each open database.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {                 (object) The database, e.g. chainstate or blocks/index\n"
+            "    \"read\": {               (object) Latency of reads\n"
+            "      \"count\": n,           (numeric) Number of reads\n"
+            "      \"total_us\": n,        (numeric) Total time spent, in microseconds\n"
+            "      \"max_us\": n,          (numeric) Longest read, in microseconds\n"
+            "      \"histogram\": [n,...]  (array) Number of reads taking less than 1, 2, 4, 8... microseconds\n"
+            "    },\n"
+            "    \"exists\": {...},        (object) Latency of existence checks\n"
+            "    \"writebatch\": {...},    (object) Latency of writes\n"
+            "    \"iterator_seek\": {...}, (object) Latency of iterator seeks\n"
+            "    \"iterator_next\": {...}, (object) Latency of iterator steps\n"
+            "    \"bytes_read\": n,        (numeric) Bytes of values read\n"
+            "    \"bytes_written\": n,     (numeric) Bytes written\n"
+            "    \"blockcache_size\": n,   (numeric) Size of the block cache\n"
+            "    \"blockcache_lookups\": n, (numeric) Lookups in the block cache\n"
+            "    \"blockcache_hits\": n,   (numeric) Lookups that found the block\n"
+            "    \"files_per_level\": [n,...], (array) Number of table files at each level\n"
+            "    \"leveldb_stats\": \"...\" (string) LevelDB's compaction statistics\n"
+            "  }, ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    UniValue ret(UniValue::VOBJ);
+    ForEachDBWrapper([&ret](CDBWrapper& db) {
+        const CDBStats& stats = db.GetStats();
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("read", LatencyToJSON(stats.read)));
+        obj.push_back(Pair("exists", LatencyToJSON(stats.exists)));
+        obj.push_back(Pair("writebatch", LatencyToJSON(stats.writeBatch)));
+        obj.push_back(Pair("iterator_seek", LatencyToJSON(stats.iterSeek)));
+        obj.push_back(Pair("iterator_next", LatencyToJSON(stats.iterNext)));
+        obj.push_back(Pair("bytes_read", (int64_t)stats.nBytesRead));
+        obj.push_back(Pair("bytes_written", (int64_t)stats.nBytesWritten));
+        obj.push_back(Pair("blockcache_size", (int64_t)db.GetBlockCacheSize()));
+        obj.push_back(Pair("blockcache_lookups", (int64_t)stats.nCacheLookups));
+        obj.push_back(Pair("blockcache_hits", (int64_t)stats.nCacheHits));
+
+        UniValue levels(UniValue::VARR);
+        for (int level = 0; ; level++) {
+            std::string files = db.GetProperty(strprintf("leveldb.num-files-at-level%d", level));
+            if (files.empty())
+                break;
+            levels.push_back(atoi(files));
+        }
+        obj.push_back(Pair("files_per_level", levels));
+        obj.push_back(Pair("leveldb_stats", db.GetProperty("leveldb.stats")));
+
+        ret.push_back(Pair(db.GetName(), obj));
+    });
+    return ret;
+}
+
+UniValue compactdb(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw runtime_error(
+            "compactdb \"name\" ( \"begin\" \"end\" )\n"
+            "\nCompacts a key range of a database. This can take a long time, and\n"
+            "other users of the database may be slowed down meanwhile.\n"
+            "\nArguments:\n"
+            "1. \"name\"     (string, required) The database, as listed by getdbstats\n"
+            "2. \"begin\"    (string, optional) Hex of the first serialized key. Default is the start of the database\n"
+            "3. \"end\"      (string, optional) Hex of the last serialized key. Default is the end of the database\n"
+            "\nExamples:\n"
+            + HelpExampleCli("compactdb", "\"chainstate\"")
+            + HelpExampleRpc("compactdb", "\"blocks/index\", \"62\", \"63\"")
+        );
+
+    const std::string name = request.params[0].get_str();
+    std::string keys[2];
+    for (size_t i = 1; i < request.params.size(); i++) {
+        const std::string& hex = request.params[i].get_str();
+        if (!IsHex(hex) && !hex.empty())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Key must be hexadecimal");
+        std::vector<unsigned char> key = ParseHex(hex);
+        keys[i - 1].assign(key.begin(), key.end());
+    }
+
+    // Compaction can take minutes; don't keep the statistics waiting.
+    bool fFound = WithDBWrapper(name, [&](CDBWrapper& db) {
+        int64_t nStart = GetTimeMillis();
+        db.CompactRange(keys[0], keys[1]);
+        LogPrintf("Compacted %s in %dms\n", name, GetTimeMillis() - nStart);
+    });
+    if (!fFound)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown database " + name);
+
+    return NullUniValue;
+}
+
 UniValue invalidateblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1019,6 +1222,9 @@ static const CRPCCommand commands[] =
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
     { "blockchain",         "verifychain",            &verifychain,            true,  {"checklevel","nblocks"} },
+    { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height","target"} },
+    { "blockchain",         "getdbstats",             &getdbstats,             true,  {} },
+    { "blockchain",         "compactdb",              &compactdb,              true,  {"name","begin","end"} },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        true,  {"blockhash"} },
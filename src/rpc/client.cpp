@@ -97,10 +97,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "importaddress", 2, "rescan" },
     { "importaddress", 3, "p2sh" },
     { "importpubkey", 2, "rescan" },
+    { "pruneblockchain", 0, "height" },
+    { "pruneblockchain", 1, "target" },
     { "verifychain", 0, "checklevel" },
     { "verifychain", 1, "nblocks" },
     { "keypoolrefill", 0, "newsize" },
     { "getrawmempool", 0, "verbose" },
+    { "getmemoryinfo", 0, "verbose" },
     { "estimatefee", 0, "nblocks" },
     { "prioritisetransaction", 1, "fee_delta" },
     // Echo with conversion (For testing only)
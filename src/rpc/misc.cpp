@@ -5,13 +5,17 @@
 
 #include "base58.h"
 #include "clientversion.h"
+#include "coins.h"
+#include "core_memusage.h"
 #include "dstencode.h"
 #include "init.h"
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "timedata.h"
+#include "txmempool.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
@@ -369,6 +373,105 @@ UniValue verifymessage(const JSONRPCRequest& request)
     return (pubkey.GetID() == *keyID);
 }
 
+UniValue getmemoryinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw runtime_error(
+            "getmemoryinfo ( verbose )\n"
+            "\nReturns an object with the approximate heap usage (in bytes) of the node's subsystems.\n"
+            "\nArguments:\n"
+            "1. verbose           (boolean, optional, default=false) Include the buffer usage of each peer\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blockindex\": xxxxx,       (numeric) block index entries and candidate set\n"
+            "  \"coinscache\": xxxxx,       (numeric) UTXO cache (see -dbcache)\n"
+            "  \"mempool\": xxxxx,          (numeric) transaction memory pool (see -maxmempool)\n"
+            "  \"orphans\": xxxxx,          (numeric) orphan transaction pool\n"
+            "  \"thinblocks\": xxxxx,       (numeric) thin blocks under construction\n"
+            "  \"relay\": xxxxx,            (numeric) recently relayed transactions (mapRelay)\n"
+            "  \"sigcache\": xxxxx,         (numeric) signature cache (see -maxsigcachesize)\n"
+            "  \"addrman\": xxxxx,          (numeric) address manager tables\n"
+            "  \"peers\": {\n"
+            "    \"sendbuffers\": xxxxx,    (numeric) queued outgoing messages, all peers\n"
+            "    \"recvbuffers\": xxxxx,    (numeric) received messages waiting to be processed, all peers\n"
+            "    \"nodes\": [               (array, verbose only)\n"
+            "      {\n"
+            "        \"id\": n,             (numeric) peer index\n"
+            "        \"sendbuffer\": xxxxx, (numeric)\n"
+            "        \"recvbuffer\": xxxxx  (numeric)\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  },\n"
+            "  \"wallet\": xxxxx,           (numeric) wallet transactions (only if wallet is enabled)\n"
+            "  \"total\": xxxxx             (numeric) sum of the above\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmemoryinfo", "")
+            + HelpExampleCli("getmemoryinfo", "true")
+            + HelpExampleRpc("getmemoryinfo", "")
+        );
+
+    const bool fVerbose = request.params.size() > 0 && request.params[0].get_bool();
+
+    UniValue obj(UniValue::VOBJ);
+    size_t nTotal = 0;
+    auto add = [&obj, &nTotal](const char* name, size_t usage) {
+        obj.push_back(Pair(name, (uint64_t)usage));
+        nTotal += usage;
+    };
+
+    {
+        LOCK(cs_main);
+        add("blockindex", BlockIndexDynamicMemoryUsage());
+        add("coinscache", pcoinsTip ? pcoinsTip->DynamicMemoryUsage() : 0);
+        add("mempool", mempool.DynamicMemoryUsage());
+        add("orphans", OrphanTxDynamicMemoryUsage());
+        add("thinblocks", ThinBlocksDynamicMemoryUsage());
+    }
+    add("relay", RelayMapDynamicMemoryUsage());
+    add("sigcache", SignatureCacheDynamicMemoryUsage());
+
+    UniValue peers(UniValue::VOBJ);
+    UniValue nodes(UniValue::VARR);
+    size_t nSendBuffers = 0;
+    size_t nRecvBuffers = 0;
+    if (g_connman) {
+        add("addrman", g_connman->GetAddressMemoryUsage());
+        g_connman->ForEachNode([&](CNode* pnode) {
+            size_t nSend = pnode->GetSendBufferUsage();
+            size_t nRecv = pnode->GetRecvBufferUsage();
+            nSendBuffers += nSend;
+            nRecvBuffers += nRecv;
+            if (!fVerbose)
+                return;
+            UniValue node(UniValue::VOBJ);
+            node.push_back(Pair("id", pnode->GetId()));
+            node.push_back(Pair("sendbuffer", (uint64_t)nSend));
+            node.push_back(Pair("recvbuffer", (uint64_t)nRecv));
+            nodes.push_back(node);
+        });
+    }
+    peers.push_back(Pair("sendbuffers", (uint64_t)nSendBuffers));
+    peers.push_back(Pair("recvbuffers", (uint64_t)nRecvBuffers));
+    if (fVerbose)
+        peers.push_back(Pair("nodes", nodes));
+    obj.push_back(Pair("peers", peers));
+    nTotal += nSendBuffers + nRecvBuffers;
+
+#ifdef ENABLE_WALLET
+    if (pwalletMain) {
+        LOCK(pwalletMain->cs_wallet);
+        size_t usage = memusage::DynamicUsage(pwalletMain->mapWallet);
+        for (auto& w : pwalletMain->mapWallet)
+            usage += RecursiveDynamicUsage(static_cast<const CTransaction&>(w.second));
+        add("wallet", usage);
+    }
+#endif
+
+    obj.push_back(Pair("total", (uint64_t)nTotal));
+    return obj;
+}
+
 UniValue setmocktime(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -416,6 +519,7 @@ static const CRPCCommand commands[] =
     { "util",               "validateaddress",        &validateaddress,        true,  {"address"} }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true,  {"nrequired","keys"} },
     { "util",               "verifymessage",          &verifymessage,          true,  {"address","signature","message"} },
+    { "control",            "getmemoryinfo",          &getmemoryinfo,          true,  {"verbose"} },
 
     /* Not shown in help */
     { "hidden",             "setmocktime",            &setmocktime,            true,  {"timestamp"}},
@@ -11,6 +11,7 @@
 #include "protocol.h"
 #include "sync.h"
 #include "timedata.h"
+#include "txrequest.h"
 #include "util.h"
 #include "version.h"
 
@@ -94,7 +95,14 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"requestcost\": {          (json object) What serving the peer's requests cost\n"
+            "      \"cputime\": n,            (numeric) Processing time spent on them, in seconds\n"
+            "      \"diskread\": n,           (numeric) Bytes read from disk for them\n"
+            "      \"budget\": n,             (numeric) Seconds of processing left in the peer's budget, negative when over budget\n"
+            "      \"throttled\": n           (numeric) Times the peer ran out of budget and had to wait\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -147,6 +155,12 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        UniValue cost(UniValue::VOBJ);
+        cost.push_back(Pair("cputime", stats.requestCost.nCPUMicros * 0.000001));
+        cost.push_back(Pair("diskread", stats.requestCost.nDiskBytes));
+        cost.push_back(Pair("budget", stats.requestCost.nBudget * 0.000001));
+        cost.push_back(Pair("throttled", stats.requestCost.nThrottled));
+        obj.push_back(Pair("requestcost", cost));
 
         ret.push_back(obj);
     }
@@ -448,6 +462,19 @@ UniValue getnetworkinfo(const JSONRPCRequest& request)
             "  ,...\n"
             "  ],\n"
             "  \"relayfee\": x.xxxxxxxx,                (numeric) minimum relay fee for non-free transactions in bch/kb\n"
+            "  \"txrequests\": {                        (object) transactions announced by peers\n"
+            "    \"tracked\": xxx,                      (numeric) announcements not yet fetched or given up on\n"
+            "    \"requested\": xxx,                    (numeric) transactions requested since startup\n"
+            "    \"timedout\": xxx,                     (numeric) requests that timed out, so another peer was asked\n"
+            "    \"duplicatesavoided\": xxx             (numeric) announcements not requested as the transaction arrived from another peer\n"
+            "  },\n"
+            "  \"admission\": {                         (object) inbound connections while connection slots were exhausted, by IP group\n"
+            "    \"group\": {                           (object) the IP group, or \"default\" for IPs in no group\n"
+            "      \"evicted\": xxx,                    (numeric) peers of the group evicted for a connection of higher priority\n"
+            "      \"refused\": xxx                     (numeric) connections from the group refused\n"
+            "    }\n"
+            "    ,...\n"
+            "  },\n"
             "  \"localaddresses\": [                    (array) list of local addresses\n"
             "  {\n"
             "    \"address\": \"xxxx\",                 (string) network address\n"
@@ -476,6 +503,23 @@ UniValue getnetworkinfo(const JSONRPCRequest& request)
         obj.push_back(Pair("connections",   (int)g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL)));
     obj.push_back(Pair("networks",      GetNetworksInfo()));
     obj.push_back(Pair("relayfee",      ValueFromAmount(::minRelayTxFee.GetFeePerK())));
+    TxRequestStats txRequests = g_txrequest.GetStats();
+    UniValue txRequestsObj(UniValue::VOBJ);
+    txRequestsObj.push_back(Pair("tracked", (uint64_t)txRequests.nTracked));
+    txRequestsObj.push_back(Pair("requested", txRequests.nRequested));
+    txRequestsObj.push_back(Pair("timedout", txRequests.nTimedOut));
+    txRequestsObj.push_back(Pair("duplicatesavoided", txRequests.nDuplicatesAvoided));
+    obj.push_back(Pair("txrequests", txRequestsObj));
+    if (g_connman) {
+        UniValue admissionObj(UniValue::VOBJ);
+        for (auto& a : g_connman->GetAdmissionStats()) {
+            UniValue groupObj(UniValue::VOBJ);
+            groupObj.push_back(Pair("evicted", a.second.nEvicted));
+            groupObj.push_back(Pair("refused", a.second.nRefused));
+            admissionObj.push_back(Pair(a.first, groupObj));
+        }
+        obj.push_back(Pair("admission", admissionObj));
+    }
     UniValue localAddresses(UniValue::VARR);
     {
         LOCK(cs_mapLocalHost);
@@ -4,12 +4,16 @@
 
 #include "scheduler.h"
 
+#include <algorithm>
 #include <assert.h>
-#include <boost/bind.hpp>
 #include <boost/thread/reverse_lock.hpp>
+#include <exception>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+const CScheduler::TaskId CScheduler::NO_TASK;
+const CScheduler::Strand CScheduler::NO_STRAND;
+
+CScheduler::CScheduler() : nLastTaskId(NO_TASK), nLastStrand(NO_STRAND), nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -26,6 +30,19 @@ static boost::system_time toPosixTime(const boost::chrono::system_clock::time_po
 }
 #endif
 
+CScheduler::queue_type::iterator CScheduler::nextRunnable()
+{
+    if (busyStrands.empty())
+        return taskQueue.begin();
+
+    for (queue_type::iterator it = taskQueue.begin(); it != taskQueue.end(); ++it) {
+        Strand strand = tasks[it->second].strand;
+        if (strand == NO_STRAND || !busyStrands.count(strand))
+            return it;
+    }
+    return taskQueue.end();
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -36,42 +53,72 @@ void CScheduler::serviceQueue()
     // is called.
     while (!shouldStop()) {
         try {
-            while (!shouldStop() && taskQueue.empty()) {
+            queue_type::iterator next = nextRunnable();
+            while (!shouldStop() && next == taskQueue.end()) {
                 // Wait until there is something to do.
                 newTaskScheduled.wait(lock);
+                next = nextRunnable();
             }
+            if (shouldStop())
+                continue;
 
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
+            // Wait until either there is a new task (or a strand was
+            // released), or until the time of the next runnable task.
+            // Either way, look at the queue again.
+            if (next->first > boost::chrono::system_clock::now()) {
 // wait_until needs boost 1.50 or later; older versions have timed_wait:
 #if BOOST_VERSION < 105000
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.timed_wait(lock, toPosixTime(taskQueue.begin()->first))) {
-                // Keep waiting until timeout
-            }
+                newTaskScheduled.timed_wait(lock, toPosixTime(next->first));
 #else
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.wait_until<>(lock, taskQueue.begin()->first) != boost::cv_status::timeout) {
-                // Keep waiting until timeout
-            }
+                // Some boost versions have a conflicting overload of wait_until that returns void.
+                // Explicitly use a template here to avoid hitting that overload.
+                newTaskScheduled.wait_until<>(lock, next->first);
 #endif
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
                 continue;
+            }
+
+            const TaskId id = next->second;
+            const time_point scheduled = next->first;
+            Task& task = tasks[id];
+            taskQueue.erase(next);
+            task.fQueued = false;
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            const Function f = task.f;
+            const std::string name = task.name;
+            const Strand strand = task.strand;
+            if (strand != NO_STRAND)
+                busyStrands.insert(strand);
 
-            {
+            const boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+            const int64_t nDelayMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(
+                    boost::chrono::system_clock::now() - scheduled).count();
+            std::exception_ptr error;
+            try {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 boost::reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
                 f();
+            } catch (...) {
+                // Release the strand and the task before passing this on.
+                error = std::current_exception();
             }
+
+            if (strand != NO_STRAND) {
+                busyStrands.erase(strand);
+                newTaskScheduled.notify_all();
+            }
+            recordRun(name, boost::chrono::duration_cast<boost::chrono::microseconds>(
+                        boost::chrono::steady_clock::now() - start).count(), nDelayMicros);
+
+            std::map<TaskId, Task>::iterator t = tasks.find(id);
+            if (t != tasks.end() && !t->second.fQueued) {
+                if (t->second.nRepeatSeconds > 0 && !t->second.fCancelled && !error)
+                    enqueue(id, t->second, boost::chrono::system_clock::now() + boost::chrono::seconds(t->second.nRepeatSeconds));
+                else
+                    tasks.erase(t);
+            }
+            if (error)
+                std::rethrow_exception(error);
         } catch (...) {
             --nThreadsServicingQueue;
             throw;
@@ -92,29 +139,120 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+CScheduler::Strand CScheduler::newStrand()
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return ++nLastStrand;
+}
+
+void CScheduler::enqueue(TaskId id, Task& task, time_point t)
+{
+    task.pos = taskQueue.insert(std::make_pair(t, id));
+    task.fQueued = true;
+}
+
+CScheduler::TaskId CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t,
+                                        const std::string& name, Strand strand)
 {
+    TaskId id;
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        id = ++nLastTaskId;
+        Task& task = tasks[id];
+        task.f = f;
+        task.name = name;
+        task.strand = strand;
+        task.nRepeatSeconds = 0;
+        task.fCancelled = false;
+        enqueue(id, task, t);
     }
     newTaskScheduled.notify_one();
+    return id;
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::TaskId CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds,
+                                               const std::string& name, Strand strand)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    return schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), name, strand);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::TaskId CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds,
+                                             const std::string& name, Strand strand)
 {
-    f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    assert(deltaSeconds > 0);
+    TaskId id;
+    {
+        boost::unique_lock<boost::mutex> lock(newTaskMutex);
+        id = ++nLastTaskId;
+        Task& task = tasks[id];
+        task.f = f;
+        task.name = name;
+        task.strand = strand;
+        task.nRepeatSeconds = deltaSeconds;
+        task.fCancelled = false;
+        enqueue(id, task, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    }
+    newTaskScheduled.notify_one();
+    return id;
+}
+
+bool CScheduler::cancel(TaskId id)
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::map<TaskId, Task>::iterator it = tasks.find(id);
+    if (it == tasks.end())
+        return false;
+    if (it->second.fQueued) {
+        taskQueue.erase(it->second.pos);
+        tasks.erase(it);
+        return true;
+    }
+    // Running right now; only repeating tasks have a future to cancel.
+    if (it->second.nRepeatSeconds > 0 && !it->second.fCancelled) {
+        it->second.fCancelled = true;
+        return true;
+    }
+    return false;
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+bool CScheduler::reschedule(TaskId id, boost::chrono::system_clock::time_point t)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    {
+        boost::unique_lock<boost::mutex> lock(newTaskMutex);
+        std::map<TaskId, Task>::iterator it = tasks.find(id);
+        if (it == tasks.end() || !it->second.fQueued)
+            return false;
+        taskQueue.erase(it->second.pos);
+        enqueue(id, it->second, t);
+    }
+    newTaskScheduled.notify_all();
+    return true;
+}
+
+void CScheduler::recordRun(const std::string& name, int64_t nMicros, int64_t nDelayMicros)
+{
+    if (name.empty())
+        return;
+    std::map<std::string, TaskStats>::iterator it = stats.find(name);
+    if (it == stats.end()) {
+        TaskStats empty = { name, 0, 0, 0, 0, 0 };
+        it = stats.insert(std::make_pair(name, empty)).first;
+    }
+    TaskStats& s = it->second;
+    ++s.nRuns;
+    s.nTotalMicros += nMicros;
+    s.nMaxMicros = std::max(s.nMaxMicros, nMicros);
+    s.nLastMicros = nMicros;
+    s.nLastDelayMicros = nDelayMicros;
+}
+
+std::vector<CScheduler::TaskStats> CScheduler::getTaskStats() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::vector<TaskStats> result;
+    for (std::map<std::string, TaskStats>::const_iterator it = stats.begin(); it != stats.end(); ++it)
+        result.push_back(it->second);
+    return result;
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
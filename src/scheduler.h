@@ -14,6 +14,14 @@
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
 #include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/** -schedulerthreads default */
+static const int DEFAULT_SCHEDULER_THREADS = 2;
+/** Maximum number of scheduler threads allowed */
+static const int MAX_SCHEDULER_THREADS = 16;
 
 //
 // Simple class for background tasks that should be run
@@ -32,6 +40,9 @@
 // delete t;
 // delete s; // Must be done after thread is interrupted/joined.
 //
+// serviceQueue may be run from several threads. Tasks then run in parallel,
+// except tasks sharing a strand (see newStrand), which never overlap.
+//
 
 class CScheduler
 {
@@ -41,20 +52,41 @@ public:
 
     typedef boost::function<void(void)> Function;
 
+    // Handle to a scheduled task, for cancelling or rescheduling it.
+    // A repeating task keeps its handle across runs.
+    typedef uint64_t TaskId;
+    static const TaskId NO_TASK = 0;
+
+    // Tasks scheduled on the same strand are run one at a time, in
+    // scheduled order.
+    typedef int Strand;
+    static const Strand NO_STRAND = 0;
+    Strand newStrand();
+
     // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    TaskId schedule(Function f, boost::chrono::system_clock::time_point t,
+                    const std::string& name = "", Strand strand = NO_STRAND);
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    TaskId scheduleFromNow(Function f, int64_t deltaSeconds,
+                           const std::string& name = "", Strand strand = NO_STRAND);
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    TaskId scheduleEvery(Function f, int64_t deltaSeconds,
+                         const std::string& name = "", Strand strand = NO_STRAND);
+
+    // Remove a task from the queue. A repeating task that is currently
+    // running finishes its current run and is not run again.
+    // Returns false if the task is unknown or has already run.
+    bool cancel(TaskId id);
 
-    // To keep things as simple as possible, there is no unschedule.
+    // Move a pending task to time t. For repeating tasks this only
+    // affects the next run. Returns false if the task is not pending.
+    bool reschedule(TaskId id, boost::chrono::system_clock::time_point t);
 
     // Services the queue 'forever'. Should be run in a thread,
     // and interrupted using boost::interrupt_thread
@@ -70,14 +102,51 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Runtime statistics, aggregated by task name. Unnamed tasks are
+    // not tracked.
+    struct TaskStats {
+        std::string name;
+        uint64_t nRuns;
+        int64_t nTotalMicros;
+        int64_t nMaxMicros;
+        int64_t nLastMicros;
+        // How late the last run started relative to its scheduled time.
+        int64_t nLastDelayMicros;
+    };
+    std::vector<TaskStats> getTaskStats() const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    typedef boost::chrono::system_clock::time_point time_point;
+    typedef std::multimap<time_point, TaskId> queue_type;
+
+    struct Task {
+        Function f;
+        std::string name;
+        Strand strand;
+        int64_t nRepeatSeconds; // 0 for one-shot tasks
+        queue_type::iterator pos; // valid only while queued
+        bool fQueued;
+        bool fCancelled;
+    };
+
+    queue_type taskQueue;
+    std::map<TaskId, Task> tasks;
+    std::set<Strand> busyStrands;
+    std::map<std::string, TaskStats> stats;
+    TaskId nLastTaskId;
+    Strand nLastStrand;
+
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
     bool stopRequested;
     bool stopWhenEmpty;
     bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+
+    // First queued task whose strand is free, or taskQueue.end().
+    queue_type::iterator nextRunnable();
+    void enqueue(TaskId id, Task& task, time_point t);
+    void recordRun(const std::string& name, int64_t nMicros, int64_t nDelayMicros);
 };
 
 #endif
@@ -85,13 +85,30 @@ public:
 
         setValid.insert(entry);
     }
+
+    size_t DynamicMemoryUsage()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        return memusage::DynamicUsage(setValid);
+    }
 };
 
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache;
+    return signatureCache;
+}
+
+}
+
+size_t SignatureCacheDynamicMemoryUsage()
+{
+    return GetSignatureCache().DynamicMemoryUsage();
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
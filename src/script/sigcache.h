@@ -16,6 +16,9 @@ static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
 
 class CPubKey;
 
+/** Approximate heap usage of the signature cache. */
+size_t SignatureCacheDynamicMemoryUsage();
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
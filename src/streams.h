@@ -15,6 +15,7 @@
 #include <limits>
 #include <map>
 #include <set>
+#include <stdexcept>
 #include <stdint.h>
 #include <stdio.h>
 #include <string>
@@ -91,6 +92,79 @@ private:
     size_t nPos;
 };
 
+/** Writes single bits, most significant first, to an underlying byte stream.
+ * A partially filled byte is written out on Flush or destruction.
+ */
+template <typename OStream>
+class BitStreamWriter
+{
+public:
+    explicit BitStreamWriter(OStream& ostream) : m_ostream(ostream), m_buffer(0), m_offset(0) {}
+    ~BitStreamWriter() { Flush(); }
+
+    /** Write the nbits least significant bits of data. */
+    void Write(uint64_t data, int nbits)
+    {
+        if (nbits < 0 || nbits > 64)
+            throw std::out_of_range("nbits must be between 0 and 64");
+        while (nbits > 0) {
+            int bits = std::min(8 - m_offset, nbits);
+            m_buffer |= (data << (64 - nbits)) >> (64 - 8 + m_offset);
+            m_offset += bits;
+            nbits -= bits;
+            if (m_offset == 8)
+                Flush();
+        }
+    }
+
+    void Flush()
+    {
+        if (m_offset == 0)
+            return;
+        m_ostream << m_buffer;
+        m_buffer = 0;
+        m_offset = 0;
+    }
+
+private:
+    OStream& m_ostream;
+    uint8_t m_buffer;
+    int m_offset; // bits of m_buffer in use
+};
+
+/** Reads single bits, most significant first, from an underlying byte stream. */
+template <typename IStream>
+class BitStreamReader
+{
+public:
+    explicit BitStreamReader(IStream& istream) : m_istream(istream), m_buffer(0), m_offset(8) {}
+
+    /** Read nbits and return them as the least significant bits of the result. */
+    uint64_t Read(int nbits)
+    {
+        if (nbits < 0 || nbits > 64)
+            throw std::out_of_range("nbits must be between 0 and 64");
+        uint64_t data = 0;
+        while (nbits > 0) {
+            if (m_offset == 8) {
+                m_istream >> m_buffer;
+                m_offset = 0;
+            }
+            int bits = std::min(8 - m_offset, nbits);
+            data <<= bits;
+            data |= static_cast<uint8_t>(m_buffer << m_offset) >> (8 - bits);
+            m_offset += bits;
+            nbits -= bits;
+        }
+        return data;
+    }
+
+private:
+    IStream& m_istream;
+    uint8_t m_buffer;
+    int m_offset; // bits of m_buffer already read
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -6,8 +6,16 @@
 #include <string>
 #include <boost/test/unit_test.hpp>
 
+#include "clientversion.h"
 #include "hash.h"
 #include "random.h"
+#include "streams.h"
+#include "utiltime.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
@@ -49,6 +57,13 @@ public:
         CAddrMan::Delete(nId);
     }
 
+    //! Run f while holding the tables' lock.
+    void HoldLock(std::function<void()> f)
+    {
+        LOCK(cs);
+        f();
+    }
+
     // Simulates connection failure so that we can test eviction of offline nodes
     void SimConnFail(CService& addr)
     {
@@ -407,6 +422,129 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
 }
 
 
+BOOST_AUTO_TEST_CASE(addrman_snapshot)
+{
+    CAddrManTest addrman;
+    addrman.MakeDeterministic();
+    SetMockTime(GetTime());
+
+    std::shared_ptr<const CAddrManSnapshot> empty = addrman.GetSnapshot();
+    BOOST_CHECK(empty->size() == 0);
+    BOOST_CHECK(empty->Select().ToString() == "[::]:0");
+    BOOST_CHECK(empty->GetAddr().empty());
+
+    CNetAddr source = CNetAddr("252.2.2.2");
+    CAddress addr1 = CAddress(CService("250.1.1.1", 8333));
+    addr1.nTime = GetAdjustedTime();
+    addrman.Add(addr1, source);
+
+    // The empty snapshot is recent enough to be reused after an add.
+    BOOST_CHECK(addrman.GetSnapshot() == empty);
+    SetMockTime(GetTime() + ADDRMAN_SNAPSHOT_MAX_AGE);
+    std::shared_ptr<const CAddrManSnapshot> snapshot = addrman.GetSnapshot();
+    BOOST_CHECK(snapshot != empty);
+    BOOST_CHECK(snapshot->size() == 1);
+    BOOST_CHECK(snapshot->Select().ToString() == "250.1.1.1:8333");
+    BOOST_CHECK(snapshot->Select(true).ToString() == "250.1.1.1:8333");
+
+    // Unchanged tables keep the snapshot, however old.
+    SetMockTime(GetTime() + ADDRMAN_SNAPSHOT_MAX_AGE);
+    BOOST_CHECK(addrman.GetSnapshot() == snapshot);
+
+    // Moving an address to tried shows up right away.
+    addrman.Good(CAddress(addr1));
+    std::shared_ptr<const CAddrManSnapshot> tried = addrman.GetSnapshot();
+    BOOST_CHECK(tried != snapshot);
+    BOOST_CHECK(tried->Select().ToString() == "250.1.1.1:8333");
+    BOOST_CHECK(tried->Select(true).ToString() == "[::]:0");
+    // The old snapshot is unaffected.
+    BOOST_CHECK(snapshot->Select(true).ToString() == "250.1.1.1:8333");
+
+    // Connection attempts wait for the snapshot to age, like adds.
+    addrman.Attempt(CAddress(addr1), true);
+    BOOST_CHECK(addrman.GetSnapshot() == tried);
+    SetMockTime(GetTime() + ADDRMAN_SNAPSHOT_MAX_AGE);
+    BOOST_CHECK(addrman.GetSnapshot() != tried);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(addrman_addbatched)
+{
+    CAddrManTest addrman;
+    addrman.MakeDeterministic();
+
+    std::vector<CAddress> vAddr;
+    for (int i = 1; i <= 100; i++) {
+        CAddress addr = CAddress(CService("250.1." + std::to_string(i) + ".1", 8333));
+        addr.nTime = GetAdjustedTime();
+        vAddr.push_back(addr);
+    }
+    CNetAddr source = CNetAddr("252.2.2.2");
+
+    // The tables are free, so the addresses are added right away.
+    addrman.AddBatched(std::vector<CAddress>(vAddr.begin(), vAddr.begin() + 50), source);
+    size_t nAdded = addrman.size();
+    BOOST_CHECK(nAdded > 0);
+
+    // Held by another thread, so the addresses are queued.
+    std::mutex m;
+    std::condition_variable cv;
+    bool fLocked = false, fRelease = false;
+    std::thread holder([&]() {
+        std::unique_lock<std::mutex> lock(m);
+        addrman.HoldLock([&]() {
+            fLocked = true;
+            cv.notify_all();
+            cv.wait(lock, [&]() { return fRelease; });
+        });
+    });
+    {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&]() { return fLocked; });
+    }
+    addrman.AddBatched(std::vector<CAddress>(vAddr.begin() + 50, vAddr.end()), source);
+    {
+        std::unique_lock<std::mutex> lock(m);
+        fRelease = true;
+    }
+    cv.notify_all();
+    holder.join();
+    BOOST_CHECK(addrman.size() == nAdded);
+
+    // They are applied before the next snapshot.
+    BOOST_CHECK(addrman.GetSnapshot()->size() > nAdded);
+    BOOST_CHECK(addrman.GetSnapshot()->size() == addrman.size());
+}
+
+
+BOOST_AUTO_TEST_CASE(addrman_serialize_roundtrip)
+{
+    CAddrManTest addrman;
+    addrman.MakeDeterministic();
+
+    for (int i = 1; i <= 200; i++) {
+        CAddress addr = CAddress(CService("250." + std::to_string(i) + ".1.1", 8333));
+        addr.nTime = GetAdjustedTime();
+        addrman.Add(addr, CNetAddr(i % 2 ? "252.2.2.2" : "252.3.3.3"));
+        if (i % 5 == 0)
+            addrman.Good(addr);
+    }
+
+    CDataStream ss1(SER_DISK, CLIENT_VERSION);
+    ss1 << addrman;
+    const std::string strSerialized(ss1.begin(), ss1.end());
+
+    CAddrMan addrman2;
+    ss1 >> addrman2;
+    BOOST_CHECK(addrman2.size() == addrman.size());
+
+    // Written out again, the tables are unchanged.
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << addrman2;
+    BOOST_CHECK(std::string(ss2.begin(), ss2.end()) == strSerialized);
+}
+
 BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
 {
     CAddrManTest addrman;
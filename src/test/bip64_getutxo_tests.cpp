@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bip64_getutxo.h"
+#include "coins.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(bip64_getutxo_tests, TestingSetup)
+
+static Coin MakeCoin(int nHeight)
+{
+    CTxOut out(nHeight * 1000, CScript() << nHeight << OP_DROP << OP_TRUE);
+    return Coin(out, nHeight, false);
+}
+
+static std::string Serialized(const bip64::UTXORetriever& utxos)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << utxos.GetBitmap() << utxos.GetResults();
+    return ss.str();
+}
+
+BOOST_AUTO_TEST_CASE(getutxos_batched_matches_sequential)
+{
+    std::vector<COutPoint> outpoints;
+    CMutableTransaction mempoolTx;
+    {
+        LOCK(cs_main);
+        // Enough coins on disk only to be fetched in parallel.
+        std::vector<COutPoint> onDisk;
+        for (int i = 0; i < 4 * (int)bip64::MIN_PARALLEL_FETCH; ++i) {
+            onDisk.push_back(COutPoint(GetRandHash(), i % 3));
+            pcoinsTip->AddCoin(onDisk.back(), MakeCoin(i + 1), false);
+        }
+        BOOST_CHECK(pcoinsTip->Flush());
+        outpoints.insert(outpoints.end(), onDisk.begin(), onDisk.end());
+
+        // Coins only in the cache, and coins on disk spent in the cache.
+        for (int i = 0; i < 10; ++i) {
+            outpoints.push_back(COutPoint(GetRandHash(), 0));
+            pcoinsTip->AddCoin(outpoints.back(), MakeCoin(1000 + i), false);
+            pcoinsTip->SpendCoin(onDisk[i * 3]);
+        }
+
+        // Unknown outpoints.
+        for (int i = 0; i < 10; ++i)
+            outpoints.push_back(COutPoint(GetRandHash(), 1));
+
+        // A mempool transaction spending a coin on disk.
+        mempoolTx.vin.resize(1);
+        mempoolTx.vin[0].prevout = onDisk[1];
+        mempoolTx.vout.resize(2, CTxOut(5000, CScript() << OP_TRUE));
+        TestMemPoolEntryHelper entry;
+        mempool.addUnchecked(mempoolTx.GetHash(), entry.FromTx(mempoolTx));
+        outpoints.push_back(COutPoint(mempoolTx.GetHash(), 1));
+        outpoints.push_back(COutPoint(mempoolTx.GetHash(), 2));
+    }
+
+    for (CTxMemPool* pool : {(CTxMemPool*)nullptr, &mempool}) {
+        std::string expected;
+        {
+            LOCK2(cs_main, mempool.cs);
+            expected = Serialized(bip64::UTXORetriever(outpoints, *pcoinsTip, pool));
+        }
+        bip64::UTXORetriever utxos(outpoints, pool);
+        BOOST_CHECK(Serialized(utxos) == expected);
+        BOOST_CHECK_EQUAL(utxos.GetTipHeight(), chainActive.Height());
+        BOOST_CHECK(utxos.GetTipHash() == chainActive.Tip()->GetBlockHash());
+
+        const std::string bitmap = utxos.GetBitmapStr();
+        BOOST_CHECK_EQUAL(bitmap[0], '0'); // spent in the cache
+        BOOST_CHECK_EQUAL(bitmap[1], pool ? '0' : '1'); // spent in the mempool
+        BOOST_CHECK_EQUAL(bitmap[2], '1');
+        BOOST_CHECK_EQUAL(bitmap[bitmap.size() - 2], pool ? '1' : '0');
+        BOOST_CHECK_EQUAL(bitmap[bitmap.size() - 1], '0'); // past the last output
+    }
+
+    // The result size limit applies the same way.
+    BOOST_CHECK_THROW(bip64::UTXORetriever(outpoints, &mempool, 100), std::runtime_error);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,202 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "chainparams.h"
+#include "coins.h"
+#include "data/blockfilters.json.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+#include "undo.h"
+#include "utilstrencodings.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+#include <univalue.h>
+
+extern UniValue read_json(const std::string& jsondata);
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static GCSFilter::Element RandomElement()
+{
+    GCSFilter::Element element(32);
+    for (unsigned char& c : element)
+        c = insecure_rand();
+    return element;
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; ++i) {
+        included.insert(RandomElement());
+        excluded.insert(RandomElement());
+    }
+
+    GCSFilter filter(GCSFilter::Params(0, 0, 10, 1 << 10), included);
+    for (const GCSFilter::Element& element : included) {
+        BOOST_CHECK(filter.Match(element));
+
+        GCSFilter::ElementSet query(excluded);
+        query.insert(element);
+        BOOST_CHECK(filter.MatchAny(query));
+    }
+
+    // With M = 1024 a false positive among 100 queries is unlikely but
+    // possible, so only check that most of them miss.
+    int nFalsePositives = 0;
+    for (const GCSFilter::Element& element : excluded)
+        nFalsePositives += filter.Match(element);
+    BOOST_CHECK(nFalsePositives < 5);
+
+    // Decoding the encoded filter gives the same filter.
+    GCSFilter decoded(filter.GetParams(), filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 100);
+    for (const GCSFilter::Element& element : included)
+        BOOST_CHECK(decoded.Match(element));
+
+    // Trailing data is rejected.
+    std::vector<unsigned char> padded = filter.GetEncoded();
+    padded.push_back(0);
+    BOOST_CHECK_THROW(GCSFilter(filter.GetParams(), padded), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_default_constructor)
+{
+    GCSFilter filter;
+    BOOST_CHECK_EQUAL(filter.GetN(), 0);
+    BOOST_CHECK_EQUAL(filter.GetEncoded().size(), 1);
+    BOOST_CHECK(!filter.Match(RandomElement()));
+
+    GCSFilter decoded(filter.GetParams(), filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // Output scripts in the block.
+    included_scripts[0] << std::vector<unsigned char>(0, 65) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(1, 20) << OP_EQUALVERIFY << OP_CHECKSIG;
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(2, 33) << OP_1 << OP_CHECKMULTISIG;
+
+    // Scripts of outputs spent by the block.
+    included_scripts[3] << OP_HASH160 << std::vector<unsigned char>(3, 20) << OP_EQUAL;
+    included_scripts[4] << OP_2 << std::vector<unsigned char>(4, 33) << OP_1 << OP_CHECKMULTISIG;
+
+    // Data carrier output, and scripts that are not in the block at all.
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(5, 40);
+    excluded_scripts[1] << OP_HASH160 << std::vector<unsigned char>(6, 20) << OP_EQUAL;
+    excluded_scripts[2] << OP_3 << std::vector<unsigned char>(7, 33) << OP_1 << OP_CHECKMULTISIG;
+
+    CMutableTransaction tx_1;
+    tx_1.vout.emplace_back(100, included_scripts[0]);
+    tx_1.vout.emplace_back(200, included_scripts[1]);
+    tx_1.vout.emplace_back(0, excluded_scripts[0]);
+
+    CMutableTransaction tx_2;
+    tx_2.vout.emplace_back(300, included_scripts[2]);
+    // An empty output script is skipped.
+    tx_2.vout.emplace_back(400, CScript());
+
+    CBlock block;
+    block.vtx.push_back(CTransaction(tx_1));
+    block.vtx.push_back(CTransaction(tx_2));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.emplace_back();
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(500, included_scripts[3]), 1000, true);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(600, included_scripts[4]), 10000, false);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(700, CScript()), 100000, false);
+
+    BlockFilter block_filter(BLOCK_FILTER_BASIC, block, block_undo);
+    const GCSFilter& filter = block_filter.GetFilter();
+    BOOST_CHECK_EQUAL(filter.GetN(), 5);
+
+    for (const CScript& script : included_scripts)
+        BOOST_CHECK(filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    for (const CScript& script : excluded_scripts)
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(script.begin(), script.end())));
+
+    // Serialization round trip.
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block_filter;
+    BlockFilter block_filter2;
+    stream >> block_filter2;
+    BOOST_CHECK_EQUAL(block_filter.GetType(), block_filter2.GetType());
+    BOOST_CHECK(block_filter.GetBlockHash() == block_filter2.GetBlockHash());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == block_filter2.GetEncodedFilter());
+
+    // Reconstructing from parts gives the same filter and header.
+    BlockFilter block_filter3(BLOCK_FILTER_BASIC, block.GetHash(), block_filter.GetEncodedFilter());
+    BOOST_CHECK(block_filter.GetHash() == block_filter3.GetHash());
+    const uint256 prev_header = GetRandHash();
+    BOOST_CHECK(block_filter.ComputeHeader(prev_header) == block_filter3.ComputeHeader(prev_header));
+    BOOST_CHECK(block_filter.ComputeHeader(prev_header) != block_filter.ComputeHeader(uint256()));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_type_names)
+{
+    BlockFilterType type;
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BLOCK_FILTER_BASIC), "basic");
+    BOOST_CHECK(BlockFilterTypeByName("basic", type));
+    BOOST_CHECK_EQUAL(type, BLOCK_FILTER_BASIC);
+    BOOST_CHECK(!BlockFilterTypeByName("extended", type));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilters_json_test)
+{
+    UniValue json = read_json(std::string(json_tests::blockfilters, json_tests::blockfilters + sizeof(json_tests::blockfilters)));
+    SelectParams(CBaseChainParams::TESTNET);
+
+    for (unsigned int i = 0; i < json.size(); i++) {
+        const UniValue& test = json[i];
+        std::string strTest = test.write();
+        if (test.size() == 1)
+            continue; // comment
+        if (test.size() != 8) {
+            BOOST_ERROR("Bad test: " << strTest);
+            continue;
+        }
+
+        unsigned int pos = 0;
+        /*int block_height =*/ test[pos++].get_int();
+        uint256 block_hash = uint256S(test[pos++].get_str());
+
+        CBlock block;
+        CDataStream ssBlock(ParseHex(test[pos++].get_str()), SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock >> block;
+        BOOST_CHECK_MESSAGE(block.GetHash() == block_hash, strTest);
+
+        CBlockUndo block_undo;
+        block_undo.vtxundo.emplace_back();
+        CTxUndo& tx_undo = block_undo.vtxundo.back();
+        const UniValue& prev_scripts = test[pos++].get_array();
+        for (unsigned int j = 0; j < prev_scripts.size(); j++) {
+            std::vector<unsigned char> raw_script = ParseHex(prev_scripts[j].get_str());
+            tx_undo.vprevout.emplace_back(CTxOut(0, CScript(raw_script.begin(), raw_script.end())), 0, false);
+        }
+
+        uint256 prev_filter_header_basic = uint256S(test[pos++].get_str());
+        std::vector<unsigned char> filter_basic = ParseHex(test[pos++].get_str());
+        uint256 filter_header_basic = uint256S(test[pos++].get_str());
+
+        BlockFilter computed_filter_basic(BLOCK_FILTER_BASIC, block, block_undo);
+        BOOST_CHECK_MESSAGE(computed_filter_basic.GetEncodedFilter() == filter_basic, strTest);
+
+        uint256 computed_header_basic = computed_filter_basic.ComputeHeader(prev_filter_header_basic);
+        BOOST_CHECK_MESSAGE(computed_header_basic == filter_header_basic, strTest);
+    }
+
+    SelectParams(CBaseChainParams::MAIN);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
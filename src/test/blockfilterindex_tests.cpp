@@ -0,0 +1,108 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "test/test_bitcoin.h"
+#include "undo.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilterindex_tests, TestChainSetup)
+
+static bool CheckFilterLookups(const BlockFilterIndex& index, const CBlockIndex* pindex,
+                               uint256& lastHeader)
+{
+    CBlock block;
+    CBlockUndo blockUndo;
+    if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+        return false;
+    if (pindex->pprev && !UndoReadFromDisk(blockUndo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+        return false;
+    const BlockFilter expected(BLOCK_FILTER_BASIC, block, blockUndo);
+
+    BlockFilter filter;
+    uint256 header;
+    if (!index.LookupFilter(pindex, filter) || !index.LookupFilterHeader(pindex, header))
+        return false;
+
+    // Each header commits to the previous one.
+    const bool fOk = filter.GetEncodedFilter() == expected.GetEncodedFilter()
+        && header == expected.ComputeHeader(lastHeader);
+    lastHeader = header;
+    return fOk;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilterindex_sync)
+{
+    BlockFilterIndex index(BLOCK_FILTER_BASIC, 1 << 20, true);
+    BOOST_CHECK(!index.IsSynced());
+
+    // A sync with no time to run indexes at most one block.
+    BOOST_CHECK(index.Sync(0));
+    BOOST_CHECK(!index.IsSynced());
+
+    BOOST_CHECK(index.Sync());
+    BOOST_CHECK(index.IsSynced());
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    BOOST_CHECK(index.GetBestBlockHash() == tip->GetBlockHash());
+
+    uint256 lastHeader;
+    for (int nHeight = 0; nHeight <= tip->nHeight; nHeight++)
+        BOOST_CHECK(CheckFilterLookups(index, tip->GetAncestor(nHeight), lastHeader));
+
+    std::vector<BlockFilter> filters;
+    std::vector<uint256> hashes;
+    BOOST_CHECK(index.LookupFilterRange(tip->nHeight - 9, tip, filters));
+    BOOST_CHECK(index.LookupFilterHashRange(tip->nHeight - 9, tip, hashes));
+    BOOST_CHECK_EQUAL(filters.size(), 10u);
+    BOOST_CHECK_EQUAL(hashes.size(), 10u);
+    BOOST_CHECK(filters.back().GetBlockHash() == tip->GetBlockHash());
+    BOOST_CHECK(hashes.back() == filters.back().GetHash());
+    BOOST_CHECK(!index.LookupFilterRange(tip->nHeight + 1, tip, filters));
+
+    // New blocks are indexed on the next sync.
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), CScript() << OP_TRUE);
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    BOOST_CHECK(index.Sync());
+    BOOST_CHECK(index.GetBestBlockHash() == tip->GetBlockHash());
+    BOOST_CHECK(CheckFilterLookups(index, tip, lastHeader));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilterindex_missing_data)
+{
+    BlockFilterIndex index(BLOCK_FILTER_BASIC, 1 << 20, true);
+
+    // A block in the middle of the chain is missing, as if pruned.
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = chainActive[50];
+        pindex->nStatus &= ~BLOCK_HAVE_DATA;
+    }
+    BOOST_CHECK(!index.Sync());
+    BOOST_CHECK(!index.IsSynced());
+    BOOST_CHECK(index.GetBestBlockHash() == pindex->pprev->GetBlockHash());
+
+    {
+        LOCK(cs_main);
+        pindex->nStatus |= BLOCK_HAVE_DATA;
+    }
+    BOOST_CHECK(index.Sync());
+    BOOST_CHECK(index.IsSynced());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "blockencodings.h"
 #include "blocksender.h"
 #include "net.h"
+#include "recentblockcache.h"
 #include "uint256.h"
 #include "protocol.h"
 #include "chain.h"
@@ -275,4 +276,90 @@ BOOST_AUTO_TEST_CASE(msg_xblocktx_depth) {
     checkReReq(req, "xblocktx");
 }
 
+BOOST_AUTO_TEST_CASE(send_from_recent_block_cache) {
+    struct CountingSender : public BlockSender {
+        CountingSender(RecentBlockCache* cache) :
+            BlockSender(cache), readBlock(TestBlock2()), nReads(0)
+        {
+        }
+        bool readBlockFromDisk(CBlock& block, const CBlockIndex* pindex) override {
+            ++nReads;
+            block = readBlock;
+            return true;
+        }
+        CBlock readBlock;
+        int nReads;
+    };
+
+    RecentBlockCache cache;
+    CountingSender bs(&cache);
+    uint256 hash = bs.readBlock.GetHash();
+    CBlockIndex index;
+    index.phashBlock = &hash;
+    index.nHeight = 100;
+
+    DummyConnman connman;
+    DummyNode node1, node2;
+    NodeStatePtr(node2.id)->supportsCompactBlocks = true;
+
+    // Read once, then served from the cache in any form.
+    bs.sendBlock(connman, node1, index, MSG_BLOCK, index.nHeight);
+    bs.sendBlock(connman, node1, index, MSG_FILTERED_BLOCK, index.nHeight + 1);
+    bs.sendBlock(connman, node2, index, MSG_CMPCT_BLOCK, index.nHeight + 2);
+    BOOST_CHECK_EQUAL(bs.nReads, 1);
+    BOOST_CHECK(connman.MsgWasSent(node1, "block", 0));
+    BOOST_CHECK(connman.MsgWasSent(node1, "merkleblock", 1));
+    BOOST_CHECK(connman.MsgWasSent(node2, "cmpctblock", 0));
+
+    XThinReRequest req;
+    req.block = hash;
+    req.txRequesting = { bs.readBlock.vtx[1].GetHash().GetCheapHash(),
+                         bs.readBlock.vtx[2].GetHash().GetCheapHash() };
+    bs.sendReReqReponse(connman, node2, index, req, index.nHeight + 1);
+    BOOST_CHECK_EQUAL(bs.nReads, 1);
+    BOOST_CHECK(connman.MsgWasSent(node2, "xblocktx", 1));
+
+    // Blocks this deep are not cached.
+    bs.sendBlock(connman, node1, index, MSG_BLOCK, index.nHeight + MAX_RECENT_BLOCKS);
+    BOOST_CHECK_EQUAL(bs.nReads, 2);
+}
+
+BOOST_AUTO_TEST_CASE(cached_block_encodings) {
+    CBlock block = TestBlock2();
+    CachedBlock cached(std::make_shared<const CBlock>(block));
+    BOOST_CHECK(cached.GetHash() == block.GetHash());
+
+    CDataStream expected(SER_NETWORK, PROTOCOL_VERSION);
+    expected << block;
+    BOOST_CHECK(cached.GetSerialized().str() == expected.str());
+
+    CDataStream compactStream(cached.GetCompact());
+    CompactBlock compact;
+    compactStream >> compact;
+    BOOST_CHECK(compact.header.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(compact.prefilledtxn.size(), 1);
+    BOOST_CHECK_EQUAL(compact.shorttxids.size(), block.vtx.size() - 1);
+
+    // Positions come back in block order, as xthin responses require.
+    std::set<uint64_t> cheapHashes = { block.vtx[3].GetHash().GetCheapHash(),
+                                       block.vtx[1].GetHash().GetCheapHash() };
+    BOOST_CHECK(cached.FindByCheapHash(cheapHashes) == std::vector<uint32_t>({ 1, 3 }));
+    cheapHashes.insert(0xf00d);
+    BOOST_CHECK_THROW(cached.FindByCheapHash(cheapHashes), std::runtime_error);
+
+    // The cache keeps the newest blocks.
+    RecentBlockCache cache(2);
+    CBlock block1 = TestBlock1();
+    auto entry = cache.Insert(std::make_shared<const CBlock>(block1));
+    BOOST_CHECK(cache.Insert(std::make_shared<const CBlock>(block1)) == entry);
+    cache.Insert(std::make_shared<const CBlock>(block));
+    BOOST_CHECK(cache.Get(block1.GetHash()) == entry);
+    CBlock block3 = block1;
+    block3.nNonce++;
+    cache.Insert(std::make_shared<const CBlock>(block3));
+    BOOST_CHECK(!cache.Get(block1.GetHash()));
+    BOOST_CHECK(cache.Get(block.GetHash()));
+    BOOST_CHECK(cache.Get(block3.GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -461,6 +461,43 @@ BOOST_AUTO_TEST_CASE(merkle_block_4_test_update_none)
     BOOST_CHECK(!filter.contains(COutPoint(uint256S("0x02981fa052f0481dbc5868f4fc2166035a10f27a03cfd2de67326471df5bc041"), 0)));
 }
 
+BOOST_AUTO_TEST_CASE(merkle_block_shared_data)
+{
+    // Serving a block from shared precomputed data gives each peer the same
+    // merkle block, and filter updates, as building it from the block.
+    CBlock block = getBlock13b8a();
+    const CFilteredBlockData data(block);
+
+    CBloomFilter filters[3] = {
+        CBloomFilter(10, 0.000001, 0, BLOOM_UPDATE_ALL),
+        CBloomFilter(10, 0.000001, 5, BLOOM_UPDATE_P2PUBKEY_ONLY),
+        CBloomFilter(10, 0.000001, 7, BLOOM_UPDATE_NONE),
+    };
+    // Match the last transaction by txid
+    filters[0].insert(uint256S("0x74d681e0e03bafa802c8aa084379aa98d9fcd632ddc2ed9782b586ec87451f20"));
+    // Match the first data push of the generation output script
+    std::vector<unsigned char> push;
+    opcodetype opcode;
+    CScript::const_iterator pc = block.vtx[0].vout[0].scriptPubKey.begin();
+    BOOST_REQUIRE(block.vtx[0].vout[0].scriptPubKey.GetOp(pc, opcode, push));
+    filters[1].insert(push);
+    // Matches nothing
+    filters[2].insert(uint256S("0x0000000000000000000000000000000000000000000000000000000000000001"));
+
+    for (CBloomFilter& filter : filters) {
+        CBloomFilter filterShared = filter;
+        CMerkleBlock merkleBlock(block, filter);
+        CMerkleBlock merkleBlockShared(data, filterShared);
+
+        BOOST_CHECK(merkleBlock.vMatchedTxn == merkleBlockShared.vMatchedTxn);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION), ssShared(SER_NETWORK, PROTOCOL_VERSION);
+        ss << merkleBlock << filter;
+        ssShared << merkleBlockShared << filterShared;
+        BOOST_CHECK(ss.str() == ssShared.str());
+    }
+    BOOST_CHECK(GetFilteredBlockData(block) == GetFilteredBlockData(block));
+}
+
 static std::vector<unsigned char> RandomData()
 {
     uint256 r = GetRandHash();
@@ -541,4 +578,53 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(rolling_bloom_generations)
+{
+    // Generations of 50 entries, three of them kept.
+    CRollingBloomFilter rb(100, 0.000001);
+    std::vector<uint256> hashes(151);
+    for (uint256& hash : hashes)
+        hash = GetRandHash();
+    for (size_t i = 0; i < 150; i++)
+        rb.insert(hashes[i]);
+
+    // Up to 1.5 * N entries are remembered...
+    for (size_t i = 0; i < 150; i++)
+        BOOST_CHECK(rb.contains(hashes[i]));
+
+    // ... and the next insert drops the oldest generation.
+    rb.insert(hashes[150]);
+    unsigned int nHits = 0;
+    for (size_t i = 0; i < 50; i++)
+        nHits += rb.contains(hashes[i]);
+    BOOST_CHECK_EQUAL(nHits, 0u);
+    for (size_t i = 50; i < 151; i++)
+        BOOST_CHECK(rb.contains(hashes[i]));
+}
+
+BOOST_AUTO_TEST_CASE(rolling_bloom_key_types)
+{
+    CRollingBloomFilter rb(100, 0.000001);
+    const uint256 hash = GetRandHash();
+    const COutPoint outpoint(GetRandHash(), 3);
+
+    // Nothing is allocated or matched before the first insert.
+    BOOST_CHECK(!rb.contains(hash));
+    BOOST_CHECK(!rb.contains(outpoint));
+
+    rb.insert(hash);
+    rb.insert(outpoint);
+
+    // Typed keys match their serialization.
+    BOOST_CHECK(rb.contains(std::vector<unsigned char>(hash.begin(), hash.end())));
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << outpoint;
+    BOOST_CHECK(rb.contains(std::vector<unsigned char>(stream.begin(), stream.end())));
+    BOOST_CHECK(!rb.contains(COutPoint(outpoint.hash, 4)));
+
+    rb.reset();
+    BOOST_CHECK(!rb.contains(hash));
+    BOOST_CHECK(!rb.contains(outpoint));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
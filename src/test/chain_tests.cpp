@@ -4,6 +4,7 @@
 
 #include "chain.h"
 #include "test/test_bitcoin.h"
+#include "test/test_random.h"
 #include "consensus/consensus.h" // for MAX_BLOCK_SIZE
 
 #include <boost/test/unit_test.hpp>
@@ -73,4 +74,47 @@ BOOST_AUTO_TEST_CASE(tip_max_blocksize) {
     BOOST_CHECK_EQUAL(3 * MAX_BLOCK_SIZE, chain.MaxBlockSizeInsecure());
 }
 
+static int NaiveCountVersions(const CBlockIndex* pindex, int minVersion, int nWindow) {
+    int nFound = 0;
+    for (int i = 0; i < nWindow && pindex != nullptr; ++i, pindex = pindex->pprev)
+        nFound += pindex->nVersion >= minVersion;
+    return nFound;
+}
+
+BOOST_AUTO_TEST_CASE(rolling_version_counts) {
+    const int nWindow = 100;
+    std::vector<CBlockIndex> vIndex(1000);
+    for (size_t i = 0; i < vIndex.size(); ++i) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : nullptr;
+        // Drift towards newer versions as the chain grows
+        vIndex[i].nVersion = 1 + (insecure_rand() % 3) + (i * 2 / vIndex.size());
+        vIndex[i].BuildSkip();
+        vIndex[i].BuildVersionCounts(nWindow);
+    }
+
+    for (const CBlockIndex& index : vIndex) {
+        for (int v = 1; v <= 5; ++v) {
+            BOOST_CHECK_EQUAL(NaiveCountVersions(&index, v, nWindow),
+                              index.CountVersionsAtLeast(v, nWindow));
+        }
+        // A different window falls back to walking the chain
+        BOOST_CHECK_EQUAL(NaiveCountVersions(&index, 3, nWindow / 2),
+                          index.CountVersionsAtLeast(3, nWindow / 2));
+    }
+
+    // Entries built on top of an unbuilt parent are still correct
+    CBlockIndex unbuilt;
+    unbuilt.nHeight = vIndex.size();
+    unbuilt.pprev = &vIndex.back();
+    unbuilt.nVersion = 4;
+    CBlockIndex child;
+    child.nHeight = unbuilt.nHeight + 1;
+    child.pprev = &unbuilt;
+    child.nVersion = 2;
+    child.BuildVersionCounts(nWindow);
+    BOOST_CHECK_EQUAL(NaiveCountVersions(&child, 4, nWindow),
+                      child.CountVersionsAtLeast(4, nWindow));
+}
+
 BOOST_AUTO_TEST_SUITE_END();
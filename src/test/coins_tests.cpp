@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "main.h"
 #include "script/standard.h"
 #include "uint256.h"
 #include "undo.h"
@@ -14,6 +15,7 @@
 
 #include <vector>
 #include <map>
+#include <set>
 
 #include <boost/test/unit_test.hpp>
 
@@ -856,4 +858,141 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_FIXTURE_TEST_CASE(ccoins_snapshot, TestingSetup)
+{
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 4; ++i)
+        outpoints.push_back(COutPoint(GetRandHash(), i));
+    std::shared_ptr<CCoinsViewSnapshot> snapshot;
+    {
+        LOCK(cs_main);
+        for (int i = 0; i < 3; ++i)
+            pcoinsTip->AddCoin(outpoints[i], Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false), false);
+        BOOST_CHECK(pcoinsTip->Flush());
+        // Modified since the coins were written to the database.
+        pcoinsTip->SpendCoin(outpoints[1]);
+        pcoinsTip->AddCoin(outpoints[3], Coin(CTxOut(4, CScript() << OP_TRUE), 2, false), false);
+        snapshot = GetCoinsSnapshot();
+        BOOST_CHECK(GetCoinsSnapshot() == snapshot);
+        BOOST_CHECK_EQUAL(snapshot->GetOverlaySize(), 2);
+        BOOST_CHECK(snapshot->GetBestBlock() == chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK_EQUAL(snapshot->GetHeight(), chainActive.Height());
+
+        // Not seen by the snapshot.
+        pcoinsTip->SpendCoin(outpoints[0]);
+        BOOST_CHECK(pcoinsTip->Flush());
+    }
+
+    Coin coin;
+    BOOST_CHECK(snapshot->GetCoin(outpoints[0], coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 1);
+    BOOST_CHECK(!snapshot->HaveCoin(outpoints[1]));
+    BOOST_CHECK(snapshot->HaveCoin(outpoints[2]));
+    BOOST_CHECK(snapshot->GetCoin(outpoints[3], coin));
+    BOOST_CHECK_EQUAL(coin.nHeight, 2);
+
+    // The cursor merges the database with the overlay in order.
+    std::unique_ptr<CCoinsViewCursor> pcursor(snapshot->Cursor());
+    std::set<COutPoint> expected{outpoints[0], outpoints[2], outpoints[3]};
+    std::vector<COutPoint> seen;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        BOOST_CHECK(pcursor->GetKey(key));
+        BOOST_CHECK(pcursor->GetValue(coin));
+        seen.push_back(key);
+    }
+    BOOST_CHECK(seen == std::vector<COutPoint>(expected.begin(), expected.end()));
+
+    // A new one is taken when the tip changes.
+    LOCK(cs_main);
+    const uint256 hashTip = pcoinsTip->GetBestBlock();
+    pcoinsTip->SetBestBlock(GetRandHash());
+    std::shared_ptr<CCoinsViewSnapshot> snapshot2 = GetCoinsSnapshot();
+    BOOST_CHECK(snapshot2 != snapshot);
+    BOOST_CHECK(!snapshot2->HaveCoin(outpoints[0]));
+    BOOST_CHECK_EQUAL(snapshot2->GetOverlaySize(), 0);
+    pcoinsTip->SetBestBlock(hashTip);
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_snapshot_tracking, TestingSetup)
+{
+    LOCK(cs_main);
+    const uint256 hashTip = pcoinsTip->GetBestBlock();
+    const COutPoint outpoint(GetRandHash(), 0);
+
+    // Point lookups don't get a snapshot that would copy pcoinsTip.
+    BOOST_CHECK(!GetCoinsSnapshotIfCheap());
+    BOOST_CHECK(pcoinsTip->GetTrackedCoins() == nullptr);
+    std::shared_ptr<CCoinsViewSnapshot> snapshot = GetCoinsSnapshot();
+    BOOST_CHECK(pcoinsTip->GetTrackedCoins() != nullptr);
+    BOOST_CHECK(GetCoinsSnapshotIfCheap() == snapshot);
+
+    // Changes written by a child cache, as for a block, are tracked, and
+    // the next snapshot is taken from them.
+    const size_t nUsage = pcoinsTip->DynamicMemoryUsage();
+    for (int i = 0; i < 3; ++i) {
+        CCoinsViewCache view(pcoinsTip);
+        if (i == 2)
+            view.SpendCoin(COutPoint(outpoint.hash, 1));
+        else
+            view.AddCoin(COutPoint(outpoint.hash, i), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false), false);
+        view.SetBestBlock(GetRandHash());
+        BOOST_CHECK(view.Flush());
+    }
+    BOOST_CHECK(pcoinsTip->DynamicMemoryUsage() > nUsage);
+    std::shared_ptr<CCoinsViewSnapshot> snapshot2 = GetCoinsSnapshotIfCheap();
+    BOOST_CHECK(snapshot2 && snapshot2 != snapshot);
+    BOOST_CHECK(snapshot2->GetBestBlock() == pcoinsTip->GetBestBlock());
+    BOOST_CHECK(snapshot2->HaveCoin(outpoint));
+    BOOST_CHECK(!snapshot2->HaveCoin(COutPoint(outpoint.hash, 1)));
+    BOOST_CHECK(!snapshot->HaveCoin(outpoint));
+
+    // A flush writes them to the database.
+    BOOST_CHECK(pcoinsTip->Flush());
+    BOOST_CHECK_EQUAL(pcoinsTip->GetTrackedCoins()->GetSize(), 0);
+    pcoinsTip->TrackModifiedCoins(false);
+    pcoinsTip->SetBestBlock(hashTip);
+    BOOST_CHECK(!GetCoinsSnapshotIfCheap());
+    BOOST_CHECK(snapshot2->HaveCoin(outpoint));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_overlay)
+{
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 8; ++i)
+        outpoints.push_back(COutPoint(uint256(), i));
+
+    // Layers of 1, 2, 4 and 8 coins, each setting the value to its number.
+    CCoinsOverlay overlay;
+    for (int n = 1; n <= 4; ++n) {
+        CCoinsOverlay::Layer layer;
+        for (int i = 0; i < (1 << (n - 1)); ++i)
+            layer.emplace_back(outpoints[i], Coin(CTxOut(n, CScript() << OP_TRUE), 1, false));
+        overlay.Push(std::move(layer));
+    }
+    // Spend one in a newer layer.
+    CCoinsOverlay::Layer layer;
+    layer.emplace_back(outpoints[5], Coin());
+    overlay.Push(std::move(layer));
+
+    const Coin* pcoin = overlay.Find(outpoints[0]);
+    BOOST_CHECK(pcoin && pcoin->out.nValue == 4);
+    BOOST_CHECK(overlay.Find(outpoints[5])->IsSpent());
+    BOOST_CHECK(overlay.Find(COutPoint(uint256(), 8)) == nullptr);
+    // Merged layers keep the newest entry of each coin.
+    BOOST_CHECK_EQUAL(overlay.GetSize(), 9);
+    BOOST_CHECK(overlay.DynamicMemoryUsage() > 0);
+
+    std::shared_ptr<const CCoinsOverlay::Layer> flat = overlay.Flatten();
+    BOOST_CHECK_EQUAL(flat->size(), 8);
+    for (size_t i = 0; i < flat->size(); ++i) {
+        BOOST_CHECK((*flat)[i].first == outpoints[i]);
+        BOOST_CHECK(i == 5 ? (*flat)[i].second.IsSpent() : (*flat)[i].second.out.nValue == 4);
+    }
+
+    overlay.Clear();
+    BOOST_CHECK(overlay.Find(outpoints[0]) == nullptr);
+    BOOST_CHECK_EQUAL(overlay.DynamicMemoryUsage(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
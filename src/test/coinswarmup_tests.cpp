@@ -0,0 +1,127 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinswarmup.h"
+#include "coins.h"
+#include "txmempool.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <limits>
+#include <map>
+
+namespace {
+
+class WarmupTestView : public CCoinsView {
+public:
+    std::map<COutPoint, Coin> coins;
+    uint256 hashBest;
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override {
+        auto it = coins.find(outpoint);
+        if (it == coins.end())
+            return false;
+        coin = it->second;
+        return true;
+    }
+    uint256 GetBestBlock() const override { return hashBest; }
+};
+
+COutPoint RandomOutPoint() {
+    return COutPoint(GetRandHash(), insecure_rand() % 10);
+}
+
+} // ns anon
+
+BOOST_FIXTURE_TEST_SUITE(coinswarmup_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(warm_cache) {
+    WarmupTestView base;
+    std::vector<COutPoint> vOutPoints;
+    for (int i = 0; i < 2500; ++i) {
+        vOutPoints.push_back(RandomOutPoint());
+        base.coins[vOutPoints.back()] = Coin(CTxOut(i, CScript() << OP_TRUE), i, false);
+    }
+    // Coins spent since they were recorded are not found.
+    for (int i = 0; i < 100; ++i)
+        vOutPoints.push_back(RandomOutPoint());
+
+    CCoinsViewCache cache(&base);
+    CCriticalSection cs;
+    CoinsWarmup warmup(cache, base, cs, std::numeric_limits<size_t>::max());
+    warmup.Start(vOutPoints, 3);
+    BOOST_CHECK(warmup.WaitFor(std::chrono::seconds(60)));
+
+    CoinsWarmupStats stats = warmup.GetStats();
+    BOOST_CHECK_EQUAL(stats.nTotal, 2600);
+    BOOST_CHECK_EQUAL(stats.nRead, 2600);
+    BOOST_CHECK_EQUAL(stats.nLoaded, 2500);
+    BOOST_CHECK(stats.fDone);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2500);
+    for (const auto& c : base.coins)
+        BOOST_CHECK(cache.HaveCoinInCache(c.first));
+}
+
+BOOST_AUTO_TEST_CASE(warm_cache_limit) {
+    WarmupTestView base;
+    std::vector<COutPoint> vOutPoints;
+    for (int i = 0; i < 100; ++i) {
+        vOutPoints.push_back(RandomOutPoint());
+        base.coins[vOutPoints.back()] = Coin(CTxOut(i, CScript() << OP_TRUE), i, false);
+    }
+
+    CCoinsViewCache cache(&base);
+    CCriticalSection cs;
+    CoinsWarmup warmup(cache, base, cs, 0);
+    warmup.Start(vOutPoints, 1);
+    BOOST_CHECK(warmup.WaitFor(std::chrono::seconds(60)));
+    BOOST_CHECK_EQUAL(warmup.GetStats().nLoaded, 0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(coins_to_warm) {
+    WarmupTestView base;
+    CCoinsViewCache cache(&base);
+    const COutPoint cached = RandomOutPoint();
+    cache.AddCoin(cached, Coin(CTxOut(1, CScript() << OP_TRUE), 1, false), false);
+    const COutPoint spent = RandomOutPoint();
+    cache.AddCoin(spent, Coin(CTxOut(2, CScript() << OP_TRUE), 1, false), false);
+    cache.SpendCoin(spent);
+
+    // A mempool transaction spending a coin in the chain, and its child.
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    const COutPoint input = RandomOutPoint();
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vin[0].prevout = input;
+    parent.vout.resize(1);
+    parent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(parent.GetHash(), entry.FromTx(parent));
+    CMutableTransaction child;
+    child.vin.resize(1);
+    child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+    child.vout.resize(1);
+    child.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(child.GetHash(), entry.FromTx(child));
+
+    std::vector<COutPoint> vOutPoints = GetCoinsToWarm(cache, pool, 10);
+    BOOST_CHECK(vOutPoints == std::vector<COutPoint>({ input, cached }));
+    vOutPoints = GetCoinsToWarm(cache, pool, 1);
+    BOOST_CHECK(vOutPoints == std::vector<COutPoint>({ input }));
+
+    // Written at shutdown, and read at startup.
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    BOOST_CHECK(WriteCoinsWarmupFile(path, GetCoinsToWarm(cache, pool, 10)));
+    std::vector<COutPoint> vRead;
+    BOOST_CHECK(ReadCoinsWarmupFile(path, vRead));
+    BOOST_CHECK(vRead == std::vector<COutPoint>({ input, cached }));
+    boost::filesystem::remove(path);
+    BOOST_CHECK(!ReadCoinsWarmupFile(path, vRead));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
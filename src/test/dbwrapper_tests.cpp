@@ -117,6 +117,37 @@ BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
     BOOST_CHECK_EQUAL(it->Valid(), false);
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_snapshot)
+{
+    path ph = temp_directory_path() / unique_path();
+    bool isObfuscated;
+    CDBWrapper dbw(ph, (1 << 20), isObfuscated, true, false);
+
+    uint256 in = GetRandHash();
+    uint256 in2 = GetRandHash();
+    BOOST_CHECK(dbw.Write('j', in));
+    BOOST_CHECK(dbw.Write('k', in2));
+    std::shared_ptr<const leveldb::Snapshot> snapshot = dbw.GetSnapshot();
+
+    // Written after the snapshot was taken.
+    BOOST_CHECK(dbw.Write('j', GetRandHash()));
+    BOOST_CHECK(dbw.Erase('k'));
+    BOOST_CHECK(dbw.Write('l', GetRandHash()));
+
+    uint256 res;
+    BOOST_CHECK(dbw.Read('j', res, snapshot.get()));
+    BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+    BOOST_CHECK(dbw.Exists('k', snapshot.get()));
+    BOOST_CHECK(!dbw.Exists('k'));
+    BOOST_CHECK(!dbw.Exists('l', snapshot.get()));
+
+    std::unique_ptr<CDBIterator> it(dbw.NewIterator(snapshot.get()));
+    int nEntries = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next())
+        nEntries++;
+    BOOST_CHECK_EQUAL(nEntries, 2);
+}
+
 BOOST_AUTO_TEST_CASE(readwrite_existing_data)
 {
     // We're going to share this path between two wrappers
@@ -193,4 +224,108 @@ BOOST_AUTO_TEST_CASE(existing_data_reindex)
     BOOST_CHECK_EQUAL(res3.ToString(), in2.ToString());
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_stats)
+{
+    path ph = temp_directory_path() / unique_path();
+    bool isObfuscated;
+    CDBWrapper dbw(ph, (1 << 20), isObfuscated, true, false, "statstest");
+    BOOST_CHECK_EQUAL(dbw.GetName(), "statstest");
+    const CDBStats& stats = dbw.GetStats();
+    const uint64_t nReads = stats.read.Count(); // reads when opening
+
+    for (char key = 'a'; key <= 'j'; key++)
+        BOOST_CHECK(dbw.Write(key, GetRandHash()));
+    uint256 res;
+    BOOST_CHECK(dbw.Read('a', res));
+    BOOST_CHECK(!dbw.Read('z', res));
+    BOOST_CHECK(dbw.Exists('b'));
+
+    std::unique_ptr<CDBIterator> it(dbw.NewIterator());
+    int nEntries = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next())
+        nEntries++;
+    BOOST_CHECK_EQUAL(nEntries, 10);
+
+    BOOST_CHECK_EQUAL(stats.writeBatch.Count(), 10);
+    BOOST_CHECK_EQUAL(stats.read.Count(), nReads + 2);
+    BOOST_CHECK_EQUAL(stats.exists.Count(), 1);
+    BOOST_CHECK_EQUAL(stats.iterSeek.Count(), 1);
+    BOOST_CHECK_EQUAL(stats.iterNext.Count(), 10);
+    BOOST_CHECK_EQUAL(uint64_t(stats.nBytesRead), 32);
+    BOOST_CHECK(stats.nBytesWritten >= 10 * 32);
+
+    uint64_t nInBuckets = 0;
+    for (int n = 0; n < CDBLatency::NUM_BUCKETS; n++)
+        nInBuckets += stats.writeBatch.Bucket(n);
+    BOOST_CHECK_EQUAL(nInBuckets, 10);
+    BOOST_CHECK(stats.writeBatch.MaxMicros() <= stats.writeBatch.TotalMicros());
+
+    bool fFound = false;
+    ForEachDBWrapper([&](CDBWrapper& db) { fFound |= &db == &dbw; });
+    BOOST_CHECK(fFound);
+
+    BOOST_CHECK(!dbw.GetProperty("leveldb.stats").empty());
+    BOOST_CHECK(dbw.GetProperty("leveldb.nonexistent").empty());
+
+    // Compacting moves the entries out of the memtable into a table file.
+    // Meanwhile, the databases can be listed.
+    BOOST_CHECK(WithDBWrapper("statstest", [&](CDBWrapper& db) {
+        BOOST_CHECK_EQUAL(&db, &dbw);
+        db.CompactRange("", "");
+        bool fListed = false;
+        ForEachDBWrapper([&](CDBWrapper& db) { fListed |= &db == &dbw; });
+        BOOST_CHECK(fListed);
+    }));
+    BOOST_CHECK_EQUAL(dbw.GetProperty("leveldb.num-files-at-level0"), "0");
+    BOOST_CHECK(dbw.Read('j', res));
+    BOOST_CHECK(!WithDBWrapper("nonexistent", [](CDBWrapper&) { BOOST_ERROR("called"); }));
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    DBOptions options(40 << 20);
+    BOOST_CHECK_EQUAL(options.nBlockCache, 20 << 20);
+    BOOST_CHECK_EQUAL(options.nWriteBuffer, 10 << 20);
+    BOOST_CHECK_EQUAL(options.nBloomBits, DBWRAPPER_BLOOM_BITS);
+
+    BOOST_CHECK(ApplyDBOption("chainstate.blockcache=64", "chainstate", options));
+    BOOST_CHECK(ApplyDBOption("blocks/index.bloombits=0", "chainstate", options));
+    BOOST_CHECK(ApplyDBOption("chainstate.maxopenfiles=500", "chainstate", options));
+    BOOST_CHECK_EQUAL(options.nBlockCache, 64 << 20);
+    BOOST_CHECK_EQUAL(options.nBloomBits, DBWRAPPER_BLOOM_BITS);
+    BOOST_CHECK_EQUAL(options.nMaxOpenFiles, 500);
+
+    BOOST_CHECK(!ApplyDBOption("chainstate.blockcache", "chainstate", options));
+    BOOST_CHECK(!ApplyDBOption("chainstate.blockcache=-1", "chainstate", options));
+    BOOST_CHECK(!ApplyDBOption("chainstate.nonsense=1", "chainstate", options));
+    BOOST_CHECK(!ApplyDBOption("blockcache=1", "chainstate", options));
+    BOOST_CHECK_EQUAL(options.nBlockCache, 64 << 20);
+
+    // A database without bloom filters still works.
+    options.nBloomBits = 0;
+    path ph = temp_directory_path() / unique_path();
+    bool isObfuscated;
+    CDBWrapper dbw(ph, options, isObfuscated, true, false);
+    uint256 in = GetRandHash(), res;
+    BOOST_CHECK(dbw.Write('k', in));
+    BOOST_CHECK(dbw.Read('k', res));
+    BOOST_CHECK(res == in);
+    BOOST_CHECK_EQUAL(dbw.GetBlockCacheSize(), 64 << 20);
+}
+
+BOOST_AUTO_TEST_CASE(dblatency_buckets)
+{
+    CDBLatency latency;
+    latency.Add(0);
+    latency.Add(1);
+    latency.Add(3);
+    latency.Add(int64_t(1) << 40);
+    BOOST_CHECK_EQUAL(latency.Bucket(0), 1);
+    BOOST_CHECK_EQUAL(latency.Bucket(1), 1);
+    BOOST_CHECK_EQUAL(latency.Bucket(2), 1);
+    BOOST_CHECK_EQUAL(latency.Bucket(CDBLatency::NUM_BUCKETS - 1), 1);
+    BOOST_CHECK_EQUAL(latency.Count(), 4);
+    BOOST_CHECK_EQUAL(latency.MaxMicros(), int64_t(1) << 40);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
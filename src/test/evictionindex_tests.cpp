@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "evictionindex.h"
+#include "net.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+std::unique_ptr<CNode> NewNode(NodeId id, const std::string& ip) {
+    return std::unique_ptr<CNode>(new CNode(id, NODE_NETWORK, 0, INVALID_SOCKET,
+                CAddress(CService(CNetAddr(ip), 8333)), 0, "", true));
+}
+
+} // ns anon
+
+BOOST_FIXTURE_TEST_SUITE(evictionindex_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(find_lowest_priority)
+{
+    std::unique_ptr<CNode> a = NewNode(1, "10.0.0.1");
+    std::unique_ptr<CNode> b = NewNode(2, "10.0.0.2");
+    std::unique_ptr<CNode> c = NewNode(3, "10.0.0.3");
+
+    EvictionIndex index;
+    index.insert(a.get(), "high", 2);
+    index.insert(b.get(), "low", -1);
+    index.insert(c.get(), "low", -1);
+    BOOST_CHECK_EQUAL(index.size(), 3u);
+
+    // Nothing lower than the lowest.
+    CNode* pnode = nullptr;
+    std::string group;
+    BOOST_CHECK(!index.findLowerThan(-1, pnode, group));
+
+    // The newest node of the lowest group.
+    BOOST_CHECK(index.findLowerThan(0, pnode, group));
+    BOOST_CHECK_EQUAL(pnode, c.get());
+    BOOST_CHECK_EQUAL(group, "low");
+
+    index.erase(c.get());
+    BOOST_CHECK(index.findLowerThan(0, pnode, group));
+    BOOST_CHECK_EQUAL(pnode, b.get());
+
+    index.erase(b.get());
+    BOOST_CHECK(!index.findLowerThan(0, pnode, group));
+    BOOST_CHECK(index.findLowerThan(3, pnode, group));
+    BOOST_CHECK_EQUAL(pnode, a.get());
+    BOOST_CHECK_EQUAL(index.size(), 1u);
+
+    index.clear();
+    BOOST_CHECK(!index.findLowerThan(3, pnode, group));
+    BOOST_CHECK_EQUAL(index.size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(set_priority)
+{
+    std::unique_ptr<CNode> a = NewNode(1, "10.0.0.1");
+    std::unique_ptr<CNode> b = NewNode(2, "10.0.0.2");
+
+    EvictionIndex index;
+    index.insert(a.get(), "a", 0);
+    index.insert(b.get(), "b", 1);
+
+    CNode* pnode = nullptr;
+    std::string group;
+    BOOST_CHECK(index.findLowerThan(1, pnode, group));
+    BOOST_CHECK_EQUAL(pnode, a.get());
+
+    index.setPriority("a", 2);
+    BOOST_CHECK(!index.findLowerThan(1, pnode, group));
+    BOOST_CHECK(index.findLowerThan(2, pnode, group));
+    BOOST_CHECK_EQUAL(pnode, b.get());
+
+    // Unknown groups are ignored.
+    index.setPriority("c", -5);
+    BOOST_CHECK(index.findLowerThan(2, pnode, group));
+    BOOST_CHECK_EQUAL(group, "b");
+
+    // Reinserting a node moves it.
+    index.insert(b.get(), "a", 2);
+    BOOST_CHECK_EQUAL(index.size(), 2u);
+    BOOST_CHECK(!index.findLowerThan(2, pnode, group));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,120 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "getdataworkers.h"
+#include "test/dummyconnman.h"
+#include "test/test_bitcoin.h"
+#include "test/thinblockutil.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Records what would have been sent instead of sending blocks.
+class TestWorkers : public GetDataWorkers {
+public:
+    TestWorkers(CConnman& connman) : GetDataWorkers(connman) { }
+
+    std::vector<std::pair<NodeId, uint256> > Served() {
+        std::lock_guard<std::mutex> lock(cs_served);
+        return served;
+    }
+
+protected:
+    void Serve(CNode& node, const Request& req) override {
+        std::lock_guard<std::mutex> lock(cs_served);
+        served.push_back(std::make_pair(node.id, req.inv.hash));
+    }
+
+private:
+    std::mutex cs_served;
+    std::vector<std::pair<NodeId, uint256> > served;
+};
+
+bool WaitFor(std::function<bool()> done) {
+    for (int i = 0; i < 500 && !done(); ++i)
+        MilliSleep(10);
+    return done();
+}
+
+CInv BlockInv(int n) {
+    return CInv(MSG_BLOCK, ArithToUint256(arith_uint256(n)));
+}
+
+} // ns anon
+
+BOOST_FIXTURE_TEST_SUITE(getdataworkers_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(peers_take_turns) {
+    DummyConnman connman;
+    DummyNode node1, node2;
+    TestWorkers workers(connman);
+
+    // Queued before starting, so the turn order is known.
+    for (int i = 1; i <= 3; ++i)
+        BOOST_CHECK(workers.Queue(node1, BlockInv(i), nullptr));
+    for (int i = 11; i <= 12; ++i)
+        BOOST_CHECK(workers.Queue(node2, BlockInv(i), nullptr));
+    BOOST_CHECK_EQUAL(workers.NumPending(node1.id), 3);
+    BOOST_CHECK(workers.HasPending(node2.id));
+
+    workers.Start(1);
+    BOOST_CHECK(WaitFor([&]() { return workers.Served().size() == 5; }));
+    BOOST_CHECK(WaitFor([&]() { return !workers.HasPending(node1.id) && !workers.HasPending(node2.id); }));
+
+    std::vector<std::pair<NodeId, uint256> > expected = {
+        { node1.id, BlockInv(1).hash }, { node2.id, BlockInv(11).hash },
+        { node1.id, BlockInv(2).hash }, { node2.id, BlockInv(12).hash },
+        { node1.id, BlockInv(3).hash }
+    };
+    BOOST_CHECK(workers.Served() == expected);
+    workers.Stop();
+    BOOST_CHECK_EQUAL(node1.GetRefCount(), 0);
+    BOOST_CHECK(!workers.Queue(node1, BlockInv(4), nullptr));
+}
+
+BOOST_AUTO_TEST_CASE(full_send_buffer_waits) {
+    DummyConnman connman;
+    DummyNode node1, node2;
+    TestWorkers workers(connman);
+    workers.Start(2);
+
+    node2.fPauseSend = true;
+    BOOST_CHECK(workers.Queue(node2, BlockInv(2), nullptr));
+    BOOST_CHECK(workers.Queue(node1, BlockInv(1), nullptr));
+    BOOST_CHECK(WaitFor([&]() { return !workers.HasPending(node1.id); }));
+    BOOST_CHECK_EQUAL(workers.Served().size(), 1);
+    BOOST_CHECK(workers.HasPending(node2.id));
+
+    node2.fPauseSend = false;
+    BOOST_CHECK(WaitFor([&]() { return !workers.HasPending(node2.id); }));
+    BOOST_CHECK_EQUAL(workers.Served().size(), 2);
+    BOOST_CHECK(workers.Served().back().first == node2.id);
+}
+
+BOOST_AUTO_TEST_CASE(queue_limits) {
+    DummyConnman connman;
+    DummyNode node;
+    TestWorkers workers(connman);
+
+    for (size_t i = 0; i < MAX_GETDATA_QUEUE_PER_PEER; ++i)
+        BOOST_CHECK(workers.Queue(node, BlockInv(i), nullptr));
+    BOOST_CHECK(!workers.Queue(node, BlockInv(1000), nullptr));
+    BOOST_CHECK_EQUAL(node.GetRefCount(), 1);
+
+    // Requests of a disconnected peer are dropped.
+    node.fDisconnect = true;
+    workers.Start(1);
+    BOOST_CHECK(WaitFor([&]() { return !workers.HasPending(node.id); }));
+    BOOST_CHECK(workers.Served().empty());
+    BOOST_CHECK_EQUAL(node.GetRefCount(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -18,7 +18,9 @@ BOOST_FIXTURE_TEST_SUITE(hash_tests, BasicTestingSetup)
 BOOST_AUTO_TEST_CASE(murmurhash3)
 {
 
-#define T(expected, seed, data) BOOST_CHECK_EQUAL(MurmurHash3(seed, ParseHex(data)), expected)
+#define T(expected, seed, data) \
+    BOOST_CHECK_EQUAL(MurmurHash3(seed, ParseHex(data)), expected); \
+    BOOST_CHECK_EQUAL(CMurmurHash3Input(ParseHex(data)).Hash(seed), expected)
 
     // Test MurmurHash3 with various inputs. Of course this is retested in the
     // bloom filter tests - they would fail if MurmurHash3() had any problems -
@@ -48,6 +50,26 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(murmurhash3_many_seeds)
+{
+    // Batched hashing covers both full and partial lanes.
+    std::vector<unsigned int> seeds;
+    for (unsigned int i = 0; i < 21; ++i)
+        seeds.push_back(i * 0xFBA4C795 + 0x12345678);
+
+    for (size_t nLen = 0; nLen < 40; nLen += 3) {
+        std::vector<unsigned char> data(nLen);
+        for (size_t i = 0; i < nLen; ++i)
+            data[i] = i * 7 + 1;
+        const CMurmurHash3Input input(data);
+
+        std::vector<unsigned int> results(seeds.size());
+        input.HashMany(seeds.data(), results.data(), seeds.size());
+        for (size_t i = 0; i < seeds.size(); ++i)
+            BOOST_CHECK_EQUAL(results[i], MurmurHash3(seeds[i], data));
+    }
+}
+
 /*
    SipHash-2-4 output with
    k = 00 01 02 ...
@@ -164,4 +164,30 @@ BOOST_AUTO_TEST_CASE(add_or_replace_keeps_conncount) {
     BOOST_CHECK_EQUAL(1, FindGroupForIP(ip).connCount);
 }
 
+BOOST_AUTO_TEST_CASE(ipgroups_changed_signal)
+{
+    std::vector<std::pair<std::string, int> > changes;
+    boost::signals2::scoped_connection conn = IPGroupsChanged().connect(
+            [&changes](const std::string& group, int priority) {
+                changes.push_back(std::make_pair(group, priority));
+            });
+
+    // Each connection from an IP lowers the priority of its group.
+    CNetAddr ip("10.0.0.1");
+    std::unique_ptr<IPGroupSlot> slot1 = AssignIPGroupSlot(ip);
+    std::unique_ptr<IPGroupSlot> slot2 = AssignIPGroupSlot(ip);
+    BOOST_CHECK_EQUAL(changes.size(), 2u);
+    BOOST_CHECK_EQUAL(changes[0].first, ip.ToStringIP());
+    BOOST_CHECK_EQUAL(changes[0].second, DEFAULT_IPGROUP_PRI);
+    BOOST_CHECK_EQUAL(changes[1].second, DEFAULT_IPGROUP_PRI - IPGROUP_CONN_MODIFIER);
+
+    slot2.reset();
+    BOOST_CHECK_EQUAL(changes.size(), 3u);
+    BOOST_CHECK_EQUAL(changes[2].second, DEFAULT_IPGROUP_PRI);
+
+    // The group is gone with the last connection.
+    slot1.reset();
+    BOOST_CHECK_EQUAL(changes.size(), 3u);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
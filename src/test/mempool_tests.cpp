@@ -378,4 +378,110 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     CheckSort<3>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolSortForRelayTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // parent with a low fee, and a child paying for it
+    CMutableTransaction parent;
+    parent.vout.resize(1);
+    parent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    parent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(parent.GetHash(), entry.Fee(1000LL).FromTx(parent));
+
+    CMutableTransaction child;
+    child.vin.resize(1);
+    child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+    child.vin[0].scriptSig = CScript() << OP_11;
+    child.vout.resize(1);
+    child.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    child.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(child.GetHash(), entry.Fee(100000LL).FromTx(child));
+
+    CMutableTransaction high, low;
+    high.vout.resize(1);
+    high.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    high.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(high.GetHash(), entry.Fee(20000LL).FromTx(high));
+    low.vout.resize(1);
+    low.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    low.vout[0].nValue = 3 * COIN;
+    pool.addUnchecked(low.GetHash(), entry.Fee(500LL).FromTx(low));
+
+    uint256 missing = GetRandHash();
+    std::vector<uint256> vHashes = {
+        missing, child.GetHash(), low.GetHash(), parent.GetHash(), high.GetHash()
+    };
+    pool.SortForRelay(vHashes, vHashes.size());
+    std::vector<uint256> expected = {
+        high.GetHash(), parent.GetHash(), low.GetHash(), child.GetHash(), missing
+    };
+    BOOST_CHECK(vHashes == expected);
+
+    // Only the first ones are put in order, but none are lost.
+    vHashes = { low.GetHash(), missing, child.GetHash(), high.GetHash() };
+    pool.SortForRelay(vHashes, 1);
+    BOOST_CHECK(vHashes[0] == high.GetHash());
+    std::sort(vHashes.begin(), vHashes.end());
+    expected = { low.GetHash(), missing, child.GetHash(), high.GetHash() };
+    std::sort(expected.begin(), expected.end());
+    BOOST_CHECK(vHashes == expected);
+}
+
+BOOST_AUTO_TEST_CASE(DisconnectedBlockTransactionsTest)
+{
+    // Three blocks, each spending the previous one's transaction.
+    std::vector<std::vector<CTransaction>> blocks(3);
+    uint256 prev = GetRandHash();
+    for (int n = 0; n < 3; ++n) {
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << n << OP_0;
+        coinbase.vout.resize(1);
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(prev, 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = (10 - n) * COIN;
+        blocks[n] = { coinbase, tx };
+        prev = tx.GetHash();
+    }
+
+    // Disconnected from the newest.
+    DisconnectedBlockTransactions disconnected;
+    for (int n = 2; n >= 0; --n)
+        disconnected.AddBlock(blocks[n]);
+    BOOST_CHECK_EQUAL(disconnected.size(), 3);
+    BOOST_CHECK(disconnected.DynamicMemoryUsage() > 0);
+
+    // Parents first, without coinbases.
+    std::vector<CTransaction> vtx = disconnected.TakeTransactions();
+    BOOST_REQUIRE_EQUAL(vtx.size(), 3);
+    for (int n = 0; n < 3; ++n)
+        BOOST_CHECK(vtx[n] == blocks[n][1]);
+    BOOST_CHECK_EQUAL(disconnected.size(), 0);
+    BOOST_CHECK_EQUAL(disconnected.DynamicMemoryUsage(), 0);
+
+    // A transaction confirmed in the new chain is not taken.
+    for (int n = 2; n >= 0; --n)
+        disconnected.AddBlock(blocks[n]);
+    disconnected.RemoveForBlock(std::vector<CTransaction>{ blocks[1][1] });
+    vtx = disconnected.TakeTransactions();
+    BOOST_REQUIRE_EQUAL(vtx.size(), 2);
+    BOOST_CHECK(vtx[0] == blocks[0][1]);
+    BOOST_CHECK(vtx[1] == blocks[2][1]);
+
+    // Over the limit, the newest block goes first.
+    for (int n = 2; n >= 0; --n)
+        disconnected.AddBlock(blocks[n]);
+    vtx = disconnected.RemoveNewestBlock();
+    BOOST_REQUIRE_EQUAL(vtx.size(), 1);
+    BOOST_CHECK(vtx[0] == blocks[2][1]);
+    BOOST_CHECK_EQUAL(disconnected.size(), 2);
+    vtx = disconnected.TakeTransactions();
+    BOOST_REQUIRE_EQUAL(vtx.size(), 2);
+    BOOST_CHECK(vtx[1] == blocks[1][1]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,8 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "bloom.h"
+#include "hash.h"
 #include "main.h"
 #include "net.h"
+#include "netmessagemaker.h"
 
 #include "test/test_bitcoin.h"
 #include "test/thinblockutil.h"
@@ -23,6 +26,26 @@ protected:
         return false;
     }
 };
+
+// Queue a message as received from the peer.
+template <typename... Args>
+void QueueReceived(CNode& node, const char* command, Args&&... args)
+{
+    CSerializedNetMsg msg = CNetMsgMaker(PROTOCOL_VERSION).Make(command, std::forward<Args>(args)...);
+    CMessageHeader hdr(Params().NetworkMagic(), command, msg.data.size());
+    uint256 hash = Hash(msg.data.begin(), msg.data.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream s(SER_NETWORK, INIT_PROTO_VERSION);
+    s << hdr;
+    s.write((const char*)msg.data.data(), msg.data.size());
+
+    CNetMessage received(Params().NetworkMagic(), SER_NETWORK, INIT_PROTO_VERSION);
+    const int nHeader = received.readHeader(&s[0], s.size());
+    received.readData(&s[nHeader], s.size() - nHeader);
+    LOCK(node.cs_vProcessMsg);
+    node.nProcessQueueSize += s.size();
+    node.vProcessMsg.push_back(std::move(received));
+}
 } // ns anon
 
 BOOST_AUTO_TEST_CASE(MaxSizeVersionMessage)
@@ -137,4 +160,37 @@ BOOST_AUTO_TEST_CASE(OverMaxSizeValidRejectMessage)
     logCategories.store(temp);
 }
 
+BOOST_AUTO_TEST_CASE(OverBudgetFilterOrder)
+{
+    DummyNode n;
+    n.nVersion = PROTOCOL_VERSION;
+    n.fSuccessfullyConnected = true;
+    CConnman dummy(0, 0);
+    std::atomic<bool> interruptDummy(false);
+
+    // Use up the peer's budget.
+    n.requestCost.SetBudget(1, 0);
+    n.requestCost.AddCPUTime(PEER_REQUEST_BURST * 1000000);
+    n.requestCost.AddCPUTime(PEER_REQUEST_BURST * 1000000);
+    BOOST_CHECK(n.requestCost.IsOverBudget());
+
+    const std::vector<unsigned char> vData(20, 0xab);
+    CBloomFilter filter(10, 0.000001, 0, BLOOM_UPDATE_ALL);
+    filter.insert(vData);
+    QueueReceived(n, NetMsgType::FILTERLOAD, filter);
+    QueueReceived(n, NetMsgType::FILTERCLEAR);
+
+    // The filterclear waits behind the filterload.
+    ProcessMessages(&n, &dummy, interruptDummy);
+    BOOST_CHECK_EQUAL(n.vProcessMsg.size(), 2u);
+
+    n.requestCost.SetBudget(0, 0);
+    while (!n.vProcessMsg.empty())
+        ProcessMessages(&n, &dummy, interruptDummy);
+    LOCK(n.cs_filter);
+    // Cleared, so it matches everything rather than only what was loaded.
+    BOOST_CHECK(n.pfilter);
+    BOOST_CHECK(n.pfilter->contains(std::vector<unsigned char>(20, 0xcd)));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -78,6 +78,11 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
             CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
             ss << pmt1;
 
+            // building from precomputed tree levels gives the same tree
+            CDataStream ssLevels(SER_NETWORK, PROTOCOL_VERSION);
+            ssLevels << CPartialMerkleTree(CPartialMerkleTree::ComputeLevels(vTxid), vMatch);
+            BOOST_CHECK(ss.str() == ssLevels.str());
+
             // verify CPartialMerkleTree's size guarantees
             unsigned int n = std::min<unsigned int>(nTx, 1 + vMatchTxid1.size()*nHeight);
             BOOST_CHECK(ss.size() <= 10 + (258*n+7)/8);
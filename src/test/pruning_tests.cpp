@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "test/test_bitcoin.h"
+#include "undo.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+// A regtest chain past the height pruning starts at, spread over several
+// small block files with -fastprune.
+struct PruneTestSetup : public TestChainSetup {
+    PruneTestSetup() : TestChainSetup(0) {
+        mapArgs["-fastprune"] = "1";
+        fPruneMode = true;
+        for (int i = 0; i < Params().PruneAfterHeight() + 400; i++)
+            CreateAndProcessBlock(std::vector<CMutableTransaction>(), CScript() << OP_TRUE);
+    }
+    ~PruneTestSetup() {
+        mapArgs.erase("-fastprune");
+        fPruneMode = false;
+        fHavePruned = false;
+    }
+};
+
+bool HaveFile(int nFile, const char* prefix) {
+    return boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nFile, 0), prefix));
+}
+
+// Blocks above nHeight, and all blocks within the keep window of the tip,
+// still have their block and undo data on disk.
+void CheckKeptFrom(int nHeight) {
+    LOCK(cs_main);
+    const int nKeepFrom = std::min(nHeight + 1, chainActive.Height() - nPruneKeepBlocks + 1);
+    for (int h = nKeepFrom; h <= chainActive.Height(); h++) {
+        const CBlockIndex* pindex = chainActive[h];
+        BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_DATA);
+        BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_UNDO);
+        CBlock block;
+        CBlockUndo blockUndo;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+        BOOST_CHECK(UndoReadFromDisk(blockUndo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()));
+    }
+}
+
+// The first block file is gone, and blocks up to nHeight still marked as
+// stored point at files that exist.
+void CheckPrunedTo(int nHeight) {
+    LOCK(cs_main);
+    BOOST_CHECK(fHavePruned);
+    BOOST_CHECK(!(chainActive.Genesis()->nStatus & BLOCK_HAVE_DATA));
+    BOOST_CHECK(!HaveFile(0, "blk"));
+    BOOST_CHECK(!HaveFile(0, "rev"));
+    for (int h = 0; h <= nHeight; h++) {
+        const CBlockIndex* pindex = chainActive[h];
+        if (pindex->nStatus & BLOCK_HAVE_DATA)
+            BOOST_CHECK(HaveFile(pindex->nFile, "blk"));
+    }
+}
+
+} // ns anon
+
+BOOST_FIXTURE_TEST_SUITE(pruning_tests, PruneTestSetup)
+
+BOOST_AUTO_TEST_CASE(prune_to_height)
+{
+    const int nTip = chainActive.Height();
+    std::string strError;
+    BOOST_CHECK(CalculateCurrentUsage() > 0);
+
+    BOOST_CHECK(PruneBlockFilesTo(nTip / 2, 0, strError));
+    CheckPrunedTo(nTip / 2);
+    CheckKeptFrom(nTip / 2);
+
+    // Asking for the tip still keeps nPruneKeepBlocks.
+    BOOST_CHECK(PruneBlockFilesTo(nTip, 0, strError));
+    CheckPrunedTo(nTip - nPruneKeepBlocks);
+    CheckKeptFrom(nTip);
+    BOOST_CHECK(HaveFile(chainActive.Tip()->nFile, "blk"));
+    BOOST_CHECK(HaveFile(chainActive.Tip()->nFile, "rev"));
+}
+
+BOOST_AUTO_TEST_CASE(prune_to_target)
+{
+    const int nTip = chainActive.Height();
+    const uint64_t nUsage = CalculateCurrentUsage();
+    std::string strError;
+
+    // A target above the current usage prunes nothing.
+    BOOST_CHECK(PruneBlockFilesTo(0, nUsage * 2, strError));
+    BOOST_CHECK_EQUAL(CalculateCurrentUsage(), nUsage);
+    BOOST_CHECK(!fHavePruned);
+
+    // The smallest target prunes all but the keep window.
+    BOOST_CHECK(PruneBlockFilesTo(0, 1, strError));
+    BOOST_CHECK(CalculateCurrentUsage() < nUsage);
+    CheckPrunedTo(nTip - nPruneKeepBlocks);
+    CheckKeptFrom(nTip);
+
+    fPruneMode = false;
+    BOOST_CHECK(!PruneBlockFilesTo(0, 1, strError));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
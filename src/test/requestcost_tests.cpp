@@ -0,0 +1,61 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ipgroups.h"
+#include "requestcost.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(requestcost_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(scale_budget)
+{
+    BOOST_CHECK_EQUAL(RequestCost::ScaleBudget(100, DEFAULT_IPGROUP_PRI), 100);
+    BOOST_CHECK_EQUAL(RequestCost::ScaleBudget(100, DEFAULT_IPGROUP_PRI + 2), 300);
+    BOOST_CHECK_EQUAL(RequestCost::ScaleBudget(100, DEFAULT_IPGROUP_PRI - 1), 50);
+    BOOST_CHECK_EQUAL(RequestCost::ScaleBudget(100, DEFAULT_IPGROUP_PRI - 1000), 1);
+}
+
+BOOST_AUTO_TEST_CASE(over_budget)
+{
+    RequestCost cost;
+    cost.SetBudget(100, DEFAULT_IPGROUP_PRI);
+    BOOST_CHECK(!cost.IsOverBudget());
+
+    // A burst of requests is served from the saved up budget.
+    const int64_t nBurst = 100 * 1000 * PEER_REQUEST_BURST;
+    cost.AddCPUTime(nBurst / 2);
+    cost.AddDiskRead((nBurst / 4) * DISK_BYTES_PER_COST_MICRO);
+    BOOST_CHECK(!cost.IsOverBudget());
+
+    RequestCostStats stats = cost.GetStats();
+    BOOST_CHECK_EQUAL(stats.nCPUMicros, nBurst / 2);
+    BOOST_CHECK_EQUAL(stats.nDiskBytes, (nBurst / 4) * DISK_BYTES_PER_COST_MICRO);
+    BOOST_CHECK(stats.nBudget <= nBurst / 4);
+    BOOST_CHECK_EQUAL(stats.nThrottled, 0);
+
+    // It takes the budget of several seconds to recover from this.
+    cost.AddCPUTime(nBurst / 2);
+    cost.AddCPUTime(1000);
+    BOOST_CHECK(cost.IsOverBudget());
+    cost.AddCPUTime(1000);
+    BOOST_CHECK(cost.IsOverBudget());
+    stats = cost.GetStats();
+    BOOST_CHECK(stats.nBudget < 0);
+    BOOST_CHECK_EQUAL(stats.nThrottled, 1);
+}
+
+BOOST_AUTO_TEST_CASE(unlimited_budget)
+{
+    RequestCost cost;
+    cost.SetBudget(0, DEFAULT_IPGROUP_PRI);
+    cost.AddCPUTime(1000 * 1000 * PEER_REQUEST_BURST);
+    BOOST_CHECK(!cost.IsOverBudget());
+    RequestCostStats stats = cost.GetStats();
+    BOOST_CHECK_EQUAL(stats.nCPUMicros, 1000 * 1000 * PEER_REQUEST_BURST);
+    BOOST_CHECK_EQUAL(stats.nThrottled, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
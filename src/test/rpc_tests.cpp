@@ -292,4 +292,38 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_getmemoryinfo)
+{
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getmemoryinfo"));
+    BOOST_CHECK(find_value(r.get_obj(), "blockindex").get_int64() > 0);
+    BOOST_CHECK(find_value(r.get_obj(), "coinscache").isNum());
+    BOOST_CHECK(find_value(r.get_obj(), "peers").isObject());
+    BOOST_CHECK(find_value(find_value(r.get_obj(), "peers").get_obj(), "nodes").isNull());
+
+    int64_t total = 0;
+    for (const std::string& key : r.getKeys()) {
+        if (key == "total" || key == "peers")
+            continue;
+        total += find_value(r.get_obj(), key).get_int64();
+    }
+    const UniValue& peers = find_value(r.get_obj(), "peers");
+    total += find_value(peers.get_obj(), "sendbuffers").get_int64();
+    total += find_value(peers.get_obj(), "recvbuffers").get_int64();
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "total").get_int64(), total);
+
+    BOOST_CHECK_NO_THROW(r = CallRPC("getmemoryinfo true"));
+    BOOST_CHECK(find_value(find_value(r.get_obj(), "peers").get_obj(), "nodes").isArray());
+    BOOST_CHECK_THROW(CallRPC("getmemoryinfo true extra"), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_pruneblockchain)
+{
+    BOOST_CHECK_THROW(CallRPC("pruneblockchain"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("pruneblockchain -1"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("pruneblockchain 0 -1"), runtime_error);
+    // Not running in prune mode.
+    BOOST_CHECK_THROW(CallRPC("pruneblockchain 0"), runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
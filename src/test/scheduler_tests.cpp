@@ -114,4 +114,126 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void increment(boost::mutex& mutex, int& counter)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    ++counter;
+}
+
+BOOST_AUTO_TEST_CASE(cancel_and_reschedule)
+{
+    CScheduler s;
+    boost::mutex mutex;
+    int counter = 0;
+    CScheduler::Function f = boost::bind(&increment, boost::ref(mutex), boost::ref(counter));
+
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    boost::chrono::system_clock::time_point later = now + boost::chrono::hours(1);
+    CScheduler::TaskId a = s.schedule(f, later);
+    CScheduler::TaskId b = s.schedule(f, later);
+    CScheduler::TaskId c = s.schedule(f, later);
+    BOOST_CHECK(a != CScheduler::NO_TASK);
+    BOOST_CHECK(a != b && b != c);
+
+    BOOST_CHECK(s.cancel(a));
+    BOOST_CHECK(!s.cancel(a));
+    BOOST_CHECK(s.reschedule(b, now));
+    BOOST_CHECK(!s.reschedule(a, now));
+
+    boost::chrono::system_clock::time_point first, last;
+    BOOST_CHECK_EQUAL(s.getQueueInfo(first, last), 2);
+    BOOST_CHECK(first == now);
+
+    // Only b is due; c stays queued.
+    boost::thread t(boost::bind(&CScheduler::serviceQueue, &s));
+    while (s.getQueueInfo(first, last) != 1)
+        MicroSleep(100);
+    s.stop();
+    t.join();
+
+    BOOST_CHECK_EQUAL(counter, 1);
+    BOOST_CHECK(!s.cancel(b));
+    BOOST_CHECK(s.cancel(c));
+    BOOST_CHECK_EQUAL(s.getQueueInfo(first, last), 0);
+}
+
+BOOST_AUTO_TEST_CASE(cancel_repeating)
+{
+    CScheduler s;
+    boost::mutex mutex;
+    int counter = 0;
+    CScheduler::Function f = boost::bind(&increment, boost::ref(mutex), boost::ref(counter));
+
+    CScheduler::TaskId id = s.scheduleEvery(f, 1, "repeat");
+    boost::chrono::system_clock::time_point first, last;
+    BOOST_CHECK(s.reschedule(id, boost::chrono::system_clock::now()));
+
+    boost::thread t(boost::bind(&CScheduler::serviceQueue, &s));
+    for (;;) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (counter > 0)
+                break;
+        }
+        MicroSleep(100);
+    }
+    // The repeating task is back in the queue under the same handle.
+    while (s.getQueueInfo(first, last) != 1)
+        MicroSleep(100);
+    BOOST_CHECK(s.cancel(id));
+    BOOST_CHECK_EQUAL(s.getQueueInfo(first, last), 0);
+    s.stop();
+    t.join();
+
+    std::vector<CScheduler::TaskStats> stats = s.getTaskStats();
+    BOOST_CHECK_EQUAL(stats.size(), 1);
+    BOOST_CHECK_EQUAL(stats[0].name, "repeat");
+    BOOST_CHECK_EQUAL(stats[0].nRuns, 1);
+    BOOST_CHECK(stats[0].nMaxMicros >= stats[0].nLastMicros);
+}
+
+struct StrandCheck {
+    boost::mutex mutex;
+    int running = 0;
+    int maxRunning = 0;
+    int done = 0;
+};
+
+static void strandTask(StrandCheck& check)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(check.mutex);
+        check.maxRunning = std::max(check.maxRunning, ++check.running);
+    }
+    MicroSleep(200);
+    boost::unique_lock<boost::mutex> lock(check.mutex);
+    --check.running;
+    ++check.done;
+}
+
+BOOST_AUTO_TEST_CASE(strands)
+{
+    CScheduler s;
+    StrandCheck serial, parallel;
+    CScheduler::Strand strand = s.newStrand();
+    BOOST_CHECK(strand != CScheduler::NO_STRAND);
+    BOOST_CHECK(strand != s.newStrand());
+
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    for (int i = 0; i < 20; i++) {
+        s.schedule(boost::bind(&strandTask, boost::ref(serial)), now, "serial", strand);
+        s.schedule(boost::bind(&strandTask, boost::ref(parallel)), now, "parallel");
+    }
+
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &s));
+    s.stop(true);
+    threads.join_all();
+
+    BOOST_CHECK_EQUAL(serial.done, 20);
+    BOOST_CHECK_EQUAL(parallel.done, 20);
+    BOOST_CHECK_EQUAL(serial.maxRunning, 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,10 +7,14 @@
 #include "test_bitcoin.h"
 
 
+#include "chainparams.h"
+#include "consensus/merkle.h"
 #include "consensus/validation.h"
 #include "key.h"
 #include "main.h"
+#include "miner.h"
 #include "options.h"
+#include "pow.h"
 #include "random.h"
 #include "rpc/register.h"
 #include "rpc/server.h"
@@ -58,6 +62,7 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         pblocktree = new CBlockTreeDB(1 << 20, isObfuscated, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, isObfuscated, true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        SetCoinsSnapshotDB(pcoinsdbview);
         InitBlockIndex();
         {
             CValidationState state;
@@ -78,12 +83,45 @@ TestingSetup::~TestingSetup()
         threadGroup.interrupt_all();
         threadGroup.join_all();
         UnloadBlockIndex();
+        SetCoinsSnapshotDB(nullptr);
         delete pcoinsTip;
         delete pcoinsdbview;
         delete pblocktree;
         boost::filesystem::remove_all(pathTemp);
 }
 
+TestChainSetup::TestChainSetup(int nBlocks) : TestingSetup(CBaseChainParams::REGTEST)
+{
+        CScript scriptPubKey = CScript() << OP_TRUE;
+        for (int i = 0; i < nBlocks; i++)
+            CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+}
+
+CBlock TestChainSetup::CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns,
+                                             const CScript& scriptPubKey)
+{
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPubKey));
+        CBlock& block = pblocktemplate->block;
+
+        // Just the coinbase and the given transactions.
+        block.vtx.resize(1);
+        for (const CMutableTransaction& tx : txns)
+            block.vtx.push_back(CTransaction(tx));
+        {
+            LOCK(cs_main);
+            CMutableTransaction coinbase(block.vtx[0]);
+            coinbase.vin[0].scriptSig = CScript() << (chainActive.Height() + 1) << OP_0;
+            block.vtx[0] = CTransaction(coinbase);
+        }
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        while (!CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus()))
+            ++block.nNonce;
+
+        CValidationState state;
+        ProcessNewBlock(state, BlockSource{}, &block, true, NULL, connman);
+        return block;
+}
+
 CTxMemPoolEntry TestMemPoolEntryHelper::FromTx(CMutableTransaction &tx, CTxMemPool *pool) {
     CTransaction txn(tx);
     return FromTx(txn, pool);
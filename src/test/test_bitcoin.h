@@ -34,6 +34,19 @@ struct TestingSetup: public BasicTestingSetup {
     ~TestingSetup();
 };
 
+class CBlock;
+struct CMutableTransaction;
+class CScript;
+
+/** Testing setup with a regtest chain of mined blocks on disk. */
+struct TestChainSetup : public TestingSetup {
+    TestChainSetup(int nBlocks = 100);
+
+    // Mine a block with the transactions on the tip and process it.
+    CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns,
+                                 const CScript& scriptPubKey);
+};
+
 class CTxMemPoolEntry;
 class CTxMemPool;
 
@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txrequest.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+typedef std::vector<uint256> Hashes;
+
+BOOST_FIXTURE_TEST_SUITE(txrequest_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(requests_from_one_peer) {
+    TxRequestTracker tracker;
+    const uint256 txid = GetRandHash();
+    const int64_t nNow = 1000 * TXREQUEST_TIMEOUT;
+
+    // Inbound peer 1 announces first, then outbound peer 2.
+    BOOST_CHECK(tracker.ReceivedInv(1, txid, false, nNow));
+    BOOST_CHECK(tracker.ReceivedInv(2, txid, true, nNow + 1));
+    BOOST_CHECK(tracker.GetRequestable(1, nNow + 1).empty());
+
+    // The outbound peer is asked first, and only it.
+    BOOST_CHECK(tracker.GetRequestable(2, nNow + 1) == Hashes{txid});
+    BOOST_CHECK(tracker.GetRequestable(2, nNow + 2).empty());
+    BOOST_CHECK(tracker.GetRequestable(1, nNow + TXREQUEST_NONPREFERRED_DELAY).empty());
+
+    // It times out, so the other peer is asked.
+    int64_t nLater = nNow + 1 + TXREQUEST_TIMEOUT;
+    BOOST_CHECK(tracker.GetRequestable(2, nLater).empty());
+    BOOST_CHECK(tracker.GetRequestable(1, nLater) == Hashes{txid});
+    BOOST_CHECK_EQUAL(tracker.GetStats().nTimedOut, 1);
+
+    // Peer 1 doesn't have it either. No one is left to ask.
+    tracker.ReceivedResponse(1, txid);
+    BOOST_CHECK_EQUAL(tracker.GetStats().nTracked, 0);
+    BOOST_CHECK_EQUAL(tracker.CountForPeer(1), 0);
+    BOOST_CHECK_EQUAL(tracker.GetStats().nRequested, 2);
+}
+
+BOOST_AUTO_TEST_CASE(first_announcer_is_asked) {
+    TxRequestTracker tracker;
+    const uint256 txid = GetRandHash();
+    const int64_t nNow = 1000 * TXREQUEST_TIMEOUT;
+
+    for (NodeId peer = 1; peer <= 3; ++peer)
+        tracker.ReceivedInv(peer, txid, true, nNow);
+    BOOST_CHECK(tracker.GetRequestable(3, nNow).empty());
+    BOOST_CHECK(tracker.GetRequestable(1, nNow) == Hashes{txid});
+
+    // It arrives; the others need not be asked.
+    tracker.ForgetTxHash(txid);
+    BOOST_CHECK(tracker.GetRequestable(2, nNow + TXREQUEST_TIMEOUT).empty());
+    BOOST_CHECK_EQUAL(tracker.GetStats().nDuplicatesAvoided, 2);
+    BOOST_CHECK_EQUAL(tracker.GetStats().nTracked, 0);
+}
+
+BOOST_AUTO_TEST_CASE(disconnected_peer) {
+    TxRequestTracker tracker;
+    const int64_t nNow = 1000 * TXREQUEST_TIMEOUT;
+
+    Hashes txids;
+    for (int i = 0; i < 10; ++i) {
+        txids.push_back(GetRandHash());
+        tracker.ReceivedInv(1, txids.back(), true, nNow);
+    }
+    tracker.ReceivedInv(2, txids[0], true, nNow);
+    BOOST_CHECK_EQUAL(tracker.CountForPeer(1), 10);
+    BOOST_CHECK_EQUAL(tracker.GetRequestable(1, nNow).size(), 10);
+
+    // Only the transaction another peer announced is still tracked, and
+    // that peer is asked for it right away.
+    tracker.DisconnectedPeer(1);
+    BOOST_CHECK_EQUAL(tracker.CountForPeer(1), 0);
+    BOOST_CHECK_EQUAL(tracker.GetStats().nTracked, 1);
+    BOOST_CHECK(tracker.GetRequestable(2, nNow) == Hashes{txids[0]});
+}
+
+BOOST_AUTO_TEST_CASE(announcement_limit) {
+    TxRequestTracker tracker;
+    const uint256 txid = GetRandHash();
+
+    for (size_t i = 0; i < MAX_PEER_TX_ANNOUNCEMENTS; ++i)
+        BOOST_CHECK(tracker.ReceivedInv(1, GetRandHash(), true, 0));
+    BOOST_CHECK(!tracker.ReceivedInv(1, txid, true, 0));
+    BOOST_CHECK(tracker.ReceivedInv(2, txid, true, 0));
+
+    // Repeated announcements are counted once.
+    BOOST_CHECK(tracker.ReceivedInv(2, txid, true, 0));
+    BOOST_CHECK_EQUAL(tracker.CountForPeer(2), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,69 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "consensus/validation.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "txmempool.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txvalidation_tests, TestingSetup)
+
+static bool Accept(const CTransaction& tx, unsigned int nParallelInputs, std::string& reason)
+{
+    const unsigned int nParallelInputsOld = nParallelMempoolInputs;
+    nParallelMempoolInputs = nParallelInputs;
+    LOCK(cs_main);
+    CValidationState state;
+    const bool fAccepted = AcceptToMemoryPool(mempool, state, tx, false, nullptr, nullptr);
+    nParallelMempoolInputs = nParallelInputsOld;
+    reason = state.GetRejectReason();
+    return fAccepted;
+}
+
+BOOST_AUTO_TEST_CASE(parallel_script_checks)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // A consolidation transaction with many inputs.
+    const size_t nInputs = 200;
+    CMutableTransaction tx;
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < nInputs; ++i) {
+            const COutPoint outpoint(GetRandHash(), i);
+            pcoinsTip->AddCoin(outpoint, Coin(CTxOut(COIN, scriptPubKey), 1, false), false);
+            tx.vin.push_back(CTxIn(outpoint));
+        }
+    }
+    tx.vout.push_back(CTxOut((nInputs - 1) * COIN, scriptPubKey));
+    for (size_t i = 0; i < nInputs; ++i)
+        BOOST_CHECK(SignSignature(keystore, scriptPubKey, tx, i, COIN, SIGHASH_ALL));
+
+    // One bad signature is reported the same way whether the scripts are
+    // verified serially or on the script check threads.
+    CMutableTransaction txBad(tx);
+    txBad.vin[150].scriptSig[10] ^= 1;
+    std::string reasonSerial, reasonParallel;
+    BOOST_CHECK(!Accept(txBad, 0, reasonSerial));
+    BOOST_CHECK(!Accept(txBad, 100, reasonParallel));
+    BOOST_CHECK_EQUAL(reasonParallel, reasonSerial);
+    BOOST_CHECK(reasonParallel.find("mandatory-script-verify-flag-failed") == 0);
+
+    std::string reason;
+    BOOST_CHECK(Accept(tx, 100, reason));
+    BOOST_CHECK(mempool.exists(tx.GetHash()));
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,137 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "undo.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <boost/test/unit_test.hpp>
+
+static CBlockUndo RandomBlockUndo(size_t nTx)
+{
+    CBlockUndo undo;
+    undo.vtxundo.resize(nTx);
+    for (size_t i = 0; i < nTx; ++i) {
+        // Some transactions spend nothing worth undoing, and the scripts
+        // vary in length, including empty.
+        for (int c = insecure_rand() % 4; c > 0; --c) {
+            CScript script;
+            for (int n = insecure_rand() % 40; n > 0; --n)
+                script << OP_NOP;
+            undo.vtxundo[i].vprevout.emplace_back(
+                CTxOut(insecure_rand() % (21000000 * COIN), script),
+                insecure_rand() % 1000000, insecure_rand() % 2);
+        }
+    }
+    return undo;
+}
+
+static void CheckEqual(const CTxUndo& a, const CTxUndo& b)
+{
+    BOOST_REQUIRE_EQUAL(a.vprevout.size(), b.vprevout.size());
+    for (size_t c = 0; c < a.vprevout.size(); ++c) {
+        BOOST_CHECK(a.vprevout[c].out == b.vprevout[c].out);
+        BOOST_CHECK_EQUAL(a.vprevout[c].nHeight, b.vprevout[c].nHeight);
+        BOOST_CHECK_EQUAL(a.vprevout[c].fCoinBase, b.vprevout[c].fCoinBase);
+    }
+}
+
+static void CheckEqual(const CBlockUndo& a, const CBlockUndo& b)
+{
+    BOOST_REQUIRE_EQUAL(a.vtxundo.size(), b.vtxundo.size());
+    for (size_t i = 0; i < a.vtxundo.size(); ++i)
+        CheckEqual(a.vtxundo[i], b.vtxundo[i]);
+}
+
+BOOST_FIXTURE_TEST_SUITE(undo_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(columnar_roundtrip) {
+    for (size_t nTx : {0, 1, 300}) {
+        const CBlockUndo undo = RandomBlockUndo(nTx);
+
+        CDataStream stream(SER_DISK, CLIENT_VERSION);
+        stream << CColumnarBlockUndo(undo);
+
+        // Read back as columns, and as the legacy structure.
+        CDataStream copy(stream);
+        CColumnarBlockUndo columns;
+        stream >> columns;
+        BOOST_CHECK(stream.empty());
+        BOOST_CHECK_EQUAL(columns.GetTxCount(), nTx);
+
+        CBlockUndo decoded;
+        columns.GetBlockUndo(decoded);
+        CheckEqual(undo, decoded);
+
+        CBlockUndo read;
+        copy >> read;
+        BOOST_CHECK(copy.empty());
+        CheckEqual(undo, read);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(columnar_random_access) {
+    const CBlockUndo undo = RandomBlockUndo(100);
+    const CColumnarBlockUndo columns(undo);
+
+    size_t nCoins = 0;
+    for (const CTxUndo& txundo : undo.vtxundo)
+        nCoins += txundo.vprevout.size();
+    BOOST_CHECK_EQUAL(columns.GetCoinCount(), nCoins);
+
+    // Backwards, as when disconnecting a block.
+    for (size_t i = undo.vtxundo.size(); i-- > 0; ) {
+        CTxUndo txundo;
+        columns.GetTxUndo(i, txundo);
+        CheckEqual(undo.vtxundo[i], txundo);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(columnar_reads_legacy) {
+    const CBlockUndo undo = RandomBlockUndo(50);
+
+    CDataStream stream(SER_DISK, CLIENT_VERSION);
+    stream << undo;
+    CColumnarBlockUndo columns;
+    stream >> columns;
+    BOOST_CHECK(stream.empty());
+
+    CBlockUndo decoded;
+    columns.GetBlockUndo(decoded);
+    CheckEqual(undo, decoded);
+}
+
+BOOST_AUTO_TEST_CASE(columnar_rejects_corrupt) {
+    CBlockUndo undo;
+    undo.vtxundo.resize(2);
+    undo.vtxundo[0].vprevout.emplace_back(CTxOut(1, CScript() << OP_TRUE), 1, false);
+    undo.vtxundo[1].vprevout.emplace_back(CTxOut(2, CScript() << OP_NOP), 2, true);
+    undo.vtxundo[1].vprevout.emplace_back(CTxOut(3, CScript()), 3, false);
+
+    CDataStream good(SER_DISK, CLIENT_VERSION);
+    good << CColumnarBlockUndo(undo);
+    // The marker, three one byte counts and then the transaction offsets.
+    const size_t nLastTxOffset = 1 + 8 + 3 + 4 * 2;
+
+    CDataStream stream(good);
+    stream[3] ^= 1;
+    CColumnarBlockUndo columns;
+    BOOST_CHECK_THROW(stream >> columns, std::ios_base::failure);
+
+    stream = good;
+    stream[nLastTxOffset] = 2;
+    BOOST_CHECK_THROW(stream >> columns, std::ios_base::failure);
+
+    stream = good;
+    stream.resize(stream.size() - 1);
+    BOOST_CHECK_THROW(stream >> columns, std::ios_base::failure);
+
+    // Older versions, which read a vector of CTxUndo, reject it.
+    stream = good;
+    std::vector<CTxUndo> legacy;
+    BOOST_CHECK_THROW(stream >> legacy, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,8 @@
 #include <boost/test/unit_test.hpp>
 
 #include "utilprocessmsg.h"
+#include "chainparams.h"
+#include "net.h"
 #include "options.h"
 #include "test/thinblockutil.h"
 
@@ -44,4 +46,62 @@ BOOST_AUTO_TEST_CASE(keep_outgoing_peer) {
     BOOST_CHECK(KeepOutgoingPeer(node));
 }
 
+static void QueueMsg(std::list<CNetMessage>& msgs, const char* command) {
+    msgs.push_back(CNetMessage(Params().NetworkMagic(), SER_NETWORK, INIT_PROTO_VERSION));
+    msgs.back().hdr = CMessageHeader(Params().NetworkMagic(), command, 0);
+}
+
+BOOST_AUTO_TEST_CASE(over_budget_defers_only_requests) {
+    std::list<CNetMessage> msgs;
+    QueueMsg(msgs, NetMsgType::GETDATA);
+    QueueMsg(msgs, NetMsgType::PING);
+    QueueMsg(msgs, NetMsgType::HEADERS);
+    QueueMsg(msgs, NetMsgType::BLOCK);
+
+    // The block download from the peer goes on, the ping waits for the
+    // getdata it follows.
+    auto next = NextUnmeteredMessage(msgs, false);
+    BOOST_CHECK_EQUAL(next->hdr.GetCommand(), NetMsgType::HEADERS);
+    msgs.erase(next);
+    next = NextUnmeteredMessage(msgs, false);
+    BOOST_CHECK_EQUAL(next->hdr.GetCommand(), NetMsgType::BLOCK);
+    msgs.erase(next);
+    BOOST_CHECK(NextUnmeteredMessage(msgs, false) == msgs.end());
+
+    // A ping with no requests before it is answered.
+    msgs.clear();
+    QueueMsg(msgs, NetMsgType::PING);
+    QueueMsg(msgs, NetMsgType::GETHEADERS);
+    BOOST_CHECK_EQUAL(NextUnmeteredMessage(msgs, false)->hdr.GetCommand(), NetMsgType::PING);
+
+    // Unless getdata requests of the peer wait already.
+    BOOST_CHECK(NextUnmeteredMessage(msgs, true) == msgs.end());
+    QueueMsg(msgs, NetMsgType::PONG);
+    BOOST_CHECK_EQUAL(NextUnmeteredMessage(msgs, true)->hdr.GetCommand(), NetMsgType::PONG);
+}
+
+BOOST_AUTO_TEST_CASE(over_budget_keeps_order_behind_requests) {
+    // Messages changing how requests are answered don't overtake them.
+    std::list<CNetMessage> msgs;
+    QueueMsg(msgs, NetMsgType::SENDHEADERS);
+    QueueMsg(msgs, NetMsgType::FILTERLOAD);
+    QueueMsg(msgs, NetMsgType::FILTERCLEAR);
+    QueueMsg(msgs, NetMsgType::GETHEADERS);
+    QueueMsg(msgs, NetMsgType::SENDCMPCT);
+    QueueMsg(msgs, NetMsgType::CMPCTBLOCK);
+    QueueMsg(msgs, NetMsgType::NOTFOUND);
+
+    auto next = NextUnmeteredMessage(msgs, false);
+    BOOST_CHECK_EQUAL(next->hdr.GetCommand(), NetMsgType::SENDHEADERS);
+    msgs.erase(next);
+    next = NextUnmeteredMessage(msgs, false);
+    BOOST_CHECK_EQUAL(next->hdr.GetCommand(), NetMsgType::CMPCTBLOCK);
+    msgs.erase(next);
+    next = NextUnmeteredMessage(msgs, false);
+    BOOST_CHECK_EQUAL(next->hdr.GetCommand(), NetMsgType::NOTFOUND);
+    msgs.erase(next);
+    BOOST_CHECK(NextUnmeteredMessage(msgs, false) == msgs.end());
+    BOOST_CHECK_EQUAL(msgs.size(), 4u);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
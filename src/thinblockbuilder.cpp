@@ -2,6 +2,7 @@
 #include "thinblock.h"
 #include "util.h"
 #include "consensus/merkle.h"
+#include "core_memusage.h"
 #include "xthin.h"
 #include "uint256.h"
 #include "blockencodings.h"
@@ -103,6 +104,13 @@ int ThinBlockBuilder::numTxsMissing() const {
     return missing;
 }
 
+size_t ThinBlockBuilder::DynamicMemoryUsage() const {
+    return RecursiveDynamicUsage(thinBlock)
+        + memusage::DynamicUsage(wanted)
+        + memusage::DynamicUsage(wantedIdks)
+        + memusage::DynamicUsage(wantedIndex);
+}
+
 std::vector<std::pair<int, ThinTx> > ThinBlockBuilder::getTxsMissing() const {
     assert(wanted.size() == thinBlock.vtx.size());
 
@@ -52,6 +52,9 @@ class ThinBlockBuilder {
         // Returns the block (and invalidates this object)
         CBlock finishBlock();
 
+        // Approximate heap usage of the partial block and its indexes.
+        size_t DynamicMemoryUsage() const;
+
     private:
         CBlock thinBlock;
         std::vector<ThinTx> wanted;
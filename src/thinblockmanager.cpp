@@ -4,6 +4,7 @@
 #include "thinblockmanager.h"
 #include "thinblock.h"
 #include "thinblockbuilder.h"
+#include "memusage.h"
 #include "util.h"
 #include <algorithm>
 
@@ -42,6 +43,17 @@ int ThinBlockManager::numWorkers(const uint256& block) const {
         : 0;
 }
 
+size_t ThinBlockManager::DynamicMemoryUsage() const {
+    size_t usage = memusage::DynamicUsage(builders);
+    for (auto& b : builders) {
+        usage += memusage::DynamicUsage(b.second.workers);
+        if (b.second.builder)
+            usage += memusage::MallocUsage(sizeof(ThinBlockBuilder))
+                + b.second.builder->DynamicMemoryUsage();
+    }
+    return usage;
+}
+
 // When a stub provides transactions, add those to the transaction finder (wrap it).
 struct WrappedFinder : public TxFinder {
 
@@ -60,6 +60,9 @@ class ThinBlockManager : boost::noncopyable {
         void removeIfExists(const uint256& block);
         std::vector<std::pair<int, ThinTx> > getTxsMissing(const uint256& block) const;
 
+        // Approximate heap usage of all blocks under construction.
+        size_t DynamicMemoryUsage() const;
+
         // public for unittest
         void requestBlockAnnouncements(ThinBlockWorker& w, CConnman&, CNode& n);
 
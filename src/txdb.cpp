@@ -54,7 +54,7 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool &isObfuscated, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, isObfuscated, fMemory, fWipe) {
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool &isObfuscated, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, isObfuscated, fMemory, fWipe, "chainstate") {
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
@@ -146,7 +146,7 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool &isObfuscated, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, isObfuscated, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool &isObfuscated, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, isObfuscated, fMemory, fWipe, "blocks/index") {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -171,20 +171,55 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
-    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COIN);
+    return new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock());
+}
+
+CCoinsViewDBSnapshot* CCoinsViewDB::Snapshot() const
+{
+    return new CCoinsViewDBSnapshot(db);
+}
+
+bool CCoinsViewDBSnapshot::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin, snapshot.get());
+}
+
+bool CCoinsViewDBSnapshot::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint), snapshot.get());
+}
+
+uint256 CCoinsViewDBSnapshot::GetBestBlock() const {
+    uint256 hashBestChain;
+    if (!db.Read(DB_BEST_BLOCK, hashBestChain, snapshot.get()))
+        return uint256();
+    return hashBestChain;
+}
+
+CCoinsViewCursor *CCoinsViewDBSnapshot::Cursor() const
+{
+    return new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(snapshot.get()), GetBestBlock());
+}
+
+size_t CCoinsViewDBSnapshot::EstimateSize() const
+{
+    // LevelDB only estimates the size of the current version.
+    return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
+}
+
+CCoinsViewDBCursor::CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn) :
+    CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn)
+{
+    pcursor->Seek(DB_COIN);
     // Cache key of first record
-    if (i->pcursor->Valid()) {
-        CoinEntry entry(&i->keyTmp.second);
-        i->pcursor->GetKey(entry);
-        i->keyTmp.first = entry.key;
+    if (pcursor->Valid()) {
+        CoinEntry entry(&keyTmp.second);
+        pcursor->GetKey(entry);
+        keyTmp.first = entry.key;
     } else {
-        i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
+        keyTmp.first = 0; // Make sure Valid() and GetKey() return false
     }
-    return i;
 }
 
 bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
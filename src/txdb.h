@@ -11,6 +11,7 @@
 #include "chain.h"
 
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -19,6 +20,7 @@
 
 class CBlockIndex;
 class CCoinsViewDBCursor;
+class CCoinsViewDBSnapshot;
 class uint256;
 
 //! -dbcache default (MiB)
@@ -35,6 +37,8 @@ static const int64_t nMaxBlockDBCache = 2;
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
+//! Max memory allocated to block filter index DB specific cache, if -blockfilterindex (MiB)
+static const int64_t nMaxFilterIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
 
@@ -81,6 +85,31 @@ public:
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    //! A view of the database as it is now, that is not changed by later
+    //! writes. It must not outlive this.
+    CCoinsViewDBSnapshot* Snapshot() const;
+};
+
+/**
+ * Read-only view of the coin database as it was when the snapshot was
+ * taken. It can be read from any thread while the database is written.
+ */
+class CCoinsViewDBSnapshot : public CCoinsView
+{
+public:
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    CCoinsViewCursor *Cursor() const override;
+    size_t EstimateSize() const override;
+
+private:
+    CCoinsViewDBSnapshot(const CDBWrapper& dbIn) : db(dbIn), snapshot(dbIn.GetSnapshot()) {}
+    const CDBWrapper& db;
+    std::shared_ptr<const leveldb::Snapshot> snapshot;
+
+    friend class CCoinsViewDB;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -97,12 +126,13 @@ public:
     void Next();
 
 private:
-    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
-        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    //! Positioned at the first coin.
+    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn);
     std::unique_ptr<CDBIterator> pcursor;
     std::pair<char, COutPoint> keyTmp;
 
     friend class CCoinsViewDB;
+    friend class CCoinsViewDBSnapshot;
 };
 
 /** Access to the block database (blocks/index/) */
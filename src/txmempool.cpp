@@ -233,6 +233,48 @@ void CTxMemPool::queryAncestors(const uint256 txHash,
     return;
 }
 
+namespace {
+struct RelayOrder {
+    uint256 hash;
+    bool fInMempool;
+    uint64_t nAncestors;
+    double nFees;
+    double nSize;
+
+    bool operator<(const RelayOrder& b) const
+    {
+        if (fInMempool != b.fInMempool)
+            return fInMempool;
+        if (nAncestors != b.nAncestors)
+            return nAncestors < b.nAncestors;
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        return nFees * b.nSize > b.nFees * nSize;
+    }
+};
+} // ns anon
+
+void CTxMemPool::SortForRelay(std::vector<uint256>& vHashes, size_t nFirst) const
+{
+    std::vector<RelayOrder> vOrder;
+    vOrder.reserve(vHashes.size());
+    {
+        LOCK(cs);
+        for (const uint256& hash : vHashes) {
+            indexed_transaction_set::const_iterator it = mapTx.find(hash);
+            if (it == mapTx.end())
+                vOrder.push_back(RelayOrder{hash, false, 0, 0, 1});
+            else
+                vOrder.push_back(RelayOrder{hash, true, it->GetCountWithAncestors(),
+                                            double(it->GetFeesWithAncestors()),
+                                            double(it->GetSizeWithAncestors())});
+        }
+    }
+    nFirst = std::min(nFirst, vOrder.size());
+    std::partial_sort(vOrder.begin(), vOrder.begin() + nFirst, vOrder.end());
+    for (size_t i = 0; i < vOrder.size(); ++i)
+        vHashes[i] = vOrder[i].hash;
+}
+
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
@@ -900,3 +942,57 @@ void CTxMemPool::TrimToSize(size_t sizelimit) {
         RemoveStaged(stage, false);
     }
 }
+
+static size_t DisconnectedTxUsage(const CTransaction& tx)
+{
+    return sizeof(CTransaction) + RecursiveDynamicUsage(tx) + memusage::IncrementalDynamicUsage(std::set<uint256>());
+}
+
+void DisconnectedBlockTransactions::AddBlock(const std::vector<CTransaction>& vtx)
+{
+    blocks.emplace_front();
+    std::vector<CTransaction>& block = blocks.front();
+    block.reserve(vtx.size());
+    for (const CTransaction& tx : vtx) {
+        if (tx.IsCoinBase() || !setTxids.insert(tx.GetHash()).second)
+            continue;
+        block.push_back(tx);
+        nUsage += DisconnectedTxUsage(tx);
+    }
+}
+
+void DisconnectedBlockTransactions::RemoveForBlock(const std::vector<CTransaction>& vtx)
+{
+    for (const CTransaction& tx : vtx)
+        if (setTxids.erase(tx.GetHash()))
+            nUsage -= DisconnectedTxUsage(tx);
+}
+
+std::vector<CTransaction> DisconnectedBlockTransactions::RemoveNewestBlock()
+{
+    std::vector<CTransaction> vRemoved;
+    if (blocks.empty())
+        return vRemoved;
+    for (const CTransaction& tx : blocks.back()) {
+        if (setTxids.erase(tx.GetHash())) {
+            nUsage -= DisconnectedTxUsage(tx);
+            vRemoved.push_back(tx);
+        }
+    }
+    blocks.pop_back();
+    return vRemoved;
+}
+
+std::vector<CTransaction> DisconnectedBlockTransactions::TakeTransactions()
+{
+    std::vector<CTransaction> vtx;
+    vtx.reserve(setTxids.size());
+    for (const std::vector<CTransaction>& block : blocks)
+        for (const CTransaction& tx : block)
+            if (setTxids.count(tx.GetHash()))
+                vtx.push_back(tx);
+    blocks.clear();
+    setTxids.clear();
+    nUsage = 0;
+    return vtx;
+}
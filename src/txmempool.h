@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
 #include <list>
 #include <set>
 
@@ -497,6 +498,13 @@ public:
      */
     void queryAncestors(const uint256 txHash, std::vector<uint256>& vAncestors, uint64_t nLocalServices);
 
+    /** Order transactions for announcing them to peers: parents before
+     *  children, and otherwise the highest feerate with ancestors first.
+     *  Transactions that are not in the mempool go last. Only the first
+     *  nFirst hashes are put in order.
+     */
+    void SortForRelay(std::vector<uint256>& vHashes, size_t nFirst) const;
+
     /** Remove transactions from the mempool until its dynamic size is <= sizelimit. */
     void TrimToSize(size_t sizelimit);
 
@@ -597,4 +605,43 @@ public:
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
 };
 
+/** Maximum kilobytes of transactions held back in a reorg */
+static const unsigned int MAX_DISCONNECTED_TX_POOL_SIZE = 20000;
+
+/**
+ * Transactions of blocks disconnected in a reorg, held back until the new
+ * chain is connected, so the mempool is updated once for the whole reorg
+ * rather than once per block. Transactions confirmed again in the new
+ * chain are forgotten.
+ *
+ * Blocks are disconnected from the tip down, so each block added is older
+ * than those before. The oldest block first, each in block order, is an
+ * order in which parents come before their children.
+ */
+class DisconnectedBlockTransactions
+{
+public:
+    DisconnectedBlockTransactions() : nUsage(0) {}
+
+    //! Add the transactions of a block, except the coinbase.
+    void AddBlock(const std::vector<CTransaction>& vtx);
+    //! Forget transactions that a connected block confirmed.
+    void RemoveForBlock(const std::vector<CTransaction>& vtx);
+    //! Forget the transactions of the most recently connected block left,
+    //! returning them. Their descendants need to be removed from the
+    //! mempool.
+    std::vector<CTransaction> RemoveNewestBlock();
+    //! The transactions left, parents first, leaving this empty.
+    std::vector<CTransaction> TakeTransactions();
+
+    size_t DynamicMemoryUsage() const { return nUsage; }
+    size_t size() const { return setTxids.size(); }
+
+private:
+    //! The oldest block first
+    std::deque<std::vector<CTransaction>> blocks;
+    std::set<uint256> setTxids;
+    size_t nUsage;
+};
+
 #endif // BITCOIN_TXMEMPOOL_H
@@ -0,0 +1,150 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txrequest.h"
+
+#include <limits>
+
+TxRequestTracker g_txrequest;
+
+TxRequestTracker::TxRequestTracker() :
+    nSequence(0), nRequested(0), nTimedOut(0), nDuplicatesAvoided(0)
+{
+}
+
+bool TxRequestTracker::ReceivedInv(NodeId peer, const uint256& txid, bool fPreferred, int64_t nNow)
+{
+    size_t& nCount = mapPeerCount[peer];
+    if (nCount >= MAX_PEER_TX_ANNOUNCEMENTS)
+        return false;
+
+    int64_t nTime = fPreferred ? nNow : nNow + TXREQUEST_NONPREFERRED_DELAY;
+    if (index.insert(Announcement{txid, nTime, peer, nSequence, CANDIDATE, fPreferred}).second) {
+        ++nSequence;
+        ++nCount;
+    }
+    return true;
+}
+
+template <typename Iter>
+void TxRequestTracker::Erase(Iter it)
+{
+    auto count = mapPeerCount.find(it->peer);
+    if (--count->second == 0)
+        mapPeerCount.erase(count);
+    index.get<0>().erase(index.project<0>(it));
+}
+
+void TxRequestTracker::SetState(AnnouncementIndex::iterator it, State state, int64_t nTime)
+{
+    index.modify(it, [state, nTime](Announcement& a) {
+        a.state = state;
+        a.nTime = nTime;
+    });
+}
+
+bool TxRequestTracker::IsBestCandidate(const Announcement& ann, int64_t nNow) const
+{
+    auto range = index.get<1>().equal_range(ann.txid);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->state == REQUESTED)
+            return false;
+        if (it->state != CANDIDATE || it->nTime > nNow)
+            continue;
+        if (it->fPreferred != ann.fPreferred) {
+            if (it->fPreferred)
+                return false;
+        }
+        else if (it->nSequence < ann.nSequence) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TxRequestTracker::MaybeForget(const uint256& txid)
+{
+    auto range = index.get<1>().equal_range(txid);
+    for (auto it = range.first; it != range.second; ++it)
+        if (it->state != COMPLETED)
+            return;
+    while (range.first != range.second)
+        Erase(range.first++);
+}
+
+std::vector<uint256> TxRequestTracker::GetRequestable(NodeId peer, int64_t nNow)
+{
+    auto& byState = index.get<2>();
+    const int64_t nMinTime = std::numeric_limits<int64_t>::min();
+
+    // Give up on requests that took too long, so another peer is asked.
+    std::vector<uint256> vExpired;
+    auto it = byState.lower_bound(ByPeerState::result_type(peer, REQUESTED, nMinTime));
+    while (it != byState.end() && it->peer == peer && it->state == REQUESTED && it->nTime <= nNow) {
+        vExpired.push_back(it->txid);
+        byState.modify(it++, [](Announcement& a) { a.state = COMPLETED; });
+        ++nTimedOut;
+    }
+    for (const uint256& txid : vExpired)
+        MaybeForget(txid);
+
+    std::vector<AnnouncementIndex::iterator> vReady;
+    it = byState.lower_bound(ByPeerState::result_type(peer, CANDIDATE, nMinTime));
+    for (; it != byState.end() && it->peer == peer && it->state == CANDIDATE && it->nTime <= nNow; ++it)
+        if (IsBestCandidate(*it, nNow))
+            vReady.push_back(index.project<0>(it));
+
+    std::vector<uint256> vRequest;
+    vRequest.reserve(vReady.size());
+    for (AnnouncementIndex::iterator ready : vReady) {
+        vRequest.push_back(ready->txid);
+        SetState(ready, REQUESTED, nNow + TXREQUEST_TIMEOUT);
+    }
+    nRequested += vRequest.size();
+    return vRequest;
+}
+
+void TxRequestTracker::ReceivedResponse(NodeId peer, const uint256& txid)
+{
+    auto it = index.find(ByPeer::result_type(peer, txid));
+    if (it == index.end() || it->state == COMPLETED)
+        return;
+    SetState(it, COMPLETED, it->nTime);
+    MaybeForget(txid);
+}
+
+void TxRequestTracker::ForgetTxHash(const uint256& txid)
+{
+    auto range = index.get<1>().equal_range(txid);
+    while (range.first != range.second) {
+        if (range.first->state == CANDIDATE)
+            ++nDuplicatesAvoided;
+        Erase(range.first++);
+    }
+}
+
+void TxRequestTracker::DisconnectedPeer(NodeId peer)
+{
+    std::vector<uint256> vPending;
+    auto it = index.lower_bound(ByPeer::result_type(peer, uint256()));
+    while (it != index.end() && it->peer == peer) {
+        if (it->state != COMPLETED)
+            vPending.push_back(it->txid);
+        Erase(it++);
+    }
+    // Transactions that no one else is left to ask for are forgotten.
+    for (const uint256& txid : vPending)
+        MaybeForget(txid);
+}
+
+size_t TxRequestTracker::CountForPeer(NodeId peer) const
+{
+    auto it = mapPeerCount.find(peer);
+    return it == mapPeerCount.end() ? 0 : it->second;
+}
+
+TxRequestStats TxRequestTracker::GetStats() const
+{
+    return TxRequestStats{index.size(), nRequested, nTimedOut, nDuplicatesAvoided};
+}
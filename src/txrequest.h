@@ -0,0 +1,130 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_TXREQUEST_H
+#define BITCOIN_TXREQUEST_H
+
+#include "net.h"
+#include "uint256.h"
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <vector>
+
+/** Microseconds to wait for a requested transaction before asking another
+ *  peer that announced it. We receive a transaction within 20 seconds 99%
+ *  of the time, based on relay times observed in July 2015. */
+static const int64_t TXREQUEST_TIMEOUT = 20 * 1000000;
+/** Microseconds before a transaction is requested from an inbound peer,
+ *  so that outbound peers that announce it too are asked first. */
+static const int64_t TXREQUEST_NONPREFERRED_DELAY = 2 * 1000000;
+/** Maximum number of announcements tracked for a peer */
+static const size_t MAX_PEER_TX_ANNOUNCEMENTS = MAX_INV_SZ;
+
+struct TxRequestStats {
+    size_t nTracked;
+    uint64_t nRequested;
+    uint64_t nTimedOut;
+    //! Announcements dropped because the transaction arrived from another
+    //! peer before it was requested from this one.
+    uint64_t nDuplicatesAvoided;
+};
+
+/**
+ * Tracks which peers announced which transactions, and which of them the
+ * transactions are requested from.
+ *
+ * A transaction is requested from one peer at a time. Preferred (outbound
+ * or whitelisted) peers are asked first, and otherwise the one that
+ * announced it first. If the peer does not deliver in time, or answers
+ * notfound, the next best peer that announced it is asked.
+ *
+ * Not thread safe; guarded by cs_main.
+ */
+class TxRequestTracker {
+public:
+    TxRequestTracker();
+
+    //! A peer announced a transaction we don't have. Returns false if the
+    //! peer has too many outstanding announcements.
+    bool ReceivedInv(NodeId peer, const uint256& txid, bool fPreferred, int64_t nNow);
+
+    //! The transactions to request from the peer now. They are marked as
+    //! requested until they arrive or time out.
+    std::vector<uint256> GetRequestable(NodeId peer, int64_t nNow);
+
+    //! The peer sent the transaction, or told us it does not have it.
+    void ReceivedResponse(NodeId peer, const uint256& txid);
+
+    //! We have the transaction, or have rejected it. Forgets all
+    //! announcements of it.
+    void ForgetTxHash(const uint256& txid);
+
+    //! Forget all announcements of the peer. Takes time in proportion to
+    //! their number.
+    void DisconnectedPeer(NodeId peer);
+
+    size_t CountForPeer(NodeId peer) const;
+    TxRequestStats GetStats() const;
+
+private:
+    enum State : uint8_t {
+        CANDIDATE,
+        REQUESTED,
+        COMPLETED
+    };
+
+    struct Announcement {
+        uint256 txid;
+        //! When a candidate may be requested, or when a request times out
+        int64_t nTime;
+        NodeId peer;
+        uint64_t nSequence;
+        State state;
+        bool fPreferred;
+    };
+
+    struct ByPeer {
+        typedef std::tuple<NodeId, const uint256&> result_type;
+        result_type operator()(const Announcement& a) const { return result_type(a.peer, a.txid); }
+    };
+    struct ByTxid {
+        typedef uint256 result_type;
+        const result_type& operator()(const Announcement& a) const { return a.txid; }
+    };
+    struct ByPeerState {
+        typedef std::tuple<NodeId, State, int64_t> result_type;
+        result_type operator()(const Announcement& a) const { return result_type(a.peer, a.state, a.nTime); }
+    };
+
+    typedef boost::multi_index_container<
+        Announcement,
+        boost::multi_index::indexed_by<
+            boost::multi_index::ordered_unique<ByPeer>,
+            boost::multi_index::ordered_non_unique<ByTxid>,
+            boost::multi_index::ordered_non_unique<ByPeerState>
+        >
+    > AnnouncementIndex;
+
+    AnnouncementIndex index;
+    std::map<NodeId, size_t> mapPeerCount;
+    uint64_t nSequence;
+    uint64_t nRequested;
+    uint64_t nTimedOut;
+    uint64_t nDuplicatesAvoided;
+
+    template <typename Iter>
+    void Erase(Iter it);
+    void SetState(AnnouncementIndex::iterator it, State state, int64_t nTime);
+    bool IsBestCandidate(const Announcement& ann, int64_t nNow) const;
+    //! Forget a transaction once all peers that announced it were asked.
+    void MaybeForget(const uint256& txid);
+};
+
+extern TxRequestTracker g_txrequest;
+
+#endif // BITCOIN_TXREQUEST_H
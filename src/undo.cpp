@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The Bitcoin XT developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "undo.h"
+
+#include "crypto/common.h"
+
+CColumnarBlockUndo::CColumnarBlockUndo() : nTx(0), nCoins(0), vTxOffsets(4, 0), vScriptOffsets(4, 0)
+{
+}
+
+CColumnarBlockUndo::CColumnarBlockUndo(const CBlockUndo& undo) : nTx(undo.vtxundo.size()), nCoins(0)
+{
+    for (const CTxUndo& txundo : undo.vtxundo)
+        nCoins += txundo.vprevout.size();
+
+    vTxOffsets.resize((nTx + 1) * 4);
+    vHeights.resize(nCoins * 4);
+    vValues.resize(nCoins * 8);
+    vScriptOffsets.resize((nCoins + 1) * 4);
+
+    uint32_t nCoin = 0;
+    uint32_t nScriptOffset = 0;
+    WriteLE32(&vTxOffsets[0], 0);
+    WriteLE32(&vScriptOffsets[0], 0);
+    for (size_t i = 0; i < nTx; ++i) {
+        for (const Coin& coin : undo.vtxundo[i].vprevout) {
+            WriteLE32(&vHeights[nCoin * 4], uint32_t(coin.nHeight) * 2 + coin.fCoinBase);
+            WriteLE64(&vValues[nCoin * 8], coin.out.nValue);
+            vScripts.insert(vScripts.end(), coin.out.scriptPubKey.begin(), coin.out.scriptPubKey.end());
+            nScriptOffset += coin.out.scriptPubKey.size();
+            WriteLE32(&vScriptOffsets[++nCoin * 4], nScriptOffset);
+        }
+        WriteLE32(&vTxOffsets[(i + 1) * 4], nCoin);
+    }
+}
+
+void CColumnarBlockUndo::GetTxUndo(size_t nIndex, CTxUndo& txundo) const
+{
+    assert(nIndex < nTx);
+    const uint32_t nBegin = ReadLE32(&vTxOffsets[nIndex * 4]);
+    const uint32_t nEnd = ReadLE32(&vTxOffsets[(nIndex + 1) * 4]);
+
+    txundo.vprevout.resize(nEnd - nBegin);
+    for (uint32_t c = nBegin; c < nEnd; ++c) {
+        Coin& coin = txundo.vprevout[c - nBegin];
+        const uint32_t nCode = ReadLE32(&vHeights[c * 4]);
+        coin.nHeight = nCode >> 1;
+        coin.fCoinBase = nCode & 1;
+        coin.out.nValue = ReadLE64(&vValues[c * 8]);
+        const unsigned char* script = vScripts.data();
+        coin.out.scriptPubKey.assign(script + ReadLE32(&vScriptOffsets[c * 4]),
+                                     script + ReadLE32(&vScriptOffsets[(c + 1) * 4]));
+    }
+}
+
+void CColumnarBlockUndo::GetBlockUndo(CBlockUndo& undo) const
+{
+    undo.vtxundo.resize(nTx);
+    std::vector<Coin*> coins;
+    coins.reserve(nCoins);
+    for (size_t i = 0; i < nTx; ++i) {
+        std::vector<Coin>& vprevout = undo.vtxundo[i].vprevout;
+        vprevout.resize(ReadLE32(&vTxOffsets[(i + 1) * 4]) - ReadLE32(&vTxOffsets[i * 4]));
+        for (Coin& coin : vprevout)
+            coins.push_back(&coin);
+    }
+
+    // Decode a column at a time, each a loop over fixed width fields.
+    for (size_t c = 0; c < nCoins; ++c) {
+        const uint32_t nCode = ReadLE32(&vHeights[c * 4]);
+        coins[c]->nHeight = nCode >> 1;
+        coins[c]->fCoinBase = nCode & 1;
+    }
+    for (size_t c = 0; c < nCoins; ++c)
+        coins[c]->out.nValue = ReadLE64(&vValues[c * 8]);
+    const unsigned char* script = vScripts.data();
+    uint32_t nScriptBegin = 0;
+    for (size_t c = 0; c < nCoins; ++c) {
+        const uint32_t nScriptEnd = ReadLE32(&vScriptOffsets[(c + 1) * 4]);
+        coins[c]->out.scriptPubKey.assign(script + nScriptBegin, script + nScriptEnd);
+        nScriptBegin = nScriptEnd;
+    }
+}
+
+void CColumnarBlockUndo::CheckOffsets() const
+{
+    if (ReadLE32(&vTxOffsets[0]) != 0)
+        throw std::ios_base::failure("Bad undo transaction offsets");
+    for (size_t i = 0; i < nTx; ++i) {
+        const uint32_t nBegin = ReadLE32(&vTxOffsets[i * 4]);
+        const uint32_t nEnd = ReadLE32(&vTxOffsets[(i + 1) * 4]);
+        if (nEnd < nBegin || nEnd - nBegin > MAX_INPUTS_PER_TX)
+            throw std::ios_base::failure("Bad undo transaction offsets");
+    }
+    if (ReadLE32(&vTxOffsets[nTx * 4]) != nCoins)
+        throw std::ios_base::failure("Bad undo transaction offsets");
+
+    if (ReadLE32(&vScriptOffsets[0]) != 0)
+        throw std::ios_base::failure("Bad undo script offsets");
+    for (size_t c = 0; c < nCoins; ++c)
+        if (ReadLE32(&vScriptOffsets[(c + 1) * 4]) < ReadLE32(&vScriptOffsets[c * 4]))
+            throw std::ios_base::failure("Bad undo script offsets");
+    if (ReadLE32(&vScriptOffsets[nCoins * 4]) != vScripts.size())
+        throw std::ios_base::failure("Bad undo script offsets");
+}
@@ -6,10 +6,14 @@
 #ifndef BITCOIN_UNDO_H
 #define BITCOIN_UNDO_H
 
+#include "coins.h"
 #include "compressor.h"
 #include "consensus/consensus.h"
 #include "primitives/transaction.h"
 #include "serialize.h"
+#include "version.h"
+
+#include <algorithm>
 
 /** Undo information for a CTxIn
  *
@@ -95,18 +99,176 @@ public:
     }
 };
 
-/** Undo information for a CBlock */
+/** Marks block undo data in the columnar format. Read as the transaction
+ *  count of the legacy format it is out of range, so older versions reject
+ *  it rather than misreading it. */
+static const uint64_t UNDO_COLUMNAR_MARKER = 0x6f646e7563ffffffULL;
+
+/** Reads the start of block undo data. Returns true if it is in the
+ *  columnar format, or else the legacy transaction count. */
+template <typename Stream>
+bool ReadColumnarUndoMarker(Stream& s, uint64_t& nLegacyCount)
+{
+    uint8_t chSize = ser_readdata8(s);
+    if (chSize == 255) {
+        if (ser_readdata64(s) != UNDO_COLUMNAR_MARKER)
+            throw std::ios_base::failure("Unknown undo data format");
+        return true;
+    }
+    // The rest of the legacy CompactSize transaction count
+    if (chSize < 253) {
+        nLegacyCount = chSize;
+    }
+    else if (chSize == 253) {
+        nLegacyCount = ser_readdata16(s);
+        if (nLegacyCount < 253)
+            throw std::ios_base::failure("non-canonical ReadCompactSize()");
+    }
+    else {
+        nLegacyCount = ser_readdata32(s);
+        if (nLegacyCount < 0x10000u)
+            throw std::ios_base::failure("non-canonical ReadCompactSize()");
+    }
+    if (nLegacyCount > MAX_SIZE)
+        throw std::ios_base::failure("ReadCompactSize(): size too large");
+    return false;
+}
+
+/** Undo information for a CBlock. Written in the legacy format, and read
+ *  from either. */
 class CBlockUndo
 {
 public:
     std::vector<CTxUndo> vtxundo; // for all but the coinbase
 
-    ADD_SERIALIZE_METHODS;
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        ::Serialize(s, vtxundo);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s);
+
+    template <typename Stream>
+    void UnserializeLegacy(Stream& s, uint64_t nCount) {
+        vtxundo.clear();
+        vtxundo.reserve(std::min<uint64_t>(nCount, 1 << 16));
+        for (uint64_t i = 0; i < nCount; ++i) {
+            vtxundo.emplace_back();
+            ::Unserialize(s, vtxundo.back());
+        }
+    }
+};
+
+/**
+ * Undo information for a CBlock in columns. A table of offsets gives the
+ * coins spent by each transaction, so they are found without decoding
+ * those of the others, and the columns are fixed width (except for the
+ * scripts), so decoding them is a tight loop instead of a varint and
+ * decompression per coin.
+ *
+ * Serialized as UNDO_COLUMNAR_MARKER, the number of transactions, coins
+ * and script bytes as CompactSize, and then the columns:
+ *  - per transaction and one more, the index of its first coin (LE32)
+ *  - per coin, height * 2 + coinbase (LE32)
+ *  - per coin, the value (LE64)
+ *  - per coin and one more, the offset of its script (LE32)
+ *  - the scripts
+ *
+ * Legacy undo data is converted when read.
+ */
+class CColumnarBlockUndo
+{
+public:
+    CColumnarBlockUndo();
+    explicit CColumnarBlockUndo(const CBlockUndo& undo);
+
+    size_t GetTxCount() const { return nTx; }
+    size_t GetCoinCount() const { return nCoins; }
+
+    //! The coins spent by a transaction, 0 being the first after the
+    //! coinbase.
+    void GetTxUndo(size_t nIndex, CTxUndo& txundo) const;
+    void GetBlockUndo(CBlockUndo& undo) const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, 255);
+        ser_writedata64(s, UNDO_COLUMNAR_MARKER);
+        WriteCompactSize(s, nTx);
+        WriteCompactSize(s, nCoins);
+        WriteCompactSize(s, vScripts.size());
+        WriteColumn(s, vTxOffsets);
+        WriteColumn(s, vHeights);
+        WriteColumn(s, vValues);
+        WriteColumn(s, vScriptOffsets);
+        WriteColumn(s, vScripts);
+    }
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action) {
-        READWRITE(vtxundo);
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        uint64_t nLegacyCount;
+        if (!ReadColumnarUndoMarker(s, nLegacyCount)) {
+            CBlockUndo undo;
+            undo.UnserializeLegacy(s, nLegacyCount);
+            *this = CColumnarBlockUndo(undo);
+            return;
+        }
+        UnserializeColumns(s);
+    }
+
+    //! Reads what follows the marker.
+    template <typename Stream>
+    void UnserializeColumns(Stream& s) {
+        nTx = ReadCompactSize(s);
+        nCoins = ReadCompactSize(s);
+        const uint64_t nScriptBytes = ReadCompactSize(s);
+        if (nTx > MAX_SIZE / 4 || nCoins > MAX_SIZE / 8)
+            throw std::ios_base::failure("Too many undo records");
+        ReadColumn(s, vTxOffsets, (nTx + 1) * 4);
+        ReadColumn(s, vHeights, nCoins * 4);
+        ReadColumn(s, vValues, nCoins * 8);
+        ReadColumn(s, vScriptOffsets, (nCoins + 1) * 4);
+        ReadColumn(s, vScripts, nScriptBytes);
+        CheckOffsets();
+    }
+
+private:
+    uint64_t nTx;
+    uint64_t nCoins;
+    std::vector<unsigned char> vTxOffsets;
+    std::vector<unsigned char> vHeights;
+    std::vector<unsigned char> vValues;
+    std::vector<unsigned char> vScriptOffsets;
+    std::vector<unsigned char> vScripts;
+
+    //! Throws if the offset tables don't fit the columns.
+    void CheckOffsets() const;
+
+    template <typename Stream>
+    static void WriteColumn(Stream& s, const std::vector<unsigned char>& column) {
+        if (!column.empty())
+            s.write((const char*)column.data(), column.size());
+    }
+
+    template <typename Stream>
+    static void ReadColumn(Stream& s, std::vector<unsigned char>& column, size_t nSize) {
+        column.resize(nSize);
+        if (nSize)
+            s.read((char*)column.data(), nSize);
     }
 };
 
+template <typename Stream>
+void CBlockUndo::Unserialize(Stream& s) {
+    uint64_t nLegacyCount;
+    if (!ReadColumnarUndoMarker(s, nLegacyCount)) {
+        UnserializeLegacy(s, nLegacyCount);
+        return;
+    }
+    CColumnarBlockUndo columns;
+    columns.UnserializeColumns(s);
+    columns.GetBlockUndo(*this);
+}
+
 #endif // BITCOIN_UNDO_H
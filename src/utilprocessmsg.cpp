@@ -6,6 +6,8 @@
 #include "options.h"
 #include "utiltime.h"
 
+#include <set>
+
 bool HaveBlockData(const uint256& hash) {
     return mapBlockIndex.count(hash)
         && mapBlockIndex.find(hash)->second->nStatus & BLOCK_HAVE_DATA;
@@ -45,3 +47,43 @@ bool RateLimitExceeded(double& dCount, int64_t& nLastTime, int64_t nLimit, unsig
     dCount += nSize;
     return false;
 }
+
+bool IsRequestCommand(const std::string& strCommand)
+{
+    static const std::set<std::string> setRequests = {
+        NetMsgType::GETDATA, NetMsgType::GETBLOCKS, NetMsgType::GETHEADERS,
+        NetMsgType::GETADDR, NetMsgType::MEMPOOL, NetMsgType::FILTERLOAD,
+        NetMsgType::FILTERADD, NetMsgType::GETBLOCKTXN, NetMsgType::GET_XTHIN,
+        NetMsgType::GET_XBLOCKTX, NetMsgType::GETCFILTERS, NetMsgType::GETCFHEADERS,
+        NetMsgType::GETCFCHECKPT, "getutxos"
+    };
+    return setRequests.count(strCommand) != 0;
+}
+
+// Responses to what we asked the peer for, which don't change how its
+// requests are answered.
+static bool IsSolicitedResponse(const std::string& strCommand)
+{
+    static const std::set<std::string> setResponses = {
+        NetMsgType::BLOCK, NetMsgType::HEADERS, NetMsgType::TX,
+        NetMsgType::CMPCTBLOCK, NetMsgType::BLOCKTXN, NetMsgType::XTHINBLOCK,
+        NetMsgType::XBLOCKTX, NetMsgType::PONG, NetMsgType::NOTFOUND
+    };
+    return setResponses.count(strCommand) != 0;
+}
+
+std::list<CNetMessage>::iterator NextUnmeteredMessage(
+        std::list<CNetMessage>& msgs, bool fRequestsWaiting)
+{
+    for (auto it = msgs.begin(); it != msgs.end(); ++it) {
+        const std::string strCommand = it->hdr.GetCommand();
+        if (IsRequestCommand(strCommand)) {
+            fRequestsWaiting = true;
+            continue;
+        }
+        if (fRequestsWaiting && !IsSolicitedResponse(strCommand))
+            continue;
+        return it;
+    }
+    return msgs.end();
+}
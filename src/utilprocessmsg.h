@@ -3,9 +3,12 @@
 
 #include <vector>
 #include <cstdint>
+#include <list>
+#include <string>
 
 class uint256;
 class CNode;
+class CNetMessage;
 class CBlockHeader;
 class CBlockIndex;
 namespace Consensus { struct Params; }
@@ -29,6 +32,19 @@ bool KeepOutgoingPeer(const CNode&);
 
 void UpdateBestHeaderSent(CNode& node, CBlockIndex* blockIndex);
 
+// Whether the message asks us to serve the peer something. What it costs
+// counts against the peer's request budget; blocks and transactions it
+// relays to us do not.
+bool IsRequestCommand(const std::string& strCommand);
+
+// The next message to process from a peer that is over its request budget.
+// Its requests wait, and so does everything behind them but the responses
+// to what we asked it for, so that messages such as filterclear or
+// sendheaders keep their order with the requests and pongs still follow
+// the responses. Returns msgs.end() if all messages wait.
+std::list<CNetMessage>::iterator NextUnmeteredMessage(
+        std::list<CNetMessage>& msgs, bool fRequestsWaiting);
+
 // Exponentially limit the rate of nSize flow to nLimit.  nLimit unit is thousands-per-minute.
 bool RateLimitExceeded(double& dCount, int64_t& nLastTime, int64_t nLimit, unsigned int nSize);
 
@@ -9,6 +9,8 @@
 
 #include "utiltime.h"
 
+#include <time.h>
+
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
 
@@ -45,6 +47,17 @@ int64_t GetSystemTimeInSeconds()
     return GetTimeMicros()/1000000;
 }
 
+int64_t GetThreadCPUTimeMicros()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    // Fall back to wall time, which also counts time spent waiting.
+    return GetTimeMicros();
+}
+
 void MilliSleep(int64_t n)
 {
 
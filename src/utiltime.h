@@ -23,6 +23,7 @@ int64_t GetTime();
 int64_t GetTimeMillis();
 int64_t GetTimeMicros();
 int64_t GetSystemTimeInSeconds(); // Like GetTime(), but not mockable
+int64_t GetThreadCPUTimeMicros(); // Processing time of the calling thread, where supported
 void SetMockTime(int64_t nMockTimeIn);
 void MilliSleep(int64_t n);
 